@@ -0,0 +1,172 @@
+// GCC flags the replaced operator delete below once it is inlined next to library allocations
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <format>
+#include <memory_resource>
+#include <new>
+#include <print>
+#include <string>
+
+namespace {
+
+u64 allocation_count = 0;
+
+// Benchmark names are plain ASCII, quotes and backslashes are all that needs escaping
+std::string json_string(const std::string_view text) {
+    std::string out = "\"";
+    for (const char c : text) {
+        if (c == '"' || c == '\\') out.push_back('\\');
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
+
+// libstdc++ allocates for the default pmr resource internally, out of sight of the operator new replacement below
+class counting_resource final : public std::pmr::memory_resource {
+private:
+    void* do_allocate(const std::size_t bytes, const std::size_t alignment) override {
+        ++allocation_count;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, const std::size_t bytes, const std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+f64 percentile(const std::vector<f64>& sorted, const f64 p) {
+    const auto index = static_cast<std::size_t>(p * static_cast<f64>(sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void usage() {
+    std::println(stderr, "Usage: ssm-bench [--filter TEXT] [--samples N] [--sample-ms N] [--warmup-ms N]");
+    std::println(stderr, "Prints a table to stderr and the results as JSON to stdout");
+}
+
+} // namespace
+
+void* operator new(const std::size_t size) {
+    ++allocation_count;
+    if (void* p = std::malloc(size == 0 ? 1 : size); p != nullptr) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace bench {
+
+u64 allocations() noexcept {
+    return allocation_count;
+}
+
+bool runner::selected(const std::string_view suite, const std::string_view name) const {
+    if (opts_.filter.empty()) return true;
+    const std::string full = std::string(suite) + "/" + std::string(name);
+    return full.find(opts_.filter) != std::string::npos;
+}
+
+void runner::record(const std::string_view suite, const std::string_view name, const u64 batch,
+                    std::vector<f64>& samples, const f64 allocs, const u64 bytes) {
+    std::ranges::sort(samples);
+
+    f64 sum = 0;
+    for (const f64 s : samples) sum += s;
+    const f64 mean = sum / static_cast<f64>(samples.size());
+    f64 variance = 0;
+    for (const f64 s : samples) variance += (s - mean) * (s - mean);
+
+    result r;
+    r.suite = suite;
+    r.name = name;
+    r.batch = batch;
+    r.samples = samples.size();
+    r.min_ns = samples.front();
+    r.median_ns = percentile(samples, 0.5);
+    r.p90_ns = percentile(samples, 0.9);
+    r.max_ns = samples.back();
+    r.mean_ns = mean;
+    r.stddev_ns = samples.size() > 1 ? std::sqrt(variance / static_cast<f64>(samples.size() - 1)) : 0;
+    r.allocs = allocs;
+    r.bytes = bytes;
+
+    // Bytes per nanosecond are GB/s
+    const std::string throughput = bytes == 0 ? "" : std::format("{:.2f}", static_cast<f64>(bytes) / r.median_ns);
+    std::println(stderr, "{:<8} {:<34} {:>11.1f} ns {:>11.1f} ns {:>6.1f}% {:>9.2f} {:>7}", r.suite, r.name, r.median_ns,
+                 r.p90_ns, r.mean_ns > 0 ? 100 * r.stddev_ns / r.mean_ns : 0, r.allocs, throughput);
+    results_.push_back(MOVE(r));
+}
+
+void runner::write_header(std::FILE* out) const {
+    std::println(out, "{:<8} {:<34} {:>14} {:>14} {:>7} {:>9} {:>7}", "suite", "benchmark", "median", "p90", "cv",
+                 "allocs/op", "GB/s");
+}
+
+void runner::write_json(std::FILE* out) const {
+    std::println(out, "{{\"benchmarks\": [");
+    for (std::size_t i = 0; i < results_.size(); ++i) {
+        const result& r = results_[i];
+        std::println(out,
+                     "  {{\"suite\": {}, \"name\": {}, \"batch\": {}, \"samples\": {}, \"min_ns\": {:.2f}, "
+                     "\"median_ns\": {:.2f}, \"p90_ns\": {:.2f}, \"max_ns\": {:.2f}, \"mean_ns\": {:.2f}, "
+                     "\"stddev_ns\": {:.2f}, \"allocs_per_op\": {:.3f}, \"bytes_per_op\": {}}}{}",
+                     json_string(r.suite), json_string(r.name), r.batch, r.samples, r.min_ns, r.median_ns, r.p90_ns,
+                     r.max_ns, r.mean_ns, r.stddev_ns, r.allocs, r.bytes, i + 1 < results_.size() ? "," : "");
+    }
+    std::println(out, "]}}");
+}
+
+} // namespace bench
+
+int main(int argc, char* argv[]) {
+    bench::options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view flag = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (flag == "--filter") {
+            opts.filter = value;
+        } else if (flag == "--samples") {
+            opts.samples = std::max<std::size_t>(1, std::strtoull(value, nullptr, 10));
+        } else if (flag == "--sample-ms") {
+            opts.sample_time = std::chrono::milliseconds(std::strtoll(value, nullptr, 10));
+        } else if (flag == "--warmup-ms") {
+            opts.warmup = std::chrono::milliseconds(std::strtoll(value, nullptr, 10));
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    counting_resource counting;
+    std::pmr::set_default_resource(&counting);
+
+    bench::runner runner(opts);
+    runner.write_header(stderr);
+    bench::cli_suite(runner);
+    bench::fuzzy_suite(runner);
+    bench::process_suite(runner);
+    bench::search_suite(runner);
+    bench::sqlite_suite(runner);
+    runner.write_json(stdout);
+    return 0;
+}
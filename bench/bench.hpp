@@ -0,0 +1,106 @@
+#ifndef SSM_BENCH_HPP
+#define SSM_BENCH_HPP
+
+#include "common.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+// Keeps the compiler from discarding a value that is only computed to be timed
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// operator new calls so far, counted by the replacement in bench.cpp
+u64 allocations() noexcept;
+
+struct options {
+    std::chrono::nanoseconds warmup = std::chrono::milliseconds(100);
+    std::chrono::nanoseconds sample_time = std::chrono::milliseconds(10);
+    std::size_t samples = 25;
+    std::string_view filter; // only run benchmarks whose "suite/name" contains this
+};
+
+// Every statistic is per iteration
+struct result {
+    std::string suite;
+    std::string name;
+    u64 batch = 0; // iterations per sample
+    u64 samples = 0;
+    f64 min_ns = 0;
+    f64 median_ns = 0;
+    f64 p90_ns = 0;
+    f64 max_ns = 0;
+    f64 mean_ns = 0;
+    f64 stddev_ns = 0;
+    f64 allocs = 0;
+    u64 bytes = 0; // processed per iteration, for throughput, 0 if not a throughput benchmark
+};
+
+class runner {
+public:
+    explicit runner(const options& opts) : opts_(opts) {}
+
+    // `body(n)` must run the measured operation n times. The batch size is doubled until one call takes at least
+    // options::sample_time, then the body is warmed up and timed options::samples times. `bytes` is how much input
+    // one operation gets through, it adds a GB/s column
+    template <typename Body>
+    void run(const std::string_view suite, const std::string_view name, Body&& body, const u64 bytes = 0) {
+        if (!selected(suite, name)) return;
+
+        u64 batch = 1;
+        while (time_ns(body, batch) < opts_.sample_time.count() && batch < (u64{1} << 40)) batch *= 2;
+
+        const i64 warmup_end = now_ns() + opts_.warmup.count();
+        while (now_ns() < warmup_end) body(batch);
+
+        std::vector<f64> samples;
+        samples.reserve(opts_.samples);
+        const u64 allocations_before = allocations();
+        for (std::size_t i = 0; i < opts_.samples; ++i) {
+            samples.push_back(static_cast<f64>(time_ns(body, batch)) / static_cast<f64>(batch));
+        }
+        const u64 allocated = allocations() - allocations_before;
+
+        record(suite, name, batch, samples, static_cast<f64>(allocated) / static_cast<f64>(batch * opts_.samples), bytes);
+    }
+
+    void write_header(std::FILE* out) const;
+    void write_json(std::FILE* out) const;
+
+private:
+    options opts_;
+    std::vector<result> results_;
+
+    [[nodiscard]] bool selected(std::string_view suite, std::string_view name) const;
+    void record(std::string_view suite, std::string_view name, u64 batch, std::vector<f64>& samples, f64 allocs,
+                u64 bytes);
+
+    static i64 now_ns() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    template <typename Body>
+    static i64 time_ns(Body& body, const u64 batch) {
+        const i64 start = now_ns();
+        body(batch);
+        return now_ns() - start;
+    }
+};
+
+void cli_suite(runner& r);
+void fuzzy_suite(runner& r);
+void process_suite(runner& r);
+void search_suite(runner& r);
+void sqlite_suite(runner& r);
+
+} // namespace bench
+
+#endif //SSM_BENCH_HPP
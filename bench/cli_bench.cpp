@@ -0,0 +1,131 @@
+#include "bench.hpp"
+
+#include "cli.hpp"
+
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using utils::cli::ArgSpec;
+using utils::cli::Command;
+using utils::cli::CommandSpec;
+using utils::cli::arg;
+using utils::cli::arg_spec;
+
+// Same shape as the ssm tree in main.cpp, once through the builder and once as a schema
+Command make_app() {
+    return Command("ssm", "Simple Snippet Manager")
+        .subcommand_required()
+        .subcommand(Command("init", "Initialize ssm directory and database"))
+        .subcommand(Command("new", "Create a new snippet").arg(arg("<NAME>").about("Name of the snippet")))
+        .subcommand(Command("ls", "List all snippets"))
+        .subcommand(Command("rm", "Remove snippets").arg(arg("<SNIPPETS>...").about("Snippets to remove")))
+        .subcommand(Command("get", "Get snippets' content")
+            .arg(arg("<SNIPPETS>...").about("Snippets to get"))
+            .arg(arg("-H --header").about("Print a header before each snippet"))
+            .arg(arg("-s --separator <SEP>").about("Text written between consecutive snippets")))
+        .subcommand(Command("edit", "Edit snippets").arg(arg("<SNIPPETS>...").about("Snippets to edit")))
+        .subcommand(Command("debug", "Debugging tools")
+            .subcommand_required()
+            .subcommand(Command("sql", "Profile a command").arg(arg("<COMMAND>...").trailing().about("Command line"))));
+}
+
+constexpr ArgSpec NEW_ARGS[] = {arg_spec("<NAME>").about("Name of the snippet")};
+constexpr ArgSpec RM_ARGS[] = {arg_spec("<SNIPPETS>...").about("Snippets to remove")};
+constexpr ArgSpec GET_ARGS[] = {
+    arg_spec("<SNIPPETS>...").about("Snippets to get"),
+    arg_spec("-H --header").about("Print a header before each snippet"),
+    arg_spec("-s --separator <SEP>").about("Text written between consecutive snippets"),
+};
+constexpr ArgSpec EDIT_ARGS[] = {arg_spec("<SNIPPETS>...").about("Snippets to edit")};
+constexpr ArgSpec SQL_ARGS[] = {arg_spec("<COMMAND>...").trailing().about("Command line")};
+constexpr CommandSpec DEBUG_COMMANDS[] = {{.name = "sql", .description = "Profile a command", .args = SQL_ARGS}};
+constexpr CommandSpec COMMANDS[] = {
+    {.name = "init", .description = "Initialize ssm directory and database"},
+    {.name = "new", .description = "Create a new snippet", .args = NEW_ARGS},
+    {.name = "ls", .description = "List all snippets"},
+    {.name = "rm", .description = "Remove snippets", .args = RM_ARGS},
+    {.name = "get", .description = "Get snippets' content", .args = GET_ARGS},
+    {.name = "edit", .description = "Edit snippets", .args = EDIT_ARGS},
+    {.name = "debug", .description = "Debugging tools", .subcommands = DEBUG_COMMANDS, .subcommand_required = true},
+};
+constexpr CommandSpec APP = {
+    .name = "ssm",
+    .description = "Simple Snippet Manager",
+    .subcommands = COMMANDS,
+    .subcommand_required = true,
+    .response_files = true,
+};
+using Schema = utils::cli::Schema<APP>;
+
+struct command_line {
+    std::string_view label;
+    std::vector<const char*> args;
+};
+
+// Parses and walks to the leaf matches the way dispatch does
+template <typename Parse>
+void parse_loop(const command_line& line, const u64 n, Parse get_matches) {
+    std::vector<char*> argv;
+    for (const char* a : line.args) argv.push_back(const_cast<char*>(a));
+    const int argc = static_cast<int>(argv.size());
+
+    for (u64 i = 0; i < n; ++i) {
+        const auto [matches, err] = get_matches(argc, argv.data());
+        const auto sub = matches.subcommand();
+        bench::do_not_optimize(sub);
+        bench::do_not_optimize(err.message.size());
+    }
+}
+
+} // namespace
+
+namespace bench {
+
+void cli_suite(runner& r) {
+    r.run("cli", "builder tree construction", [](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            const Command app = make_app();
+            do_not_optimize(app.subcommands().size());
+        }
+    });
+
+    const std::vector<command_line> lines = {
+        {.label = "ls", .args = {"ssm", "ls"}},
+        {.label = "new name", .args = {"ssm", "new", "name"}},
+        {.label = "get 1-3 foo -H -s ---", .args = {"ssm", "get", "1-3", "foo", "-H", "-s", "---"}},
+        {.label = "rm a b c d e f g h", .args = {"ssm", "rm", "a", "b", "c", "d", "e", "f", "g", "h"}},
+        {.label = "debug sql get -H 3", .args = {"ssm", "debug", "sql", "get", "-H", "3"}},
+    };
+
+    Command app = make_app();
+    app.response_files();
+    for (const command_line& line : lines) {
+        r.run("cli", std::string("builder ") + std::string(line.label), [&](const u64 n) {
+            parse_loop(line, n, [&](const int argc, char** argv) { return app.get_matches(argc, argv); });
+        });
+        r.run("cli", std::string("schema ") + std::string(line.label), [&](const u64 n) {
+            parse_loop(line, n, [](const int argc, char** argv) { return Schema::get_matches(argc, argv); });
+        });
+    }
+
+    // A response file is mapped once per parse and its lines go into the matches as views, one entry per name
+    constexpr std::size_t RESPONSE_NAMES = 10000;
+    const std::filesystem::path response = std::filesystem::temp_directory_path() / "ssm-bench-names";
+    {
+        std::ofstream out(response);
+        for (std::size_t i = 0; i < RESPONSE_NAMES; ++i) out << std::format("snippet-{:05}\n", i);
+    }
+    const std::string at_file = "@" + response.string();
+    const command_line response_line = {.label = "rm @file (10k names)", .args = {"ssm", "rm", at_file.c_str()}};
+    r.run("cli", std::string("schema ") + std::string(response_line.label), [&](const u64 n) {
+        parse_loop(response_line, n, [](const int argc, char** argv) { return Schema::get_matches(argc, argv); });
+    });
+    std::filesystem::remove(response);
+}
+
+} // namespace bench
@@ -0,0 +1,95 @@
+#include "bench.hpp"
+
+#include "fuzzy.hpp"
+
+#include <array>
+#include <atomic>
+#include <format>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+namespace {
+
+// A million names shaped like real ones: two to four words joined by dashes, now and then a version number
+ssm::fuzzy::name_set make_names(const std::size_t count) {
+    constexpr std::array<std::string_view, 24> words = {
+        "deploy", "k8s",   "nginx",  "docker", "compose", "redis", "backup", "restore", "staging", "prod",  "canary", "helm",
+        "ingress", "certs", "rotate", "logs",  "tail",    "psql",  "dump",   "migrate", "lookup",  "cache", "purge",  "old",
+    };
+
+    ssm::fuzzy::name_set names;
+    names.reserve(count, count * 24);
+    u64 state = 0x9e3779b97f4a7c15ULL;
+    const auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    std::string name;
+    for (std::size_t i = 0; i < count; ++i) {
+        name.clear();
+        const u64 parts = 2 + next() % 3;
+        for (u64 p = 0; p < parts; ++p) {
+            if (p > 0) name.push_back('-');
+            name += words[next() % words.size()];
+        }
+        if (next() % 4 == 0) name += std::format("-v{}", next() % 100);
+        names.add(name);
+    }
+    return names;
+}
+
+} // namespace
+
+void fuzzy_suite(runner& r) {
+    const ssm::fuzzy::name_set names = make_names(1'000'000);
+
+    r.run("fuzzy", "rank 1M names 'deplk8s', 1 thread", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::fuzzy::rank(names, "deplk8s", 10, 1).size());
+    });
+
+    r.run("fuzzy", "rank 1M names 'deplk8s', all cores", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::fuzzy::rank(names, "deplk8s", 10).size());
+    });
+
+    // Almost every name survives the filter, so this is the scorer's worst case
+    r.run("fuzzy", "rank 1M names 'e', 1 thread", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::fuzzy::rank(names, "e", 10, 1).size());
+    });
+
+    // What `ssm pick` does per keystroke: filter the last query's matches, then rank a screenful. The first key scans
+    // every name, each later one only what the key before it left
+    std::vector<ssm::fuzzy::match> all(names.size());
+    for (std::size_t i = 0; i < all.size(); ++i) all[i] = {.index = static_cast<u32>(i), .score = 0};
+    const std::atomic<bool> cancel = false;
+    constexpr std::string_view typed = "deplk8s";
+
+    r.run("fuzzy", "pick first key 'd' of 1M names, 1 thread", [&](const u64 n) {
+        std::vector<ssm::fuzzy::match> matches;
+        for (u64 i = 0; i < n; ++i) {
+            ssm::fuzzy::filter(names, all, typed.substr(0, 1), cancel, matches, 1);
+            do_not_optimize(ssm::fuzzy::best(names, matches, 50).size());
+        }
+    });
+
+    r.run("fuzzy", "pick 'deplk8s' key by key in 1M names, 1 thread", [&](const u64 n) {
+        std::array<std::vector<ssm::fuzzy::match>, 2> levels;
+        for (u64 i = 0; i < n; ++i) {
+            std::span<const ssm::fuzzy::match> candidates = all;
+            for (std::size_t k = 1; k <= typed.size(); ++k) {
+                std::vector<ssm::fuzzy::match>& matches = levels[k % 2];
+                ssm::fuzzy::filter(names, candidates, typed.substr(0, k), cancel, matches, 1);
+                do_not_optimize(ssm::fuzzy::best(names, matches, 50).size());
+                candidates = matches;
+            }
+        }
+    });
+}
+
+} // namespace bench
@@ -0,0 +1,85 @@
+#include "bench.hpp"
+
+#define UTILS_PROCESS_IMPLEMENTATION
+#include "process.hpp"
+
+#include <expected>
+#include <print>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+namespace {
+
+utils::process::Task<std::expected<utils::process::ExitStatus, std::string>> spawn_and_wait(
+    utils::process::EventLoop& loop, std::vector<std::string> args) {
+    utils::process::Redirect redirect;
+    auto child = co_await loop.spawn(MOVE(args), redirect);
+    if (!child) co_return std::unexpected(child.error());
+    co_return co_await loop.wait(*child);
+}
+
+} // namespace
+
+// Spawn latency is dominated by the kernel, so these measure what run_async, spawn and the pool and event loop add on
+// top of it
+void process_suite(runner& r) {
+    const std::vector<std::string> args = {"true"};
+    if (!utils::process::run_sync(args)) {
+        std::println(stderr, "process: skipped, could not run 'true'");
+        return;
+    }
+
+    r.run("process", "run_async + wait_proc true", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            const auto proc = utils::process::run_async(args);
+            if (proc) do_not_optimize(utils::process::wait_proc(*proc).has_value());
+        }
+    });
+
+    r.run("process", "spawn + wait_child true", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            auto child = utils::process::spawn(args);
+            if (child) do_not_optimize(utils::process::wait_child(*child).has_value());
+        }
+    });
+
+    r.run("process", "run_sync true", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(utils::process::run_sync(args).has_value());
+    });
+
+    r.run("process", "run_async x8 + wait_procs true", [&](const u64 n) {
+        std::vector<Proc> procs;
+        for (u64 i = 0; i < n; ++i) {
+            procs.clear();
+            for (int j = 0; j < 8; ++j) {
+                if (const auto proc = utils::process::run_async(args); proc) procs.push_back(*proc);
+            }
+            do_not_optimize(utils::process::wait_procs(procs).has_value());
+        }
+    });
+
+    r.run("process", "ProcessPool x8 true, 8 running", [&](const u64 n) {
+        utils::process::ProcessPool pool(8);
+        for (u64 i = 0; i < n; ++i) {
+            std::size_t done = 0;
+            for (int j = 0; j < 8; ++j) {
+                pool.submit(args, [&](std::size_t, const auto& result) { if (result.has_value()) ++done; });
+            }
+            do_not_optimize(pool.run().has_value());
+            do_not_optimize(done);
+        }
+    });
+
+    r.run("process", "EventLoop x8 true, when_all", [&](const u64 n) {
+        utils::process::EventLoop loop;
+        for (u64 i = 0; i < n; ++i) {
+            std::vector<utils::process::Task<std::expected<utils::process::ExitStatus, std::string>>> tasks;
+            for (int j = 0; j < 8; ++j) tasks.push_back(spawn_and_wait(loop, args));
+            do_not_optimize(loop.run(utils::process::when_all(MOVE(tasks))).size());
+        }
+    });
+}
+
+} // namespace bench
@@ -0,0 +1,388 @@
+#include "bench.hpp"
+
+#include "fts.hpp"
+#include "minhash.hpp"
+#include "process.hpp"
+#include "regex.hpp"
+#include "search.hpp"
+#include "sqlite3.hpp"
+#include "symbols.hpp"
+#include "tfidf.hpp"
+#include "trigram.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bench {
+
+namespace {
+
+// Shell and YAML shaped lines, the kind of text snippets hold
+std::string make_text(const std::size_t size) {
+    constexpr std::array<std::string_view, 12> lines = {
+        "kubectl -n staging rollout restart deploy/web\n",
+        "helm upgrade --install web ./chart --set image.tag=v1.4.2\n",
+        "docker compose -f compose.prod.yml up -d --build\n",
+        "  image: registry.example.com/web:1.4.2\n",
+        "pg_dump -Fc -d app > /backups/app-$(date +%F).dump\n",
+        "for f in *.log; do gzip -9 \"$f\"; done\n",
+        "    resources:\n      limits:\n        memory: 512Mi\n",
+        "git log --oneline --graph --decorate -n 20\n",
+        "export KUBECONFIG=$HOME/.kube/config-prod\n",
+        "SELECT id, name FROM file ORDER BY id;\n",
+        "rsync -avz --delete ./dist/ deploy@host:/srv/www/\n",
+        "journalctl -u nginx --since '1 hour ago' | tail -n 50\n",
+    };
+
+    std::string text;
+    text.reserve(size + 128);
+    u64 state = 0x2545f4914f6cdd1dULL;
+    while (text.size() < size) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        text += lines[state % lines.size()];
+    }
+    text.resize(size);
+    return text;
+}
+
+// Every line of `text` that matches, counted
+u64 count_lines(ssm::regex::matcher& matcher, const std::string_view text) {
+    u64 lines = 0;
+    for (auto line = matcher.next_line(text, 0); line.has_value(); line = matcher.next_line(text, line->end + 1)) {
+        ++lines;
+    }
+    return lines;
+}
+
+void regex_cases(runner& r, const std::string& text) {
+    // The required string rules out nearly every line, the automaton checks the rest
+    const auto rare = ssm::regex::program::compile(R"(image\.tag=v9\.\d+)");
+    // Every line is the automaton's, no single string is common to all matches
+    const auto dates = ssm::regex::program::compile(R"(\d{4}-\d{2}-\d{2})");
+    // The required string is on a twelfth of the lines, each of which the automaton then checks
+    const auto common = ssm::regex::program::compile(R"(kubectl -n (prod|dev)\s)");
+    if (!rare || !dates || !common) {
+        std::println(stderr, "search: regex cases skipped, a pattern does not compile");
+        return;
+    }
+
+    ssm::regex::matcher rare_matcher(*rare);
+    r.run("search", "regex 64 MiB, rare literal", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(count_lines(rare_matcher, text));
+    }, text.size());
+
+    ssm::regex::matcher dates_matcher(*dates);
+    r.run("search", "regex 64 MiB, DFA only", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(count_lines(dates_matcher, text));
+    }, text.size());
+
+    ssm::regex::matcher common_matcher(*common);
+    r.run("search", "regex 64 MiB, common literal", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(count_lines(common_matcher, text));
+    }, text.size());
+
+    // std::regex has no line mode, so it gets one line at a time, over a sixteenth of the text
+    const std::string_view slice = std::string_view(text).substr(0, text.size() / 16);
+    const std::regex std_dates(R"(\d{4}-\d{2}-\d{2})", std::regex::ECMAScript | std::regex::optimize);
+    r.run("search", "std::regex 4 MiB, DFA only", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            u64 lines = 0;
+            for (std::size_t begin = 0; begin < slice.size();) {
+                const std::size_t end = std::min(slice.find('\n', begin), slice.size());
+                if (std::regex_search(slice.data() + begin, slice.data() + end, std_dates)) ++lines;
+                begin = end + 1;
+            }
+            do_not_optimize(lines);
+        }
+    }, slice.size());
+}
+
+// Indexing runs the tokenizer over every byte of a snippet and FTS5 then writes out a posting per token, so both are
+// measured on their own. unicode61, the stock tokenizer, is the baseline for the whole of indexing
+void fts_cases(runner& r, const std::string& text) {
+    r.run("search", "fts tokenize 64 MiB", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            u64 tokens = 0;
+            ssm::fts::tokenize(text, ssm::fts::mode::document, [&](const ssm::fts::token&) { return ++tokens != 0; });
+            do_not_optimize(tokens);
+        }
+    }, text.size());
+
+    if (!ssm::fts::install()) {
+        std::println(stderr, "search: fts cases skipped, the tokenizer could not be registered");
+        return;
+    }
+
+    // Every op indexes 1024 snippets of 4 KiB into a new table, and commits
+    constexpr std::size_t DOCS = 1024;
+    constexpr std::size_t DOC_SIZE = 4096;
+    const auto index_docs = [&](const char* tokenizer) {
+        return [&text, tokenizer](const u64 n) {
+            const ssm_sqlite3::database sqlite(":memory:");
+            for (u64 i = 0; i < n; ++i) {
+                sqlite.exec(std::format("CREATE VIRTUAL TABLE t USING fts5(content, tokenize = '{}', content = '', "
+                                        "contentless_delete = 1); BEGIN;", tokenizer).c_str());
+                const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("INSERT INTO t (rowid, content) VALUES (?, ?);");
+                for (std::size_t doc = 0; doc < DOCS; ++doc) {
+                    const std::string_view content = std::string_view(text).substr(doc * 7919 % (text.size() - DOC_SIZE), DOC_SIZE);
+                    ssm_sqlite3::database::bind_int64(stmt.get(), 1, static_cast<i64>(doc + 1));
+                    sqlite3_bind_text(stmt.get(), 2, content.data(), static_cast<int>(content.size()), SQLITE_STATIC);
+                    do_not_optimize(sqlite3_step(stmt.get()));
+                    sqlite3_reset(stmt.get());
+                }
+                sqlite.exec("COMMIT; DROP TABLE t;");
+            }
+        };
+    };
+    r.run("search", "fts index 4 MiB, ssm_code", index_docs("ssm_code"), DOCS * DOC_SIZE);
+    r.run("search", "fts index 4 MiB, unicode61", index_docs("unicode61"), DOCS * DOC_SIZE);
+}
+
+// Snippets made of words from a shared vocabulary, common ones far more often than rare ones, so they overlap the way
+// real snippets do and every vector is different
+std::vector<std::string> make_documents(const std::size_t count, const std::size_t words) {
+    constexpr u64 VOCABULARY = 20000;
+    std::vector<std::string> docs(count);
+    u64 state = 0x9e3779b97f4a7c15ULL;
+    for (std::string& doc : docs) {
+        for (std::size_t i = 0; i < words; ++i) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            const u64 r = state % VOCABULARY;
+            doc += std::format("w{} ", r * r / VOCABULARY);
+        }
+    }
+    return docs;
+}
+
+// `ssm similar` reads every vector and scores it against the snippet's, so the scan is measured at the size the
+// feature is meant for, and the kernel that scores one pair on its own
+void tfidf_cases(runner& r) {
+    std::array<u32, ssm::tfidf::MAX_TERMS> a_terms{};
+    std::array<u32, ssm::tfidf::MAX_TERMS> b_terms{};
+    std::array<f32, ssm::tfidf::MAX_TERMS> weights{};
+    for (std::size_t i = 0; i < ssm::tfidf::MAX_TERMS; ++i) {
+        a_terms[i] = static_cast<u32>(i * 2);
+        b_terms[i] = static_cast<u32>(i * 3); // a third in common
+        weights[i] = 0.17F;
+    }
+    r.run("search", "tfidf dot, 32 terms each", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::tfidf::dot(a_terms, weights, b_terms, weights));
+    });
+
+    constexpr std::size_t DOCS = 100000;
+    const std::vector<std::string> docs = make_documents(DOCS, 64);
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);") ||
+        !ssm::tfidf::build(sqlite)) {
+        std::println(stderr, "search: tfidf cases skipped, {}", sqlite.errmsg());
+        return;
+    }
+    sqlite.exec("BEGIN;");
+    for (std::size_t i = 0; i < DOCS; ++i) ssm::tfidf::index_file(sqlite, static_cast<i64>(i + 1), docs[i]);
+    sqlite.exec("COMMIT;");
+
+    u64 next = 0;
+    r.run("search", "tfidf nearest 100k, top 10", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::tfidf::nearest(sqlite, static_cast<i64>(next++ % DOCS + 1), 10));
+    });
+
+    r.run("search", "tfidf index 64-word snippet", [&](const u64 n) {
+        sqlite.exec("BEGIN;");
+        for (u64 i = 0; i < n; ++i) {
+            do_not_optimize(ssm::tfidf::index_file(sqlite, static_cast<i64>(next % DOCS + 1), docs[next * 7 % DOCS]));
+            ++next;
+        }
+        sqlite.exec("COMMIT;");
+    });
+}
+
+// Signing is the per-write cost, tokenizing included. Finding duplicates walks the buckets of a store where one
+// snippet in ten is a copy of another with a word changed
+void minhash_cases(runner& r, const std::string& text) {
+    const std::string_view slice = std::string_view(text).substr(0, text.size() / 16);
+    r.run("search", "minhash sign 4 MiB", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::minhash::signature_of(slice));
+    }, slice.size());
+
+    constexpr std::size_t DOCS = 100000;
+    std::vector<std::string> docs = make_documents(DOCS, 64);
+    for (std::size_t i = 0; i < DOCS; i += 10) {
+        docs[i] = docs[(i * 7919 + 1) % DOCS];
+        docs[i].replace(docs[i].find(' ') + 1, 0, "changed ");
+    }
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);") ||
+        !ssm::minhash::build(sqlite)) {
+        std::println(stderr, "search: minhash cases skipped, {}", sqlite.errmsg());
+        return;
+    }
+    sqlite.exec("BEGIN;");
+    for (std::size_t i = 0; i < DOCS; ++i) ssm::minhash::index_file(sqlite, static_cast<i64>(i + 1), docs[i]);
+    sqlite.exec("COMMIT;");
+
+    r.run("search", "minhash dups 100k, 0.8", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::minhash::clusters(sqlite, 0.8));
+    });
+}
+
+// Extraction is the per-write cost and mostly lines that define nothing. Lookup is a prefix range over a store of
+// 100k snippets defining a function each
+void symbols_cases(runner& r, const std::string& text) {
+    const std::string_view slice = std::string_view(text).substr(0, text.size() / 16);
+    r.run("search", "symbols extract 4 MiB", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::symbols::extract(slice));
+    }, slice.size());
+
+    constexpr std::size_t DOCS = 100000;
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);") ||
+        !ssm::symbols::build(sqlite)) {
+        std::println(stderr, "search: symbols cases skipped, {}", sqlite.errmsg());
+        return;
+    }
+    sqlite.exec("BEGIN;");
+    for (std::size_t i = 0; i < DOCS; ++i) {
+        sqlite.exec(std::format("INSERT INTO file (name, path) VALUES ('snippet-{0}', 'snippet-{0}');", i).c_str());
+        const std::string content = std::format("deploy_{}() {{\n  kubectl apply\n}}\n", i);
+        ssm::symbols::index_file(sqlite, static_cast<i64>(i + 1), content);
+    }
+    sqlite.exec("COMMIT;");
+
+    r.run("search", "symbols lookup 100k, 11 hits", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::symbols::lookup(sqlite, "deploy_4242"));
+    });
+}
+
+// The brute-force path of `ssm grep --no-index` against `grep -rlF` over the same directory of files, both reading
+// from the page cache after the first pass
+void scan_cases(runner& r, const std::string& text, const std::string_view needle) {
+    constexpr std::size_t FILES = 256;
+    constexpr std::size_t FILE_SIZE = 256 * 1024;
+
+    std::string dir_template = (std::filesystem::temp_directory_path() / "ssm-bench-XXXXXX").string();
+    if (mkdtemp(dir_template.data()) == nullptr) {
+        std::println(stderr, "search: scan cases skipped, could not create a temporary directory");
+        return;
+    }
+    const std::filesystem::path dir = dir_template;
+
+    std::vector<std::filesystem::path> paths;
+    for (std::size_t i = 0; i < FILES; ++i) {
+        std::string content = text.substr(i * 7919 % (text.size() - FILE_SIZE), FILE_SIZE);
+        if (i == FILES / 3) content.replace(FILE_SIZE / 2, needle.size(), needle);
+        paths.push_back(dir / std::format("snippet-{}", i));
+        std::ofstream(paths.back(), std::ios::binary) << content;
+    }
+
+    r.run("search", "parallel scan 64 MiB in 256 files", [&](const u64 n) {
+        const ssm::search::finder finder(needle);
+        for (u64 i = 0; i < n; ++i) {
+            std::atomic<std::size_t> matches = 0;
+            ssm::search::parallel_for(paths.size(), 0, [&](const std::size_t file) {
+                const ssm::search::mapped_file mapped(paths[file]);
+                std::string out;
+                if (ssm::search::grep_text(paths[file].filename().native(), mapped.text(), finder, true, out)) {
+                    matches.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+            do_not_optimize(matches.load());
+        }
+    }, FILES * FILE_SIZE);
+
+    const std::vector<std::string> args = {"grep", "-rlF", std::string(needle), dir.string()};
+    const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    utils::process::Redirect redirect = {.fd_out = null_fd};
+    if (null_fd >= 0 && utils::process::run_sync(args, redirect, false)) {
+        r.run("search", "grep -rlF 64 MiB in 256 files", [&](const u64 n) {
+            for (u64 i = 0; i < n; ++i) do_not_optimize(utils::process::run_sync(args, redirect, false).has_value());
+        }, FILES * FILE_SIZE);
+    } else {
+        std::println(stderr, "search: grep case skipped, could not run 'grep'");
+    }
+    if (null_fd >= 0) close(null_fd);
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+}
+
+} // namespace
+
+void search_suite(runner& r) {
+    const std::string text = make_text(64 * 1024 * 1024);
+    constexpr std::string_view absent = "image.tag=v9";
+    const ssm::search::finder finder(absent);
+
+    r.run("search", "finder 64 MiB, absent needle", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(finder.find(text));
+    }, text.size());
+
+    r.run("search", "std find 64 MiB, absent needle", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(std::string_view(text).find(absent));
+    }, text.size());
+
+    regex_cases(r, text);
+    fts_cases(r, text);
+    tfidf_cases(r);
+    minhash_cases(r, text);
+    symbols_cases(r, text);
+
+    // 2000 snippets of 4 KiB cut from the same text, one of which holds the needle
+    constexpr u64 SNIPPETS = 2000;
+    constexpr std::size_t SNIPPET_SIZE = 4096;
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);") ||
+        !ssm::trigram::build(sqlite)) {
+        std::println(stderr, "search: trigram cases skipped, {}", sqlite.errmsg());
+        return;
+    }
+
+    sqlite.exec("BEGIN;");
+    for (u64 i = 0; i < SNIPPETS; ++i) {
+        std::string content = text.substr(i * 7919 % (text.size() - SNIPPET_SIZE), SNIPPET_SIZE);
+        if (i == SNIPPETS / 2) content += absent;
+        ssm::trigram::index_file(sqlite, static_cast<i64>(i + 1), content);
+    }
+    sqlite.exec("COMMIT;");
+
+    r.run("search", "trigram lookup 2k, rare needle", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::trigram::candidates(sqlite, absent));
+    });
+
+    r.run("search", "trigram lookup 2k, common needle", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::trigram::candidates(sqlite, "kubectl"));
+    });
+
+    u64 next_id = SNIPPETS + 1;
+    r.run("search", "trigram index 4 KiB snippet", [&](const u64 n) {
+        sqlite.exec("BEGIN;");
+        for (u64 i = 0; i < n; ++i) {
+            const std::string_view content = std::string_view(text).substr(next_id * 104729 % (text.size() - SNIPPET_SIZE), SNIPPET_SIZE);
+            do_not_optimize(ssm::trigram::index_file(sqlite, static_cast<i64>(next_id++), content));
+        }
+        sqlite.exec("COMMIT;");
+    });
+
+    scan_cases(r, text, absent);
+}
+
+} // namespace bench
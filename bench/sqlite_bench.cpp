@@ -0,0 +1,113 @@
+#include "bench.hpp"
+
+#include "sqlite3.hpp"
+#include "suggest.hpp"
+
+#include <print>
+#include <string>
+
+namespace bench {
+
+namespace {
+
+// "Did you mean" lookups against 10k indexed names, one typo away from an existing name
+void suggest_suite(runner& r) {
+    constexpr u64 NAMES = 10'000;
+
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);"
+                                     "CREATE UNIQUE INDEX idx_file_name ON file(name);") ||
+        !ssm::suggest::build(sqlite)) {
+        std::println(stderr, "suggest: skipped, {}", sqlite.errmsg());
+        return;
+    }
+
+    const ssm_sqlite3::stmt_handle insert = sqlite.prepare("INSERT INTO file (name, path) VALUES (?, ?);");
+    sqlite.exec("BEGIN;");
+    for (u64 i = 0; i < NAMES; ++i) {
+        const std::string name = "deploy-service-" + std::to_string(i * 7919 % 100'003);
+        ssm_sqlite3::database::bind_text(insert.get(), 1, name);
+        ssm_sqlite3::database::bind_text(insert.get(), 2, name);
+        sqlite3_step(insert.get());
+        sqlite3_reset(insert.get());
+        ssm::suggest::add_name(sqlite, sqlite.last_insert_rowid(), name);
+    }
+    sqlite.exec("COMMIT;");
+
+    r.run("sqlite", "suggest closest, 10k names", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) do_not_optimize(ssm::suggest::closest(sqlite, "depoly-service-7919", 3));
+    });
+
+    u64 next_id = 0;
+    r.run("sqlite", "suggest add + remove name", [&](const u64 n) {
+        sqlite.exec("BEGIN;");
+        for (u64 i = 0; i < n; ++i) {
+            const std::string name = "scratch-" + std::to_string(next_id);
+            ssm::suggest::add_name(sqlite, static_cast<i64>(NAMES + next_id), name);
+            ssm::suggest::remove_name(sqlite, static_cast<i64>(NAMES + next_id), name);
+            ++next_id;
+        }
+        sqlite.exec("COMMIT;");
+    });
+}
+
+} // namespace
+
+// Runs against an in-memory database with the same schema as the snippet store, so disk I/O never shows up
+void sqlite_suite(runner& r) {
+    const ssm_sqlite3::database sqlite(":memory:");
+    if (!sqlite.ok() || !sqlite.exec("CREATE TABLE file (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT NOT NULL, "
+                                     "path TEXT NOT NULL);"
+                                     "CREATE UNIQUE INDEX idx_file_name ON file(name);"
+                                     "CREATE UNIQUE INDEX idx_file_path ON file(path);")) {
+        std::println(stderr, "sqlite: skipped, {}", sqlite.errmsg());
+        return;
+    }
+
+    r.run("sqlite", "prepare + finalize select", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT path FROM file WHERE name = ?;");
+            do_not_optimize(stmt.get());
+        }
+    });
+
+    // Names keep growing across samples, so the insert cost includes a steadily deeper index
+    u64 next_id = 0;
+    const ssm_sqlite3::stmt_handle insert = sqlite.prepare("INSERT INTO file (name, path) VALUES (?, ?);");
+    r.run("sqlite", "bind + step insert (one txn)", [&](const u64 n) {
+        sqlite.exec("BEGIN;");
+        std::string name;
+        for (u64 i = 0; i < n; ++i) {
+            name = "snippet-" + std::to_string(next_id++);
+            ssm_sqlite3::database::bind_text(insert.get(), 1, name);
+            ssm_sqlite3::database::bind_text(insert.get(), 2, name);
+            do_not_optimize(sqlite3_step(insert.get()));
+            sqlite3_reset(insert.get());
+        }
+        sqlite.exec("COMMIT;");
+    });
+
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT path FROM file WHERE name = ?;");
+    r.run("sqlite", "bind + step select by name", [&](const u64 n) {
+        std::string name;
+        for (u64 i = 0; i < n; ++i) {
+            name = "snippet-" + std::to_string(i % (next_id == 0 ? 1 : next_id));
+            ssm_sqlite3::database::bind_text(select.get(), 1, name);
+            do_not_optimize(sqlite3_step(select.get()));
+            sqlite3_reset(select.get());
+        }
+    });
+
+    const ssm_sqlite3::stmt_handle scan = sqlite.prepare("SELECT name FROM file ORDER BY id LIMIT 100;");
+    r.run("sqlite", "step 100-row scan", [&](const u64 n) {
+        for (u64 i = 0; i < n; ++i) {
+            while (sqlite3_step(scan.get()) == SQLITE_ROW) do_not_optimize(sqlite3_column_text(scan.get(), 0));
+            sqlite3_reset(scan.get());
+        }
+    });
+
+    suggest_suite(r);
+}
+
+} // namespace bench
@@ -0,0 +1,95 @@
+#ifndef SSM_ARENA_HPP
+#define SSM_ARENA_HPP
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace ssm::mem {
+
+// Bump allocator for short-lived runs. Memory is carved out of large malloc'd blocks and only given back when the
+// arena is released or destroyed; freeing the most recent allocation rolls the bump pointer back, any other free
+// is a no-op. Not thread-safe.
+class arena final : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    struct stats {
+        u64 allocations = 0;
+        u64 deallocations = 0;
+        u64 rollbacks = 0;     // deallocations that actually reclaimed memory
+        u64 bytes = 0;         // bytes handed out, alignment padding included
+        u64 blocks = 0;
+        u64 block_bytes = 0;   // bytes requested from malloc
+    };
+
+    explicit arena(std::size_t block_size = DEFAULT_BLOCK_SIZE) noexcept;
+    ~arena() override;
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    arena(arena&&) = delete;
+    arena& operator=(arena&&) = delete;
+
+    // nullptr when malloc fails instead of throwing, for C callers like SQLite
+    [[nodiscard]] void* try_allocate(std::size_t bytes, std::size_t alignment) noexcept;
+    void free(void* p, std::size_t bytes) noexcept;
+    // Grows the most recent allocation in place when the current block has room
+    [[nodiscard]] bool try_extend(void* p, std::size_t old_bytes, std::size_t new_bytes) noexcept;
+
+    void release() noexcept;
+
+    [[nodiscard]] const stats& statistics() const noexcept {
+        return stats_;
+    }
+
+private:
+    struct block {
+        block* prev;
+        std::size_t size;
+    };
+
+    block* head_ = nullptr;
+    std::byte* cursor_ = nullptr;
+    std::byte* end_ = nullptr;
+    std::byte* last_ = nullptr; // start of the most recent allocation
+    std::size_t block_size_;
+    stats stats_;
+
+    bool grow(std::size_t bytes, std::size_t alignment) noexcept;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// Memory setup for one run of ssm, constructed first thing in main and destroyed last. SSM_ALLOC picks how:
+// - unset or "arena": SQLite allocates from its own locked arena through SQLITE_CONFIG_MALLOC, falling back to
+//   malloc past a cap so long runs stay bounded, and cli_resource() hands out a second, unlocked arena for parsing
+// - "heap": like the above, but SQLite gets a fixed memsys5 heap through SQLITE_CONFIG_HEAP when the bundled
+//   amalgamation was built with SQLITE_ENABLE_MEMSYS5
+// - "system": nothing changes, for comparison
+// Built with -DSSM_ALLOC_STATS (`make alloc-stats`) global operator new is counted as well and every counter is
+// printed to stderr on destruction.
+class runtime {
+public:
+    runtime();
+    ~runtime();
+
+    runtime(const runtime&) = delete;
+    runtime& operator=(const runtime&) = delete;
+    runtime(runtime&&) = delete;
+    runtime& operator=(runtime&&) = delete;
+
+private:
+    bool configured_ = false;
+};
+
+// What the command line is parsed into: the unlocked arena while a runtime has set one up, the global heap otherwise.
+// Never installed as the default pmr resource, so it is only ever touched by the main thread that passes it in
+std::pmr::memory_resource* cli_resource() noexcept;
+
+} // namespace ssm::mem
+
+#endif //SSM_ARENA_HPP
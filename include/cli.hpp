@@ -11,17 +11,36 @@
 
 #include "common.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <expected>
 #include <format>
+#include <functional>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <print>
+#include <span>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
 namespace utils::cli {
 
 using ValueType = std::variant<std::monostate, char, std::string, bool, i64, u64, f64>;
@@ -41,121 +60,136 @@ constexpr std::optional<std::string_view> peek(const int argc, char** argv) {
     return {*argv};
 }
 
+constexpr std::string to_formatted(const ValueType& var, const bool quoted = true) {
+    static_assert(std::variant_size_v<ValueType> == 7, "ValueType variant size changed");
+    switch (var.index()) {
+    case 0: return "";
+    case 1: return quoted ? std::format("'{}'", *std::get_if<char>(&var)) : std::format("{}", *std::get_if<char>(&var));
+    case 2: return quoted ? std::format("\"{}\"", *std::get_if<std::string>(&var)) : *std::get_if<std::string>(&var);
+    case 3: return *std::get_if<bool>(&var) ? "true" : "false";
+    case 4: return std::format("{}", *std::get_if<i64>(&var));
+    case 5: return std::format("{}", *std::get_if<u64>(&var));
+    case 6: return std::format("{}", *std::get_if<f64>(&var));
+    default: UNREACHABLE(); return "";
+    }
+}
+
 enum class ArgType : u8 {
     Flag,      // boolean flag like -v or --verbose
     Option,    // takes a value like [-f value] or [--file value]
     Positional // positional argument
 };
 
-class Arg {
+// Literal counterpart of Arg for schemas declared at compile time. Every string is a view into the spec literal
+class ArgSpec {
 public:
-    explicit Arg(const std::string_view name) : name_(name) {}
-
-    static Arg flag(const std::string_view name) {
-        Arg arg(name);
-        arg.type_ = ArgType::Flag;
-        return arg;
-    }
-
-    static Arg option(const std::string_view name) {
-        Arg arg(name);
-        arg.type_ = ArgType::Option;
-        arg.value_name_ = "VALUE";
-        return arg;
-    }
+    constexpr ArgSpec() = default;
+    constexpr ArgSpec(const std::string_view name, const ArgType type) : name_(name), type_(type) {}
 
-    static Arg positional(const std::string_view name) {
-        Arg arg(name);
-        arg.type_ = ArgType::Positional;
-        return arg;
-    }
-
-    Arg& short_alias(const char c) {
+    constexpr ArgSpec& short_alias(const char c) {
         short_ = c;
         return *this;
     }
 
-    Arg& long_alias(const std::string_view name) {
+    constexpr ArgSpec& long_alias(const std::string_view name) {
         long_ = name;
         return *this;
     }
 
-    Arg& about(const std::string_view description) {
+    constexpr ArgSpec& about(const std::string_view description) {
         description_ = description;
         return *this;
     }
 
-    Arg& value_name(const std::string_view name) {
+    constexpr ArgSpec& value_name(const std::string_view name) {
         value_name_ = name;
         return *this;
     }
 
-    Arg& default_value(const ValueType& value) {
-        default_value_ = value;
+    // Flags take "true" or "false", everything else the literal value text
+    constexpr ArgSpec& default_value(const std::string_view text) {
+        default_text_ = text;
         return *this;
     }
 
-    Arg& required(const bool req = true) {
+    constexpr ArgSpec& required(const bool req = true) {
         required_ = req;
         return *this;
     }
 
-    Arg& multiple(const bool multiple = true) {
+    constexpr ArgSpec& multiple(const bool multiple = true) {
         multiple_ = multiple;
         return *this;
     }
 
-    [[nodiscard]] const std::string& name() const {
+    constexpr ArgSpec& trailing(const bool trailing = true) {
+        trailing_ = trailing;
+        if (trailing) multiple_ = true;
+        return *this;
+    }
+
+    [[nodiscard]] constexpr std::string_view name() const {
         return name_;
     }
-    [[nodiscard]] ArgType type() const {
+    [[nodiscard]] constexpr ArgType type() const {
         return type_;
     }
-    [[nodiscard]] char short_alias() const {
+    [[nodiscard]] constexpr char short_alias() const {
         return short_;
     }
-    [[nodiscard]] const std::string& long_alias() const {
+    [[nodiscard]] constexpr std::string_view long_alias() const {
         return long_;
     }
-    [[nodiscard]] const std::string& description() const {
+    [[nodiscard]] constexpr std::string_view description() const {
         return description_;
     }
-    [[nodiscard]] const std::string& value_name() const {
+    [[nodiscard]] constexpr std::string_view value_name() const {
         return value_name_;
     }
-    [[nodiscard]] const ValueType& default_value() const {
-        return default_value_;
+    [[nodiscard]] constexpr std::string_view default_text() const {
+        return default_text_;
     }
-    [[nodiscard]] bool is_required() const {
+    [[nodiscard]] constexpr bool is_required() const {
         return required_;
     }
-    [[nodiscard]] bool is_multiple() const {
+    [[nodiscard]] constexpr bool is_multiple() const {
         return multiple_;
     }
+    [[nodiscard]] constexpr bool is_trailing() const {
+        return trailing_;
+    }
+    [[nodiscard]] constexpr bool has_default() const {
+        return type_ == ArgType::Flag ? default_text_ == "true" : !default_text_.empty();
+    }
 
 private:
-    std::string name_;
+    std::string_view name_;
     ArgType type_ = ArgType::Flag;
     char short_ = '\0';
-    std::string long_;
-    std::string description_;
-    std::string value_name_;
-    ValueType default_value_ = std::monostate{};
+    std::string_view long_;
+    std::string_view description_;
+    std::string_view value_name_;
+    std::string_view default_text_;
     bool required_ = false;
     bool multiple_ = false;
+    bool trailing_ = false;
 };
 
-constexpr Arg arg(std::string_view spec) {
+constexpr ArgSpec arg_spec(const std::string_view spec) {
+    // Trailing "..." marks a positional that collects every remaining value, e.g. <NAME>...
+    const bool variadic = spec.ends_with("...");
+    const std::string_view pos_spec = variadic ? spec.substr(0, spec.length() - 3) : spec;
+
     // Required positional argument
-    if (spec.starts_with('<') && spec.ends_with('>')) {
-        const auto name = spec.substr(1, spec.length() - 2);
-        return Arg::positional(name).required(true);
+    if (pos_spec.starts_with('<') && pos_spec.ends_with('>')) {
+        const auto name = pos_spec.substr(1, pos_spec.length() - 2);
+        return ArgSpec(name, ArgType::Positional).required(true).multiple(variadic);
     }
 
     // Optional positional argument
-    if (spec.starts_with('[') && spec.ends_with(']')) {
-        const auto name = spec.substr(1, spec.length() - 2);
-        return Arg::positional(name).required(false);
+    if (pos_spec.starts_with('[') && pos_spec.ends_with(']')) {
+        const auto name = pos_spec.substr(1, pos_spec.length() - 2);
+        return ArgSpec(name, ArgType::Positional).required(false).multiple(variadic);
     }
 
     if (spec.starts_with('-')) {
@@ -175,7 +209,9 @@ constexpr Arg arg(std::string_view spec) {
             }
         }
 
-        Arg result_arg = is_option ? Arg::option("") : Arg::flag("");
+        const ArgType type = is_option ? ArgType::Option : ArgType::Flag;
+        ArgSpec result_arg("", type);
+        if (is_option) result_arg.value_name("VALUE");
 
         const std::size_t space_pos = flag_part.find(' ');
         if (space_pos != std::string_view::npos) {
@@ -183,15 +219,15 @@ constexpr Arg arg(std::string_view spec) {
             const auto short_part = flag_part.substr(0, space_pos);
             const auto long_part = flag_part.substr(space_pos + 1);
 
-            char short_alias = '\0';
             if (short_part.starts_with('-') && short_part.length() == 2) {
-                short_alias = short_part[1];
-                result_arg.short_alias(short_alias);
+                result_arg.short_alias(short_part[1]);
             }
 
             if (long_part.starts_with("--") && long_part.length() > 2) {
                 const auto long_name = long_part.substr(2);
-                result_arg = is_option ? Arg::option(long_name) : Arg::flag(long_name);
+                const char short_alias = result_arg.short_alias();
+                result_arg = ArgSpec(long_name, type);
+                if (is_option) result_arg.value_name("VALUE");
                 result_arg.short_alias(short_alias).long_alias(long_name);
             }
 
@@ -201,133 +237,607 @@ constexpr Arg arg(std::string_view spec) {
 
         if (flag_part.starts_with("--") && flag_part.length() > 2) {
             const std::string_view long_name = flag_part.substr(2);
-            result_arg = is_option ? Arg::option(long_name) : Arg::flag(long_name);
+            result_arg = ArgSpec(long_name, type);
             result_arg.long_alias(long_name);
         } else if (flag_part.starts_with('-') && flag_part.length() == 2) {
-            const char short_char = flag_part[1];
-            const std::string short_str(1, short_char);
-            result_arg = is_option ? Arg::option(short_str) : Arg::flag(short_str);
-            result_arg.short_alias(short_char);
+            result_arg = ArgSpec(flag_part.substr(1, 1), type);
+            result_arg.short_alias(flag_part[1]);
         }
 
-        if (is_option && !value_part.empty()) result_arg.value_name(value_part);
+        if (is_option) result_arg.value_name(value_part.empty() ? "VALUE" : value_part);
         return result_arg;
     }
 
     // Default to flag
-    return Arg::flag(spec);
+    return {spec, ArgType::Flag};
 }
 
-class ArgMatches {
+namespace detail {
+
+inline constexpr ArgSpec HELP_ARG = arg_spec("-h --help").about("Show this help message");
+
+} // namespace detail
+
+// Every container below allocates from the current default pmr resource, so a program that installs an arena with
+// std::pmr::set_default_resource gets the whole command tree without touching the global heap
+
+class Arg {
 public:
-    ArgMatches() = default;
-    ~ArgMatches() = default;
+    explicit Arg(const std::string_view name) : name_(name) {}
 
-    ArgMatches(const ArgMatches& other)
-        : flags_(other.flags_), values_(other.values_), subcommand_name_(other.subcommand_name_) {
-        if (other.subcommand_matches_) {
-            subcommand_matches_ = std::make_unique<ArgMatches>(*other.subcommand_matches_);
+    explicit Arg(const ArgSpec& spec)
+        : name_(spec.name()), type_(spec.type()), short_(spec.short_alias()), long_(spec.long_alias()),
+          description_(spec.description()), value_name_(spec.value_name()), required_(spec.is_required()),
+          multiple_(spec.is_multiple()), trailing_(spec.is_trailing()) {
+        if (spec.default_text().empty()) return;
+        if (type_ == ArgType::Flag) {
+            default_value(spec.default_text() == "true");
+        } else {
+            default_value(std::string(spec.default_text()));
         }
     }
 
-    ArgMatches(ArgMatches&&) noexcept = default;
+    static Arg flag(const std::string_view name) {
+        Arg arg(name);
+        arg.type_ = ArgType::Flag;
+        return arg;
+    }
+
+    static Arg option(const std::string_view name) {
+        Arg arg(name);
+        arg.type_ = ArgType::Option;
+        arg.value_name_ = "VALUE";
+        return arg;
+    }
+
+    static Arg positional(const std::string_view name) {
+        Arg arg(name);
+        arg.type_ = ArgType::Positional;
+        return arg;
+    }
+
+    Arg& short_alias(const char c) {
+        short_ = c;
+        return *this;
+    }
+
+    Arg& long_alias(const std::string_view name) {
+        long_ = name;
+        return *this;
+    }
+
+    Arg& about(const std::string_view description) {
+        description_ = description;
+        return *this;
+    }
+
+    Arg& value_name(const std::string_view name) {
+        value_name_ = name;
+        return *this;
+    }
+
+    Arg& default_value(const ValueType& value) {
+        default_value_ = value;
+        default_text_ = to_formatted(value, false);
+        return *this;
+    }
+
+    Arg& required(const bool req = true) {
+        required_ = req;
+        return *this;
+    }
+
+    Arg& multiple(const bool multiple = true) {
+        multiple_ = multiple;
+        return *this;
+    }
 
-    ArgMatches& operator=(const ArgMatches& other) {
-        if (this != &other) {
-            flags_ = other.flags_;
-            values_ = other.values_;
-            subcommand_name_ = other.subcommand_name_;
-            if (other.subcommand_matches_) {
-                subcommand_matches_ = std::make_unique<ArgMatches>(*other.subcommand_matches_);
-            } else {
-                subcommand_matches_.reset();
+    // Once this positional receives its first value, every remaining token is taken verbatim, flags included
+    Arg& trailing(const bool trailing = true) {
+        trailing_ = trailing;
+        if (trailing) multiple_ = true;
+        return *this;
+    }
+
+    [[nodiscard]] const std::pmr::string& name() const {
+        return name_;
+    }
+    [[nodiscard]] ArgType type() const {
+        return type_;
+    }
+    [[nodiscard]] char short_alias() const {
+        return short_;
+    }
+    [[nodiscard]] const std::pmr::string& long_alias() const {
+        return long_;
+    }
+    [[nodiscard]] const std::pmr::string& description() const {
+        return description_;
+    }
+    [[nodiscard]] const std::pmr::string& value_name() const {
+        return value_name_;
+    }
+    [[nodiscard]] const ValueType& default_value() const {
+        return default_value_;
+    }
+    // Rendered once when the default is set, so matches can hand out a view of it
+    [[nodiscard]] const std::pmr::string& default_text() const {
+        return default_text_;
+    }
+    [[nodiscard]] bool is_required() const {
+        return required_;
+    }
+    [[nodiscard]] bool is_multiple() const {
+        return multiple_;
+    }
+    [[nodiscard]] bool is_trailing() const {
+        return trailing_;
+    }
+    [[nodiscard]] bool has_default() const {
+        if (type_ == ArgType::Flag) return std::holds_alternative<bool>(default_value_) && *std::get_if<bool>(&default_value_);
+        return !std::holds_alternative<std::monostate>(default_value_);
+    }
+
+private:
+    std::pmr::string name_;
+    ArgType type_ = ArgType::Flag;
+    char short_ = '\0';
+    std::pmr::string long_;
+    std::pmr::string description_;
+    std::pmr::string value_name_;
+    ValueType default_value_ = std::monostate{};
+    std::pmr::string default_text_;
+    bool required_ = false;
+    bool multiple_ = false;
+    bool trailing_ = false;
+};
+
+constexpr Arg arg(const std::string_view spec) {
+    return Arg(arg_spec(spec));
+}
+
+class Command;
+class MatchesView;
+struct CompiledCommand;
+
+// Whole contents of a response file, or of stdin for `--args-from -`. Regular files are mapped rather than read, so
+// the tokens parsed out of them are views into the page cache and a million names cost no per-token copies
+class TokenSource {
+public:
+    TokenSource() = default;
+    TokenSource(const TokenSource&) = delete;
+    TokenSource& operator=(const TokenSource&) = delete;
+
+    ~TokenSource() {
+#ifndef _WIN32
+        if (map_ != nullptr) munmap(map_, size_);
+#endif // _WIN32
+    }
+
+    // "-" reads stdin to the end
+    static std::expected<std::shared_ptr<TokenSource>, std::string> open(const std::string_view path) {
+        auto source = std::make_shared<TokenSource>();
+#ifdef _WIN32
+        std::FILE* file = path == "-" ? stdin : std::fopen(std::string(path).c_str(), "rb");
+        if (file == nullptr) {
+            return std::unexpected(std::format("Could not open response file '{}': {}", path, std::strerror(errno)));
+        }
+        std::array<char, 64 * 1024> chunk{};
+        std::size_t n = 0;
+        while ((n = std::fread(chunk.data(), 1, chunk.size(), file)) > 0) source->buffer_.append(chunk.data(), n);
+        const bool failed = std::ferror(file) != 0;
+        if (file != stdin) std::fclose(file);
+        if (failed) return std::unexpected(std::format("Could not read response file '{}'", path));
+#else
+        if (path == "-") {
+            if (!source->read_all(STDIN_FILENO)) {
+                return std::unexpected(std::format("Could not read arguments from stdin: {}", std::strerror(errno)));
             }
+            return source;
         }
-        return *this;
+
+        const int fd = ::open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return std::unexpected(std::format("Could not open response file '{}': {}", path, std::strerror(errno)));
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            const auto size = static_cast<std::size_t>(st.st_size);
+            if (void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); map != MAP_FAILED) {
+                madvise(map, size, MADV_SEQUENTIAL);
+                source->map_ = map;
+                source->size_ = size;
+                close(fd);
+                return source;
+            }
+        }
+
+        // Pipes and process substitution can't be mapped, read them like stdin
+        const bool ok = source->read_all(fd);
+        const int saved_errno = errno;
+        close(fd);
+        if (!ok) {
+            return std::unexpected(std::format("Could not read response file '{}': {}", path, std::strerror(saved_errno)));
+        }
+#endif // _WIN32
+        return source;
+    }
+
+    [[nodiscard]] std::string_view text() const {
+        if (map_ != nullptr) return {static_cast<const char*>(map_), size_};
+        return buffer_;
+    }
+
+    // Sources opened earlier in the same parse, kept alive by this one
+    void chain(std::shared_ptr<const TokenSource> previous) {
+        previous_ = MOVE(previous);
+    }
+
+private:
+    void* map_ = nullptr;
+    std::size_t size_ = 0;
+    std::string buffer_;
+    std::shared_ptr<const TokenSource> previous_;
+
+#ifndef _WIN32
+    bool read_all(const int fd) {
+        std::size_t used = 0;
+        buffer_.resize(64 * 1024);
+        while (true) {
+            if (used == buffer_.size()) buffer_.resize(buffer_.size() * 2);
+            const ssize_t n = read(fd, buffer_.data() + used, buffer_.size() - used);
+            if (n == 0) break;
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            used += static_cast<std::size_t>(n);
+        }
+        buffer_.resize(used);
+        return true;
+    }
+#endif // _WIN32
+};
+
+// Fixed inline capacity with an overflow vector for unusually long command lines, so typical parses never allocate
+template <typename T, std::size_t N>
+class InlineVector {
+public:
+    InlineVector() = default;
+    explicit InlineVector(std::pmr::memory_resource* resource) : overflow_(resource) {}
+
+    void push_back(const T& value) {
+        if (size_ < N) {
+            inline_[size_] = value;
+        } else {
+            overflow_.push_back(value);
+        }
+        ++size_;
     }
 
-    ArgMatches& operator=(ArgMatches&&) noexcept = default;
+    [[nodiscard]] const T& operator[](const std::size_t i) const {
+        return i < N ? inline_[i] : overflow_[i - N];
+    }
 
-    bool get_flag(const std::string& name) const {
-        const auto it = flags_.find(name);
-        return it != flags_.end() && it->second;
+    [[nodiscard]] T& operator[](const std::size_t i) {
+        return i < N ? inline_[i] : overflow_[i - N];
     }
 
+    [[nodiscard]] std::size_t size() const {
+        return size_;
+    }
+
+    void clear() {
+        overflow_.clear();
+        size_ = 0;
+    }
+
+private:
+    std::array<T, N> inline_{};
+    std::pmr::vector<T> overflow_;
+    std::size_t size_ = 0;
+};
+
+// Flat result of a parse. Every value is keyed by the command level it was parsed at and the index of its Arg in that
+// Command, and points straight into argv or into a response file the matches keep alive, so both argv and the Command
+// tree must outlive the matches
+class ArgMatches {
+public:
+    static constexpr u16 NO_SUBCOMMAND = UINT16_MAX;
+
+    ArgMatches() = default;
+    // Storage for unusually long command lines comes from `resource` instead of the default pmr resource
+    explicit ArgMatches(std::pmr::memory_resource* resource) : entries_(resource), levels_(resource) {}
+
+    struct Entry {
+        u16 level = 0;
+        u16 arg = 0;
+        std::string_view value;
+    };
+
+    // Either a builder Command or a command of a compile-time Schema, whichever produced this level
+    using CommandRef = std::variant<const Command*, const CompiledCommand*>;
+
+    struct Level {
+        CommandRef command;
+        u16 subcommand = NO_SUBCOMMAND;
+        bool help = false;
+    };
+
+    [[nodiscard]] MatchesView view() const;
+
+    [[nodiscard]] bool get_flag(std::string_view name) const;
+
     template <typename T = std::string>
-    [[nodiscard]] std::optional<T> get_one(const std::string& name) const {
-        const auto it = values_.find(name);
-        if (it == values_.end() || it->second.empty()) {
-            return std::nullopt;
+    [[nodiscard]] std::optional<T> get_one(std::string_view name) const;
+
+    template <typename T = std::string>
+    [[nodiscard]] std::vector<T> get_many(std::string_view name) const;
+
+    [[nodiscard]] std::optional<std::pair<std::string_view, MatchesView>> subcommand() const;
+
+    int dispatch() const;
+
+    u16 push_level(const CommandRef command) {
+        levels_.push_back({.command = command});
+        return static_cast<u16>(levels_.size() - 1);
+    }
+
+    void set_help(const u16 level) {
+        levels_[level].help = true;
+    }
+
+    void set_subcommand(const u16 level, const std::size_t index) {
+        levels_[level].subcommand = static_cast<u16>(index);
+    }
+
+    void add(const u16 level, const std::size_t arg, const std::string_view value) {
+        entries_.push_back({.level = level, .arg = static_cast<u16>(arg), .value = value});
+    }
+
+    [[nodiscard]] bool contains(const u16 level, const std::size_t arg) const {
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i].level == level && entries_[i].arg == arg) return true;
         }
-        return parse_value<T>(it->second.front());
+        return false;
+    }
+
+    // Values added from a response file point into it, so it lives as long as the matches and any copies of them.
+    // Sources form a list through TokenSource::chain, an empty one costs a parse without response files nothing
+    void keep(std::shared_ptr<TokenSource> source) {
+        source->chain(MOVE(sources_));
+        sources_ = MOVE(source);
+    }
+
+    [[nodiscard]] const InlineVector<Entry, 16>& entries() const {
+        return entries_;
     }
 
+    [[nodiscard]] const InlineVector<Level, 4>& levels() const {
+        return levels_;
+    }
+
+    void clear() {
+        entries_.clear();
+        levels_.clear();
+        sources_.reset();
+    }
+
+private:
+    InlineVector<Entry, 16> entries_;
+    InlineVector<Level, 4> levels_;
+    std::shared_ptr<const TokenSource> sources_;
+};
+
+// Non-owning view of one command level of an ArgMatches; cheap to copy and valid as long as the matches are
+class MatchesView {
+public:
+    MatchesView(const ArgMatches& matches, const u16 level) : matches_(&matches), level_(level) {}
+
+    [[nodiscard]] bool get_flag(std::string_view name) const;
+
     template <typename T = std::string>
-    [[nodiscard]] std::vector<T> get_many(const std::string& name) const {
-        const auto it = values_.find(name);
-        if (it == values_.end() || it->second.empty()) {
-            return {};
+    [[nodiscard]] std::optional<T> get_one(const std::string_view name) const {
+        const auto index = arg_index(name);
+        if (!index.has_value()) return std::nullopt;
+
+        const auto& entries = matches_->entries();
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].level == level_ && entries[i].arg == *index) return parse_value<T>(entries[i].value);
         }
+        if (const auto fallback = default_text(*index); fallback.has_value()) return parse_value<T>(*fallback);
+        return std::nullopt;
+    }
+
+    template <typename T = std::string>
+    [[nodiscard]] std::vector<T> get_many(const std::string_view name) const {
         std::vector<T> result;
-        result.reserve(it->second.size());
-        for (const auto& val_str : it->second) {
-            if (const auto parsed = parse_value<T>(val_str); parsed.has_value()) {
+        const auto index = arg_index(name);
+        if (!index.has_value()) return result;
+
+        const auto& entries = matches_->entries();
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].level != level_ || entries[i].arg != *index) continue;
+            if (const auto parsed = parse_value<T>(entries[i].value); parsed.has_value()) {
                 result.push_back(*parsed);
             }
         }
+        if (result.empty()) {
+            if (const auto fallback = default_text(*index); fallback.has_value()) {
+                if (const auto parsed = parse_value<T>(*fallback); parsed.has_value()) result.push_back(*parsed);
+            }
+        }
         return result;
     }
 
-    [[nodiscard]] std::optional<std::pair<std::string, std::unique_ptr<ArgMatches>>> subcommand() const {
-        if (subcommand_name_.empty() || subcommand_matches_ == nullptr) {
-            return std::nullopt;
+    // Describes the first value of `name`, given or default, that does not convert to T. Flags carry no value
+    template <typename T>
+    [[nodiscard]] std::optional<std::string> invalid_value(const std::string_view name) const {
+        const auto index = arg_index(name);
+        if (!index.has_value() || arg_type(*index) == ArgType::Flag) return std::nullopt;
+
+        bool given = false;
+        const auto& entries = matches_->entries();
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].level != level_ || entries[i].arg != *index) continue;
+            given = true;
+            if (!parse_value<T>(entries[i].value).has_value()) return invalid_message(*index, entries[i].value);
         }
-        return std::make_pair(subcommand_name_, std::make_unique<ArgMatches>(*subcommand_matches_));
+        if (!given) {
+            const auto fallback = default_text(*index);
+            if (fallback.has_value() && !parse_value<T>(*fallback).has_value()) return invalid_message(*index, *fallback);
+        }
+        return std::nullopt;
     }
 
-    void set_flag(const std::string& name, const bool value) {
-        flags_[name] = value;
-    }
+    [[nodiscard]] std::optional<std::pair<std::string_view, MatchesView>> subcommand() const;
 
-    void add_value(const std::string& name, const std::string& value) {
-        values_[name].push_back(value);
+    [[nodiscard]] std::optional<std::size_t> subcommand_index() const {
+        if (matches_->levels().size() <= level_) return std::nullopt;
+        const u16 index = matches_->levels()[level_].subcommand;
+        if (index == ArgMatches::NO_SUBCOMMAND) return std::nullopt;
+        return index;
     }
 
-    void set_subcommand(const std::string& name, std::unique_ptr<ArgMatches> matches) {
-        subcommand_name_ = name;
-        subcommand_matches_ = MOVE(matches);
-    }
+    void print_help() const;
+
+    // Follows the subcommand indices recorded while parsing down to the deepest level and calls its handler. A level
+    // that asked for help, or one without a handler, prints its help instead
+    int dispatch() const;
 
 private:
-    std::unordered_map<std::string, bool> flags_;
-    std::unordered_map<std::string, std::vector<std::string>> values_;
-    std::string subcommand_name_;
-    std::unique_ptr<ArgMatches> subcommand_matches_;
+    const ArgMatches* matches_;
+    u16 level_;
+
+    [[nodiscard]] std::optional<std::size_t> arg_index(std::string_view name) const;
+    [[nodiscard]] std::optional<std::string_view> default_text(std::size_t index) const;
+    [[nodiscard]] ArgType arg_type(std::size_t index) const;
+    [[nodiscard]] std::string invalid_message(std::size_t index, std::string_view value) const;
+
+    [[nodiscard]] const ArgMatches::CommandRef& command_ref() const {
+        return matches_->levels()[level_].command;
+    }
 
     template <typename T>
     static constexpr std::optional<T> parse_value(std::string_view str) {
-        if constexpr (std::is_same_v<T, std::string>) {
-            return {std::string(str)};
+        if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+            return {T(str)};
+        } else if constexpr (std::is_same_v<T, bool>) {
+            if (str == "true"  || str == "1" || str == "yes" || str == "on") return {true};
+            if (str == "false" || str == "0" || str == "no"  || str == "off") return {false};
+            return std::nullopt;
         } else if constexpr (std::is_arithmetic_v<T>) {
             T result;
             auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), result);
             if (ec == std::errc{} && ptr == str.data() + str.size()) return {result};
             return std::nullopt;
-        } else if constexpr (std::is_same_v<T, bool>) {
-            if (str == "true"  || str == "1" || str == "yes" || str == "on") return {true};
-            if (str == "false" || str == "0" || str == "no"  || str == "off") return {false};
-            return std::nullopt;
         }
         return std::nullopt;
     }
 };
 
+using Handler = int (*)(MatchesView);
+
+// Lets a string literal be passed as a template argument, e.g. bind<&fn, "NAME">
+template <std::size_t N>
+struct FixedString {
+    std::array<char, N> chars{};
+
+    constexpr FixedString(const char (&str)[N]) {
+        for (std::size_t i = 0; i < N; ++i) chars[i] = str[i];
+    }
+
+    [[nodiscard]] constexpr std::string_view view() const {
+        return {chars.data(), N - 1};
+    }
+};
+
+namespace detail {
+
+// bool reads a flag, std::optional<T> and std::vector<T> an optional or repeated value, anything else a single value
+template <typename T>
+struct Extract {
+    static T get(const MatchesView matches, const std::string_view name) {
+        if constexpr (std::is_same_v<T, bool>) {
+            return matches.get_flag(name);
+        } else {
+            return matches.get_one<T>(name).value_or(T{});
+        }
+    }
+};
+
+template <typename T>
+struct Extract<std::optional<T>> {
+    static std::optional<T> get(const MatchesView matches, const std::string_view name) {
+        return matches.get_one<T>(name);
+    }
+};
+
+template <typename T>
+struct Extract<std::vector<T>> {
+    static std::vector<T> get(const MatchesView matches, const std::string_view name) {
+        return matches.get_many<T>(name);
+    }
+};
+
+// The type a single value of the parameter converts to
+template <typename T>
+struct ValueOf {
+    using type = T;
+};
+
+template <typename T>
+struct ValueOf<std::optional<T>> {
+    using type = T;
+};
+
+template <typename T>
+struct ValueOf<std::vector<T>> {
+    using type = T;
+};
+
+template <typename F>
+struct HandlerTraits;
+
+template <typename... Args>
+struct HandlerTraits<int (*)(Args...)> {
+    using Params = std::tuple<std::remove_cvref_t<Args>...>;
+};
+
+} // namespace detail
+
+// Adapts int fn(T1, T2, ...) into a Handler; each parameter is extracted from the argument named at the same position.
+// A value that does not convert to its parameter fails like a parse error instead of reaching fn; absent ones default
+template <auto Fn, FixedString... Names>
+int bind(const MatchesView matches) {
+    using Params = typename detail::HandlerTraits<decltype(Fn)>::Params;
+    static_assert(std::tuple_size_v<Params> == sizeof...(Names), "bind needs one argument name per parameter");
+
+    std::optional<std::string> error;
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        using detail::ValueOf;
+        ((error = matches.invalid_value<typename ValueOf<std::tuple_element_t<I, Params>>::type>(Names.view()),
+          error.has_value()) || ...);
+    }(std::index_sequence_for<decltype(Names)...>{});
+    if (error.has_value()) {
+        std::println(stderr, "Error parsing arguments: {}", *error);
+        return 1;
+    }
+
+    return [&]<std::size_t... I>(std::index_sequence<I...>) {
+        return Fn(detail::Extract<std::tuple_element_t<I, Params>>::get(matches, Names.view())...);
+    }(std::index_sequence_for<decltype(Names)...>{});
+}
+
 struct ParseError {
 
     enum class ParseErrorType : u8 {
         None,
         MissingRequiredArgument,
         MissingRequiredSubcommand,
+        UnreadableResponseFile,
+        MissingResponseFile,
     };
 
     ParseErrorType type;
@@ -341,13 +851,21 @@ struct ParseError {
         return {.type = ParseErrorType::None, .message = ""};
     }
 
-    static constexpr ParseError MissingRequiredArgument(const std::string& cmd_name, const std::string& arg_name) {
+    static constexpr ParseError MissingRequiredArgument(const std::string_view cmd_name, const std::string_view arg_name) {
         return {.type = ParseErrorType::MissingRequiredArgument, .message = std::format("Missing required argument '{}' for command '{}'", arg_name, cmd_name)};
     }
 
-    static constexpr ParseError MissingRequiredSubcommand(const std::string& cmd_name) {
+    static constexpr ParseError MissingRequiredSubcommand(const std::string_view cmd_name) {
         return {.type = ParseErrorType::MissingRequiredSubcommand, .message = std::format("Missing required subcommand for command '{}'", cmd_name)};
     }
+
+    static ParseError UnreadableResponseFile(std::string message) {
+        return {.type = ParseErrorType::UnreadableResponseFile, .message = MOVE(message)};
+    }
+
+    static ParseError MissingResponseFile() {
+        return {.type = ParseErrorType::MissingResponseFile, .message = "--args-from requires a path"};
+    }
 };
 
 struct ParseResult {
@@ -355,6 +873,165 @@ struct ParseResult {
     ParseError error;
 };
 
+namespace detail {
+
+// Hands out argv one token at a time. With response files enabled, `@FILE` and `--args-from FILE` splice the lines of
+// FILE into the stream in their place ("-" is stdin); lines are taken verbatim apart from a trailing '\r', empty ones
+// are skipped and nothing inside a file is expanded again. Expansion stops after a literal `--` on the command line
+class TokenStream {
+public:
+    TokenStream(const int argc, char** argv, ArgMatches* sources)
+        : argc_(argc), argv_(argv), sources_(sources) {}
+
+    // False at the end of the line, and from the first unreadable or missing response file on. Taking the token by
+    // reference keeps it in registers, which an optional return did not; parsing is a tight loop over this
+    bool next(std::string_view& token) {
+        while (!error_.has_value()) {
+            if (pos_ < text_.size()) {
+                const std::size_t end = std::min(text_.find('\n', pos_), text_.size());
+                token = text_.substr(pos_, end - pos_);
+                pos_ = end + 1;
+                if (token.ends_with('\r')) token.remove_suffix(1);
+                if (!token.empty()) return true;
+                continue;
+            }
+
+            if (argc_ == 0) return false;
+            --argc_;
+            token = *argv_++;
+            if (sources_ == nullptr || literal_) return true;
+
+            if (token == "--") {
+                literal_ = true;
+            } else if (token == "--args-from") {
+                if (argc_ == 0) {
+                    error_ = ParseError::MissingResponseFile();
+                    return false;
+                }
+                --argc_;
+                expand(*argv_++);
+                continue;
+            } else if (token.size() > 1 && token.starts_with('@')) {
+                expand(token.substr(1));
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    [[nodiscard]] const std::optional<ParseError>& error() const {
+        return error_;
+    }
+
+private:
+    int argc_;
+    char** argv_;
+    ArgMatches* sources_;
+    std::string_view text_;
+    std::size_t pos_ = 0;
+    bool literal_ = false;
+    std::optional<ParseError> error_;
+
+    void expand(const std::string_view path) {
+        auto source = TokenSource::open(path);
+        if (!source.has_value()) {
+            error_ = ParseError::UnreadableResponseFile(MOVE(source.error()));
+            return;
+        }
+        text_ = (*source)->text();
+        pos_ = 0;
+        sources_->keep(MOVE(*source));
+    }
+};
+
+// Generic token walk shared by the builder Command and compile-time Schema commands. Cmd provides find_subcommand,
+// subcommand_at, find_long, find_short, find_positional, arg_at, arg_count, requires_subcommand and level_ref
+template <typename Cmd>
+void add_flag_or_option(const Cmd& cmd, ArgMatches& matches, const u16 level, const std::optional<std::size_t> index,
+                        const std::string_view arg, TokenStream& tokens) {
+    if (!index.has_value()) return;
+    const ArgType type = cmd.arg_at(*index).type();
+    if (type == ArgType::Flag) {
+        matches.add(level, *index, arg);
+    } else if (type == ArgType::Option) {
+        if (std::string_view value; tokens.next(value)) {
+            matches.add(level, *index, value);
+        }
+    }
+}
+
+template <typename Cmd>
+ParseError parse_tokens(const Cmd& cmd, ArgMatches& matches, TokenStream& tokens) {
+    const u16 level = matches.push_level(cmd.level_ref());
+    std::size_t positional_index = 0;
+
+    std::string_view arg;
+    while (tokens.next(arg)) {
+        if (arg == "--help" || arg == "-h") {
+            matches.set_help(level);
+            return ParseError::None();
+        }
+
+        // Check for subcommands first
+        if (const auto sub = cmd.find_subcommand(arg); sub.has_value()) {
+            matches.set_subcommand(level, *sub);
+            return parse_tokens(cmd.subcommand_at(*sub), matches, tokens);
+        }
+
+        // Check for --
+        if (arg == "--") {
+            // Treat all remaining arguments as positional
+            std::string_view rest;
+            while (tokens.next(rest)) {
+                const auto pos_arg = cmd.find_positional(positional_index);
+                if (pos_arg.has_value()) {
+                    matches.add(level, *pos_arg, rest);
+                    if (!cmd.arg_at(*pos_arg).is_multiple()) ++positional_index;
+                }
+            }
+            break;
+        }
+
+        // Handle flags and options
+        if (arg.starts_with("--")) {
+            add_flag_or_option(cmd, matches, level, cmd.find_long(arg.substr(2)), arg, tokens);
+        } else if (arg.starts_with("-") && arg.length() > 1) {
+            add_flag_or_option(cmd, matches, level, cmd.find_short(arg[1]), arg, tokens);
+        } else {
+            const auto pos_arg = cmd.find_positional(positional_index);
+            if (pos_arg.has_value()) {
+                matches.add(level, *pos_arg, arg);
+                if (cmd.arg_at(*pos_arg).is_trailing()) {
+                    std::string_view rest;
+                    while (tokens.next(rest)) matches.add(level, *pos_arg, rest);
+                    break;
+                }
+                if (!cmd.arg_at(*pos_arg).is_multiple()) ++positional_index;
+            }
+        }
+    }
+
+    if (tokens.error().has_value()) return *tokens.error();
+
+    // Validate required arguments, defaults count as present
+    for (std::size_t i = 0; i < cmd.arg_count(); ++i) {
+        const auto& spec = cmd.arg_at(i);
+        if (spec.is_required() && !matches.contains(level, i) && !spec.has_default()) {
+            return ParseError::MissingRequiredArgument(cmd.name(), spec.name());
+        }
+    }
+
+    // Validate subcommand requirement
+    if (cmd.requires_subcommand() && matches.levels()[level].subcommand == ArgMatches::NO_SUBCOMMAND) {
+        return ParseError::MissingRequiredSubcommand(cmd.name());
+    }
+
+    return ParseError::None();
+}
+
+} // namespace detail
+
 class Command {
 public:
     explicit Command(const std::string_view name, const std::string_view description = "", const bool help_arg = true)
@@ -362,14 +1039,14 @@ public:
         ASSERT(!name_.empty(), "Command name cannot be empty");
 
         if (help_arg) {
-            this->arg(cli::arg("-h --help").about("Show this help message"));
+            this->arg(Arg(detail::HELP_ARG));
         }
     }
 
     Command& subcommand(Command cmd) {
         if (cmd.name().size() > max_cmd_len) max_cmd_len = cmd.name().size();
 
-        cmd.parent_cmd_ = parent_cmd_.empty() ? name_ : std::format("{} {}", parent_cmd_, name_);
+        cmd.set_parent(parent_cmd_.empty() ? std::string(name_) : std::format("{} {}", parent_cmd_, name_));
 
         subcommands_.push_back(MOVE(cmd));
         return *this;
@@ -385,6 +1062,12 @@ public:
         return *this;
     }
 
+    // Called by ArgMatches::dispatch when this is the deepest command on the line; use bind<> for typed parameters
+    Command& handler(std::function<int(MatchesView)> handler) {
+        handler_ = MOVE(handler);
+        return *this;
+    }
+
     Command& arg(const Arg& arg) {
         // Calculate max option length for help formatting
         std::size_t curr_opt_len = 0;
@@ -411,30 +1094,120 @@ public:
         return *this;
     }
 
-    ParseResult get_matches(const int argc, char** argv) const {
-        ArgMatches matches;
+    // Lets the command line name `@FILE` or `--args-from FILE` to read further arguments from FILE, one per line
+    Command& response_files(const bool enable = true) {
+        response_files_ = enable;
+        return *this;
+    }
+
+    ParseResult get_matches(const int argc, char** argv,
+                            std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const {
+        ParseResult result{.matches = ArgMatches(resource), .error = ParseError::None()};
         int current_argc = argc;
         char** current_argv = argv;
         shift(current_argc, current_argv); // Skip program name
-        return parse_args(matches, current_argc, current_argv);
+        detail::TokenStream tokens(current_argc, current_argv, response_files_ ? &result.matches : nullptr);
+        result.error = detail::parse_tokens(*this, result.matches, tokens);
+        if (result.error.has_error()) result.matches.clear();
+        return result;
     }
 
-    [[nodiscard]] const std::string& name() const {
+    [[nodiscard]] const std::pmr::string& name() const {
         return name_;
     }
 
-    [[nodiscard]] const std::string& description() const {
+    [[nodiscard]] const std::pmr::string& description() const {
         return description_;
     }
 
-    [[nodiscard]] const std::vector<Command>& subcommands() const {
+    [[nodiscard]] const std::pmr::vector<Command>& subcommands() const {
         return subcommands_;
     }
 
-    [[nodiscard]] const std::vector<Arg>& args() const {
+    [[nodiscard]] const std::pmr::vector<Arg>& args() const {
         return args_;
     }
 
+    [[nodiscard]] std::optional<std::size_t> arg_index(const std::string_view name) const {
+        for (std::size_t i = 0; i < args_.size(); ++i) {
+            if (args_[i].name() == name) return i;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] bool flag_default(const std::size_t index) const {
+        const ValueType& value = args_[index].default_value();
+        return std::holds_alternative<bool>(value) && *std::get_if<bool>(&value);
+    }
+
+    [[nodiscard]] std::optional<std::string_view> value_default(const std::size_t index) const {
+        const Arg& arg = args_[index];
+        if (arg.type() == ArgType::Flag || std::holds_alternative<std::monostate>(arg.default_value())) return std::nullopt;
+        return std::string_view(arg.default_text());
+    }
+
+    [[nodiscard]] std::string_view subcommand_name(const std::size_t index) const {
+        return subcommands_[index].name();
+    }
+
+    [[nodiscard]] std::optional<int> invoke(const MatchesView matches) const {
+        if (!handler_) return std::nullopt;
+        return handler_(matches);
+    }
+
+    // Lookups used by detail::parse_tokens, all linear since a builder tree is only known at runtime
+    [[nodiscard]] std::optional<std::size_t> find_subcommand(const std::string_view name) const {
+        for (std::size_t i = 0; i < subcommands_.size(); ++i) {
+            if (subcommands_[i].name() == name) return i;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<std::size_t> find_positional(const std::size_t index) const {
+        std::size_t pos_count = 0;
+        for (std::size_t i = 0; i < args_.size(); ++i) {
+            if (args_[i].type() == ArgType::Positional) {
+                if (pos_count == index) return i;
+                ++pos_count;
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<std::size_t> find_short(const char short_alias) const {
+        for (std::size_t i = 0; i < args_.size(); ++i) {
+            if (args_[i].short_alias() == short_alias) return i;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<std::size_t> find_long(const std::string_view long_alias) const {
+        for (std::size_t i = 0; i < args_.size(); ++i) {
+            if (args_[i].long_alias() == long_alias || args_[i].name() == long_alias) return i;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] const Command& subcommand_at(const std::size_t index) const {
+        return subcommands_[index];
+    }
+
+    [[nodiscard]] const Arg& arg_at(const std::size_t index) const {
+        return args_[index];
+    }
+
+    [[nodiscard]] std::size_t arg_count() const {
+        return args_.size();
+    }
+
+    [[nodiscard]] bool requires_subcommand() const {
+        return subcommand_required_ && !subcommands_.empty();
+    }
+
+    [[nodiscard]] ArgMatches::CommandRef level_ref() const {
+        return this;
+    }
+
     void clear() {
         subcommands_.clear();
         args_.clear();
@@ -460,6 +1233,7 @@ public:
                 } else {
                     std::print(" [{}]", arg.name());
                 }
+                if (arg.is_multiple()) std::print("...");
             }
         }
 
@@ -505,7 +1279,7 @@ public:
                     written += 2;
                 }
 
-                const std::string& long_name = arg.long_alias().empty() ? arg.name() : arg.long_alias();
+                const std::pmr::string& long_name = arg.long_alias().empty() ? arg.name() : arg.long_alias();
                 if (!long_name.empty()) {
                     if (written > 0) {
                         std::print(", ");
@@ -534,159 +1308,556 @@ public:
     }
 
 private:
-    std::string name_;
-    std::string description_;
-    std::string parent_cmd_;
+    std::pmr::string name_;
+    std::pmr::string description_;
+    std::pmr::string parent_cmd_;
 
-    std::vector<Command> subcommands_;
-    std::vector<Arg> args_;
+    std::pmr::vector<Command> subcommands_;
+    std::pmr::vector<Arg> args_;
+    std::function<int(MatchesView)> handler_;
 
     std::size_t max_opt_len = 0;
     std::size_t max_cmd_len = 0;
     bool subcommand_required_ = false;
+    bool response_files_ = false;
 
-    static constexpr std::string to_formatted(const ValueType& var, const bool quoted = true) {
-        static_assert(std::variant_size_v<ValueType> == 7, "ValueType variant size changed");
-        switch (var.index()) {
-        case 0: return "";
-        case 1: return quoted ? std::format("'{}'", *std::get_if<char>(&var)) : std::format("{}", *std::get_if<char>(&var));
-        case 2: return quoted ? std::format("\"{}\"", *std::get_if<std::string>(&var)) : *std::get_if<std::string>(&var);
-        case 3: return *std::get_if<bool>(&var) ? "true" : "false";
-        case 4: return std::format("{}", *std::get_if<i64>(&var));
-        case 5: return std::format("{}", *std::get_if<u64>(&var));
-        case 6: return std::format("{}", *std::get_if<f64>(&var));
-        default: UNREACHABLE(); return "";
+    // Nested subcommands are usually built before their parent is attached, so the path is refreshed all the way down
+    void set_parent(const std::string_view parent) {
+        parent_cmd_ = parent;
+        for (Command& subcmd : subcommands_) {
+            subcmd.set_parent(std::format("{} {}", parent_cmd_, name_));
         }
     }
+};
 
-    ParseResult parse_args(ArgMatches& matches, const int argc, char** argv) const {
-        int current_argc = argc;
-        char** current_argv = argv;
-        std::size_t positional_index = 0;
+// Compile-time counterpart of Command. Trees are declared as constexpr arrays of specs and handed to Schema, which
+// builds the lookup tables and help text while compiling
+struct CommandSpec {
+    std::string_view name;
+    std::string_view description;
+    std::span<const ArgSpec> args = {};
+    std::span<const CommandSpec> subcommands = {};
+    bool subcommand_required = false;
+    bool help_arg = true;
+    Handler handler = nullptr;
+    bool response_files = false; // only read on the root, see Command::response_files
+};
 
-        while (current_argc > 0) {
-            const std::string_view arg = *current_argv;
+namespace detail {
 
-            if (arg == "--help" || arg == "-h") {
-                matches.set_flag("help", true);
-                return {.matches = matches, .error = ParseError::None()};
-            }
+// Deliberately not constexpr: reaching it while a Schema is being built stops compilation with the message in the trace
+inline void schema_error(const char* message) {
+    UNUSED(message);
+}
 
-            // Check for subcommands first
-            for (const auto& subcmd : subcommands_) {
-                if (arg != subcmd.name()) continue;
-                shift(current_argc, current_argv);
+constexpr u32 hash_name(const std::string_view name, const u32 seed) {
+    u32 hash = 2166136261U ^ seed;
+    for (const char c : name) {
+        hash ^= static_cast<u8>(c);
+        hash *= 16777619U;
+    }
+    return hash;
+}
 
-                ArgMatches temp_matches;
-                const auto [res, err] = subcmd.parse_args(temp_matches, current_argc, current_argv);
-                if (err.has_error()) return {.matches = {}, .error = err};
+constexpr std::string_view long_key(const ArgSpec& arg) {
+    return arg.long_alias().empty() ? arg.name() : arg.long_alias();
+}
 
-                matches.set_subcommand(subcmd.name(), std::make_unique<ArgMatches>(MOVE(res)));
-                return {.matches = matches, .error = ParseError::None()};
-            }
+constexpr std::size_t option_width(const ArgSpec& arg) {
+    std::size_t width = arg.short_alias() != '\0' ? 2 : 0; // "-x"
+    const std::string_view long_name = long_key(arg);
+    if (!long_name.empty()) {
+        if (width > 0) width += 2;    // ", "
+        width += long_name.size() + 2; // "--name"
+    }
+    if (arg.type() == ArgType::Option && !arg.value_name().empty()) {
+        width += arg.value_name().size() + 3; // " <value>"
+    }
+    return width;
+}
 
-            // Check for --
-            if (arg == "--") {
-                shift(current_argc, current_argv);
-                // Treat all remaining arguments as positional
-                while (current_argc > 0) {
-                    const Arg* pos_arg = find_positional_arg(positional_index);
-                    if (pos_arg != nullptr) {
-                        matches.add_value(pos_arg->name(), std::string(*current_argv));
-                        if (!pos_arg->is_multiple()) ++positional_index;
-                    }
-                    shift(current_argc, current_argv);
-                }
-                break;
-            }
+// Counts when out is null, so the same code sizes the buffer and then fills it
+struct HelpWriter {
+    char* out = nullptr;
+    std::size_t size = 0;
 
-            // Handle flags and options
-            if (arg.starts_with("--")) {
-                const Arg* matching_arg = find_flag_by_long(arg.substr(2));
-                add_flag_or_option(matches, matching_arg, current_argc, current_argv);
-            } else if (arg.starts_with("-") && arg.length() > 1) {
-                const Arg* matching_arg = find_flag_by_short(arg[1]);
-                add_flag_or_option(matches, matching_arg, current_argc, current_argv);
-            } else {
-                const Arg* pos_arg = find_positional_arg(positional_index);
-                if (pos_arg != nullptr) {
-                    matches.add_value(pos_arg->name(), std::string(arg));
-                    if (!pos_arg->is_multiple()) ++positional_index;
-                }
-            }
+    constexpr void put(const char c) {
+        if (out != nullptr) out[size] = c;
+        ++size;
+    }
 
-            shift(current_argc, current_argv);
-        }
+    constexpr void put(const std::string_view text) {
+        for (const char c : text) put(c);
+    }
 
-        for (const Arg& arg : args_) {
-            if (arg.name() == "help") continue; // Skip help flag
+    constexpr void pad(const std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) put(' ');
+    }
+};
 
-            if (arg.type() == ArgType::Flag) {
-                if (!matches.get_flag(arg.name()) && std::holds_alternative<bool>(arg.default_value())) {
-                    matches.set_flag(arg.name(), *std::get_if<bool>(&arg.default_value()));
-                }
-            } else if (!matches.get_one<std::string>(arg.name()).has_value() && !std::holds_alternative<std::monostate>(arg.default_value())) {
-                matches.add_value(arg.name(), to_formatted(arg.default_value(), false));
-            }
+} // namespace detail
+
+struct CompiledCommand {
+    static constexpr std::size_t SLOTS = 32;
+    // Twice SLOTS, so a seed search over 20-odd names finds a perfect hash in tens of tries, not thousands
+    static constexpr std::size_t TABLE_SLOTS = 2 * SLOTS;
+    static constexpr u8 EMPTY = UINT8_MAX;
+
+    const CommandSpec* spec = nullptr;
+    std::string_view help;
+    u16 first_child = 0;
+    u32 long_seed = 0;
+    u32 subcommand_seed = 0;
+    std::array<u8, TABLE_SLOTS> long_slots{};
+    std::array<u8, TABLE_SLOTS> subcommand_slots{};
+    std::array<u8, 128> short_slots{};
+    std::array<u8, SLOTS> positionals{};
+    std::size_t positional_count = 0;
+
+    static constexpr CompiledCommand compile(const CommandSpec& spec, const std::string_view help, const u16 first_child) {
+        if (spec.args.size() >= SLOTS || spec.subcommands.size() >= SLOTS) {
+            detail::schema_error("A schema command supports at most 31 arguments and 31 subcommands");
         }
 
-        // Validate required arguments
-        for (const Arg& arg : args_) {
-            if (!arg.is_required()) continue;
-            const bool found = arg.type() == ArgType::Flag ? matches.get_flag(arg.name())
-                                                           : matches.get_one<std::string>(arg.name()).has_value();
-            if (!found) {
-                return {.matches = {}, .error = ParseError::MissingRequiredArgument(name_, arg.name())};
+        CompiledCommand cmd;
+        cmd.spec = &spec;
+        cmd.help = help;
+        cmd.first_child = first_child;
+        cmd.long_slots.fill(EMPTY);
+        cmd.subcommand_slots.fill(EMPTY);
+        cmd.short_slots.fill(EMPTY);
+        cmd.positionals.fill(EMPTY);
+
+        std::array<std::string_view, SLOTS> keys{};
+        std::array<u8, SLOTS> owners{};
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < spec.args.size(); ++i) {
+            const ArgSpec& arg = spec.args[i];
+            if (arg.type() == ArgType::Positional) {
+                cmd.positionals[cmd.positional_count++] = static_cast<u8>(i);
+                continue;
             }
+            if (arg.short_alias() != '\0') {
+                const auto c = static_cast<u8>(arg.short_alias());
+                if (c >= cmd.short_slots.size()) detail::schema_error("Short aliases must be ASCII");
+                if (cmd.short_slots[c] == EMPTY) cmd.short_slots[c] = static_cast<u8>(i);
+            }
+            keys[count] = detail::long_key(arg);
+            owners[count++] = static_cast<u8>(i);
+        }
+        cmd.long_seed = place(keys, owners, count, cmd.long_slots);
+
+        count = 0;
+        for (std::size_t i = 0; i < spec.subcommands.size(); ++i) {
+            keys[count] = spec.subcommands[i].name;
+            owners[count++] = static_cast<u8>(i);
         }
+        cmd.subcommand_seed = place(keys, owners, count, cmd.subcommand_slots);
+        return cmd;
+    }
+
+    [[nodiscard]] constexpr std::string_view name() const {
+        return spec->name;
+    }
 
-        // Validate subcommand requirement
-        if (subcommand_required_ && !subcommands_.empty() && !matches.subcommand().has_value()) {
-            return {.matches = {}, .error = ParseError::MissingRequiredSubcommand(name_)};
+    [[nodiscard]] constexpr std::optional<std::size_t> arg_index(const std::string_view arg_name) const {
+        for (std::size_t i = 0; i < spec->args.size(); ++i) {
+            if (spec->args[i].name() == arg_name) return i;
         }
+        return std::nullopt;
+    }
 
-        return {.matches = matches, .error = ParseError::None()};
+    [[nodiscard]] constexpr bool flag_default(const std::size_t index) const {
+        return spec->args[index].type() == ArgType::Flag && spec->args[index].has_default();
     }
 
-    [[nodiscard]] const Arg* find_positional_arg(const std::size_t index) const {
-        std::size_t pos_count = 0;
-        for (const Arg& cmd_arg : args_) {
-            if (cmd_arg.type() == ArgType::Positional) {
-                if (pos_count == index) return &cmd_arg;
-                ++pos_count;
+    [[nodiscard]] constexpr std::optional<std::string_view> value_default(const std::size_t index) const {
+        const ArgSpec& arg = spec->args[index];
+        if (arg.type() == ArgType::Flag || !arg.has_default()) return std::nullopt;
+        return arg.default_text();
+    }
+
+    [[nodiscard]] constexpr std::string_view subcommand_name(const std::size_t index) const {
+        return spec->subcommands[index].name;
+    }
+
+    void print_help() const {
+        std::print("{}", help);
+    }
+
+    [[nodiscard]] std::optional<int> invoke(const MatchesView matches) const {
+        if (spec->handler == nullptr) return std::nullopt;
+        return spec->handler(matches);
+    }
+
+    [[nodiscard]] constexpr std::optional<std::size_t> find_subcommand(const std::string_view sub_name) const {
+        const u8 slot = subcommand_slots[detail::hash_name(sub_name, subcommand_seed) & (TABLE_SLOTS - 1)];
+        if (slot == EMPTY || spec->subcommands[slot].name != sub_name) return std::nullopt;
+        return slot;
+    }
+
+    [[nodiscard]] constexpr std::optional<std::size_t> find_long(const std::string_view long_alias) const {
+        const u8 slot = long_slots[detail::hash_name(long_alias, long_seed) & (TABLE_SLOTS - 1)];
+        if (slot == EMPTY || detail::long_key(spec->args[slot]) != long_alias) return std::nullopt;
+        return slot;
+    }
+
+    [[nodiscard]] constexpr std::optional<std::size_t> find_short(const char short_alias) const {
+        const auto c = static_cast<u8>(short_alias);
+        if (c >= short_slots.size() || short_slots[c] == EMPTY) return std::nullopt;
+        return short_slots[c];
+    }
+
+    [[nodiscard]] constexpr std::optional<std::size_t> find_positional(const std::size_t index) const {
+        if (index >= positional_count) return std::nullopt;
+        return positionals[index];
+    }
+
+    [[nodiscard]] constexpr const ArgSpec& arg_at(const std::size_t index) const {
+        return spec->args[index];
+    }
+
+    [[nodiscard]] constexpr std::size_t arg_count() const {
+        return spec->args.size();
+    }
+
+    [[nodiscard]] constexpr bool requires_subcommand() const {
+        return spec->subcommand_required && !spec->subcommands.empty();
+    }
+
+private:
+    // Searches for the first seed that sends every key to its own slot, which makes each lookup one hash and one compare
+    static constexpr u32 place(const std::array<std::string_view, SLOTS>& keys, const std::array<u8, SLOTS>& owners,
+                               const std::size_t count, std::array<u8, TABLE_SLOTS>& slots) {
+        for (u32 seed = 0; seed < 1 << 16; ++seed) {
+            std::array<u8, TABLE_SLOTS> candidate{};
+            candidate.fill(EMPTY);
+            bool collision = false;
+            for (std::size_t i = 0; i < count && !collision; ++i) {
+                u8& slot = candidate[detail::hash_name(keys[i], seed) & (TABLE_SLOTS - 1)];
+                collision = slot != EMPTY;
+                slot = owners[i];
+            }
+            if (!collision) {
+                slots = candidate;
+                return seed;
             }
         }
-        return nullptr;
+        detail::schema_error("No perfect hash seed found, are two names the same?");
+        return 0;
+    }
+};
+
+// Flattens a CommandSpec tree in breadth-first order, so the subcommands of every command are contiguous, and
+// generates its tables and help text at compile time. Parsing then costs no allocations and no tree construction
+template <const CommandSpec& Root>
+class Schema {
+public:
+    static ParseResult get_matches(const int argc, char** argv,
+                                   std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        ParseResult result{.matches = ArgMatches(resource), .error = ParseError::None()};
+        int current_argc = argc;
+        char** current_argv = argv;
+        shift(current_argc, current_argv); // Skip program name
+        detail::TokenStream tokens(current_argc, current_argv, Root.response_files ? &result.matches : nullptr);
+        result.error = detail::parse_tokens(Node{0}, result.matches, tokens);
+        if (result.error.has_error()) result.matches.clear();
+        return result;
+    }
+
+    static constexpr std::string_view name() {
+        return Root.name;
+    }
+
+    static constexpr std::string_view help() {
+        return COMMANDS[0].help;
+    }
+
+    static void print_help() {
+        COMMANDS[0].print_help();
+    }
+
+private:
+    static constexpr std::size_t count(const CommandSpec& spec) {
+        std::size_t n = 1;
+        for (const CommandSpec& sub : spec.subcommands) n += count(sub);
+        return n;
     }
 
-    [[nodiscard]] const Arg* find_flag_by_short(const char short_alias) const {
-        for (const Arg& cmd_arg : args_) {
-            if (cmd_arg.short_alias() == short_alias) return &cmd_arg;
+    static constexpr std::size_t COUNT = count(Root);
+
+    struct Layout {
+        std::array<const CommandSpec*, COUNT> order{};
+        std::array<u16, COUNT> parent{};
+        std::array<u16, COUNT> first_child{};
+    };
+
+    static constexpr Layout LAYOUT = [] {
+        Layout layout;
+        layout.order[0] = &Root;
+        std::size_t size = 1;
+        for (std::size_t i = 0; i < size; ++i) {
+            layout.first_child[i] = static_cast<u16>(size);
+            for (const CommandSpec& sub : layout.order[i]->subcommands) {
+                layout.order[size] = &sub;
+                layout.parent[size++] = static_cast<u16>(i);
+            }
+        }
+        return layout;
+    }();
+
+    static constexpr void write_path(detail::HelpWriter& out, const std::size_t index) {
+        if (index != 0) {
+            write_path(out, LAYOUT.parent[index]);
+            out.put(' ');
         }
-        return nullptr;
+        out.put(LAYOUT.order[index]->name);
     }
 
-    [[nodiscard]] const Arg* find_flag_by_long(const std::string_view long_alias) const {
-        for (const auto& cmd_arg : args_) {
-            if (cmd_arg.long_alias() == long_alias || cmd_arg.name() == long_alias) return &cmd_arg;
+    static constexpr void write_option(detail::HelpWriter& out, const ArgSpec& arg, const std::size_t width) {
+        out.put("    ");
+        std::size_t written = 0;
+        if (arg.short_alias() != '\0') {
+            out.put('-');
+            out.put(arg.short_alias());
+            written += 2;
+        }
+        if (const std::string_view long_name = detail::long_key(arg); !long_name.empty()) {
+            if (written > 0) {
+                out.put(", ");
+                written += 2;
+            }
+            out.put("--");
+            out.put(long_name);
+            written += long_name.size() + 2;
+        }
+        if (arg.type() == ArgType::Option && !arg.value_name().empty()) {
+            out.put(" <");
+            out.put(arg.value_name());
+            out.put('>');
+            written += arg.value_name().size() + 3;
         }
-        return nullptr;
+        if (written < width) out.pad(width - written);
+
+        out.put("    ");
+        out.put(arg.description());
+        if (arg.has_default() && arg.type() != ArgType::Flag) {
+            out.put(" (default: ");
+            out.put(arg.default_text());
+            out.put(')');
+        }
+        out.put('\n');
     }
 
-    static void add_flag_or_option(ArgMatches& matches, const Arg* matching_arg, int& argc, char**& argv) {
-        if (matching_arg == nullptr) return;
-        const Arg& arg = *matching_arg;
-        if (arg.type() == ArgType::Flag) {
-            matches.set_flag(arg.name(), true);
-        } else if (arg.type() == ArgType::Option) {
-            shift(argc, argv);
-            if (argc > 0) {
-                matches.add_value(arg.name(), std::string(*argv));
+    // Same layout as Command::print_help
+    static constexpr void write_help(detail::HelpWriter& out, const std::size_t index) {
+        const CommandSpec& spec = *LAYOUT.order[index];
+        if (!spec.description.empty()) {
+            out.put(spec.description);
+            out.put('\n');
+        }
+
+        out.put("Usage: ");
+        write_path(out, index);
+        bool has_options = spec.help_arg;
+        std::size_t opt_width = spec.help_arg ? detail::option_width(detail::HELP_ARG) : 0;
+        for (const ArgSpec& arg : spec.args) {
+            if (arg.type() != ArgType::Positional) {
+                has_options = true;
+                opt_width = std::max(opt_width, detail::option_width(arg));
+                continue;
+            }
+            out.put(arg.is_required() ? " <" : " [");
+            out.put(arg.name());
+            out.put(arg.is_required() ? '>' : ']');
+            if (arg.is_multiple()) out.put("...");
+        }
+        if (!spec.subcommands.empty()) out.put(" <COMMAND>");
+        if (has_options) out.put(" [OPTIONS]");
+        out.put('\n');
+
+        if (!spec.subcommands.empty()) {
+            std::size_t cmd_width = 0;
+            for (const CommandSpec& sub : spec.subcommands) cmd_width = std::max(cmd_width, sub.name.size());
+
+            out.put("\nCommands:\n");
+            for (const CommandSpec& sub : spec.subcommands) {
+                out.put("    ");
+                out.put(sub.name);
+                out.pad(cmd_width - sub.name.size());
+                if (!sub.description.empty()) {
+                    out.put("    ");
+                    out.put(sub.description);
+                }
+                out.put('\n');
+            }
+        }
+
+        if (has_options) {
+            out.put("\nOptions:\n");
+            if (spec.help_arg) write_option(out, detail::HELP_ARG, opt_width);
+            for (const ArgSpec& arg : spec.args) {
+                if (arg.type() != ArgType::Positional) write_option(out, arg, opt_width);
             }
         }
     }
+
+    static constexpr std::array<std::size_t, COUNT + 1> HELP_OFFSETS = [] {
+        std::array<std::size_t, COUNT + 1> offsets{};
+        detail::HelpWriter counter;
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            offsets[i] = counter.size;
+            write_help(counter, i);
+        }
+        offsets[COUNT] = counter.size;
+        return offsets;
+    }();
+
+    static constexpr std::array<char, HELP_OFFSETS[COUNT]> HELP_TEXT = [] {
+        std::array<char, HELP_OFFSETS[COUNT]> text{};
+        detail::HelpWriter writer{.out = text.data()};
+        for (std::size_t i = 0; i < COUNT; ++i) write_help(writer, i);
+        return text;
+    }();
+
+    static constexpr std::array<CompiledCommand, COUNT> COMMANDS = [] {
+        std::array<CompiledCommand, COUNT> commands{};
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            const std::string_view help(HELP_TEXT.data() + HELP_OFFSETS[i], HELP_OFFSETS[i + 1] - HELP_OFFSETS[i]);
+            commands[i] = CompiledCommand::compile(*LAYOUT.order[i], help, LAYOUT.first_child[i]);
+        }
+        return commands;
+    }();
+
+    // What detail::parse_tokens walks; subcommands are found through the breadth-first layout
+    struct Node {
+        std::size_t index;
+
+        [[nodiscard]] const CompiledCommand& command() const {
+            return COMMANDS[index];
+        }
+        [[nodiscard]] std::string_view name() const {
+            return command().name();
+        }
+        [[nodiscard]] std::optional<std::size_t> find_subcommand(const std::string_view sub_name) const {
+            return command().find_subcommand(sub_name);
+        }
+        [[nodiscard]] Node subcommand_at(const std::size_t sub) const {
+            return {command().first_child + sub};
+        }
+        [[nodiscard]] std::optional<std::size_t> find_long(const std::string_view long_alias) const {
+            return command().find_long(long_alias);
+        }
+        [[nodiscard]] std::optional<std::size_t> find_short(const char short_alias) const {
+            return command().find_short(short_alias);
+        }
+        [[nodiscard]] std::optional<std::size_t> find_positional(const std::size_t position) const {
+            return command().find_positional(position);
+        }
+        [[nodiscard]] const ArgSpec& arg_at(const std::size_t arg) const {
+            return command().arg_at(arg);
+        }
+        [[nodiscard]] std::size_t arg_count() const {
+            return command().arg_count();
+        }
+        [[nodiscard]] bool requires_subcommand() const {
+            return command().requires_subcommand();
+        }
+        [[nodiscard]] ArgMatches::CommandRef level_ref() const {
+            return &command();
+        }
+    };
 };
 
+inline MatchesView ArgMatches::view() const {
+    return {*this, 0};
+}
+
+inline bool ArgMatches::get_flag(const std::string_view name) const {
+    return view().get_flag(name);
+}
+
+template <typename T>
+std::optional<T> ArgMatches::get_one(const std::string_view name) const {
+    return view().get_one<T>(name);
+}
+
+template <typename T>
+std::vector<T> ArgMatches::get_many(const std::string_view name) const {
+    return view().get_many<T>(name);
+}
+
+inline std::optional<std::pair<std::string_view, MatchesView>> ArgMatches::subcommand() const {
+    return view().subcommand();
+}
+
+inline int ArgMatches::dispatch() const {
+    return view().dispatch();
+}
+
+inline int MatchesView::dispatch() const {
+    MatchesView current = *this;
+    while (current.level_ < matches_->levels().size()) {
+        const ArgMatches::Level& level = matches_->levels()[current.level_];
+        if (level.help) break;
+        if (level.subcommand == ArgMatches::NO_SUBCOMMAND) {
+            const auto status = std::visit([&](const auto* cmd) { return cmd->invoke(current); }, level.command);
+            if (status.has_value()) return *status;
+            break;
+        }
+        current = MatchesView(*matches_, static_cast<u16>(current.level_ + 1));
+    }
+    current.print_help();
+    return 0;
+}
+
+inline bool MatchesView::get_flag(const std::string_view name) const {
+    if (matches_->levels().size() <= level_) return false;
+    if (name == "help" && matches_->levels()[level_].help) return true;
+
+    const auto index = arg_index(name);
+    if (!index.has_value()) return false;
+    if (matches_->contains(level_, *index)) return true;
+    return std::visit([&](const auto* cmd) { return cmd->flag_default(*index); }, command_ref());
+}
+
+inline std::optional<std::pair<std::string_view, MatchesView>> MatchesView::subcommand() const {
+    const auto index = subcommand_index();
+    if (!index.has_value()) return std::nullopt;
+    const std::string_view name = std::visit([&](const auto* cmd) { return cmd->subcommand_name(*index); }, command_ref());
+    return std::make_pair(name, MatchesView(*matches_, static_cast<u16>(level_ + 1)));
+}
+
+inline void MatchesView::print_help() const {
+    if (matches_->levels().size() <= level_) return;
+    std::visit([](const auto* cmd) { cmd->print_help(); }, command_ref());
+}
+
+inline std::optional<std::size_t> MatchesView::arg_index(const std::string_view name) const {
+    if (matches_->levels().size() <= level_) return std::nullopt;
+    return std::visit([&](const auto* cmd) { return cmd->arg_index(name); }, command_ref());
+}
+
+inline std::optional<std::string_view> MatchesView::default_text(const std::size_t index) const {
+    return std::visit([&](const auto* cmd) { return cmd->value_default(index); }, command_ref());
+}
+
+inline ArgType MatchesView::arg_type(const std::size_t index) const {
+    return std::visit([&](const auto* cmd) { return cmd->arg_at(index).type(); }, command_ref());
+}
+
+inline std::string MatchesView::invalid_message(const std::size_t index, const std::string_view value) const {
+    return std::visit(
+        [&](const auto* cmd) {
+            const auto& arg = cmd->arg_at(index);
+            const std::string_view name = arg.name();
+            if (arg.type() == ArgType::Positional) return std::format("invalid value '{}' for <{}>", value, name);
+            const std::string_view long_name = arg.long_alias().empty() ? name : std::string_view(arg.long_alias());
+            return std::format("invalid value '{}' for --{}", value, long_name);
+        },
+        command_ref());
+}
+
 } // namespace utils::cli
 
 #endif // UTILS_CLI_HPP
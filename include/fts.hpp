@@ -0,0 +1,65 @@
+#ifndef SSM_FTS_HPP
+#define SSM_FTS_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ssm::fts {
+
+// Full-text index of the snippet contents, an FTS5 table in ssm.db keyed by file id. Snippets are mostly code and
+// shell, so it uses its own tokenizer, "ssm_code", rather than unicode61, which would keep `getSnippetImpl` as one
+// token and drop the dashes of `--dry-run`:
+//
+//   identifiers    getSnippetImpl, get_snippet_impl and HTTPServer are split on case and underscore boundaries into
+//                  get snippet impl and http server, each a token of its own, so any of them can be searched for and
+//                  a prefix like `getsnip*` finds them. The parts joined, getsnippetimpl, share the first one's
+//                  position
+//   flags, paths   --dry-run, -n, ~/.kube/config and ./dist/ are also kept whole, and a path's tails from each '/'
+//                  on, like /.kube/config, along with them
+//
+// Text is ASCII case folded, other bytes are kept as they are. A query for a flag or a path, anything starting with
+// '-', '/', '~' or '.', looks for the whole token; anything else looks for its parts as a phrase.
+
+enum class mode : u8 {
+    document,
+    query,
+};
+
+struct token {
+    std::string_view text; // case folded, only valid during the call it is passed to
+    std::size_t begin;     // bytes of the input it came from
+    std::size_t end;
+    bool colocated; // at the same position as the token before it
+};
+
+// Calls `emit` for every token of `text` in order, stopping early when it returns false. Whether it never did
+bool tokenize(std::string_view text, mode mode, const std::function<bool(const token&)>& emit);
+
+// Registers the tokenizer with every database connection opened from now on. SQLite initializes itself here, so
+// ssm::mem::runtime must already be configuring it
+bool install();
+
+// Creates the table and indexes the current content of every row of `file`, inside the caller's transaction. Run
+// once per database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the index in step with `file` and the files on disk, inside the same transaction as the change.
+// `index_file` also replaces whatever was indexed for `file_id` before
+bool index_file(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view content);
+bool remove_file(const ssm_sqlite3::database& sqlite, i64 file_id);
+
+// Names of the snippets that contain every one of `terms`, best match first by bm25. A term ending in '*' matches
+// tokens it is a prefix of. std::nullopt on a database error
+std::optional<std::vector<std::string>> search(const ssm_sqlite3::database& sqlite, std::span<const std::string_view> terms);
+
+} // namespace ssm::fts
+
+#endif // SSM_FTS_HPP
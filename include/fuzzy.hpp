@@ -0,0 +1,74 @@
+#ifndef SSM_FUZZY_HPP
+#define SSM_FUZZY_HPP
+
+#include "common.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ssm::fuzzy {
+
+// Names packed back to back in one buffer, so scanning them touches memory strictly in order
+class name_set {
+public:
+    void reserve(std::size_t names, std::size_t bytes);
+    void add(std::string_view name);
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return offsets_.size() - 1;
+    }
+
+    [[nodiscard]] std::string_view operator[](const std::size_t i) const noexcept {
+        return {bytes_.data() + offsets_[i], offsets_[i + 1] - offsets_[i]};
+    }
+
+    // All names, the end of one is the start of the next
+    [[nodiscard]] std::string_view bytes() const noexcept {
+        return bytes_;
+    }
+
+    // One bit per case-folded byte value modulo 64. A name can only match a query whose bits it has all of
+    [[nodiscard]] u64 signature(const std::size_t i) const noexcept {
+        return signatures_[i];
+    }
+
+    static u64 signature(std::string_view text) noexcept;
+
+private:
+    std::string bytes_;
+    std::vector<u32> offsets_ = {0};
+    std::vector<u64> signatures_;
+};
+
+struct match {
+    u32 index; // into the name_set
+    i32 score;
+};
+
+// Every name that contains `query` as a subsequence, best first. Scores reward characters matched at word boundaries
+// (after - _ / . : or a space, camelCase humps, digits) and runs of consecutive characters, and charge for gaps, so
+// "deplk8s" ranks deploy-k8s above deploy-lookup-k8s-old. Equal scores go to the shorter, then the earlier name.
+// An all-lowercase query ignores case, any uppercase letter makes it exact. At most `limit` matches are returned;
+// large sets are split across `threads` threads, 0 meaning one per core
+std::vector<match> rank(const name_set& names, std::string_view query, std::size_t limit, unsigned threads = 0);
+
+// Every one of `candidates` that contains `query` as a subsequence, with its score as `rank` gives it, in candidate
+// order; an empty query keeps them all at score 0. A name containing a query contains every subsequence of it, so the
+// matches of one query can be the candidates of any query that extends it, and typing only ever narrows. Gives up
+// and returns false soon after `cancel` is set
+bool filter(const name_set& names, std::span<const match> candidates, std::string_view query,
+            const std::atomic<bool>& cancel, std::vector<match>& out, unsigned threads = 0);
+
+// The best `limit` of `matches`, best first, ordered as `rank` orders them
+std::vector<match> best(const name_set& names, std::span<const match> matches, std::size_t limit);
+
+// Whether `name` is `query` itself, ignoring case the way `rank` does. Such a name always ranks first among its ties
+bool is_exact(std::string_view name, std::string_view query) noexcept;
+
+} // namespace ssm::fuzzy
+
+#endif // SSM_FUZZY_HPP
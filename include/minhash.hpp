@@ -0,0 +1,53 @@
+#ifndef SSM_MINHASH_HPP
+#define SSM_MINHASH_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace ssm::minhash {
+
+// Near-duplicate detection. A snippet's shingles are its runs of SHINGLE_TOKENS consecutive tokens, as the full-text
+// tokenizer splits them, so reformatting alone changes none. Its signature holds, for each of SIGNATURE_SIZE hash
+// functions, the least hash of any shingle. The share of places where two signatures agree estimates the Jaccard
+// similarity of the two shingle sets.
+//
+// The signature is cut into BANDS bands of ROWS values and every band is a bucket key in SQLite. Snippets sharing a
+// bucket are the only ones ever compared, so finding duplicates never looks at most pairs. With 16 bands of 8, a pair
+// at similarity 0.8 shares a bucket with probability 0.95, at 0.9 with 0.9999, and at 0.5 with 0.06.
+
+inline constexpr std::size_t SHINGLE_TOKENS = 3;
+inline constexpr std::size_t BANDS = 16;
+inline constexpr std::size_t ROWS = 8;
+inline constexpr std::size_t SIGNATURE_SIZE = BANDS * ROWS;
+
+using signature = std::array<u32, SIGNATURE_SIZE>;
+
+// std::nullopt when `content` has no tokens at all, there is nothing it could duplicate
+std::optional<signature> signature_of(std::string_view content);
+
+// Estimated Jaccard similarity, the share of places where the two agree
+f64 similarity(const signature& a, const signature& b) noexcept;
+
+// Creates the tables and signs the current content of every row of `file`, inside the caller's transaction, on every
+// core. Run once per database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the signatures and buckets in step with `file` and the files on disk, inside the same transaction as the
+// change. `index_file` also replaces whatever was indexed for `file_id` before
+bool index_file(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view content);
+bool remove_file(const ssm_sqlite3::database& sqlite, i64 file_id);
+
+// Groups of snippets, each linked to the others by pairs at least `threshold` similar, largest group first and ids
+// ascending within one. Only pairs sharing a bucket are compared, so pairs well below 0.7 are mostly missed however
+// low the threshold. std::nullopt on a database error
+std::optional<std::vector<std::vector<i64>>> clusters(const ssm_sqlite3::database& sqlite, f64 threshold);
+
+} // namespace ssm::minhash
+
+#endif // SSM_MINHASH_HPP
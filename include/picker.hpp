@@ -0,0 +1,23 @@
+#ifndef SSM_PICKER_HPP
+#define SSM_PICKER_HPP
+
+#include "fuzzy.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace ssm::picker {
+
+// A full-screen fuzzy finder on the controlling terminal, so stdout stays free for whatever is picked. Every keystroke
+// hands the query to a scoring thread and cancels the scan in flight. A query that extends an earlier one is only
+// scored against that one's matches, and going back to an earlier query reuses its matches as they were. Only the
+// rows on screen are ranked, and only the rows that changed are written.
+//
+// Up/Down or Ctrl-P/Ctrl-N move, Enter picks, Esc or Ctrl-C gives up, Ctrl-U and Ctrl-W erase the query or its last
+// word. Returns the index in `names` of the name picked, std::nullopt when the user gave up or there is no terminal
+std::optional<std::size_t> pick(const fuzzy::name_set& names, std::string_view query = {});
+
+} // namespace ssm::picker
+
+#endif // SSM_PICKER_HPP
@@ -9,10 +9,27 @@
 #ifndef UTILS_PROCESS_HPP
 #define UTILS_PROCESS_HPP
 
+#include "common.hpp"
+
 #include <expected>
 #include <string>
 #include <vector>
 
+#ifdef __linux__
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#endif // __linux__
+
 #ifdef _WIN32
 #include <bit>
 #include <cstdint>
@@ -62,6 +79,469 @@ void reset_redirect(Redirect& redirect) noexcept;
 
 std::expected<void, std::string> create_pipe(Fd& read_end, Fd& write_end);
 
+#ifdef __linux__
+// pidfd refers to this very process even after its pid is reused and becomes readable once it exits. It is INVALID_FD
+// only on kernels without pidfds (before 5.3)
+struct Child {
+    Proc pid = INVALID_PROC;
+    Fd pidfd = INVALID_FD;
+    std::chrono::steady_clock::time_point started; // wall time of a child is measured from here
+};
+
+// What a child cost, from wait4. CPU times and max RSS cover the child and any of its own children it waited for,
+// block I/O counts only reads and writes that actually went to the device
+struct ResourceUsage {
+    std::chrono::nanoseconds wall{};
+    std::chrono::nanoseconds user_cpu{};
+    std::chrono::nanoseconds system_cpu{};
+    long max_rss_kib = 0;
+    long block_reads = 0;
+    long block_writes = 0;
+};
+
+struct ExitStatus {
+    int exit_code = 0; // 128 + the signal number when the child was killed, like a shell
+    int signal = 0;    // 0 unless the child was killed
+    ResourceUsage usage;
+};
+
+// Low-latency run_async. The child is cloned with CLONE_VM | CLONE_VFORK, so no page tables are copied, and gets a
+// pidfd from the same call. PATH lookups are cached per program name; posix_spawn is the fallback on old kernels
+std::expected<Child, std::string> spawn(const std::vector<std::string>& args, Redirect& redirect, bool reset_fds = true);
+
+inline std::expected<Child, std::string> spawn(const std::vector<std::string>& args) {
+    Redirect redirect;
+    return spawn(args, redirect);
+}
+
+// Waits up to `timeout_ms` (-1 is forever) for the child to exit, or until `cancel_fd` becomes readable. Returns
+// nullopt while the child is still running, so it can be waited on again or killed. Otherwise the child is reaped and
+// its pidfd closed; unlike wait_proc a non-zero exit is not an error, it is in the returned status
+std::expected<std::optional<ExitStatus>, std::string> wait_child(Child& child, int timeout_ms = -1,
+                                                                 Fd cancel_fd = INVALID_FD);
+
+// `a | b | c` without a shell: stage i writes straight into stage i + 1 through a pipe. The first stage reads `input`
+// given to start(), or else a pipe that feed() fills; the last one writes to `output`, or to our stdout
+class Pipeline {
+public:
+    Pipeline() = default;
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    Pipeline& stage(std::vector<std::string> args);
+
+    // Appends the stages of a command line like `jq . | less -R`. Words split on whitespace, single quotes are literal,
+    // double quotes and backslashes escape as in sh. Nothing else is special, there is no shell behind this
+    std::expected<void, std::string> add(std::string_view command_line);
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return stages_.size();
+    }
+
+    std::expected<void, std::string> start(Fd input = INVALID_FD, Fd output = INVALID_FD);
+
+    // Moves the rest of `fd` into the first stage with splice, so file pages go to the pipe without passing through
+    // user space; descriptors splice cannot read from are copied instead. Once the first stage has stopped reading,
+    // feeding does nothing, that is its business and not an error
+    std::expected<void, std::string> feed(Fd fd);
+    std::expected<void, std::string> feed(std::string_view bytes);
+
+    // Closes the fed pipe and reaps every stage, statuses are in stage order
+    std::expected<std::vector<ExitStatus>, std::string> wait();
+
+private:
+    std::vector<std::vector<std::string>> stages_;
+    std::vector<Child> children_;
+    Fd input_ = INVALID_FD; // write end of the pipe into the first stage
+};
+
+// Exit status of a pooled command and everything it wrote
+struct ProcessResult {
+    int exit_code = 0; // 128 + the signal number when the child was killed, like a shell
+    int signal = 0;    // 0 unless the child was killed
+    ResourceUsage usage;
+    std::string out;
+    std::string err;
+};
+
+// Spawn and wait failures arrive as the error, a non-zero exit is still a ProcessResult
+using ProcessCallback = std::function<void(std::size_t job, std::expected<ProcessResult, std::string> result)>;
+
+// Runs queued commands with at most `max_running` children alive at once. Their stdout and stderr are captured through
+// non-blocking pipes multiplexed on one epoll instance, so a child can never stall on a full pipe while another one is
+// being waited for, and children are reaped through pidfds in the order they finish. stdin is /dev/null.
+// Everything happens on the thread that calls run(), callbacks included
+class ProcessPool {
+public:
+    explicit ProcessPool(std::size_t max_running = 0); // 0 is one per online CPU
+    ~ProcessPool();
+
+    ProcessPool(const ProcessPool&) = delete;
+    ProcessPool& operator=(const ProcessPool&) = delete;
+
+    // Returns the job number handed to `on_done`, numbered from 0 in submission order. Callbacks may submit more
+    std::size_t submit(std::vector<std::string> args, ProcessCallback on_done);
+
+    // The future is ready once run() has finished the command
+    std::future<std::expected<ProcessResult, std::string>> submit(std::vector<std::string> args);
+
+    // Returns once every submitted command has finished, fails only if epoll itself does
+    std::expected<void, std::string> run();
+
+    [[nodiscard]] std::size_t max_running() const noexcept {
+        return slots_.size();
+    }
+
+private:
+    struct Job {
+        std::size_t id = 0;
+        std::vector<std::string> args;
+        ProcessCallback on_done;
+    };
+
+    struct Slot {
+        Job job;
+        Proc pid = INVALID_PROC;
+        std::chrono::steady_clock::time_point started;
+        Fd pidfd = INVALID_FD; // INVALID_FD while idle, or when the kernel has no pidfd_open and the child is polled
+        Fd out = INVALID_FD;
+        Fd err = INVALID_FD;
+        bool active = false;
+        bool reaped = false;
+        std::string error;
+        ProcessResult result;
+    };
+
+    Fd epoll_ = INVALID_FD;
+    std::size_t next_id_ = 0;
+    std::size_t active_ = 0;
+    std::deque<Job> pending_;
+    std::vector<Slot> slots_;
+
+    void start(std::size_t slot, Job job);
+    static void drain(Fd& fd, std::string& into);
+    void reap(std::size_t slot, bool block);
+    void finish(std::size_t slot);
+    static void release(Slot& s) noexcept;
+};
+
+// Coroutine counterpart of ProcessPool: EventLoop drives any number of children and fds from one thread, each awaited
+// operation parks its coroutine on epoll (pidfds for children, timerfds for sleeps) instead of blocking the thread.
+//
+//     Task<std::expected<int, std::string>> run(EventLoop& loop, std::vector<std::string> args) {
+//         Redirect redirect = {.fd_out = ...};
+//         auto child = co_await loop.spawn(MOVE(args), redirect);
+//         ...
+//         co_return co_await loop.wait(*child);
+//     }
+//
+// Work is started lazily when first awaited, or by EventLoop::run for the outermost task. when_all runs several tasks
+// concurrently. Cancellation is structured: every operation can be given a CancelScope, cancelling a scope resumes
+// its pending operations, and those of its nested scopes, with an ECANCELED error
+class EventLoop;
+class CancelScope;
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    struct FinalAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(const std::coroutine_handle<Promise> self) const noexcept {
+            return self.promise().continuation;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    [[nodiscard]] std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    [[nodiscard]] FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    // Everything in here reports errors through std::expected
+    [[noreturn]] void unhandled_exception() const noexcept {
+        std::terminate();
+    }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& result) {
+        value.emplace(FORWARD(result));
+    }
+
+    T take() {
+        return MOVE(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void take() const noexcept {}
+};
+
+// Starts eagerly and frees itself at the end, used to fan out when_all
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept {
+            return {};
+        }
+
+        [[nodiscard]] std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+
+        [[nodiscard]] std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+
+        void return_void() const noexcept {}
+
+        [[noreturn]] void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// One suspended operation waiting for `events` on `fd`. await_resume returns 0 once the fd is ready, ECANCELED when
+// the scope was cancelled, or the errno of a failed registration
+class FdWaiter {
+public:
+    FdWaiter(EventLoop& loop, const Fd fd, const std::uint32_t events, CancelScope* scope) noexcept
+        : loop_(&loop), scope_(scope), fd_(fd), events_(events) {}
+
+    // Only pending when the coroutine waiting on it is destroyed before the fd became ready
+    ~FdWaiter();
+
+    FdWaiter(const FdWaiter&) = delete;
+    FdWaiter& operator=(const FdWaiter&) = delete;
+
+    [[nodiscard]] bool await_ready() noexcept;
+    bool await_suspend(std::coroutine_handle<> handle) noexcept;
+
+    [[nodiscard]] int await_resume() const noexcept {
+        return error_;
+    }
+
+private:
+    friend class utils::process::EventLoop;
+    friend class utils::process::CancelScope;
+
+    EventLoop* loop_;
+    CancelScope* scope_;
+    Fd fd_;
+    std::uint32_t events_;
+    int error_ = 0;
+    bool pending_ = false;
+    std::coroutine_handle<> handle_;
+
+    void cancel() noexcept;
+};
+} // namespace detail
+
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task() = default;
+    explicit Task(const std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+    [[nodiscard]] bool done() const noexcept {
+        return !handle_ || handle_.done();
+    }
+
+    // Awaiting starts the task and resumes the awaiting coroutine right from the task's final suspend point
+    [[nodiscard]] bool await_ready() const noexcept {
+        return done();
+    }
+
+    std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiting) const noexcept {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+
+    decltype(auto) await_resume() const {
+        return handle_.promise().take();
+    }
+
+private:
+    friend class EventLoop;
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+} // namespace detail
+
+// Cancelling is idempotent and reaches every nested scope. Operations started under a cancelled scope fail at once.
+// Scopes must outlive the operations given them, and nested scopes must not outlive their parent
+class CancelScope {
+public:
+    CancelScope() = default;
+    explicit CancelScope(CancelScope& parent);
+    ~CancelScope();
+
+    CancelScope(const CancelScope&) = delete;
+    CancelScope& operator=(const CancelScope&) = delete;
+
+    void cancel() noexcept;
+
+    [[nodiscard]] bool cancelled() const noexcept {
+        return cancelled_;
+    }
+
+private:
+    friend class detail::FdWaiter;
+    friend class EventLoop;
+
+    CancelScope* parent_ = nullptr;
+    std::vector<CancelScope*> children_;
+    std::vector<detail::FdWaiter*> waiters_;
+    bool cancelled_ = false;
+
+    void forget(const detail::FdWaiter* waiter) noexcept;
+};
+
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Drives `task` and everything it awaits until it completes, then returns its result
+    template <typename T>
+    T run(Task<T> task) {
+        task.handle_.resume();
+        while (!task.done()) poll();
+        return task.handle_.promise().take();
+    }
+
+    // Same as spawn(), the awaiting coroutine continues immediately
+    Task<std::expected<Child, std::string>> spawn(std::vector<std::string> args, Redirect& redirect,
+                                                  bool reset_fds = true);
+
+    // Read until EOF and write everything. `fd` is switched to non-blocking mode, and `bytes` must outlive the task.
+    // Only one operation may wait on a given fd at a time
+    Task<std::expected<std::string, std::string>> read_all(Fd fd, CancelScope* scope = nullptr);
+    Task<std::expected<void, std::string>> write_all(Fd fd, std::string_view bytes, CancelScope* scope = nullptr);
+
+    // Reaps the child and closes its pidfd. A cancelled wait kills the child rather than leaving it behind
+    Task<std::expected<ExitStatus, std::string>> wait(Child child, CancelScope* scope = nullptr);
+
+    Task<std::expected<void, std::string>> sleep_for(std::chrono::milliseconds duration, CancelScope* scope = nullptr);
+
+    // The raw readiness wait every operation above is built on
+    [[nodiscard]] detail::FdWaiter readable(const Fd fd, CancelScope* scope = nullptr) noexcept;
+    [[nodiscard]] detail::FdWaiter writable(const Fd fd, CancelScope* scope = nullptr) noexcept;
+
+private:
+    friend class detail::FdWaiter;
+
+    Fd epoll_ = INVALID_FD;
+    std::size_t waiting_ = 0;
+    std::deque<std::coroutine_handle<>> ready_; // cancelled waiters, resumed from poll() rather than from cancel()
+
+    void poll();
+};
+
+namespace detail {
+template <typename T>
+Detached when_all_one(Task<T>& task, std::optional<T>& into, std::size_t& remaining,
+                      const std::coroutine_handle<> parent) {
+    into.emplace(co_await task);
+    if (--remaining == 0) parent.resume();
+}
+
+template <typename T>
+class WhenAllAwaiter {
+public:
+    WhenAllAwaiter(std::vector<Task<T>>& tasks, std::vector<std::optional<T>>& results) noexcept
+        : tasks_(tasks), results_(results) {}
+
+    [[nodiscard]] bool await_ready() const noexcept {
+        return tasks_.empty();
+    }
+
+    // The extra count keeps tasks that finish without suspending from resuming us before we have suspended
+    bool await_suspend(const std::coroutine_handle<> parent) {
+        remaining_ = tasks_.size() + 1;
+        for (std::size_t i = 0; i < tasks_.size(); ++i) when_all_one(tasks_[i], results_[i], remaining_, parent);
+        return --remaining_ != 0;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    std::vector<Task<T>>& tasks_;
+    std::vector<std::optional<T>>& results_;
+    std::size_t remaining_ = 0;
+};
+} // namespace detail
+
+// Runs every task concurrently on the current loop, results are in the order of `tasks`
+template <typename T>
+Task<std::vector<T>> when_all(std::vector<Task<T>> tasks) {
+    static_assert(!std::is_void_v<T>, "when_all needs a result per task, return a std::expected<void, ...> instead");
+    std::vector<std::optional<T>> results(tasks.size());
+    co_await detail::WhenAllAwaiter<T>(tasks, results);
+
+    std::vector<T> out;
+    out.reserve(results.size());
+    for (auto& result : results) out.push_back(MOVE(*result));
+    co_return out;
+}
+#endif // __linux__
+
 #ifdef _WIN32
 std::string win32_error_to_string(unsigned long error_code) noexcept;
 #else
@@ -76,6 +556,13 @@ std::string build_cmdline(const std::vector<std::string>& args);
 #else
 std::vector<const char*> build_cmdline(const std::vector<std::string>& args);
 #endif // _WIN32
+#ifdef __linux__
+std::string find_in_path(const std::string& program);
+void forget_program(const std::string& program);
+
+// wait4 with EINTR retried, filling `status` once the child has been reaped. Returns what wait4 did
+pid_t reap_child(Proc pid, int options, std::chrono::steady_clock::time_point started, ExitStatus& status);
+#endif // __linux__
 } // namespace detail
 
 } // namespace utils::process
@@ -89,6 +576,8 @@ std::vector<const char*> build_cmdline(const std::vector<std::string>& args);
 #ifdef UTILS_PROCESS_IMPLEMENTATION
 
 #include <array>
+#include <cstdint>
+#include <utility>
 
 #ifdef _WIN32
 #include <cctype>
@@ -107,6 +596,22 @@ std::vector<const char*> build_cmdline(const std::vector<std::string>& args);
 #include <spawn.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <poll.h>
+#include <sched.h>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unordered_map>
+#endif // __linux__
 extern char** environ;
 #endif // _WIN32
 
@@ -433,6 +938,870 @@ std::expected<void, std::string> create_pipe(Fd& read_end, Fd& write_end) {
     return {};
 }
 
+#ifdef __linux__
+namespace detail {
+// epoll keys are the slot index shifted left by two, tagged with which of the slot's fds became ready
+constexpr std::uint64_t POOL_OUT = 0;
+constexpr std::uint64_t POOL_ERR = 1;
+constexpr std::uint64_t POOL_EXIT = 2;
+
+// Resolved programs by name, valid for the PATH they were resolved against
+struct PathCache {
+    std::mutex mutex;
+    std::string path_env;
+    std::unordered_map<std::string, std::string> programs;
+};
+
+static PathCache& path_cache() {
+    static PathCache cache;
+    return cache;
+}
+
+// Same lookup as execvp: names with a slash are used as is, empty PATH entries mean the working directory
+std::string find_in_path(const std::string& program) {
+    if (program.find('/') != std::string::npos) return program;
+
+    const char* env = std::getenv("PATH");
+    const std::string_view path_env = env != nullptr ? env : "/bin:/usr/bin";
+
+    PathCache& cache = path_cache();
+    const std::lock_guard lock(cache.mutex);
+    if (cache.path_env != path_env) {
+        cache.programs.clear();
+        cache.path_env = path_env;
+    }
+    if (const auto it = cache.programs.find(program); it != cache.programs.end()) return it->second;
+
+    std::size_t start = 0;
+    while (start <= path_env.size()) {
+        const std::size_t end = std::min(path_env.find(':', start), path_env.size());
+        const std::string_view dir = path_env.substr(start, end - start);
+        std::string candidate = dir.empty() ? program : std::string(dir) + "/" + program;
+
+        struct stat st{};
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+            return cache.programs.emplace(program, MOVE(candidate)).first->second;
+        }
+        start = end + 1;
+    }
+    return {};
+}
+
+// Called when exec fails, the program may have moved since it was cached
+void forget_program(const std::string& program) {
+    PathCache& cache = path_cache();
+    const std::lock_guard lock(cache.mutex);
+    cache.programs.erase(program);
+}
+
+struct CloneRequest {
+    const char* path;
+    char* const* argv;
+    const Redirect* redirect;
+    const sigset_t* mask; // restored right before exec
+    int error;            // errno of a failed redirect or exec, written by the child into our memory
+};
+
+// Runs on its own small stack in our address space while we are suspended, so it must stick to raw system calls
+static int clone_child(void* arg) {
+    auto* request = static_cast<CloneRequest*>(arg);
+
+    // A handler the parent installed would run on borrowed memory, every caught signal goes back to its default
+    for (int sig = 1; sig < NSIG; ++sig) {
+        struct sigaction current{};
+        if (sigaction(sig, nullptr, &current) != 0) continue;
+        if (current.sa_handler == SIG_IGN || current.sa_handler == SIG_DFL) continue;
+        struct sigaction reset{};
+        reset.sa_handler = SIG_DFL;
+        sigaction(sig, &reset, nullptr);
+    }
+
+    const Redirect& redirect = *request->redirect;
+    const std::array<Fd, 3> sources = {redirect.fd_in, redirect.fd_out, redirect.fd_err};
+    for (int dest = 0; dest < 3; ++dest) {
+        const Fd src = sources[static_cast<std::size_t>(dest)];
+        if (src == INVALID_FD) continue;
+        // dup2 onto itself keeps FD_CLOEXEC, which would close the redirect on exec
+        const bool ok = src == dest ? fcntl(src, F_SETFD, 0) == 0 : dup2(src, dest) == dest;
+        if (!ok) {
+            request->error = errno;
+            _exit(127);
+        }
+    }
+    // Only after every dup2, one pipe end may well be both stdout and stderr
+    for (const Fd src : sources) {
+        if (src > STDERR_FILENO) close(src);
+    }
+
+    sigprocmask(SIG_SETMASK, request->mask, nullptr);
+    execve(request->path, request->argv, environ);
+    request->error = errno;
+    _exit(127);
+}
+} // namespace detail
+
+std::expected<Child, std::string> spawn(const std::vector<std::string>& args, Redirect& redirect,
+                                        const bool reset_fds) {
+    if (args.empty()) return std::unexpected("No command specified");
+
+    const std::string path = detail::find_in_path(args[0]);
+    if (path.empty()) {
+        if (reset_fds) reset_redirect(redirect);
+        return std::unexpected("Could not spawn '" + args[0] + "': " + posix_error_to_string(ENOENT));
+    }
+
+    // Short command lines are the common case and need no heap
+    constexpr std::size_t INLINE_ARGS = 15;
+    std::array<const char*, INLINE_ARGS + 1> inline_argv;
+    std::vector<const char*> heap_argv;
+    const char** argv = inline_argv.data();
+    if (args.size() > INLINE_ARGS) {
+        heap_argv = detail::build_cmdline(args);
+        argv = heap_argv.data();
+    } else {
+        for (std::size_t i = 0; i < args.size(); ++i) inline_argv[i] = args[i].c_str();
+        inline_argv[args.size()] = nullptr;
+    }
+
+    // Everything is blocked until the child has exec'd, so no handler can run on the stack we lend it
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    const auto started = std::chrono::steady_clock::now();
+    detail::CloneRequest request = {
+        .path = path.c_str(),
+        .argv = const_cast<char* const*>(argv),
+        .redirect = &redirect,
+        .mask = &old,
+        .error = 0,
+    };
+    alignas(16) std::array<char, 32 * 1024> stack;
+    int pidfd = INVALID_FD;
+    const pid_t pid = clone(detail::clone_child, stack.data() + stack.size(), CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD,
+                            &request, &pidfd);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    if (pid < 0) {
+        // CLONE_PIDFD needs Linux 5.2, older kernels and seccomp filters get the portable path
+        const auto proc = run_async(args, redirect, reset_fds);
+        if (!proc) return std::unexpected(proc.error());
+        Child child = {.pid = *proc, .pidfd = INVALID_FD, .started = started};
+#ifdef SYS_pidfd_open
+        child.pidfd = static_cast<Fd>(syscall(SYS_pidfd_open, child.pid, 0));
+        if (child.pidfd < 0) child.pidfd = INVALID_FD;
+#endif // SYS_pidfd_open
+        return {child};
+    }
+
+    if (reset_fds) reset_redirect(redirect);
+
+    if (request.error != 0) {
+        // The child is already gone, only its zombie is left
+        int wstatus = 0;
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {}
+        close_fd(pidfd);
+        detail::forget_program(args[0]);
+        return std::unexpected("Could not spawn '" + args[0] + "': " + posix_error_to_string(request.error));
+    }
+
+    return {Child{.pid = pid, .pidfd = pidfd, .started = started}};
+}
+
+namespace detail {
+pid_t reap_child(const Proc pid, const int options, const std::chrono::steady_clock::time_point started,
+                 ExitStatus& status) {
+    int wstatus = 0;
+    rusage usage = {};
+    pid_t reaped = 0;
+    do {
+        reaped = wait4(pid, &wstatus, options, &usage);
+    } while (reaped < 0 && errno == EINTR);
+    if (reaped <= 0) return reaped;
+
+    status = ExitStatus{};
+    if (WIFEXITED(wstatus)) {
+        status.exit_code = WEXITSTATUS(wstatus);
+    } else if (WIFSIGNALED(wstatus)) {
+        status.signal = WTERMSIG(wstatus);
+        status.exit_code = 128 + status.signal;
+    }
+
+    const auto to_ns = [](const timeval tv) {
+        return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+    };
+    status.usage.wall = std::chrono::steady_clock::now() - started;
+    status.usage.user_cpu = to_ns(usage.ru_utime);
+    status.usage.system_cpu = to_ns(usage.ru_stime);
+    status.usage.max_rss_kib = usage.ru_maxrss;
+    status.usage.block_reads = usage.ru_inblock;
+    status.usage.block_writes = usage.ru_oublock;
+    return reaped;
+}
+} // namespace detail
+
+std::expected<std::optional<ExitStatus>, std::string> wait_child(Child& child, const int timeout_ms,
+                                                                 const Fd cancel_fd) {
+    if (child.pid == INVALID_PROC) return std::unexpected("Invalid process handle");
+
+    // Without a pidfd only the cancel fd can be polled and the child is checked every few milliseconds instead.
+    // poll skips negative fds, so both entries can always be passed
+    const bool has_pidfd = child.pidfd != INVALID_FD;
+    std::array<pollfd, 2> fds = {{
+        {.fd = child.pidfd, .events = POLLIN, .revents = 0},
+        {.fd = cancel_fd, .events = POLLIN, .revents = 0},
+    }};
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    ExitStatus status;
+    for (;;) {
+        if (!has_pidfd) {
+            const pid_t pid = detail::reap_child(child.pid, WNOHANG, child.started, status);
+            if (pid == child.pid) break;
+            if (pid < 0) return std::unexpected("Could not wait on child process: " + posix_error_to_string(errno));
+        }
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - clock::now()).count();
+            wait_ms = static_cast<int>(std::max<decltype(left)>(left, 0));
+        }
+        if (!has_pidfd) wait_ms = wait_ms < 0 ? 5 : std::min(wait_ms, 5);
+
+        const int ready = poll(fds.data(), fds.size(), wait_ms);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return std::unexpected("Could not wait on child process: " + posix_error_to_string(errno));
+        }
+        if (fds[1].revents != 0) return std::nullopt;
+        if (has_pidfd && fds[0].revents != 0) {
+            if (detail::reap_child(child.pid, 0, child.started, status) < 0) {
+                return std::unexpected("Could not wait on child process: " + posix_error_to_string(errno));
+            }
+            break;
+        }
+        if (timeout_ms >= 0 && clock::now() >= deadline) return std::nullopt;
+    }
+
+    reset_fd(child.pidfd);
+    child.pid = INVALID_PROC;
+    return status;
+}
+
+namespace detail {
+// Blocks SIGPIPE on this thread so a reader that went away shows up as EPIPE, and swallows the signal that leaves
+// pending unless one was already pending before
+class SigpipeGuard {
+public:
+    SigpipeGuard() {
+        sigemptyset(&set_);
+        sigaddset(&set_, SIGPIPE);
+        sigset_t pending;
+        sigpending(&pending);
+        was_pending_ = sigismember(&pending, SIGPIPE) == 1;
+        pthread_sigmask(SIG_BLOCK, &set_, &old_);
+    }
+
+    ~SigpipeGuard() {
+        if (!was_pending_) {
+            const timespec zero = {};
+            while (sigtimedwait(&set_, nullptr, &zero) > 0) {}
+        }
+        pthread_sigmask(SIG_SETMASK, &old_, nullptr);
+    }
+
+    SigpipeGuard(const SigpipeGuard&) = delete;
+    SigpipeGuard& operator=(const SigpipeGuard&) = delete;
+
+private:
+    sigset_t set_;
+    sigset_t old_;
+    bool was_pending_ = false;
+};
+} // namespace detail
+
+Pipeline::~Pipeline() {
+    if (!children_.empty()) wait();
+}
+
+Pipeline& Pipeline::stage(std::vector<std::string> args) {
+    stages_.push_back(MOVE(args));
+    return *this;
+}
+
+std::expected<void, std::string> Pipeline::add(const std::string_view command_line) {
+    std::vector<std::vector<std::string>> stages(1);
+    std::string word;
+    bool in_word = false;
+
+    const auto end_word = [&] {
+        if (in_word) stages.back().push_back(MOVE(word));
+        word.clear();
+        in_word = false;
+    };
+
+    for (std::size_t i = 0; i < command_line.size(); ++i) {
+        const char c = command_line[i];
+        if (c == ' ' || c == '\t' || c == '\n') {
+            end_word();
+        } else if (c == '|') {
+            end_word();
+            stages.emplace_back();
+        } else if (c == '\'') {
+            const std::size_t close = command_line.find('\'', i + 1);
+            if (close == std::string_view::npos) return std::unexpected("Unterminated ' in pipeline");
+            word.append(command_line.substr(i + 1, close - i - 1));
+            in_word = true;
+            i = close;
+        } else if (c == '"') {
+            in_word = true;
+            for (++i; i < command_line.size() && command_line[i] != '"'; ++i) {
+                // Inside double quotes a backslash only escapes the characters that would otherwise end or expand them
+                if (command_line[i] == '\\' && i + 1 < command_line.size() &&
+                    std::string_view("\"\\$`").find(command_line[i + 1]) != std::string_view::npos) {
+                    ++i;
+                }
+                word.push_back(command_line[i]);
+            }
+            if (i == command_line.size()) return std::unexpected("Unterminated \" in pipeline");
+        } else if (c == '\\' && i + 1 < command_line.size()) {
+            word.push_back(command_line[++i]);
+            in_word = true;
+        } else {
+            word.push_back(c);
+            in_word = true;
+        }
+    }
+    end_word();
+
+    for (const auto& stage : stages) {
+        if (stage.empty()) return std::unexpected("Empty stage in pipeline '" + std::string(command_line) + "'");
+    }
+    for (auto& stage : stages) stages_.push_back(MOVE(stage));
+    return {};
+}
+
+std::expected<void, std::string> Pipeline::start(const Fd input, const Fd output) {
+    if (stages_.empty()) return std::unexpected("Pipeline has no stages");
+    if (!children_.empty()) return std::unexpected("Pipeline already started");
+
+    // Ends of pipes we created are ours to close, the caller's input and output are not
+    Fd stage_in = input;
+    bool own_stage_in = false;
+    if (input == INVALID_FD) {
+        if (const auto pipe = create_pipe(stage_in, input_); !pipe) return std::unexpected(pipe.error());
+        own_stage_in = true;
+    }
+
+    for (std::size_t i = 0; i < stages_.size(); ++i) {
+        const bool last = i + 1 == stages_.size();
+        Redirect redirect = {.fd_in = stage_in, .fd_out = output, .fd_err = INVALID_FD};
+        Fd next_in = INVALID_FD;
+        if (!last) {
+            if (const auto pipe = create_pipe(next_in, redirect.fd_out); !pipe) {
+                if (own_stage_in) close_fd(stage_in);
+                wait();
+                return std::unexpected(pipe.error());
+            }
+        }
+
+        const auto child = spawn(stages_[i], redirect, false);
+        if (own_stage_in) close_fd(stage_in);
+        if (!last) close_fd(redirect.fd_out);
+        stage_in = next_in;
+        own_stage_in = true;
+
+        if (!child) {
+            // Stages already running see EOF or EPIPE and wind down on their own
+            close_fd(stage_in);
+            wait();
+            return std::unexpected(child.error());
+        }
+        children_.push_back(*child);
+    }
+    return {};
+}
+
+std::expected<void, std::string> Pipeline::feed(const Fd fd) {
+    if (input_ == INVALID_FD) return {};
+    const detail::SigpipeGuard guard;
+
+    for (;;) {
+        const ssize_t moved = splice(fd, nullptr, input_, nullptr, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved > 0) continue;
+        if (moved == 0) return {};
+        if (errno == EINTR) continue;
+        if (errno == EPIPE) {
+            reset_fd(input_);
+            return {};
+        }
+        if (errno == EINVAL) break; // Not spliceable, e.g. a file system without splice_read
+        return std::unexpected("Could not feed pipeline: " + posix_error_to_string(errno));
+    }
+
+    std::array<char, 64 * 1024> buffer;
+    for (;;) {
+        const ssize_t got = read(fd, buffer.data(), buffer.size());
+        if (got == 0) return {};
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return std::unexpected("Could not read pipeline input: " + posix_error_to_string(errno));
+        }
+        if (const auto fed = feed(std::string_view(buffer.data(), static_cast<std::size_t>(got))); !fed) return fed;
+        if (input_ == INVALID_FD) return {};
+    }
+}
+
+std::expected<void, std::string> Pipeline::feed(std::string_view bytes) {
+    if (input_ == INVALID_FD) return {};
+    const detail::SigpipeGuard guard;
+
+    while (!bytes.empty()) {
+        const ssize_t written = write(input_, bytes.data(), bytes.size());
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE) {
+                reset_fd(input_);
+                return {};
+            }
+            return std::unexpected("Could not feed pipeline: " + posix_error_to_string(errno));
+        }
+        bytes.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return {};
+}
+
+std::expected<std::vector<ExitStatus>, std::string> Pipeline::wait() {
+    reset_fd(input_);
+
+    std::vector<ExitStatus> statuses(children_.size());
+    std::string error;
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        if (detail::reap_child(children_[i].pid, 0, children_[i].started, statuses[i]) < 0 && error.empty()) {
+            error = "Could not wait on pipeline stage: " + posix_error_to_string(errno);
+        }
+        reset_fd(children_[i].pidfd);
+    }
+    children_.clear();
+
+    if (!error.empty()) return std::unexpected(error);
+    return statuses;
+}
+
+namespace detail {
+bool FdWaiter::await_ready() noexcept {
+    if (scope_ != nullptr && scope_->cancelled()) {
+        error_ = ECANCELED;
+        return true;
+    }
+    return false;
+}
+
+bool FdWaiter::await_suspend(const std::coroutine_handle<> handle) noexcept {
+    epoll_event event = {};
+    event.events = events_;
+    event.data.ptr = this;
+    if (epoll_ctl(loop_->epoll_, EPOLL_CTL_ADD, fd_, &event) != 0) {
+        error_ = errno;
+        return false;
+    }
+    handle_ = handle;
+    pending_ = true;
+    ++loop_->waiting_;
+    if (scope_ != nullptr) scope_->waiters_.push_back(this);
+    return true;
+}
+
+FdWaiter::~FdWaiter() {
+    if (!pending_) return;
+    epoll_ctl(loop_->epoll_, EPOLL_CTL_DEL, fd_, nullptr);
+    --loop_->waiting_;
+    if (scope_ != nullptr) scope_->forget(this);
+}
+
+void FdWaiter::cancel() noexcept {
+    if (!pending_) return;
+    epoll_ctl(loop_->epoll_, EPOLL_CTL_DEL, fd_, nullptr);
+    pending_ = false;
+    --loop_->waiting_;
+    error_ = ECANCELED;
+    scope_ = nullptr;
+    loop_->ready_.push_back(handle_);
+}
+} // namespace detail
+
+CancelScope::CancelScope(CancelScope& parent) : parent_(&parent), cancelled_(parent.cancelled_) {
+    parent.children_.push_back(this);
+}
+
+CancelScope::~CancelScope() {
+    if (parent_ != nullptr) std::erase(parent_->children_, this);
+    for (CancelScope* child : children_) child->parent_ = nullptr;
+    for (detail::FdWaiter* waiter : waiters_) waiter->scope_ = nullptr;
+}
+
+void CancelScope::cancel() noexcept {
+    if (cancelled_) return;
+    cancelled_ = true;
+    for (detail::FdWaiter* waiter : std::exchange(waiters_, {})) waiter->cancel();
+    for (CancelScope* child : children_) child->cancel();
+}
+
+void CancelScope::forget(const detail::FdWaiter* waiter) noexcept {
+    std::erase(waiters_, waiter);
+}
+
+EventLoop::EventLoop() : epoll_(epoll_create1(EPOLL_CLOEXEC)) {}
+
+EventLoop::~EventLoop() {
+    close_fd(epoll_);
+}
+
+detail::FdWaiter EventLoop::readable(const Fd fd, CancelScope* scope) noexcept {
+    return {*this, fd, EPOLLIN, scope};
+}
+
+detail::FdWaiter EventLoop::writable(const Fd fd, CancelScope* scope) noexcept {
+    return {*this, fd, EPOLLOUT, scope};
+}
+
+void EventLoop::poll() {
+    if (ready_.empty()) {
+        if (waiting_ == 0) {
+            std::fputs("utils::process::EventLoop: task is suspended on something other than the loop\n", stderr);
+            std::abort();
+        }
+
+        std::array<epoll_event, 64> events;
+        const int count = epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), -1);
+        // Every waiter of the batch is settled before any coroutine runs, those may well start new waits
+        for (int i = 0; i < count; ++i) {
+            auto* waiter = static_cast<detail::FdWaiter*>(events[static_cast<std::size_t>(i)].data.ptr);
+            if (!waiter->pending_) continue;
+            epoll_ctl(epoll_, EPOLL_CTL_DEL, waiter->fd_, nullptr);
+            waiter->pending_ = false;
+            --waiting_;
+            if (waiter->scope_ != nullptr) waiter->scope_->forget(waiter);
+            ready_.push_back(waiter->handle_);
+        }
+    }
+
+    while (!ready_.empty()) {
+        const std::coroutine_handle<> handle = ready_.front();
+        ready_.pop_front();
+        handle.resume();
+    }
+}
+
+Task<std::expected<Child, std::string>> EventLoop::spawn(std::vector<std::string> args, Redirect& redirect,
+                                                         const bool reset_fds) {
+    co_return process::spawn(args, redirect, reset_fds);
+}
+
+namespace detail {
+static std::string wait_error(const int error) {
+    if (error == ECANCELED) return "Cancelled";
+    return "Could not wait on file descriptor: " + posix_error_to_string(error);
+}
+
+static void set_nonblocking(const Fd fd) noexcept {
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && (flags & O_NONBLOCK) == 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+} // namespace detail
+
+Task<std::expected<std::string, std::string>> EventLoop::read_all(const Fd fd, CancelScope* scope) {
+    detail::set_nonblocking(fd);
+
+    std::string out;
+    std::size_t size = 0;
+    for (;;) {
+        if (size == out.size()) out.resize(std::max<std::size_t>(out.size() * 2, 4096));
+        const ssize_t got = read(fd, out.data() + size, out.size() - size);
+        if (got > 0) {
+            size += static_cast<std::size_t>(got);
+            continue;
+        }
+        if (got == 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) co_return std::unexpected("Could not read: " + posix_error_to_string(errno));
+
+        if (const int error = co_await readable(fd, scope); error != 0) {
+            co_return std::unexpected(detail::wait_error(error));
+        }
+    }
+    out.resize(size);
+    co_return MOVE(out);
+}
+
+Task<std::expected<void, std::string>> EventLoop::write_all(const Fd fd, std::string_view bytes, CancelScope* scope) {
+    detail::set_nonblocking(fd);
+
+    while (!bytes.empty()) {
+        ssize_t written = 0;
+        {
+            const detail::SigpipeGuard guard;
+            written = write(fd, bytes.data(), bytes.size());
+        }
+        if (written > 0) {
+            bytes.remove_prefix(static_cast<std::size_t>(written));
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && errno != EAGAIN) co_return std::unexpected("Could not write: " + posix_error_to_string(errno));
+
+        if (const int error = co_await writable(fd, scope); error != 0) {
+            co_return std::unexpected(detail::wait_error(error));
+        }
+    }
+    co_return std::expected<void, std::string>{};
+}
+
+Task<std::expected<ExitStatus, std::string>> EventLoop::wait(Child child, CancelScope* scope) {
+    for (;;) {
+        ExitStatus status;
+        const pid_t pid = detail::reap_child(child.pid, WNOHANG, child.started, status);
+        if (pid < 0) {
+            const int error = errno;
+            reset_fd(child.pidfd);
+            co_return std::unexpected("Could not wait on child process: " + posix_error_to_string(error));
+        }
+        if (pid == child.pid) {
+            reset_fd(child.pidfd);
+            co_return status;
+        }
+
+        // Without a pidfd the child is polled, like wait_child does
+        int error = 0;
+        if (child.pidfd != INVALID_FD) {
+            error = co_await readable(child.pidfd, scope);
+        } else if (const auto slept = co_await sleep_for(std::chrono::milliseconds(5), scope); !slept) {
+            error = scope != nullptr && scope->cancelled() ? ECANCELED : EIO;
+        }
+
+        if (error == ECANCELED) {
+            kill(child.pid, SIGKILL);
+            while (waitpid(child.pid, nullptr, 0) < 0 && errno == EINTR) {}
+            reset_fd(child.pidfd);
+            co_return std::unexpected(detail::wait_error(error));
+        }
+        if (error != 0) {
+            reset_fd(child.pidfd);
+            co_return std::unexpected(detail::wait_error(error));
+        }
+    }
+}
+
+Task<std::expected<void, std::string>> EventLoop::sleep_for(const std::chrono::milliseconds duration,
+                                                            CancelScope* scope) {
+    Fd timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer < 0) co_return std::unexpected("Could not create timer: " + posix_error_to_string(errno));
+
+    // A zero it_value would disarm the timer instead of firing at once
+    const auto ns = std::max<std::chrono::nanoseconds::rep>(std::chrono::nanoseconds(duration).count(), 1);
+    itimerspec spec = {};
+    spec.it_value.tv_sec = ns / 1'000'000'000;
+    spec.it_value.tv_nsec = ns % 1'000'000'000;
+    timerfd_settime(timer, 0, &spec, nullptr);
+
+    const int error = co_await readable(timer, scope);
+    reset_fd(timer);
+    if (error != 0) co_return std::unexpected(detail::wait_error(error));
+    co_return std::expected<void, std::string>{};
+}
+
+ProcessPool::ProcessPool(const std::size_t max_running) {
+    std::size_t slots = max_running;
+    if (slots == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        slots = cpus > 0 ? static_cast<std::size_t>(cpus) : 1;
+    }
+    slots_.resize(slots);
+}
+
+ProcessPool::~ProcessPool() {
+    // Only reached with live children if run() threw out of a callback. Closing the pipes first means a child blocked
+    // on a full one gets EPIPE instead of keeping us waiting forever
+    for (std::size_t i = 0; i < slots_.size(); ++i) {
+        if (!slots_[i].active) continue;
+        reset_fd(slots_[i].out);
+        reset_fd(slots_[i].err);
+        if (!slots_[i].reaped) reap(i, true);
+        release(slots_[i]);
+    }
+    close_fd(epoll_);
+}
+
+std::size_t ProcessPool::submit(std::vector<std::string> args, ProcessCallback on_done) {
+    const std::size_t id = next_id_++;
+    pending_.push_back({.id = id, .args = MOVE(args), .on_done = MOVE(on_done)});
+    return id;
+}
+
+std::future<std::expected<ProcessResult, std::string>> ProcessPool::submit(std::vector<std::string> args) {
+    auto promise = std::make_shared<std::promise<std::expected<ProcessResult, std::string>>>();
+    auto future = promise->get_future();
+    submit(MOVE(args), [promise](std::size_t, std::expected<ProcessResult, std::string> result) {
+        promise->set_value(MOVE(result));
+    });
+    return future;
+}
+
+std::expected<void, std::string> ProcessPool::run() {
+    if (epoll_ == INVALID_FD) {
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ == INVALID_FD) {
+            return std::unexpected("Could not create epoll instance: " + posix_error_to_string(errno));
+        }
+    }
+
+    std::array<epoll_event, 64> events;
+    while (!pending_.empty() || active_ > 0) {
+        for (std::size_t i = 0; i < slots_.size() && !pending_.empty(); ++i) {
+            if (slots_[i].active) continue;
+            Job job = MOVE(pending_.front());
+            pending_.pop_front();
+            start(i, MOVE(job));
+        }
+        if (active_ == 0) continue; // Every start failed and has been reported
+
+        bool polling = false;
+        for (const Slot& slot : slots_) polling |= slot.active && !slot.reaped && slot.pidfd == INVALID_FD;
+
+        const int ready = epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), polling ? 10 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return std::unexpected("Could not wait on child processes: " + posix_error_to_string(errno));
+        }
+
+        for (std::size_t e = 0; e < static_cast<std::size_t>(ready); ++e) {
+            const std::uint64_t key = events[e].data.u64;
+            const std::size_t i = key >> 2;
+            Slot& slot = slots_[i];
+            switch (key & 3) {
+            case detail::POOL_OUT: drain(slot.out, slot.result.out); break;
+            case detail::POOL_ERR: drain(slot.err, slot.result.err); break;
+            default: reap(i, false); break;
+            }
+        }
+
+        for (std::size_t i = 0; i < slots_.size(); ++i) {
+            Slot& slot = slots_[i];
+            if (!slot.active) continue;
+            if (!slot.reaped && slot.pidfd == INVALID_FD) reap(i, false);
+            if (slot.reaped && slot.out == INVALID_FD && slot.err == INVALID_FD) finish(i);
+        }
+    }
+    return {};
+}
+
+void ProcessPool::start(const std::size_t slot, Job job) {
+    Slot& s = slots_[slot];
+    s.job = MOVE(job);
+
+    const auto fail = [&](const std::string& error) {
+        release(s);
+        Job failed = MOVE(s.job);
+        s = Slot{};
+        if (failed.on_done) failed.on_done(failed.id, std::unexpected(error));
+    };
+
+    Redirect redirect;
+    const auto null_in = open_fd_for_read("/dev/null");
+    if (!null_in) return fail(null_in.error());
+    redirect.fd_in = *null_in;
+
+    if (const auto pipe = create_pipe(s.out, redirect.fd_out); !pipe) {
+        reset_redirect(redirect);
+        return fail(pipe.error());
+    }
+    if (const auto pipe = create_pipe(s.err, redirect.fd_err); !pipe) {
+        reset_redirect(redirect);
+        return fail(pipe.error());
+    }
+
+    // The write ends must be gone from this process even if spawning failed early, or the read ends never hit EOF
+    const auto child = spawn(s.job.args, redirect);
+    reset_redirect(redirect);
+    if (!child) return fail(child.error());
+
+    // Without a pidfd the child is polled instead
+    s.pid = child->pid;
+    s.pidfd = child->pidfd;
+    s.started = child->started;
+    s.active = true;
+    ++active_;
+
+    const auto watch = [&](const Fd fd, const std::uint64_t kind) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = static_cast<std::uint64_t>(slot) << 2 | kind;
+        return epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    };
+
+    const bool watched = fcntl(s.out, F_SETFL, O_NONBLOCK) == 0 && fcntl(s.err, F_SETFL, O_NONBLOCK) == 0 &&
+                         watch(s.out, detail::POOL_OUT) && watch(s.err, detail::POOL_ERR) &&
+                         (s.pidfd == INVALID_FD || watch(s.pidfd, detail::POOL_EXIT));
+    if (!watched) {
+        // Give up on the output but still reap the child, by polling, before reporting
+        s.error = "Could not watch child process: " + posix_error_to_string(errno);
+        release(s);
+    }
+}
+
+void ProcessPool::drain(Fd& fd, std::string& into) {
+    std::array<char, 16 * 1024> buffer;
+    for (;;) {
+        const ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n > 0) {
+            into.append(buffer.data(), static_cast<std::size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        reset_fd(fd); // EOF, or an error that will not go away
+        return;
+    }
+}
+
+void ProcessPool::reap(const std::size_t slot, const bool block) {
+    Slot& s = slots_[slot];
+    ExitStatus status;
+    const pid_t pid = detail::reap_child(s.pid, block ? 0 : WNOHANG, s.started, status);
+    if (pid == 0) return; // Still running
+
+    s.reaped = true;
+    reset_fd(s.pidfd);
+    if (pid < 0) {
+        if (s.error.empty()) s.error = "Could not wait on child process: " + posix_error_to_string(errno);
+        return;
+    }
+
+    s.result.exit_code = status.exit_code;
+    s.result.signal = status.signal;
+    s.result.usage = status.usage;
+}
+
+void ProcessPool::finish(const std::size_t slot) {
+    Slot& s = slots_[slot];
+    Job job = MOVE(s.job);
+    std::expected<ProcessResult, std::string> result = MOVE(s.result);
+    if (!s.error.empty()) result = std::unexpected(MOVE(s.error));
+    s = Slot{};
+    --active_;
+
+    if (job.on_done) job.on_done(job.id, MOVE(result));
+}
+
+void ProcessPool::release(Slot& s) noexcept {
+    reset_fd(s.out);
+    reset_fd(s.err);
+    reset_fd(s.pidfd);
+}
+#endif // __linux__
+
 #ifdef _WIN32
 std::string win32_error_to_string(unsigned long error_code) noexcept {
     constexpr int WIN32_ERR_MESSAGE_SIZE = 4096;
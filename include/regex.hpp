@@ -0,0 +1,130 @@
+#ifndef SSM_REGEX_HPP
+#define SSM_REGEX_HPP
+
+#include "common.hpp"
+#include "search.hpp"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ssm::regex {
+
+// A regular expression compiled for line-by-line search, like grep -E. The syntax covers what searches through
+// snippets tend to need:
+//
+//   literals and escapes     a  \.  \t  \\  \x41
+//   any byte but a newline   .
+//   classes                  [a-z_]  [^0-9]  \d \w \s \D \W \S
+//   anchors                  ^ and $, the start and end of a line
+//   groups, alternation      (a|b)  (?:a|b)
+//   repetition               *  +  ?  {n}  {n,}  {n,m}, each optionally followed by ? (only whole lines are
+//                            reported, so lazy and greedy find the same ones)
+//
+// No match ever spans a newline. Backreferences and lookaround are not supported: the pattern becomes an automaton,
+// so matching takes time linear in the text whatever the pattern.
+class program {
+public:
+    // The error says what is wrong and where, e.g. "unmatched ')' at offset 4"
+    static std::expected<program, std::string> compile(std::string_view pattern);
+
+    // A string every match contains, the longest one the pattern makes obvious, possibly empty. Lets the trigram
+    // index rule out snippets, and a substring search rule out lines, before the automaton runs
+    [[nodiscard]] const std::string& required() const noexcept {
+        return required_;
+    }
+
+private:
+    friend class matcher;
+
+    // Thompson NFA, each node consuming one byte from a set or none at all
+    struct node {
+        enum class kind : u8 {
+            bytes,
+            split, // to both `out` and `out2`
+            line_start,
+            line_end,
+            match,
+        };
+
+        kind type = kind::match;
+        u32 out = 0;
+        u32 out2 = 0;
+        std::bitset<256> bytes;
+    };
+
+    std::vector<node> nodes_;
+    u32 start_ = 0;
+
+    // Bytes no node tells apart share a class, and DFA rows have one entry per class rather than per byte
+    std::array<u8, 256> classes_{};
+    std::vector<u8> representatives_; // a byte of each class
+    u32 class_count_ = 0;
+
+    std::string required_;
+    std::optional<search::finder> prefilter_;
+    bool literal_ = false; // the pattern is `required_` and nothing more, finding it is matching
+};
+
+// Runs a program over text, building DFA states the first time each is reached and keeping them for later calls.
+// Not thread-safe, every thread needs its own. The program must outlive the matcher
+class matcher {
+public:
+    explicit matcher(const program& program);
+
+    // The first line at or after `from`, which must be the start of a line, that holds a match
+    std::optional<search::line_span> next_line(std::string_view text, std::size_t from);
+
+private:
+    // Special transition targets, real ones are row offsets into next_ and never negative
+    static constexpr i32 UNKNOWN = -1;
+    static constexpr i32 MATCHED = -2;
+    static constexpr i32 DEAD = -3; // no match is possible before the next line
+
+    static constexpr std::size_t MAX_STATES = 4096;
+
+    struct state {
+        std::vector<u32> nodes; // byte-consuming NFA nodes, ascending
+        bool matches_at_end;    // matches if the line ends here
+    };
+
+    const program* program_;
+    std::vector<state> states_;
+    std::vector<i32> next_; // states_.size() rows of class_count_ targets
+    std::unordered_map<std::string, i32> index_;
+    bool every_line_ = false; // the pattern matches the empty string
+
+    // The bytes that take the DFA out of its start state, when they make up few enough ranges to test a vector of
+    // bytes against at once. Until one of them comes along, nothing can start a match and the DFA need not run
+    static constexpr std::size_t MAX_EXIT_RANGES = 3;
+    std::vector<std::pair<u8, u8>> start_exits_;
+    bool skip_start_ = false;
+
+    // Scratch space for building states
+    std::vector<u32> marks_;
+    u32 generation_ = 0;
+    std::vector<u32> stack_;
+    std::vector<u32> set_;
+    std::vector<u32> at_end_;
+
+    void reset();
+    i32 transition(i32 row, u32 byte_class);
+    i32 intern(bool bol);
+    void closure(u32 node, bool bol, bool& matched);
+    bool reaches_match_at_end(bool bol);
+
+    // Where a match was decided: the byte that completed it, the newline ending its line, or text.size() if the
+    // text ends in the middle of the matching line. std::string_view::npos if there is none
+    std::size_t run(std::string_view text, std::size_t from);
+};
+
+} // namespace ssm::regex
+
+#endif // SSM_REGEX_HPP
@@ -0,0 +1,18 @@
+#ifndef SSM_SCHEMA_HPP
+#define SSM_SCHEMA_HPP
+
+#include "sqlite3.hpp"
+
+namespace ssm::schema {
+
+// Brings the indexes derived from the `file` table up to date with this binary. Indexes the database predates are
+// created and filled from the existing rows in one transaction, and PRAGMA user_version records how far it got.
+// Costs a single PRAGMA read once the database is current. Must run outside a transaction.
+bool migrate(const ssm_sqlite3::database& sqlite);
+
+// Whether the suggestion index has been built, so read-only paths can use it without taking the write lock
+bool has_suggest_index(const ssm_sqlite3::database& sqlite);
+
+} // namespace ssm::schema
+
+#endif // SSM_SCHEMA_HPP
@@ -0,0 +1,79 @@
+#ifndef SSM_SEARCH_HPP
+#define SSM_SEARCH_HPP
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace ssm::regex {
+class matcher;
+} // namespace ssm::regex
+
+namespace ssm::search {
+
+// Offsets of one line of a text, without its newline
+struct line_span {
+    std::size_t begin;
+    std::size_t end;
+};
+
+// Substring search that compares the needle's first and last bytes against 32 (AVX2) or 16 (SSE2) positions of the
+// haystack at once and only compares the whole needle where both agree. Text rarely has the same pair of bytes
+// needle-length apart by chance, so most of the haystack is rejected a vector at a time.
+class finder {
+public:
+    explicit finder(std::string_view needle);
+
+    [[nodiscard]] std::string_view needle() const noexcept {
+        return needle_;
+    }
+
+    // Offset of the first occurrence starting at or after `from`, std::string_view::npos if there is none. An empty
+    // needle is found at `from`
+    [[nodiscard]] std::size_t find(std::string_view haystack, std::size_t from = 0) const noexcept;
+
+private:
+    std::string needle_;
+};
+
+// Whole file mapped read-only. Empty files and files that cannot be opened or mapped give an empty text, `ok()`
+// tells the two apart
+class mapped_file {
+public:
+    explicit mapped_file(const std::filesystem::path& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    [[nodiscard]] bool ok() const noexcept {
+        return ok_;
+    }
+
+    [[nodiscard]] std::string_view text() const noexcept {
+        return {static_cast<const char*>(map_), size_};
+    }
+
+private:
+    void* map_ = nullptr;
+    std::size_t size_ = 0;
+    bool ok_ = false;
+};
+
+// Appends "name:line:text" for every line of `text` that holds a match, or "name" alone once with `files_only`.
+// Lines are numbered lazily, only the stretch up to each matching line is ever counted. Whether anything matched
+bool grep_text(std::string_view name, std::string_view text, const finder& finder, bool files_only, std::string& out);
+bool grep_text(std::string_view name, std::string_view text, regex::matcher& matcher, bool files_only, std::string& out);
+
+// Calls `body(i)` once for every i in [0, count) on `threads` threads, 0 meaning one per core. Each thread starts on
+// an equal contiguous share of the range and takes items from its front. One that runs dry steals the back half of
+// what another has left, so a few huge files in one share cannot leave the other threads idle
+void parallel_for(std::size_t count, unsigned threads, const std::function<void(std::size_t)>& body);
+
+} // namespace ssm::search
+
+#endif // SSM_SEARCH_HPP
@@ -1,19 +1,167 @@
 #ifndef SSM_SQLITE3_HPP
 #define SSM_SQLITE3_HPP
 
+#include <algorithm>
+#include <cstdio>
 #include <filesystem>
+#include <print>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "sqlite3.h"
+#include "trace.hpp"
 
 namespace ssm_sqlite3 {
 
+struct statement_profile {
+    std::string sql;
+    sqlite3_int64 runs = 0;
+    sqlite3_int64 total_ns = 0;
+    sqlite3_int64 max_ns = 0;
+    sqlite3_int64 vm_steps = 0;
+    sqlite3_int64 fullscan_steps = 0;
+    sqlite3_int64 sorts = 0;
+    sqlite3_int64 autoindex_rows = 0;
+    bool explained = false;
+    std::vector<std::string> plan; // EXPLAIN QUERY PLAN rows, already indented by depth
+};
+
+// Debug mode for `ssm debug sql`: once enabled, every database opened afterwards reports each finished statement
+// through sqlite3_trace_v2 and the profiles are aggregated per SQL text for the whole run.
+class profiler {
+public:
+    static profiler& instance() {
+        static profiler p;
+        return p;
+    }
+
+    void enable() {
+        enabled_ = true;
+    }
+
+    [[nodiscard]] bool enabled() const {
+        return enabled_;
+    }
+
+    void attach(sqlite3* db) {
+        sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, &profiler::on_trace, this);
+    }
+
+    // EXPLAIN QUERY PLAN cannot run from inside the trace callback, so plans are collected while the connection
+    // that ran the statements is closing
+    void explain_pending(sqlite3* db) {
+        sqlite3_trace_v2(db, 0, nullptr, nullptr); // the EXPLAINs themselves must not be profiled
+
+        for (statement_profile& profile : statements_) {
+            if (profile.explained) continue;
+            profile.explained = true;
+
+            sqlite3_stmt* raw = nullptr;
+            const std::string explain = "EXPLAIN QUERY PLAN " + profile.sql;
+            if (sqlite3_prepare_v2(db, explain.c_str(), -1, &raw, nullptr) != SQLITE_OK) {
+                sqlite3_finalize(raw);
+                continue;
+            }
+
+            std::unordered_map<int, int> depth; // node id -> depth
+            while (sqlite3_step(raw) == SQLITE_ROW) {
+                const int id = sqlite3_column_int(raw, 0);
+                const int parent = sqlite3_column_int(raw, 1);
+                const auto it = depth.find(parent);
+                const int level = it == depth.end() ? 0 : it->second + 1;
+                depth[id] = level;
+
+                const char* detail = reinterpret_cast<const char*>(sqlite3_column_text(raw, 3));
+                profile.plan.push_back(std::string(static_cast<std::size_t>(level) * 2, ' ') + (detail != nullptr ? detail : ""));
+            }
+            sqlite3_finalize(raw);
+        }
+    }
+
+    void report(std::FILE* out) const {
+        if (statements_.empty()) {
+            std::println(out, "No SQL statements were executed");
+            return;
+        }
+
+        sqlite3_int64 total_ns = 0;
+        for (const statement_profile& profile : statements_) total_ns += profile.total_ns;
+        std::println(out, "{} distinct statements, {:.3f} ms in SQLite\n", statements_.size(),
+                     static_cast<double>(total_ns) / 1e6);
+
+        for (std::size_t i = 0; i < statements_.size(); ++i) {
+            const statement_profile& p = statements_[i];
+            const bool suspicious = p.fullscan_steps > 0 || p.sorts > 0 || p.autoindex_rows > 0;
+            std::println(out, "#{}{} runs={} total={:.3f}ms max={:.3f}ms vm_steps={} fullscan_steps={} sorts={} autoindex_rows={}",
+                         i + 1, suspicious ? " [!]" : "", p.runs, static_cast<double>(p.total_ns) / 1e6,
+                         static_cast<double>(p.max_ns) / 1e6, p.vm_steps, p.fullscan_steps, p.sorts, p.autoindex_rows);
+            std::println(out, "    {}", p.sql);
+            for (const std::string& row : p.plan) {
+                std::println(out, "      plan: {}", row);
+            }
+            std::println(out);
+        }
+    }
+
+private:
+    bool enabled_ = false;
+    std::vector<statement_profile> statements_; // in order of first execution
+    std::unordered_map<std::string, std::size_t> index_;
+    std::unordered_map<sqlite3_stmt*, sqlite3_int64> started_; // run start per statement, see record()
+
+    static int on_trace(const unsigned type, void* ctx, void* p, void* x) {
+        auto* self = static_cast<profiler*>(ctx);
+        auto* stmt = static_cast<sqlite3_stmt*>(p);
+        if (type == SQLITE_TRACE_STMT) {
+            self->started_.try_emplace(stmt, ssm::trace::detail::now_ns());
+        } else if (type == SQLITE_TRACE_PROFILE) {
+            self->record(stmt, *static_cast<sqlite3_int64*>(x));
+        }
+        return 0;
+    }
+
+    void record(sqlite3_stmt* stmt, sqlite3_int64 elapsed_ns) {
+        // SQLite only measures profile time in whole milliseconds, so time the run from its first step instead
+        if (const auto it = started_.find(stmt); it != started_.end()) {
+            elapsed_ns = ssm::trace::detail::now_ns() - it->second;
+            started_.erase(it);
+        }
+
+        const char* sql = sqlite3_sql(stmt);
+        if (sql == nullptr) return;
+
+        auto [it, inserted] = index_.try_emplace(sql, statements_.size());
+        if (inserted) statements_.push_back({.sql = sql});
+        statement_profile& profile = statements_[it->second];
+
+        // Counters are reset so every profile event only sees its own run. This is the only read while profiling, and
+        // it feeds both the profile and the trace
+        const sqlite3_int64 vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+        SSM_TRACE_COUNTER("sqlite.vm_steps", vm_steps);
+
+        ++profile.runs;
+        profile.total_ns += elapsed_ns;
+        profile.max_ns = std::max(profile.max_ns, elapsed_ns);
+        profile.vm_steps += vm_steps;
+        profile.fullscan_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        profile.sorts += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+        profile.autoindex_rows += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+    }
+};
+
 struct stmt_handle {
     stmt_handle() = default;
     explicit stmt_handle(sqlite3_stmt* s) : stmt(s) {}
 
     ~stmt_handle() {
-        if (stmt != nullptr) sqlite3_finalize(stmt);
+        if (stmt == nullptr) return;
+        // While profiling, the profile event fired by finalize reads the steps and reports them to the trace too
+        if (!profiler::instance().enabled()) {
+            SSM_TRACE_COUNTER("sqlite.vm_steps", sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0));
+        }
+        sqlite3_finalize(stmt);
     }
 
     stmt_handle(const stmt_handle&) = delete;
@@ -46,12 +194,17 @@ private:
 
 struct database {
     explicit database(const std::filesystem::path& db_path) {
+        SSM_TRACE_SCOPE("sqlite.open");
         if (sqlite3_open_v2(db_path.string().c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+            sqlite3_close(db);
             db = nullptr;
+            return;
         }
+        if (profiler::instance().enabled()) profiler::instance().attach(db);
     }
 
     ~database() {
+        if (db != nullptr && profiler::instance().enabled()) profiler::instance().explain_pending(db);
         sqlite3_close(db); // safe to call with nullptr
     }
 
@@ -80,14 +233,28 @@ struct database {
     }
 
     bool exec(const char* sql) const {
+        SSM_TRACE_SCOPE("sqlite.exec");
         return sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
     }
 
-    static bool bind_text(sqlite3_stmt* stmt, const int index, const std::string& value) {
-        return sqlite3_bind_text(stmt, index, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT) == SQLITE_OK;
+    [[nodiscard]] sqlite3_int64 last_insert_rowid() const {
+        return sqlite3_last_insert_rowid(db);
+    }
+
+    static bool bind_text(sqlite3_stmt* stmt, const int index, const std::string_view value) {
+        return sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT) == SQLITE_OK;
+    }
+
+    static bool bind_blob(sqlite3_stmt* stmt, const int index, const std::string_view value) {
+        return sqlite3_bind_blob(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT) == SQLITE_OK;
+    }
+
+    static bool bind_int64(sqlite3_stmt* stmt, const int index, const sqlite3_int64 value) {
+        return sqlite3_bind_int64(stmt, index, value) == SQLITE_OK;
     }
 
     [[nodiscard]] stmt_handle prepare(const char* sql) const {
+        SSM_TRACE_SCOPE("sqlite.prepare");
         sqlite3_stmt* raw = nullptr;
         if (sqlite3_prepare_v2(db, sql, -1, &raw, nullptr) != SQLITE_OK) {
             return {};
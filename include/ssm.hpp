@@ -1,6 +1,8 @@
 #ifndef SSM_SSM_HPP
 #define SSM_SSM_HPP
 
+#include <span>
+#include <string>
 #include <string_view>
 
 namespace ssm {
@@ -8,19 +10,55 @@ namespace ssm {
 inline constexpr std::string_view SNIPPETS_DIRNAME = ".local/share/snippets";
 inline constexpr std::string_view DB_FILENAME = "ssm.db";
 
+// Selectors accepted by the multi-target commands: exact names, 1-based numbers as shown by `ls`,
+// inclusive number ranges like 3-10 and globs like deploy-*
+struct get_options {
+    std::string_view separator; // written between consecutive snippets
+    bool headers = false;       // print "==> name <==" before each snippet
+    std::string_view pipe;      // `cmd | cmd` to stream the snippets into instead of stdout
+    bool fuzzy = false;         // each selector is a fuzzy query resolved to its best match
+};
+
+// `ssm grep` prints every line of every snippet that contains the pattern
+struct grep_options {
+    bool files_only = false; // print each matching snippet's name once instead of its lines
+    bool regex = false;      // the pattern is a regex::program rather than a literal string
+    bool no_index = false;   // read every snippet rather than the trigram index's candidates
+    unsigned threads = 0;    // scanning threads, 0 for one per core
+};
+
 bool ssm_init();
 
 bool create_snippet(const std::string& name);
 
 void list_snippets();
 
-bool remove_snippet(const std::string& name);
+bool remove_snippets(std::span<const std::string_view> selectors);
+
+bool get_snippets(std::span<const std::string_view> selectors, const get_options& options = {});
+
+bool edit_snippets(std::span<const std::string_view> selectors, bool fuzzy = false);
+
+// Whether anything matched. The trigram index picks the snippets worth reading
+bool grep_snippets(std::string_view pattern, const grep_options& options = {});
+
+// Prints the names of the snippets whose contents hold every term, best match first. Whether there were any
+bool search_snippets(std::span<const std::string_view> terms);
+
+// Prints up to `limit` snippets most like `name` by TF-IDF cosine similarity, with their scores, most similar first.
+// Whether there were any
+bool similar_snippets(std::string_view name, std::size_t limit);
+
+// Prints groups of near-duplicate snippets, at least `threshold` similar by estimated Jaccard similarity of their
+// shingles, a blank line between groups. Whether there were any
+bool find_duplicates(double threshold);
 
-bool get_snippet(std::string_view name);
-bool get_snippet(int number);
+// Prints where every symbol starting with `prefix` is defined, as snippet:line: kind name. Whether there were any
+bool find_symbols(std::string_view prefix);
 
-bool edit_snippet(std::string_view name);
-bool edit_snippet(int number);
+// Lets the user pick a snippet on the terminal, starting from `query`, then prints it or opens it in the editor.
+// False when nothing was picked
+bool pick_snippet(std::string_view query, bool edit);
 
 } // namespace ssm
 
@@ -0,0 +1,24 @@
+#ifndef SSM_STATS_HPP
+#define SSM_STATS_HPP
+
+#include "common.hpp"
+
+#include <string_view>
+
+namespace ssm::stats {
+
+// Whether this run is recorded. SSM_STATS=0 turns recording off, SSM_STATS=N keeps one run in N and anything
+// else (including unset) records every run. Decided once so that unsampled runs never start the phase clock.
+bool sampled();
+
+// Appends the run's wall time and trace phase totals to the spool next to the database. This is a single
+// O_APPEND write that never waits on a lock; every few hundred runs the spool is folded into the latency
+// histograms in one transaction, and skipped if the database is busy.
+void record(std::string_view command, i64 wall_ns);
+
+// `ssm stats`: p50/p90/p99/max per subcommand and phase, and the store size over time.
+bool report();
+
+} // namespace ssm::stats
+
+#endif //SSM_STATS_HPP
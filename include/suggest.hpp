@@ -0,0 +1,36 @@
+#ifndef SSM_SUGGEST_HPP
+#define SSM_SUGGEST_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ssm::suggest {
+
+// Names further than this many edits from a query are never suggested
+inline constexpr std::size_t MAX_DISTANCE = 2;
+
+// Symmetric-delete ("SymSpell") dictionary over snippet names, stored in ssm.db next to the `file` table. Every
+// name is filed under the hash of each string reachable by deleting up to MAX_DISTANCE characters of its
+// case-folded prefix. Two names within MAX_DISTANCE edits always share one of them, so a lookup is a single indexed
+// probe per deletion of the query instead of a scan of every name.
+
+// Creates the dictionary and fills it from every row of `file`, inside the caller's transaction. Run once per
+// database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the dictionary in step with `file`, inside the same transaction as the row change
+bool add_name(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view name);
+bool remove_name(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view name);
+
+// Up to `limit` names within MAX_DISTANCE edits of `name`, ignoring case, closest first and then by name.
+// Adjacent transpositions count as one edit.
+std::vector<std::string> closest(const ssm_sqlite3::database& sqlite, std::string_view name, std::size_t limit);
+
+} // namespace ssm::suggest
+
+#endif // SSM_SUGGEST_HPP
@@ -0,0 +1,56 @@
+#ifndef SSM_SYMBOLS_HPP
+#define SSM_SYMBOLS_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ssm::symbols {
+
+// What snippets define, found line by line without knowing their language. Each line is cut into words, quoted
+// strings and punctuation by a byte table, and its first tokens are matched against a table of definition shapes:
+//
+//   shell     name() {   function name   alias name=   export NAME=
+//   Python    def name   async def name   class Name
+//   C, C++    #define NAME   struct/class/enum/union/namespace Name   int name(...) {
+//   SQL       CREATE [OR REPLACE] TABLE/VIEW/FUNCTION/INDEX/TRIGGER/... [IF NOT EXISTS] name, in any case
+//   YAML      metadata.name of a Kubernetes resource, under the resource's kind
+//
+// The shapes are loose, a snippet is not checked to be valid in any language, but they are anchored at the start of
+// a line, so calls and uses of a name are not mistaken for its definition.
+
+struct symbol {
+    std::string name;
+    std::string kind; // "function", "alias", "view", "Deployment", ...
+    u32 line;         // 1-based
+};
+
+struct definition {
+    std::string name;
+    std::string kind;
+    std::string snippet;
+    u32 line;
+};
+
+std::vector<symbol> extract(std::string_view content);
+
+// Creates the table and extracts the symbols of every row of `file` on every core, inside the caller's transaction.
+// Run once per database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the table in step with `file` and the files on disk, inside the same transaction as the change. `index_file`
+// also replaces whatever was indexed for `file_id` before
+bool index_file(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view content);
+bool remove_file(const ssm_sqlite3::database& sqlite, i64 file_id);
+
+// Definitions of every symbol starting with `prefix`, case-sensitive, by name and then snippet. A range scan of the
+// table's primary key. std::nullopt on a database error
+std::optional<std::vector<definition>> lookup(const ssm_sqlite3::database& sqlite, std::string_view prefix);
+
+} // namespace ssm::symbols
+
+#endif // SSM_SYMBOLS_HPP
@@ -0,0 +1,51 @@
+#ifndef SSM_TFIDF_HPP
+#define SSM_TFIDF_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace ssm::tfidf {
+
+// A TF-IDF vector per snippet, for finding the snippets most like a given one. Terms are the tokens of the full-text
+// tokenizer, hashed to 32 bits, weighted by (1 + ln tf) times a smoothed ln(N / df). Each vector keeps only its
+// MAX_TERMS heaviest terms, the ones that tell the snippet apart, and is scaled to unit length, so the cosine
+// similarity of two snippets is the dot product of their vectors.
+//
+// Term counts and document frequencies are exact and kept current on every change. The weights go stale as N moves
+// away from what it was when they were computed, so once N has doubled or halved since, every vector is recomputed
+// from the stored counts, costing a constant amount of work per change on average.
+
+inline constexpr std::size_t MAX_TERMS = 32;
+
+struct neighbour {
+    i64 file_id;
+    f32 score; // cosine similarity, in (0, 1]
+};
+
+// Creates the tables and indexes the current content of every row of `file`, inside the caller's transaction. Run
+// once per database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the vectors in step with `file` and the files on disk, inside the same transaction as the change.
+// `index_file` also replaces whatever was indexed for `file_id` before
+bool index_file(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view content);
+bool remove_file(const ssm_sqlite3::database& sqlite, i64 file_id);
+
+// Up to `count` snippets most like `file_id`, most similar first, leaving out those with no term in common.
+// std::nullopt on a database error, empty when `file_id` has no vector
+std::optional<std::vector<neighbour>> nearest(const ssm_sqlite3::database& sqlite, i64 file_id, std::size_t count);
+
+// Dot product of two vectors given as parallel arrays of ascending terms and their weights, at most MAX_TERMS long.
+// Every term of `b` is compared with 8 (AVX2) terms of `a` at once
+f32 dot(std::span<const u32> a_terms, std::span<const f32> a_weights, std::span<const u32> b_terms,
+        std::span<const f32> b_weights) noexcept;
+
+} // namespace ssm::tfidf
+
+#endif // SSM_TFIDF_HPP
@@ -0,0 +1,97 @@
+#ifndef SSM_TRACE_HPP
+#define SSM_TRACE_HPP
+
+#include "common.hpp"
+
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ssm::trace {
+
+namespace detail {
+// Written once by session before any span runs, read by every span afterwards
+inline bool enabled = false;
+
+i64 now_ns() noexcept;
+void record_span(const char* name, i64 start_ns, i64 end_ns);
+void record_counter(const char* name, i64 delta);
+void record_phase(const char* name, i64 ns);
+} // namespace detail
+
+[[nodiscard]] inline bool enabled() noexcept {
+    return detail::enabled;
+}
+
+// Owns the trace for one run: reads SSM_TRACE on construction and, if it names a file, writes every recorded
+// span and counter there as Chrome trace-event JSON on destruction. A "%p" in the path is replaced by the pid.
+// With `collect_phases` spans are also summed per name, for callers that only want the phase breakdown.
+class session {
+public:
+    explicit session(bool collect_phases = false);
+    ~session();
+
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+    session(session&&) = delete;
+    session& operator=(session&&) = delete;
+
+    [[nodiscard]] i64 elapsed_ns() const noexcept {
+        return detail::now_ns() - start_ns_;
+    }
+
+private:
+    i64 start_ns_;
+};
+
+// Total time spent in each span name so far, in first-seen order. Empty when no session is collecting.
+std::vector<std::pair<std::string_view, i64>> phase_totals();
+
+// Records a complete event covering its own lifetime. `name` must outlive the session, string literals only.
+class span {
+public:
+    explicit span(const char* name) noexcept : name_(name) {
+        if (enabled()) [[unlikely]] start_ns_ = detail::now_ns();
+    }
+
+    ~span() {
+        if (start_ns_ >= 0) [[unlikely]] detail::record_span(name_, start_ns_, detail::now_ns());
+    }
+
+    span(const span&) = delete;
+    span& operator=(const span&) = delete;
+    span(span&&) = delete;
+    span& operator=(span&&) = delete;
+
+private:
+    const char* name_;
+    i64 start_ns_ = -1;
+};
+
+// Adds `delta` to a running counter, emitted as a counter track. `name` follows the same rule as span names.
+inline void counter(const char* name, const i64 delta) {
+    if (enabled()) [[unlikely]] detail::record_counter(name, delta);
+}
+
+// Adds time that no span of ours covered, like a child's CPU time, to the phase totals and thereby to `ssm stats`.
+// It shows up in the trace as a counter. `name` follows the same rule as span names.
+inline void phase(const char* name, const i64 ns) {
+    if (enabled()) [[unlikely]] detail::record_phase(name, ns);
+}
+
+} // namespace ssm::trace
+
+#define SSM_TRACE_CONCAT_IMPL(a, b) a##b
+#define SSM_TRACE_CONCAT(a, b) SSM_TRACE_CONCAT_IMPL(a, b)
+
+#ifdef SSM_NO_TRACE
+#define SSM_TRACE_SCOPE(name) (void)0
+#define SSM_TRACE_COUNTER(name, delta) (void)0
+#define SSM_TRACE_PHASE(name, ns) (void)0
+#else
+#define SSM_TRACE_SCOPE(name) const ::ssm::trace::span SSM_TRACE_CONCAT(ssm_trace_span_, __LINE__)(name)
+#define SSM_TRACE_COUNTER(name, delta) ::ssm::trace::counter(name, delta)
+#define SSM_TRACE_PHASE(name, ns) ::ssm::trace::phase(name, ns)
+#endif // SSM_NO_TRACE
+
+#endif // SSM_TRACE_HPP
@@ -0,0 +1,36 @@
+#ifndef SSM_TRIGRAM_HPP
+#define SSM_TRIGRAM_HPP
+
+#include "common.hpp"
+#include "sqlite3.hpp"
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace ssm::trigram {
+
+// Posting lists of every 3-byte sequence in the snippet contents, stored in ssm.db next to the `file` table. A file
+// can only contain a string if it contains each of the string's trigrams, so intersecting their lists narrows a
+// search to a handful of files before any of them is read.
+//
+// Lists hold document ids, ascending, as varint deltas. Reindexing a file gives it a new document id, always
+// the largest so far, so an update only ever appends to the end of a list. The old id is left behind as a dead
+// entry that lookups skip. Once dead ids outnumber live ones, the lists are rewritten without them.
+
+// Creates the tables and indexes the current content of every row of `file`, inside the caller's transaction. Run
+// once per database by ssm::schema::migrate.
+bool build(const ssm_sqlite3::database& sqlite);
+
+// Keep the index in step with `file` and the files on disk, inside the same transaction as the change.
+// `index_file` also replaces whatever was indexed for `file_id` before
+bool index_file(const ssm_sqlite3::database& sqlite, i64 file_id, std::string_view content);
+bool remove_file(const ssm_sqlite3::database& sqlite, i64 file_id);
+
+// Ids of the files that may contain `literal`, ascending. std::nullopt when it is shorter than a trigram and the
+// index cannot narrow anything down
+std::optional<std::vector<i64>> candidates(const ssm_sqlite3::database& sqlite, std::string_view literal);
+
+} // namespace ssm::trigram
+
+#endif // SSM_TRIGRAM_HPP
@@ -1,95 +1,298 @@
 #include "common.hpp"
 #include "cli.hpp"
 
+#include "arena.hpp"
+#include "fts.hpp"
+#include "sqlite3.hpp"
 #include "ssm.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
+#include <optional>
 #include <print>
+#include <string>
+#include <string_view>
+#include <vector>
 
-using utils::cli::Command;
-using utils::cli::arg;
+using utils::cli::ArgSpec;
+using utils::cli::CommandSpec;
+using utils::cli::arg_spec;
+using utils::cli::bind;
 
-int main(int argc, char* argv[]) {
-    const Command app = Command("ssm", "Simple Snippet Manager")
-        .subcommand_required()
-        .subcommand(Command("init", "Initialize ssm directory and database"))
-        .subcommand(Command("new", "Create a new snippet")
-            .arg(arg("<NAME>")
-                .about("Name of the snippet")))
-        .subcommand(Command("ls", "List all snippets"))
-        .subcommand(Command("rm", "Remove a snippet")
-            .arg(arg("<NAME>")
-                .about("Name of the snippet to remove")))
-        .subcommand(Command("get", "Get a snippet's content")
-            .arg(arg("<SNIPPET>")
-                .about("Name or number of the snippet to get")))
-        .subcommand(Command("edit", "Edit a snippet")
-            .arg(arg("<SNIPPET>")
-                .about("Name or number of the snippet to edit")));
-
-    const auto [matches, err] = app.get_matches(argc, argv);
+namespace {
+
+int init_command() {
+    SSM_TRACE_SCOPE("cmd.init");
+    return ssm::ssm_init() ? 0 : 1;
+}
+
+int new_command(const std::string& name) {
+    SSM_TRACE_SCOPE("cmd.new");
+    return ssm::create_snippet(name) ? 0 : 1;
+}
+
+int ls_command() {
+    SSM_TRACE_SCOPE("cmd.ls");
+    ssm::list_snippets();
+    return 0;
+}
+
+int rm_command(const std::vector<std::string_view>& snippets) {
+    SSM_TRACE_SCOPE("cmd.rm");
+    return ssm::remove_snippets(snippets) ? 0 : 1;
+}
+
+int get_command(const std::vector<std::string_view>& snippets, const std::string_view separator, const bool header,
+                const std::string_view pipe, const bool fuzzy) {
+    SSM_TRACE_SCOPE("cmd.get");
+    return ssm::get_snippets(snippets, {.separator = separator, .headers = header, .pipe = pipe, .fuzzy = fuzzy}) ? 0 : 1;
+}
+
+int edit_command(const std::vector<std::string_view>& snippets, const bool fuzzy) {
+    SSM_TRACE_SCOPE("cmd.edit");
+    return ssm::edit_snippets(snippets, fuzzy) ? 0 : 1;
+}
+
+int grep_command(const std::string_view pattern, const bool files_only, const bool regex, const bool no_index,
+                 const unsigned jobs) {
+    SSM_TRACE_SCOPE("cmd.grep");
+    const ssm::grep_options options = {.files_only = files_only, .regex = regex, .no_index = no_index, .threads = jobs};
+    return ssm::grep_snippets(pattern, options) ? 0 : 1;
+}
+
+int search_command(const std::vector<std::string_view>& terms) {
+    SSM_TRACE_SCOPE("cmd.search");
+    return ssm::search_snippets(terms) ? 0 : 1;
+}
+
+int similar_command(const std::string_view name, const unsigned limit) {
+    SSM_TRACE_SCOPE("cmd.similar");
+    return ssm::similar_snippets(name, limit) ? 0 : 1;
+}
+
+int dups_command(const double threshold) {
+    SSM_TRACE_SCOPE("cmd.dups");
+    return ssm::find_duplicates(threshold) ? 0 : 1;
+}
+
+int sym_command(const std::string_view prefix) {
+    SSM_TRACE_SCOPE("cmd.sym");
+    return ssm::find_symbols(prefix) ? 0 : 1;
+}
+
+int pick_command(const std::optional<std::string_view> query, const bool edit) {
+    SSM_TRACE_SCOPE("cmd.pick");
+    return ssm::pick_snippet(query.value_or(""), edit) ? 0 : 1;
+}
+
+int stats_command() {
+    SSM_TRACE_SCOPE("cmd.stats");
+    return ssm::stats::report() ? 0 : 1;
+}
+
+int debug_sql_command(std::vector<std::string> command);
 
+constexpr ArgSpec NEW_ARGS[] = {
+    arg_spec("<NAME>")
+        .about("Name of the snippet"),
+};
+
+constexpr ArgSpec RM_ARGS[] = {
+    arg_spec("<SNIPPETS>...")
+        .about("Names, numbers, ranges (3-10) or globs of the snippets to remove"),
+};
+
+constexpr ArgSpec GET_ARGS[] = {
+    arg_spec("<SNIPPETS>...")
+        .about("Names, numbers, ranges (3-10) or globs of the snippets to get"),
+    arg_spec("-H --header")
+        .about("Print a '==> name <==' header before each snippet"),
+    arg_spec("-s --separator <SEP>")
+        .about("Text written between consecutive snippets"),
+    arg_spec("-p --pipe <COMMAND>")
+        .about("Stream the snippets into a pipeline like 'jq . | less' instead of stdout"),
+    arg_spec("-f --fuzzy")
+        .about("Take each snippet as a fuzzy query, like deplk8s for deploy-k8s"),
+};
+
+constexpr ArgSpec EDIT_ARGS[] = {
+    arg_spec("<SNIPPETS>...")
+        .about("Names, numbers, ranges (3-10) or globs of the snippets to edit"),
+    arg_spec("-f --fuzzy")
+        .about("Take each snippet as a fuzzy query, like deplk8s for deploy-k8s"),
+};
+
+constexpr ArgSpec GREP_ARGS[] = {
+    arg_spec("<PATTERN>")
+        .about("Text to search snippet contents for, matched literally unless -E is given"),
+    arg_spec("-l --files-with-matches")
+        .about("Print only the names of matching snippets"),
+    arg_spec("-E --regex")
+        .about("Take PATTERN as a regular expression, e.g. 'image\\.tag=v[0-9]+'"),
+    arg_spec("--no-index")
+        .about("Scan every snippet instead of narrowing through the index"),
+    arg_spec("-j --jobs <N>")
+        .about("Threads to scan with, one per core by default"),
+};
+
+constexpr ArgSpec SEARCH_ARGS[] = {
+    arg_spec("<TERMS>...")
+        .trailing()
+        .about("Words, identifiers, flags or paths the snippet must contain, `getsnip*` for a prefix"),
+};
+
+constexpr ArgSpec SIMILAR_ARGS[] = {
+    arg_spec("<NAME>")
+        .about("Name of the snippet to find others like"),
+    arg_spec("-n --limit <N>")
+        .default_value("10")
+        .about("How many snippets to list at most"),
+};
+
+constexpr ArgSpec DUPS_ARGS[] = {
+    arg_spec("-t --threshold <T>")
+        .default_value("0.8")
+        .about("Least similarity, between 0 and 1, for two snippets to count as duplicates"),
+};
+
+constexpr ArgSpec SYM_ARGS[] = {
+    arg_spec("<PREFIX>")
+        .about("Start of the function, alias, table or resource name, e.g. deploy_"),
+};
+
+constexpr ArgSpec PICK_ARGS[] = {
+    arg_spec("[QUERY]")
+        .about("Fuzzy query to start from, refined by typing"),
+    arg_spec("-e --edit")
+        .about("Open the picked snippet in the editor instead of printing it"),
+};
+
+constexpr ArgSpec DEBUG_SQL_ARGS[] = {
+    arg_spec("<COMMAND>...")
+        .trailing()
+        .about("ssm command line to profile, e.g. `get 3`"),
+};
+
+constexpr CommandSpec DEBUG_COMMANDS[] = {
+    {
+        .name = "sql",
+        .description = "Run a command and report every SQL statement it executed",
+        .args = DEBUG_SQL_ARGS,
+        .handler = bind<&debug_sql_command, "COMMAND">,
+    },
+};
+
+constexpr CommandSpec SSM_COMMANDS[] = {
+    {.name = "init", .description = "Initialize ssm directory and database", .handler = bind<&init_command>},
+    {.name = "new", .description = "Create a new snippet", .args = NEW_ARGS, .handler = bind<&new_command, "NAME">},
+    {.name = "ls", .description = "List all snippets", .handler = bind<&ls_command>},
+    {.name = "rm", .description = "Remove snippets", .args = RM_ARGS, .handler = bind<&rm_command, "SNIPPETS">},
+    {
+        .name = "get",
+        .description = "Get snippets' content",
+        .args = GET_ARGS,
+        .handler = bind<&get_command, "SNIPPETS", "separator", "header", "pipe", "fuzzy">,
+    },
+    {.name = "edit", .description = "Edit snippets", .args = EDIT_ARGS, .handler = bind<&edit_command, "SNIPPETS", "fuzzy">},
+    {
+        .name = "grep",
+        .description = "Search snippet contents",
+        .args = GREP_ARGS,
+        .handler = bind<&grep_command, "PATTERN", "files-with-matches", "regex", "no-index", "jobs">,
+    },
+    {
+        .name = "search",
+        .description = "Find snippets by the words, identifiers and flags in them",
+        .args = SEARCH_ARGS,
+        .handler = bind<&search_command, "TERMS">,
+    },
+    {
+        .name = "similar",
+        .description = "List the snippets whose contents are most like a snippet's",
+        .args = SIMILAR_ARGS,
+        .handler = bind<&similar_command, "NAME", "limit">,
+    },
+    {
+        .name = "dups",
+        .description = "Group snippets that are near-duplicates of each other",
+        .args = DUPS_ARGS,
+        .handler = bind<&dups_command, "threshold">,
+    },
+    {
+        .name = "sym",
+        .description = "Find the snippets that define a symbol",
+        .args = SYM_ARGS,
+        .handler = bind<&sym_command, "PREFIX">,
+    },
+    {
+        .name = "pick",
+        .description = "Pick a snippet by typing a fuzzy query, then print or edit it",
+        .args = PICK_ARGS,
+        .handler = bind<&pick_command, "QUERY", "edit">,
+    },
+    {.name = "stats", .description = "Show latency percentiles and store growth", .handler = bind<&stats_command>},
+    {.name = "debug", .description = "Debugging tools", .subcommands = DEBUG_COMMANDS, .subcommand_required = true},
+};
+
+constexpr CommandSpec SSM = {
+    .name = "ssm",
+    .description = "Simple Snippet Manager",
+    .subcommands = SSM_COMMANDS,
+    .subcommand_required = true,
+    .response_files = true,
+};
+
+// Flag tables and help text for the whole tree are generated at compile time
+using Cli = utils::cli::Schema<SSM>;
+
+// `ssm debug sql <COMMAND>...` runs the nested command line with every database connection profiled
+int debug_sql_command(std::vector<std::string> command) {
+    if (!command.empty() && command.front() == "debug") {
+        std::println(stderr, "Cannot nest debug commands");
+        return 1;
+    }
+
+    std::string program(Cli::name());
+    std::vector<char*> argv;
+    argv.reserve(command.size() + 1);
+    argv.push_back(program.data());
+    for (std::string& a : command) argv.push_back(a.data());
+
+    const auto [inner, err] = Cli::get_matches(static_cast<int>(argv.size()), argv.data(), ssm::mem::cli_resource());
     if (err.has_error()) {
         std::println(stderr, "Error parsing arguments: {}", err.message);
-        app.print_help();
         return 1;
     }
 
-    if (matches.get_flag("help")) {
-        app.print_help();
-        return 0;
-    }
+    ssm_sqlite3::profiler::instance().enable();
+    const int status = inner.dispatch();
+    ssm_sqlite3::profiler::instance().report(stderr);
+    return status;
+}
+
+} // namespace
 
-    if (matches.subcommand().has_value()) {
-        const auto [subcmd_name, subcmd_matches] = *matches.subcommand();
-
-        if (subcmd_matches->get_flag("help")) {
-            for (const Command& subcmd : app.subcommands()) {
-                if (subcmd.name() == subcmd_name) {
-                    subcmd.print_help();
-                    return 0;
-                }
-            }
-        }
-
-        if (subcmd_name == "init") {
-            return ssm::ssm_init() ? 0 : 1;
-        }
-        if (subcmd_name == "new") {
-            const std::string name = *subcmd_matches->get_one("NAME");
-            return ssm::create_snippet(name) ? 0 : 1;
-        }
-        if (subcmd_name == "ls") {
-            ssm::list_snippets();
-            return 0;
-        }
-        if (subcmd_name == "rm") {
-            const std::string name = *subcmd_matches->get_one("NAME");
-            return ssm::remove_snippet(name) ? 0 : 1;
-        }
-        if (subcmd_name == "get") {
-            if (const auto number_opt = subcmd_matches->get_one<int>("SNIPPET"); number_opt.has_value()) {
-                return ssm::get_snippet(*number_opt) ? 0 : 1;
-            }
-            if (const auto name_opt = subcmd_matches->get_one("SNIPPET"); name_opt.has_value()) {
-                return ssm::get_snippet(*name_opt) ? 0 : 1;
-            }
-            UNREACHABLE();
-        }
-        if (subcmd_name == "edit") {
-            if (const auto number_opt = subcmd_matches->get_one<int>("SNIPPET"); number_opt.has_value()) {
-                return ssm::edit_snippet(*number_opt) ? 0 : 1;
-            }
-            if (const auto name_opt = subcmd_matches->get_one("SNIPPET"); name_opt.has_value()) {
-                return ssm::edit_snippet(*name_opt) ? 0 : 1;
-            }
-            UNREACHABLE();
-        }
-
-        std::println(stderr, "Unknown subcommand: {}", subcmd_name);
-        app.print_help();
+int main(int argc, char* argv[]) {
+    const ssm::mem::runtime memory;
+    if (!ssm::fts::install()) std::println(stderr, "Failed to register the full-text tokenizer");
+    const bool record_stats = ssm::stats::sampled();
+    const ssm::trace::session trace_session(record_stats);
+    SSM_TRACE_SCOPE("ssm");
+
+    const auto [matches, err] = [&] {
+        SSM_TRACE_SCOPE("cli.parse");
+        return Cli::get_matches(argc, argv, ssm::mem::cli_resource());
+    }();
+
+    if (err.has_error()) {
+        std::println(stderr, "Error parsing arguments: {}", err.message);
+        Cli::print_help();
         return 1;
     }
 
-    app.print_help();
-    return 0;
+    const int status = matches.dispatch();
+    if (const auto subcommand = matches.subcommand(); record_stats && subcommand.has_value()) {
+        ssm::stats::record(subcommand->first, trace_session.elapsed_ns());
+    }
+    return status;
 }
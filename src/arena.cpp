@@ -0,0 +1,365 @@
+#include "arena.hpp"
+
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string_view>
+
+#ifdef SSM_ALLOC_STATS
+#include <atomic>
+#include <print>
+#endif
+
+namespace {
+
+constexpr std::size_t SQLITE_BLOCK_SIZE = 256 * 1024;
+constexpr std::size_t SQLITE_ARENA_CAP = 64 * 1024 * 1024; // past this SQLite goes back to malloc
+constexpr std::size_t SQLITE_HEAP_SIZE = 16 * 1024 * 1024;
+constexpr std::size_t SQLITE_HEADER = sizeof(u64);
+
+std::uintptr_t align_up(const std::uintptr_t n, const std::size_t alignment) {
+    return (n + alignment - 1) & ~(alignment - 1);
+}
+
+ssm::mem::arena& cli_arena() {
+    static ssm::mem::arena a;
+    return a;
+}
+
+bool cli_arena_active = false;
+
+// SQLITE_CONFIG_MALLOC backend. SQLite may allocate from several threads, so the arena sits behind a mutex. Every
+// allocation is prefixed with its rounded size, shifted left by one, with the low bit set when it came from malloc.
+struct sqlite_backend {
+    std::mutex mutex;
+    ssm::mem::arena arena{SQLITE_BLOCK_SIZE};
+    u64 mallocs = 0;
+    u64 reallocs = 0;
+    u64 frees = 0;
+    u64 fallbacks = 0;
+};
+
+sqlite_backend& backend() {
+    static sqlite_backend b;
+    return b;
+}
+
+u64 sqlite_tag(void* p) {
+    u64 tag = 0;
+    std::memcpy(&tag, static_cast<std::byte*>(p) - SQLITE_HEADER, SQLITE_HEADER);
+    return tag;
+}
+
+void* sqlite_tagged(std::byte* raw, const u64 tag) {
+    std::memcpy(raw, &tag, SQLITE_HEADER);
+    return raw + SQLITE_HEADER;
+}
+
+void* sqlite_malloc(const int n) {
+    sqlite_backend& b = backend();
+    const std::size_t size = align_up(static_cast<std::size_t>(n), 8);
+
+    std::byte* raw = nullptr;
+    {
+        const std::scoped_lock lock(b.mutex);
+        ++b.mallocs;
+        if (b.arena.statistics().block_bytes < SQLITE_ARENA_CAP) {
+            raw = static_cast<std::byte*>(b.arena.try_allocate(size + SQLITE_HEADER, 8));
+        }
+        if (raw == nullptr) ++b.fallbacks;
+    }
+    if (raw != nullptr) return sqlite_tagged(raw, u64{size} << 1);
+
+    raw = static_cast<std::byte*>(std::malloc(size + SQLITE_HEADER));
+    return raw == nullptr ? nullptr : sqlite_tagged(raw, (u64{size} << 1) | 1);
+}
+
+void sqlite_free(void* p) {
+    if (p == nullptr) return;
+    sqlite_backend& b = backend();
+    std::byte* raw = static_cast<std::byte*>(p) - SQLITE_HEADER;
+    const u64 tag = sqlite_tag(p);
+
+    const std::scoped_lock lock(b.mutex);
+    ++b.frees;
+    if ((tag & 1) != 0) {
+        std::free(raw);
+    } else {
+        b.arena.free(raw, (tag >> 1) + SQLITE_HEADER);
+    }
+}
+
+int sqlite_size(void* p) {
+    return p == nullptr ? 0 : static_cast<int>(sqlite_tag(p) >> 1);
+}
+
+void* sqlite_realloc(void* p, const int n) {
+    sqlite_backend& b = backend();
+    std::byte* raw = static_cast<std::byte*>(p) - SQLITE_HEADER;
+    const u64 tag = sqlite_tag(p);
+    const std::size_t old_size = tag >> 1;
+    const std::size_t size = align_up(static_cast<std::size_t>(n), 8);
+    if (size <= old_size) return p;
+
+    if ((tag & 1) != 0) {
+        auto* grown = static_cast<std::byte*>(std::realloc(raw, size + SQLITE_HEADER));
+        {
+            const std::scoped_lock lock(b.mutex);
+            ++b.reallocs;
+        }
+        return grown == nullptr ? nullptr : sqlite_tagged(grown, (u64{size} << 1) | 1);
+    }
+
+    {
+        const std::scoped_lock lock(b.mutex);
+        ++b.reallocs;
+        if (b.arena.try_extend(raw, old_size + SQLITE_HEADER, size + SQLITE_HEADER)) {
+            return sqlite_tagged(raw, u64{size} << 1);
+        }
+    }
+
+    void* moved = sqlite_malloc(n);
+    if (moved == nullptr) return nullptr;
+    std::memcpy(moved, p, old_size);
+    sqlite_free(p);
+    return moved;
+}
+
+int sqlite_roundup(const int n) {
+    return static_cast<int>(align_up(static_cast<std::size_t>(n), 8));
+}
+
+int sqlite_init(void*) {
+    return SQLITE_OK;
+}
+
+void sqlite_shutdown(void*) {}
+
+const sqlite3_mem_methods sqlite_methods = {
+    sqlite_malloc, sqlite_free, sqlite_realloc, sqlite_size, sqlite_roundup, sqlite_init, sqlite_shutdown, nullptr,
+};
+
+void* sqlite_heap = nullptr;
+
+#ifdef SSM_ALLOC_STATS
+std::atomic<u64> new_calls;
+std::atomic<u64> new_bytes;
+std::atomic<u64> delete_calls;
+
+void print_stats(const std::string_view mode) {
+    std::println(stderr, "Allocation stats (SSM_ALLOC={})", mode);
+    std::println(stderr, "  operator new     {} calls, {} bytes, {} deletes", new_calls.load(), new_bytes.load(),
+                 delete_calls.load());
+
+    const ssm::mem::arena::stats& cli = cli_arena().statistics();
+    std::println(stderr, "  cli arena        {} allocations, {} bytes in {} blocks", cli.allocations, cli.bytes,
+                 cli.blocks);
+
+    sqlite_backend& b = backend();
+    const ssm::mem::arena::stats& sql = b.arena.statistics();
+    std::println(stderr, "  sqlite backend   {} mallocs ({} from malloc), {} reallocs, {} frees", b.mallocs,
+                 b.fallbacks, b.reallocs, b.frees);
+    std::println(stderr, "  sqlite arena     {} allocations, {} rolled back, {} bytes in {} blocks", sql.allocations,
+                 sql.rollbacks, sql.bytes, sql.blocks);
+
+    sqlite3_int64 current = 0;
+    sqlite3_int64 peak = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &peak, 0);
+    sqlite3_int64 count = 0;
+    sqlite3_int64 peak_count = 0;
+    sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &count, &peak_count, 0);
+    std::println(stderr, "  sqlite peak      {} bytes in {} outstanding allocations", peak, peak_count);
+}
+#endif // SSM_ALLOC_STATS
+
+std::string_view alloc_mode() {
+    const char* env = std::getenv("SSM_ALLOC");
+    return env == nullptr || env[0] == '\0' ? "arena" : env;
+}
+
+} // namespace
+
+#ifdef SSM_ALLOC_STATS
+void* operator new(const std::size_t size) {
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    new_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size); p != nullptr) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(const std::size_t size, const std::align_val_t alignment) {
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    new_bytes.fetch_add(size, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, align_up(size == 0 ? 1 : size, align)); p != nullptr) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    if (p != nullptr) delete_calls.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    operator delete(p);
+}
+#endif // SSM_ALLOC_STATS
+
+namespace ssm::mem {
+
+arena::arena(const std::size_t block_size) noexcept : block_size_(block_size) {}
+
+arena::~arena() {
+    release();
+}
+
+bool arena::grow(const std::size_t bytes, const std::size_t alignment) noexcept {
+    const std::size_t needed = sizeof(block) + alignment + bytes;
+    const bool dedicated = needed > block_size_ / 4 && cursor_ != nullptr;
+    const std::size_t size = std::max(block_size_, needed);
+
+    void* mem = std::malloc(size);
+    if (mem == nullptr) return false;
+    ++stats_.blocks;
+    stats_.block_bytes += size;
+
+    auto* b = ::new (mem) block{.prev = nullptr, .size = size};
+    auto* first = reinterpret_cast<std::byte*>(b + 1);
+
+    // Large requests get a block of their own behind the current one, so the space left there is not wasted
+    if (dedicated) {
+        b->prev = head_->prev;
+        head_->prev = b;
+        return true;
+    }
+
+    b->prev = head_;
+    head_ = b;
+    cursor_ = first;
+    end_ = static_cast<std::byte*>(mem) + size;
+    last_ = nullptr;
+    return true;
+}
+
+void* arena::try_allocate(const std::size_t bytes, const std::size_t alignment) noexcept {
+    auto aligned = align_up(reinterpret_cast<std::uintptr_t>(cursor_), alignment);
+    if (cursor_ == nullptr || aligned + bytes > reinterpret_cast<std::uintptr_t>(end_)) {
+        const block* before = head_;
+        if (!grow(bytes, alignment)) return nullptr;
+
+        if (head_ == before) {
+            // Dedicated block, it is the one right behind the head
+            ++stats_.allocations;
+            stats_.bytes += bytes;
+            auto* first = reinterpret_cast<std::byte*>(head_->prev + 1);
+            return reinterpret_cast<void*>(align_up(reinterpret_cast<std::uintptr_t>(first), alignment));
+        }
+        aligned = align_up(reinterpret_cast<std::uintptr_t>(cursor_), alignment);
+    }
+
+    auto* p = reinterpret_cast<std::byte*>(aligned);
+    ++stats_.allocations;
+    stats_.bytes += static_cast<u64>(p + bytes - cursor_);
+    last_ = p;
+    cursor_ = p + bytes;
+    return p;
+}
+
+void arena::free(void* p, const std::size_t bytes) noexcept {
+    ++stats_.deallocations;
+    auto* ptr = static_cast<std::byte*>(p);
+    if (ptr != nullptr && ptr == last_ && ptr + bytes == cursor_) {
+        cursor_ = last_;
+        last_ = nullptr;
+        ++stats_.rollbacks;
+    }
+}
+
+bool arena::try_extend(void* p, const std::size_t old_bytes, const std::size_t new_bytes) noexcept {
+    auto* ptr = static_cast<std::byte*>(p);
+    if (ptr == nullptr || ptr != last_ || ptr + old_bytes != cursor_ || new_bytes > static_cast<std::size_t>(end_ - ptr)) {
+        return false;
+    }
+    stats_.bytes += new_bytes - old_bytes;
+    cursor_ = ptr + new_bytes;
+    return true;
+}
+
+void arena::release() noexcept {
+    while (head_ != nullptr) {
+        block* prev = head_->prev;
+        std::free(head_);
+        head_ = prev;
+    }
+    cursor_ = nullptr;
+    end_ = nullptr;
+    last_ = nullptr;
+}
+
+void* arena::do_allocate(const std::size_t bytes, const std::size_t alignment) {
+    void* p = try_allocate(bytes, alignment);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void arena::do_deallocate(void* p, const std::size_t bytes, std::size_t) {
+    free(p, bytes);
+}
+
+bool arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+runtime::runtime() {
+    const std::string_view mode = alloc_mode();
+    if (mode == "system") return;
+
+    // Both calls only succeed before SQLite initializes, which is why this runs first thing in main
+    bool configured = false;
+    if (mode == "heap") {
+        sqlite_heap = std::malloc(SQLITE_HEAP_SIZE);
+        configured = sqlite_heap != nullptr &&
+                     sqlite3_config(SQLITE_CONFIG_HEAP, sqlite_heap, static_cast<int>(SQLITE_HEAP_SIZE), 64) == SQLITE_OK;
+        if (!configured) {
+            std::free(sqlite_heap);
+            sqlite_heap = nullptr;
+        }
+    }
+    if (!configured) sqlite3_config(SQLITE_CONFIG_MALLOC, &sqlite_methods);
+
+    configured_ = true;
+    cli_arena_active = true;
+}
+
+runtime::~runtime() {
+#ifdef SSM_ALLOC_STATS
+    print_stats(alloc_mode());
+#endif
+    if (!configured_) return;
+
+    // SQLite keeps pointers into its arena until it is shut down
+    sqlite3_shutdown();
+    cli_arena_active = false;
+    cli_arena().release();
+    std::free(sqlite_heap);
+    sqlite_heap = nullptr;
+}
+
+std::pmr::memory_resource* cli_resource() noexcept {
+    return cli_arena_active ? &cli_arena() : std::pmr::new_delete_resource();
+}
+
+} // namespace ssm::mem
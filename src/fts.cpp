@@ -0,0 +1,337 @@
+#include "fts.hpp"
+
+#include "search.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <string>
+
+namespace {
+
+constexpr auto TOKENIZER_NAME = "ssm_code";
+
+// Longer tokens are cut to this, in documents and queries alike, so a line of base64 is one modest token rather than
+// a huge one and a query for it still finds it
+constexpr std::size_t MAX_TOKEN_BYTES = 64;
+
+// Tails indexed per path, so a long path adds a bounded number of tokens
+constexpr std::size_t MAX_PATH_TAILS = 4;
+
+// Contentless, the snippets are files on disk and need no second copy. No prefix indexes: they would make indexing
+// close to twice as slow, and a prefix query over a few thousand snippets is fast without one
+constexpr auto create_table = R"(
+    CREATE VIRTUAL TABLE IF NOT EXISTS content_fts USING fts5(
+        content,
+        tokenize = 'ssm_code',
+        content = '',
+        contentless_delete = 1
+    );
+    )";
+
+// What each byte is to the tokenizer, looked up rather than computed since every byte of a snippet is classified
+enum byte_class : u8 {
+    WORD = 1,   // letters, digits, '_' and every byte of a UTF-8 sequence, so other scripts stay in whole words
+    JOINER = 2, // holds a flag or a path together: `--dry-run`, `./dist/`, `~/.kube/config`
+    UPPER = 4,
+    LOWER = 8,
+    DIGIT = 16,
+    UNDERSCORE = 32,
+    SLASH = 64,
+};
+
+constexpr std::array<u8, 256> CLASSES = [] {
+    std::array<u8, 256> classes{};
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        if (c >= 'A' && c <= 'Z') classes[c] = WORD | UPPER;
+        if (c >= 'a' && c <= 'z') classes[c] = WORD | LOWER;
+        if (c >= '0' && c <= '9') classes[c] = WORD | DIGIT;
+        if (c >= 0x80) classes[c] = WORD;
+        if (c == '-' || c == '.' || c == '~') classes[c] = JOINER;
+    }
+    classes['_'] = WORD | UNDERSCORE;
+    classes['/'] = JOINER | SLASH;
+    return classes;
+}();
+
+u8 class_of(const char c) noexcept {
+    return CLASSES[static_cast<u8>(c)];
+}
+
+// An identifier with more subtokens than this keeps the rest together in its last one
+constexpr std::size_t MAX_SUBTOKENS = 16;
+
+struct span {
+    std::size_t begin;
+    std::size_t end;
+};
+
+// Splits the identifier starting at `begin`, which runs up to the first byte before `end` that is not a word byte,
+// into subtokens. Returns where it ends and fills in `subtokens`, setting `count`. A new subtoken starts after an
+// underscore, at an upper case letter after a lower case one (snippetImpl), and at the last of a run of upper case
+// letters or digits when a lower case one follows it (HTTPServer, Base64Encode). Other digits stay with the letters
+// around them, so k8s and utf8 are one subtoken
+std::size_t split_identifier(const std::string_view text, const std::size_t begin, const std::size_t end,
+                             std::array<span, MAX_SUBTOKENS>& subtokens, std::size_t& count) {
+    count = 0;
+    std::size_t start = begin;
+    u8 previous = 0;
+    std::size_t i = begin;
+    for (; i < end; ++i) {
+        const u8 current = class_of(text[i]);
+        if ((current & WORD) == 0) break;
+        if ((current & UNDERSCORE) != 0) {
+            if (i > start && count + 1 < MAX_SUBTOKENS) subtokens[count++] = {.begin = start, .end = i};
+            if (count + 1 < MAX_SUBTOKENS) start = i + 1;
+        } else if ((current & UPPER) != 0 && i > start && count + 1 < MAX_SUBTOKENS &&
+                   ((previous & LOWER) != 0 ||
+                    ((previous & (UPPER | DIGIT)) != 0 && i + 1 < end && (class_of(text[i + 1]) & LOWER) != 0))) {
+            subtokens[count++] = {.begin = start, .end = i};
+            start = i;
+        }
+        previous = current;
+    }
+    if (start < i) subtokens[count++] = {.begin = start, .end = i};
+    return i;
+}
+
+// Builds tokens case folded and cut to MAX_TOKEN_BYTES in place, and hands them on
+template <typename Emit>
+class emitter {
+public:
+    emitter(const std::string_view text, Emit& emit) : text_(text), emit_(emit) {}
+
+    // A subtoken, or the parts of an identifier run together without their underscores
+    bool put(const std::size_t begin, const std::size_t end, const bool colocated) {
+        return put(begin, end, colocated, false);
+    }
+
+    // A flag or a path as written, underscores and all: `--log_level`, `/opt/my_app`
+    bool put_whole(const std::size_t begin, const std::size_t end, const bool colocated) {
+        return put(begin, end, colocated, true);
+    }
+
+    // Text that is already a token, a lower case word, needs no copy
+    bool put_as_is(const std::size_t begin, const std::size_t end) {
+        const std::size_t size = std::min(end - begin, MAX_TOKEN_BYTES);
+        return emit_(ssm::fts::token{.text = text_.substr(begin, size), .begin = begin, .end = end, .colocated = false});
+    }
+
+private:
+    std::string_view text_;
+    Emit& emit_;
+    std::array<char, MAX_TOKEN_BYTES> buffer_{};
+
+    bool put(const std::size_t begin, const std::size_t end, const bool colocated, const bool underscores) {
+        std::size_t size = 0;
+        for (std::size_t i = begin; i < end && size < buffer_.size(); ++i) {
+            const char c = text_[i];
+            if (c == '_' && !underscores) continue;
+            buffer_[size++] = (class_of(c) & UPPER) != 0 ? static_cast<char>(c | 0x20) : c;
+        }
+        if (size == 0) return true;
+        return emit_(ssm::fts::token{.text = {buffer_.data(), size}, .begin = begin, .end = end, .colocated = colocated});
+    }
+};
+
+// A run of word and joiner bytes with at least one word byte and no joiners at its end, `--dry-run` or
+// `deploy/web.yml`. `seen` has the classes of all its bytes
+template <typename Emit>
+bool tokenize_chunk(const std::string_view text, const std::size_t begin, const std::size_t end, const u8 seen,
+                    const ssm::fts::mode mode, emitter<Emit>& out) {
+    // Most chunks are plain lower case words, with nothing to split
+    if ((seen & (UPPER | UNDERSCORE | JOINER)) == 0) return out.put_as_is(begin, end);
+
+    // Flags and paths start with a joiner, identifiers and dotted names do not. A query looks for a flag or a path
+    // as a whole, a document has it under its parts as well
+    const bool whole = (class_of(text[begin]) & JOINER) != 0;
+    if (mode == ssm::fts::mode::query && whole) return out.put_whole(begin, end, false);
+
+    std::array<span, MAX_SUBTOKENS> subtokens;
+    bool first_in_chunk = true;
+    for (std::size_t part = begin; part < end;) {
+        std::size_t count = 0;
+        const std::size_t part_end = split_identifier(text, part, end, subtokens, count);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!out.put(subtokens[i].begin, subtokens[i].end, false)) return false;
+            if (i > 0 || mode == ssm::fts::mode::query) continue;
+
+            // Other spellings of the whole part and chunk sit at the position of their first subtoken
+            if (count > 1 && !out.put(part, part_end, true)) return false;
+            if (!first_in_chunk) continue;
+            first_in_chunk = false;
+
+            if (whole && !out.put_whole(begin, end, true)) return false;
+            std::size_t tails = 0;
+            for (std::size_t slash = begin + 1; (seen & SLASH) != 0 && slash < end && tails < MAX_PATH_TAILS; ++slash) {
+                if (text[slash] != '/') continue;
+                ++tails;
+                if (!out.put_whole(slash, end, true)) return false;
+            }
+        }
+        part = part_end + 1;
+    }
+    return true;
+}
+
+template <typename Emit>
+bool tokenize_text(const std::string_view text, const ssm::fts::mode mode, Emit&& emit) {
+    emitter<Emit> out(text, emit);
+    for (std::size_t i = 0; i < text.size();) {
+        if ((class_of(text[i]) & (WORD | JOINER)) == 0) {
+            ++i;
+            continue;
+        }
+
+        std::size_t end = i;
+        u8 seen = 0;
+        for (; end < text.size(); ++end) {
+            const u8 byte_class = class_of(text[end]);
+            if ((byte_class & (WORD | JOINER)) == 0) break;
+            seen |= byte_class;
+        }
+        const std::size_t next = end;
+        while ((class_of(text[end - 1]) & JOINER) != 0) --end;
+
+        // Runs of dashes and dots alone, `--` and `...`, say nothing
+        if ((seen & WORD) != 0 && !tokenize_chunk(text, i, end, seen, mode, out)) return false;
+        i = next;
+    }
+    return true;
+}
+
+int create_tokenizer(void*, const char**, int, Fts5Tokenizer** out) {
+    // Nothing to configure and no state between calls, so every table shares one instance
+    static int instance = 0;
+    *out = static_cast<Fts5Tokenizer*>(static_cast<void*>(&instance));
+    return SQLITE_OK;
+}
+
+void delete_tokenizer(Fts5Tokenizer*) {}
+
+int tokenize_for_sqlite(Fts5Tokenizer*, void* context, const int flags, const char* text, const int size, const char*,
+                        int, int (*token)(void*, int, const char*, int, int, int)) {
+    if (text == nullptr || size <= 0) return SQLITE_OK;
+
+    const ssm::fts::mode mode = (flags & FTS5_TOKENIZE_QUERY) != 0 ? ssm::fts::mode::query : ssm::fts::mode::document;
+    int ret = SQLITE_OK;
+    tokenize_text({text, static_cast<std::size_t>(size)}, mode, [&](const ssm::fts::token& t) {
+        ret = token(context, t.colocated ? FTS5_TOKEN_COLOCATED : 0, t.text.data(), static_cast<int>(t.text.size()),
+                    static_cast<int>(t.begin), static_cast<int>(t.end));
+        return ret == SQLITE_OK;
+    });
+    return ret;
+}
+
+fts5_tokenizer_v2 code_tokenizer = {
+    .iVersion = 2,
+    .xCreate = create_tokenizer,
+    .xDelete = delete_tokenizer,
+    .xTokenize = tokenize_for_sqlite,
+};
+
+// Connections to a SQLite without FTS5 are left as they are, the table cannot be created there anyway and says so
+int register_tokenizer(sqlite3* db, char**, const sqlite3_api_routines*) {
+    fts5_api* api = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1);", -1, &stmt, nullptr) != SQLITE_OK) return SQLITE_OK;
+    sqlite3_bind_pointer(stmt, 1, static_cast<void*>(&api), "fts5_api_ptr", nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (api == nullptr || api->iVersion < 3) return SQLITE_OK;
+    return api->xCreateTokenizer_v2(api, TOKENIZER_NAME, nullptr, &code_tokenizer, nullptr);
+}
+
+bool insert(const ssm_sqlite3::stmt_handle& stmt, const i64 file_id, const std::string_view content) {
+    // FTS5 tokenizes the text while the statement steps, so the caller's buffer can be bound without a copy
+    if (content.size() > INT_MAX || !ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) ||
+        sqlite3_bind_text(stmt.get(), 2, content.data(), static_cast<int>(content.size()), SQLITE_STATIC) != SQLITE_OK) {
+        return false;
+    }
+    const bool ok = sqlite3_step(stmt.get()) == SQLITE_DONE;
+    sqlite3_reset(stmt.get());
+    return ok;
+}
+
+// A term as an FTS5 string, which has no operators inside it: `"--dry-run"`, or `"getsnip"*` for `getsnip*`
+void quote_term(std::string_view term, std::string& out) {
+    const bool prefix = term.ends_with('*');
+    if (prefix) term.remove_suffix(1);
+    if (term.empty()) return;
+
+    if (!out.empty()) out.push_back(' ');
+    out.push_back('"');
+    for (const char c : term) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+    if (prefix) out.push_back('*');
+}
+
+} // namespace
+
+namespace ssm::fts {
+
+bool tokenize(const std::string_view text, const mode mode, const std::function<bool(const token&)>& emit) {
+    return tokenize_text(text, mode, emit);
+}
+
+bool install() {
+    return sqlite3_auto_extension(reinterpret_cast<void (*)()>(register_tokenizer)) == SQLITE_OK;
+}
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("fts.build");
+    if (!sqlite.exec(create_table)) return false;
+
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT id, path FROM file ORDER BY id;");
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("INSERT INTO content_fts (rowid, content) VALUES (?, ?);");
+    if (!select || !stmt) return false;
+
+    int ret = sqlite3_step(select.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(select.get())) {
+        const char* path = reinterpret_cast<const char*>(sqlite3_column_text(select.get(), 1));
+        if (path == nullptr) continue;
+        const search::mapped_file file(path);
+        if (!file.ok()) continue; // removed by hand, there is nothing to find in it
+        if (!insert(stmt, sqlite3_column_int64(select.get(), 0), file.text())) return false;
+    }
+    return ret == SQLITE_DONE;
+}
+
+bool index_file(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view content) {
+    SSM_TRACE_SCOPE("fts.index");
+    if (!remove_file(sqlite, file_id)) return false;
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("INSERT INTO content_fts (rowid, content) VALUES (?, ?);");
+    return stmt && insert(stmt, file_id, content);
+}
+
+bool remove_file(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("DELETE FROM content_fts WHERE rowid = ?;");
+    return stmt && ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) && sqlite3_step(stmt.get()) == SQLITE_DONE;
+}
+
+std::optional<std::vector<std::string>> search(const ssm_sqlite3::database& sqlite,
+                                               const std::span<const std::string_view> terms) {
+    SSM_TRACE_SCOPE("fts.search");
+    std::string query;
+    for (const std::string_view term : terms) quote_term(term, query);
+    if (query.empty()) return std::vector<std::string>{};
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(
+        "SELECT file.name FROM content_fts JOIN file ON file.id = content_fts.rowid "
+        "WHERE content_fts MATCH ? ORDER BY content_fts.rank, file.id;");
+    if (!stmt || !ssm_sqlite3::database::bind_text(stmt.get(), 1, query)) return std::nullopt;
+
+    std::vector<std::string> names;
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        names.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0)));
+    }
+    if (ret != SQLITE_DONE) return std::nullopt;
+    return names;
+}
+
+} // namespace ssm::fts
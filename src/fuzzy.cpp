@@ -0,0 +1,476 @@
+#include "fuzzy.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr i32 SCORE_MATCH = 16;
+constexpr i32 GAP_START = -3;
+constexpr i32 GAP_EXTENSION = -1;
+constexpr i32 BONUS_BOUNDARY = 8;
+constexpr i32 BONUS_CAMEL = 7;
+constexpr i32 BONUS_CONSECUTIVE = -(GAP_START + GAP_EXTENSION);
+constexpr i32 FIRST_CHAR_MULTIPLIER = 2;
+constexpr i32 UNREACHABLE_SCORE = std::numeric_limits<i32>::min() / 4;
+
+// Below this many names per thread, starting a thread costs more than it saves
+constexpr std::size_t MIN_NAMES_PER_THREAD = 64 * 1024;
+
+// Names up to this long are checked with vector compares, each query character costs one compare per 16 or 32
+// bytes and yields a bitmask of where it occurs
+constexpr std::size_t BLOCK_SIZE = 64;
+
+constexpr bool is_upper(const char c) noexcept {
+    return c >= 'A' && c <= 'Z';
+}
+
+constexpr bool is_lower(const char c) noexcept {
+    return c >= 'a' && c <= 'z';
+}
+
+constexpr bool is_digit(const char c) noexcept {
+    return c >= '0' && c <= '9';
+}
+
+constexpr char fold_case(const char c) noexcept {
+    return is_upper(c) ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// 64 name bytes, case-folded if asked, ready to be compared against one query character at a time
+class block {
+public:
+    block(const char* p, const bool fold) noexcept {
+#if defined(__AVX2__)
+        for (std::size_t i = 0; i < LANES; ++i) {
+            v_[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 32));
+            if (fold) {
+                const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v_[i], _mm256_set1_epi8('A' - 1)),
+                                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v_[i]));
+                v_[i] = _mm256_or_si256(v_[i], _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+            }
+        }
+#elif defined(__SSE2__)
+        for (std::size_t i = 0; i < LANES; ++i) {
+            v_[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16));
+            if (fold) {
+                const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v_[i], _mm_set1_epi8('A' - 1)),
+                                                    _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v_[i]));
+                v_[i] = _mm_or_si128(v_[i], _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+            }
+        }
+#else
+        for (std::size_t i = 0; i < BLOCK_SIZE; ++i) bytes_[i] = fold ? fold_case(p[i]) : p[i];
+#endif
+    }
+
+    // Bit i is set when byte i equals `c`
+    [[nodiscard]] u64 find(const char c) const noexcept {
+#if defined(__AVX2__)
+        const __m256i needle = _mm256_set1_epi8(c);
+        const auto lo = static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v_[0], needle)));
+        const auto hi = static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v_[1], needle)));
+        return u64{lo} | u64{hi} << 32;
+#elif defined(__SSE2__)
+        const __m128i needle = _mm_set1_epi8(c);
+        u64 mask = 0;
+        for (std::size_t i = 0; i < LANES; ++i) {
+            const auto bits = static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(v_[i], needle)));
+            mask |= u64{bits} << (i * 16);
+        }
+        return mask;
+#else
+        u64 mask = 0;
+        for (std::size_t i = 0; i < BLOCK_SIZE; ++i) mask |= u64{bytes_[i] == c} << i;
+        return mask;
+#endif
+    }
+
+private:
+#if defined(__AVX2__)
+    static constexpr std::size_t LANES = 2;
+    __m256i v_[LANES];
+#elif defined(__SSE2__)
+    static constexpr std::size_t LANES = 4;
+    __m128i v_[LANES];
+#else
+    std::array<char, BLOCK_SIZE> bytes_;
+#endif
+};
+
+// The bits of a block that hold a name `length` bytes long
+constexpr u64 length_mask(const std::size_t length) noexcept {
+    return length == BLOCK_SIZE ? ~u64{0} : (u64{1} << length) - 1;
+}
+
+// Greedy leftmost match: each query character takes its first occurrence after the previous one. Finding one is
+// necessary and sufficient for any alignment to exist, so the scorer only ever sees names that match.
+// Branch-free, a miss simply empties `allowed`, since names fail at unpredictable characters and each early exit
+// would cost a mispredict; only every few characters is it worth checking whether anything is left
+bool is_subsequence(const block& b, const std::string_view query, const std::size_t length) noexcept {
+    u64 allowed = length_mask(length);
+    for (std::size_t i = 0; i < query.size(); ++i) {
+        const u64 hits = b.find(query[i]) & allowed;
+        const u64 first = hits & (0 - hits);
+        // Clears the first hit and everything below it. No hit clears everything, and so does a hit at bit 63
+        allowed &= ~((first << 1) - 1);
+        if (i + 1 == query.size()) return hits != 0;
+        if (i % 4 == 3 && allowed == 0) return false;
+    }
+    return false;
+}
+
+bool is_subsequence(const std::string_view name, const std::string_view query, const bool fold) noexcept {
+    std::size_t pos = 0;
+    for (const char c : query) {
+        while (pos < name.size() && (fold ? fold_case(name[pos]) : name[pos]) != c) ++pos;
+        if (pos == name.size()) return false;
+        ++pos;
+    }
+    return true;
+}
+
+enum char_class : u8 { OTHER, DELIMITER, LOWER, UPPER, DIGIT, CLASS_COUNT };
+
+constexpr std::array<u8, 256> CHAR_CLASSES = [] {
+    std::array<u8, 256> classes = {};
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        const auto ch = static_cast<char>(c);
+        if (is_lower(ch)) classes[c] = LOWER;
+        else if (is_upper(ch)) classes[c] = UPPER;
+        else if (is_digit(ch)) classes[c] = DIGIT;
+    }
+    for (const char c : std::string_view(" -_/.:")) classes[static_cast<unsigned char>(c)] = DELIMITER;
+    return classes;
+}();
+
+// Bonus for a match on a character of class [current] following one of class [previous]. Tables instead of
+// branches, the scorer runs over every surviving name and these branches would be coin flips
+constexpr std::array<std::array<i32, CLASS_COUNT>, CLASS_COUNT> BONUS = [] {
+    std::array<std::array<i32, CLASS_COUNT>, CLASS_COUNT> bonus = {};
+    for (std::size_t current = 0; current < CLASS_COUNT; ++current) {
+        bonus[DELIMITER][current] = BONUS_BOUNDARY;
+        if (current == DIGIT) {
+            bonus[OTHER][current] = BONUS_CAMEL;
+            bonus[LOWER][current] = BONUS_CAMEL;
+            bonus[UPPER][current] = BONUS_CAMEL;
+        }
+    }
+    bonus[LOWER][UPPER] = BONUS_CAMEL;
+    return bonus;
+}();
+
+i32 position_bonus(const std::string_view name, const std::size_t j) noexcept {
+    if (j == 0) return BONUS_BOUNDARY;
+    const u8 previous = CHAR_CLASSES[static_cast<unsigned char>(name[j - 1])];
+    const u8 current = CHAR_CLASSES[static_cast<unsigned char>(name[j])];
+    return BONUS[previous][current];
+}
+
+// Smith-Waterman-style local alignment with affine gaps: row i holds the best score of query[0..i] ending with
+// query[i] on each name position. `gap` carries the best predecessor at least two positions back, so a row is
+// O(name) instead of O(name^2). `prev` and `cur` hold a row each
+i32 align(const std::string_view name, const std::string_view query, const bool fold, i32* prev, i32* cur) {
+    const std::size_t n = name.size();
+    const auto at = [&](const std::size_t j) { return fold ? fold_case(name[j]) : name[j]; };
+
+    i32 best_score = UNREACHABLE_SCORE;
+    for (std::size_t j = 0; j < n; ++j) {
+        prev[j] = at(j) == query[0] ? SCORE_MATCH + FIRST_CHAR_MULTIPLIER * position_bonus(name, j)
+                                    : UNREACHABLE_SCORE;
+        best_score = std::max(best_score, prev[j]);
+    }
+
+    for (std::size_t i = 1; i < query.size(); ++i) {
+        best_score = UNREACHABLE_SCORE;
+        cur[0] = UNREACHABLE_SCORE;
+        i32 gap = UNREACHABLE_SCORE;
+        for (std::size_t j = 1; j < n; ++j) {
+            if (j >= 2) gap = std::max({gap + GAP_EXTENSION, prev[j - 2] + GAP_START, UNREACHABLE_SCORE});
+            cur[j] = UNREACHABLE_SCORE;
+            if (at(j) != query[i]) continue;
+            const i32 best = std::max(gap, prev[j - 1] + BONUS_CONSECUTIVE);
+            if (best > UNREACHABLE_SCORE / 2) cur[j] = best + SCORE_MATCH + position_bonus(name, j);
+            best_score = std::max(best_score, cur[j]);
+        }
+        std::swap(prev, cur);
+    }
+    return best_score;
+}
+
+// The same alignment for a name that fits in a block, visiting only the positions where each query character occurs
+// rather than every position of every row. With GAP_EXTENSION per position, the best gap into position j is the best
+// of prev[k] - k * GAP_EXTENSION over k <= j - 2, shifted by j, so a running maximum over the previous row's
+// occurrences replaces `gap`. `prev` and `cur` hold a row each, at the positions set in their masks
+i32 align(const std::string_view name, const block& b, const std::string_view query, i32* prev, i32* cur) {
+    const u64 length = length_mask(name.size());
+    u64 reached = b.find(query[0]) & length;
+    for (u64 hits = reached; hits != 0; hits &= hits - 1) {
+        const auto j = static_cast<std::size_t>(std::countr_zero(hits));
+        prev[j] = SCORE_MATCH + FIRST_CHAR_MULTIPLIER * position_bonus(name, j);
+    }
+
+    for (std::size_t i = 1; i < query.size() && reached != 0; ++i) {
+        u64 pending = reached; // occurrences of the previous character not yet in `best_gap`
+        i32 best_gap = UNREACHABLE_SCORE;
+        u64 next = 0;
+        for (u64 hits = b.find(query[i]) & length & ~u64{1}; hits != 0; hits &= hits - 1) {
+            const auto j = static_cast<std::size_t>(std::countr_zero(hits));
+            const u64 behind = pending & ((u64{1} << (j - 1)) - 1);
+            for (u64 k = behind; k != 0; k &= k - 1) {
+                const auto at = std::countr_zero(k);
+                best_gap = std::max(best_gap, prev[at] - at * GAP_EXTENSION);
+            }
+            pending &= ~behind;
+
+            i32 best = UNREACHABLE_SCORE;
+            if (best_gap != UNREACHABLE_SCORE) {
+                best = best_gap + GAP_START + static_cast<i32>(j - 2) * GAP_EXTENSION;
+            }
+            if ((reached >> (j - 1) & 1) != 0) best = std::max(best, prev[j - 1] + BONUS_CONSECUTIVE);
+            if (best == UNREACHABLE_SCORE) continue;
+            cur[j] = best + SCORE_MATCH + position_bonus(name, j);
+            next |= u64{1} << j;
+        }
+        reached = next;
+        std::swap(prev, cur);
+    }
+
+    i32 best_score = UNREACHABLE_SCORE;
+    for (u64 hits = reached; hits != 0; hits &= hits - 1) {
+        best_score = std::max(best_score, prev[std::countr_zero(hits)]);
+    }
+    return best_score;
+}
+
+struct ranking {
+    const ssm::fuzzy::name_set& names;
+
+    bool operator()(const ssm::fuzzy::match& a, const ssm::fuzzy::match& b) const noexcept {
+        if (a.score != b.score) return a.score > b.score;
+        const std::size_t a_size = names[a.index].size();
+        const std::size_t b_size = names[b.index].size();
+        if (a_size != b_size) return a_size < b_size;
+        return a.index < b.index;
+    }
+};
+
+// Keeps the best `limit` matches seen so far as a heap with the worst on top, so a million survivors cost a million
+// comparisons rather than a million-entry vector
+void offer(std::vector<ssm::fuzzy::match>& heap, const ssm::fuzzy::match candidate, const std::size_t limit,
+           const ranking& order) {
+    if (heap.size() < limit) {
+        heap.push_back(candidate);
+        std::ranges::push_heap(heap, order);
+    } else if (order(candidate, heap.front())) {
+        std::ranges::pop_heap(heap, order);
+        heap.back() = candidate;
+        std::ranges::push_heap(heap, order);
+    }
+}
+
+void keep_best(std::vector<ssm::fuzzy::match>& matches, const std::size_t limit, const ranking& order) {
+    if (matches.size() > limit) {
+        std::ranges::partial_sort(matches, matches.begin() + static_cast<std::ptrdiff_t>(limit), order);
+        matches.resize(limit);
+    } else {
+        std::ranges::sort(matches, order);
+    }
+}
+
+// Scores one name at a time against a query, with the scratch space that takes
+class scorer {
+public:
+    scorer(const ssm::fuzzy::name_set& names, const std::string_view query, const bool fold) noexcept
+        : names_(names), query_(query), fold_(fold), wanted_(ssm::fuzzy::name_set::signature(query)) {}
+
+    // Whether name `i` contains the query, and if so its score in `score`
+    bool operator()(const std::size_t i, i32& score) {
+        // Most names lack some query character altogether, which one AND against the signature shows
+        if ((names_.signature(i) & wanted_) != wanted_) return false;
+        const std::string_view name = names_[i];
+        if (name.size() < query_.size()) return false;
+
+        if (name.size() > BLOCK_SIZE) {
+            if (!is_subsequence(name, query_, fold_)) return false;
+            long_rows_.resize(2 * name.size()); // long names get their rows from the heap
+            score = align(name, query_, fold_, long_rows_.data(), long_rows_.data() + name.size());
+            return true;
+        }
+
+        // Loads run past the name into its neighbours, which the length mask hides. Only names within a block of the
+        // end of the buffer need copying out first
+        const std::string_view all = names_.bytes();
+        const auto offset = static_cast<std::size_t>(name.data() - all.data());
+        const char* p = name.data();
+        if (all.size() - offset < BLOCK_SIZE) {
+            std::memcpy(tail_.data(), p, name.size());
+            p = tail_.data();
+        }
+        const block b(p, fold_);
+        if (!is_subsequence(b, query_, name.size())) return false;
+        score = align(name, b, query_, rows_.data(), rows_.data() + BLOCK_SIZE);
+        return true;
+    }
+
+private:
+    const ssm::fuzzy::name_set& names_;
+    std::string_view query_;
+    bool fold_;
+    u64 wanted_;
+    std::array<char, BLOCK_SIZE> tail_ = {};
+    std::array<i32, 2 * BLOCK_SIZE> rows_;
+    std::vector<i32> long_rows_;
+};
+
+void scan(const ssm::fuzzy::name_set& names, const std::size_t first, const std::size_t last,
+          const std::string_view query, const bool fold, const std::size_t limit,
+          std::vector<ssm::fuzzy::match>& out) {
+    const ranking order{names};
+    scorer score_of(names, query, fold);
+    for (std::size_t i = first; i < last; ++i) {
+        i32 score = 0;
+        if (score_of(i, score)) offer(out, {.index = static_cast<u32>(i), .score = score}, limit, order);
+    }
+    keep_best(out, limit, order);
+}
+
+// How many names a filter scores between looks at its cancel flag, about a millisecond's worth at worst
+constexpr std::size_t CANCEL_INTERVAL = 16 * 1024;
+
+bool filter_range(const ssm::fuzzy::name_set& names, const std::span<const ssm::fuzzy::match> candidates,
+                  const std::string_view query, const bool fold, const std::atomic<bool>& cancel,
+                  std::vector<ssm::fuzzy::match>& out) {
+    scorer score_of(names, query, fold);
+    for (std::size_t begin = 0; begin < candidates.size(); begin += CANCEL_INTERVAL) {
+        if (cancel.load(std::memory_order_relaxed)) return false;
+        const std::size_t end = std::min(begin + CANCEL_INTERVAL, candidates.size());
+        for (std::size_t k = begin; k < end; ++k) {
+            i32 score = 0;
+            if (score_of(candidates[k].index, score)) out.push_back({.index = candidates[k].index, .score = score});
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+namespace ssm::fuzzy {
+
+void name_set::reserve(const std::size_t names, const std::size_t bytes) {
+    offsets_.reserve(names + 1);
+    signatures_.reserve(names);
+    bytes_.reserve(bytes);
+}
+
+void name_set::add(const std::string_view name) {
+    bytes_.append(name);
+    offsets_.push_back(static_cast<u32>(bytes_.size()));
+    signatures_.push_back(signature(name));
+}
+
+u64 name_set::signature(const std::string_view text) noexcept {
+    u64 bits = 0;
+    for (const char c : text) bits |= u64{1} << (static_cast<unsigned char>(fold_case(c)) & 63);
+    return bits;
+}
+
+std::vector<match> rank(const name_set& names, const std::string_view query, const std::size_t limit,
+                        unsigned threads) {
+    if (query.empty() || limit == 0 || names.size() == 0) return {};
+
+    // Smart case, as in most fuzzy finders
+    const bool fold = std::ranges::none_of(query, is_upper);
+
+    if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+    const std::size_t count = names.size();
+    const std::size_t workers = std::clamp<std::size_t>(count / MIN_NAMES_PER_THREAD, 1, threads);
+
+    std::vector<std::vector<match>> partial(workers);
+    const auto work = [&](const std::size_t worker) {
+        scan(names, worker * count / workers, (worker + 1) * count / workers, query, fold, limit, partial[worker]);
+    };
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(workers - 1);
+        for (std::size_t worker = 1; worker < workers; ++worker) pool.emplace_back(work, worker);
+        work(0);
+    }
+
+    std::vector<match> matches = MOVE(partial[0]);
+    for (std::size_t worker = 1; worker < workers; ++worker) {
+        matches.insert(matches.end(), partial[worker].begin(), partial[worker].end());
+    }
+    keep_best(matches, limit, ranking{names});
+    return matches;
+}
+
+bool filter(const name_set& names, const std::span<const match> candidates, const std::string_view query,
+            const std::atomic<bool>& cancel, std::vector<match>& out, unsigned threads) {
+    out.clear();
+    if (query.empty()) {
+        out.reserve(candidates.size());
+        for (const match& m : candidates) out.push_back({.index = m.index, .score = 0});
+        return !cancel.load(std::memory_order_relaxed);
+    }
+    const bool fold = std::ranges::none_of(query, is_upper);
+
+    if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+    const std::size_t count = candidates.size();
+    const std::size_t workers = std::clamp<std::size_t>(count / MIN_NAMES_PER_THREAD, 1, threads);
+    if (workers == 1) return filter_range(names, candidates, query, fold, cancel, out);
+
+    // Each worker keeps its slice's matches in candidate order, so joining them keeps the whole in that order
+    std::vector<std::vector<match>> partial(workers);
+    std::vector<u8> finished(workers, 0);
+    const auto work = [&](const std::size_t worker) {
+        const std::size_t first = worker * count / workers;
+        const std::size_t last = (worker + 1) * count / workers;
+        finished[worker] = filter_range(names, candidates.subspan(first, last - first), query, fold, cancel,
+                                        partial[worker]) ? 1 : 0;
+    };
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(workers - 1);
+        for (std::size_t worker = 1; worker < workers; ++worker) pool.emplace_back(work, worker);
+        work(0);
+    }
+    if (std::ranges::find(finished, u8{0}) != finished.end()) return false;
+
+    std::size_t total = 0;
+    for (const std::vector<match>& p : partial) total += p.size();
+    out.reserve(total);
+    for (const std::vector<match>& p : partial) out.insert(out.end(), p.begin(), p.end());
+    return true;
+}
+
+std::vector<match> best(const name_set& names, const std::span<const match> matches, const std::size_t limit) {
+    std::vector<match> heap;
+    if (limit == 0) return heap;
+    heap.reserve(std::min(limit, matches.size()));
+    const ranking order{names};
+    for (const match& m : matches) offer(heap, m, limit, order);
+    keep_best(heap, limit, order);
+    return heap;
+}
+
+bool is_exact(const std::string_view name, const std::string_view query) noexcept {
+    if (name.size() != query.size()) return false;
+    const bool fold = std::ranges::none_of(query, is_upper);
+    for (std::size_t i = 0; i < name.size(); ++i) {
+        if ((fold ? fold_case(name[i]) : name[i]) != query[i]) return false;
+    }
+    return true;
+}
+
+} // namespace ssm::fuzzy
@@ -0,0 +1,343 @@
+#include "minhash.hpp"
+
+#include "fts.hpp"
+#include "search.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+using ssm::minhash::BANDS;
+using ssm::minhash::ROWS;
+using ssm::minhash::SHINGLE_TOKENS;
+using ssm::minhash::SIGNATURE_SIZE;
+
+// Files signed per round of a build: read and hashed on every core, then written by this one
+constexpr std::size_t BUILD_BATCH = 4096;
+
+// Members of one bucket that matched none before them are kept to compare the rest against, up to this many. A bucket
+// of unrelated snippets that happen to share a band cannot turn quadratic, and a real pair it misses this way still
+// has its other bands
+constexpr std::size_t MAX_REPRESENTATIVES = 16;
+
+// Buckets are keyed by a hash of the band's values and its index, the file ids in them come in order from the
+// primary key
+constexpr auto create_tables = R"(
+    CREATE TABLE IF NOT EXISTS minhash_signature (
+        file_id INTEGER PRIMARY KEY,
+        signature BLOB NOT NULL
+    );
+
+    CREATE TABLE IF NOT EXISTS minhash_band (
+        bucket INTEGER NOT NULL,
+        file_id INTEGER NOT NULL,
+        PRIMARY KEY (bucket, file_id)
+    ) WITHOUT ROWID;
+    )";
+
+constexpr u64 splitmix64(u64& state) noexcept {
+    state += 0x9E3779B97F4A7C15ULL;
+    u64 z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Hash function i is mix(x ^ SEEDS[i])
+constexpr std::array<u32, SIGNATURE_SIZE> SEEDS = [] {
+    std::array<u32, SIGNATURE_SIZE> seeds{};
+    u64 state = 0x5353'4D5F'4D49'4E48ULL;
+    for (u32& seed : seeds) seed = static_cast<u32>(splitmix64(state) >> 32);
+    return seeds;
+}();
+
+constexpr u32 mix(u32 x) noexcept {
+    x ^= x >> 16;
+    x *= 0x7FEB352DU;
+    x ^= x >> 15;
+    x *= 0x846CA68BU;
+    x ^= x >> 16;
+    return x;
+}
+
+u32 hash_token(const std::string_view text) noexcept {
+    u32 hash = 2166136261U;
+    for (const char c : text) {
+        hash ^= static_cast<u8>(c);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Plain loops over every place, all doing the same arithmetic, so the compiler vectorizes them
+void add_shingle(ssm::minhash::signature& sig, const u32 shingle) noexcept {
+    for (std::size_t i = 0; i < SIGNATURE_SIZE; ++i) sig[i] = std::min(sig[i], mix(shingle ^ SEEDS[i]));
+}
+
+u32 hash_shingle(const std::array<u32, SHINGLE_TOKENS>& window, const std::size_t newest) noexcept {
+    u64 hash = 0;
+    for (std::size_t k = 1; k <= SHINGLE_TOKENS; ++k) {
+        hash = (hash ^ window[(newest + k) % SHINGLE_TOKENS]) * 0x9E3779B97F4A7C15ULL;
+    }
+    return static_cast<u32>(hash >> 32);
+}
+
+i64 bucket_of(const ssm::minhash::signature& sig, const std::size_t band) noexcept {
+    u64 hash = band + 1;
+    for (std::size_t r = 0; r < ROWS; ++r) {
+        hash = (hash ^ sig[band * ROWS + r]) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    return static_cast<i64>(hash);
+}
+
+std::string_view column_blob(sqlite3_stmt* stmt, const int column) {
+    const void* data = sqlite3_column_blob(stmt, column);
+    const int size = sqlite3_column_bytes(stmt, column);
+    return data == nullptr ? std::string_view{} : std::string_view(static_cast<const char*>(data), static_cast<std::size_t>(size));
+}
+
+std::optional<ssm::minhash::signature> decode(const std::string_view blob) noexcept {
+    ssm::minhash::signature sig;
+    if (blob.size() != sizeof(sig)) return std::nullopt;
+    std::memcpy(sig.data(), blob.data(), sizeof(sig));
+    return sig;
+}
+
+class writer {
+public:
+    explicit writer(const ssm_sqlite3::database& sqlite)
+        : signature_(sqlite.prepare("INSERT OR REPLACE INTO minhash_signature (file_id, signature) VALUES (?, ?);")),
+          band_(sqlite.prepare("INSERT OR IGNORE INTO minhash_band (bucket, file_id) VALUES (?, ?);")) {}
+
+    [[nodiscard]] bool ok() const noexcept {
+        return signature_ && band_;
+    }
+
+    bool put(const i64 file_id, const ssm::minhash::signature& sig) {
+        const std::string_view blob(reinterpret_cast<const char*>(sig.data()), sizeof(sig));
+        if (!ssm_sqlite3::database::bind_int64(signature_.get(), 1, file_id) ||
+            !ssm_sqlite3::database::bind_blob(signature_.get(), 2, blob) || sqlite3_step(signature_.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(signature_.get());
+        for (std::size_t band = 0; band < BANDS; ++band) {
+            if (!ssm_sqlite3::database::bind_int64(band_.get(), 1, bucket_of(sig, band)) ||
+                !ssm_sqlite3::database::bind_int64(band_.get(), 2, file_id) || sqlite3_step(band_.get()) != SQLITE_DONE) {
+                return false;
+            }
+            sqlite3_reset(band_.get());
+        }
+        return true;
+    }
+
+private:
+    ssm_sqlite3::stmt_handle signature_;
+    ssm_sqlite3::stmt_handle band_;
+};
+
+// Disjoint sets over file ids. An id never united with another has no entry and is a set of its own
+class clusterer {
+public:
+    i64 find(const i64 id) {
+        i64 root = id;
+        for (auto it = parent_.find(root); it != parent_.end() && it->second != root; it = parent_.find(root)) {
+            root = it->second;
+        }
+        for (i64 at = id; at != root;) at = std::exchange(parent_[at], root);
+        return root;
+    }
+
+    void unite(const i64 a, const i64 b) {
+        const i64 ra = find(a);
+        const i64 rb = find(b);
+        if (ra == rb) return;
+        // The smaller id becomes the root, which keeps the result the same whatever order pairs come in
+        parent_.try_emplace(ra, ra);
+        parent_.try_emplace(rb, rb);
+        parent_[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    std::vector<std::vector<i64>> groups() {
+        std::unordered_map<i64, std::vector<i64>> by_root;
+        std::vector<i64> ids;
+        ids.reserve(parent_.size());
+        for (const auto& [id, parent] : parent_) ids.push_back(id);
+        for (const i64 id : ids) by_root[find(id)].push_back(id);
+
+        std::vector<std::vector<i64>> result;
+        for (auto& [root, members] : by_root) {
+            if (members.size() < 2) continue;
+            std::ranges::sort(members);
+            result.push_back(MOVE(members));
+        }
+        std::ranges::sort(result, [](const std::vector<i64>& a, const std::vector<i64>& b) {
+            return a.size() != b.size() ? a.size() > b.size() : a.front() < b.front();
+        });
+        return result;
+    }
+
+private:
+    std::unordered_map<i64, i64> parent_;
+};
+
+} // namespace
+
+namespace ssm::minhash {
+
+std::optional<signature> signature_of(const std::string_view content) {
+    signature sig;
+    sig.fill(UINT32_MAX);
+    std::array<u32, SHINGLE_TOKENS> window{};
+    std::size_t tokens = 0;
+    // Compounds and whole flags share a position with the parts they are made of, and would only repeat them
+    fts::tokenize(content, fts::mode::document, [&](const fts::token& token) {
+        if (token.colocated) return true;
+        const std::size_t newest = tokens++ % SHINGLE_TOKENS;
+        window[newest] = hash_token(token.text);
+        if (tokens >= SHINGLE_TOKENS) add_shingle(sig, hash_shingle(window, newest));
+        return true;
+    });
+    if (tokens == 0) return std::nullopt;
+    if (tokens < SHINGLE_TOKENS) add_shingle(sig, hash_shingle(window, (tokens - 1) % SHINGLE_TOKENS));
+    return sig;
+}
+
+f64 similarity(const signature& a, const signature& b) noexcept {
+    std::size_t equal = 0;
+    for (std::size_t i = 0; i < SIGNATURE_SIZE; ++i) equal += std::size_t{a[i] == b[i]};
+    return static_cast<f64>(equal) / static_cast<f64>(SIGNATURE_SIZE);
+}
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("minhash.build");
+    if (!sqlite.exec(create_tables)) return false;
+
+    std::vector<std::pair<i64, std::string>> files;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT id, path FROM file ORDER BY id;");
+        if (!stmt) return false;
+        int ret = sqlite3_step(stmt.get());
+        for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+            const char* path = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1));
+            if (path != nullptr) files.emplace_back(sqlite3_column_int64(stmt.get(), 0), path);
+        }
+        if (ret != SQLITE_DONE) return false;
+    }
+
+    writer out(sqlite);
+    if (!out.ok()) return false;
+    std::vector<std::optional<signature>> signatures;
+    for (std::size_t begin = 0; begin < files.size(); begin += BUILD_BATCH) {
+        const std::size_t count = std::min(BUILD_BATCH, files.size() - begin);
+        signatures.assign(count, std::nullopt);
+        search::parallel_for(count, 0, [&](const std::size_t i) {
+            const search::mapped_file file(files[begin + i].second);
+            if (file.ok()) signatures[i] = signature_of(file.text()); // one removed by hand duplicates nothing
+        });
+        for (std::size_t i = 0; i < count; ++i) {
+            if (signatures[i].has_value() && !out.put(files[begin + i].first, *signatures[i])) return false;
+        }
+    }
+    return true;
+}
+
+bool index_file(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view content) {
+    SSM_TRACE_SCOPE("minhash.index");
+    if (!remove_file(sqlite, file_id)) return false;
+    const std::optional<signature> sig = signature_of(content);
+    if (!sig.has_value()) return true;
+    writer out(sqlite);
+    return out.ok() && out.put(file_id, *sig);
+}
+
+bool remove_file(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT signature FROM minhash_signature WHERE file_id = ?;");
+    if (!select || !ssm_sqlite3::database::bind_int64(select.get(), 1, file_id)) return false;
+    const int ret = sqlite3_step(select.get());
+    if (ret == SQLITE_DONE) return true;
+    if (ret != SQLITE_ROW) return false;
+    const std::optional<signature> sig = decode(column_blob(select.get(), 0));
+
+    const ssm_sqlite3::stmt_handle band = sqlite.prepare("DELETE FROM minhash_band WHERE bucket = ? AND file_id = ?;");
+    const ssm_sqlite3::stmt_handle erase = sqlite.prepare("DELETE FROM minhash_signature WHERE file_id = ?;");
+    if (!band || !erase) return false;
+    for (std::size_t b = 0; sig.has_value() && b < BANDS; ++b) {
+        if (!ssm_sqlite3::database::bind_int64(band.get(), 1, bucket_of(*sig, b)) ||
+            !ssm_sqlite3::database::bind_int64(band.get(), 2, file_id) || sqlite3_step(band.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(band.get());
+    }
+    return ssm_sqlite3::database::bind_int64(erase.get(), 1, file_id) && sqlite3_step(erase.get()) == SQLITE_DONE;
+}
+
+std::optional<std::vector<std::vector<i64>>> clusters(const ssm_sqlite3::database& sqlite, const f64 threshold) {
+    SSM_TRACE_SCOPE("minhash.clusters");
+    const ssm_sqlite3::stmt_handle scan = sqlite.prepare("SELECT bucket, file_id FROM minhash_band ORDER BY bucket;");
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT signature FROM minhash_signature WHERE file_id = ?;");
+    if (!scan || !select) return std::nullopt;
+
+    // Only snippets in a bucket with company are ever loaded, which in a store of mostly distinct ones is few
+    std::unordered_map<i64, std::optional<signature>> loaded;
+    bool failed = false;
+    const auto signature_for = [&](const i64 id) -> const std::optional<signature>& {
+        const auto [it, inserted] = loaded.try_emplace(id);
+        if (!inserted) return it->second;
+        if (!ssm_sqlite3::database::bind_int64(select.get(), 1, id)) failed = true;
+        const int ret = sqlite3_step(select.get());
+        if (ret == SQLITE_ROW) {
+            it->second = decode(column_blob(select.get(), 0));
+        } else if (ret != SQLITE_DONE) {
+            failed = true;
+        }
+        sqlite3_reset(select.get());
+        return it->second;
+    };
+
+    clusterer sets;
+    std::vector<i64> representatives;
+    const auto compare_bucket = [&](const std::vector<i64>& members) {
+        if (members.size() < 2) return;
+        representatives.clear();
+        for (const i64 id : members) {
+            const std::optional<signature>& sig = signature_for(id);
+            if (!sig.has_value()) continue;
+            bool placed = false;
+            for (const i64 rep : representatives) {
+                if (sets.find(rep) == sets.find(id)) {
+                    placed = true;
+                } else if (similarity(*sig, *signature_for(rep)) >= threshold) {
+                    sets.unite(rep, id);
+                    placed = true;
+                }
+                if (placed) break;
+            }
+            if (!placed && representatives.size() < MAX_REPRESENTATIVES) representatives.push_back(id);
+        }
+    };
+
+    std::vector<i64> members;
+    i64 bucket = 0;
+    int ret = sqlite3_step(scan.get());
+    for (; ret == SQLITE_ROW && !failed; ret = sqlite3_step(scan.get())) {
+        const i64 b = sqlite3_column_int64(scan.get(), 0);
+        if (b != bucket || members.empty()) {
+            compare_bucket(members);
+            members.clear();
+            bucket = b;
+        }
+        members.push_back(sqlite3_column_int64(scan.get(), 1));
+    }
+    if (failed || ret != SQLITE_DONE) return std::nullopt;
+    compare_bucket(members);
+    if (failed) return std::nullopt;
+    return sets.groups();
+}
+
+} // namespace ssm::minhash
@@ -0,0 +1,517 @@
+#include "picker.hpp"
+
+#ifdef __linux__
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <format>
+#include <mutex>
+#include <print>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+volatile std::sig_atomic_t resized = 0;
+
+void on_resize(int /*signal*/) {
+    resized = 1;
+}
+
+// The controlling terminal in raw mode on the alternate screen, put back the way it was on destruction
+class terminal {
+public:
+    terminal() : fd_(open("/dev/tty", O_RDWR | O_CLOEXEC)) {
+        if (fd_ < 0 || tcgetattr(fd_, &saved_) != 0) return;
+        termios raw = saved_;
+        cfmakeraw(&raw);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(fd_, TCSAFLUSH, &raw) != 0) return;
+        raw_ = true;
+
+        // SIGWINCH stays blocked but inside ppoll, so a resize cannot land between checking for one and waiting. The
+        // scoring threads start later and inherit the mask
+        sigset_t winch;
+        sigemptyset(&winch);
+        sigaddset(&winch, SIGWINCH);
+        pthread_sigmask(SIG_BLOCK, &winch, &saved_mask_);
+        wait_mask_ = saved_mask_;
+        sigdelset(&wait_mask_, SIGWINCH);
+        struct sigaction action = {};
+        action.sa_handler = on_resize;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, &saved_action_);
+
+        write("\x1b[?1049h\x1b[H\x1b[2J");
+    }
+
+    ~terminal() {
+        if (raw_) {
+            write("\x1b[?1049l");
+            tcsetattr(fd_, TCSAFLUSH, &saved_);
+            sigaction(SIGWINCH, &saved_action_, nullptr);
+            pthread_sigmask(SIG_SETMASK, &saved_mask_, nullptr);
+        }
+        if (fd_ >= 0) close(fd_);
+    }
+
+    terminal(const terminal&) = delete;
+    terminal& operator=(const terminal&) = delete;
+
+    [[nodiscard]] bool ok() const noexcept {
+        return raw_;
+    }
+
+    [[nodiscard]] int fd() const noexcept {
+        return fd_;
+    }
+
+    // The signal mask to wait with
+    [[nodiscard]] const sigset_t& wait_mask() const noexcept {
+        return wait_mask_;
+    }
+
+    // Rows and columns
+    [[nodiscard]] std::pair<std::size_t, std::size_t> size() const noexcept {
+        winsize ws = {};
+        if (ioctl(fd_, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0) return {24, 80};
+        return {ws.ws_row, ws.ws_col};
+    }
+
+    bool write(std::string_view text) const noexcept {
+        while (!text.empty()) {
+            const ssize_t n = ::write(fd_, text.data(), text.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            text.remove_prefix(static_cast<std::size_t>(n));
+        }
+        return true;
+    }
+
+private:
+    int fd_;
+    bool raw_ = false;
+    termios saved_ = {};
+    sigset_t saved_mask_ = {};
+    sigset_t wait_mask_ = {};
+    struct sigaction saved_action_ = {};
+};
+
+// How the scoring thread wakes the loop waiting in ppoll: a byte down a pipe
+class wakeup {
+public:
+    wakeup() {
+        if (pipe2(fds_.data(), O_CLOEXEC | O_NONBLOCK) != 0) fds_ = {-1, -1};
+    }
+
+    ~wakeup() {
+        for (const int fd : fds_) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    wakeup(const wakeup&) = delete;
+    wakeup& operator=(const wakeup&) = delete;
+
+    [[nodiscard]] bool ok() const noexcept {
+        return fds_[0] >= 0;
+    }
+
+    [[nodiscard]] int fd() const noexcept {
+        return fds_[0];
+    }
+
+    // A full pipe already holds a wakeup, so a failed write loses nothing
+    void signal() const noexcept {
+        constexpr char byte = 0;
+        if (::write(fds_[1], &byte, 1) < 0) return;
+    }
+
+    void drain() const noexcept {
+        std::array<char, 64> buffer;
+        while (::read(fds_[0], buffer.data(), buffer.size()) > 0) {}
+    }
+
+private:
+    std::array<int, 2> fds_ = {-1, -1};
+};
+
+// Whether `needle` is a subsequence of `haystack`, byte for byte
+bool is_subsequence(const std::string_view needle, const std::string_view haystack) noexcept {
+    std::size_t pos = 0;
+    for (const char c : needle) {
+        pos = haystack.find(c, pos);
+        if (pos == std::string_view::npos) return false;
+        ++pos;
+    }
+    return true;
+}
+
+// The answer to one query: the rows to show, best first, and how many names matched in all
+struct ranked {
+    std::string query;
+    std::vector<ssm::fuzzy::match> rows;
+    std::size_t matches = 0;
+};
+
+// Ranks queries on its own thread. A query submitted while another is being scored cancels it, only the newest one
+// is ever answered. The matches of every query along the way down to the current one are kept: typing narrows the
+// last of them, erasing goes back to the longest one still a subsequence of the query
+class scorer {
+public:
+    scorer(const ssm::fuzzy::name_set& names, const wakeup& done) : names_(names), done_(done) {
+        // The empty query matches every name, so it is where all narrowing starts
+        std::vector<ssm::fuzzy::match> all(names.size());
+        for (std::size_t i = 0; i < all.size(); ++i) all[i] = {.index = static_cast<u32>(i), .score = 0};
+        levels_.push_back({.query = {}, .matches = MOVE(all)});
+        thread_ = std::jthread([this](const std::stop_token stop) { run(stop); });
+    }
+
+    ~scorer() {
+        cancel_.store(true, std::memory_order_relaxed);
+        thread_.request_stop();
+    }
+
+    scorer(const scorer&) = delete;
+    scorer& operator=(const scorer&) = delete;
+
+    void submit(std::string query, const std::size_t rows) {
+        const std::scoped_lock lock(mutex_);
+        pending_ = job{.query = MOVE(query), .rows = rows};
+        cancel_.store(true, std::memory_order_relaxed);
+        wake_.notify_one();
+    }
+
+    // The newest answer since the last call, if any
+    std::optional<ranked> take() {
+        const std::scoped_lock lock(mutex_);
+        return std::exchange(answer_, std::nullopt);
+    }
+
+private:
+    struct job {
+        std::string query;
+        std::size_t rows;
+    };
+
+    struct level {
+        std::string query;
+        std::vector<ssm::fuzzy::match> matches; // in name order
+    };
+
+    void run(const std::stop_token stop) {
+        while (true) {
+            job next;
+            {
+                std::unique_lock lock(mutex_);
+                if (!wake_.wait(lock, stop, [this] { return pending_.has_value(); })) return;
+                next = MOVE(*pending_);
+                pending_.reset();
+                // Under the lock, so a submit that comes after taking this job always cancels it
+                cancel_.store(false, std::memory_order_relaxed);
+            }
+            std::optional<ranked> answer = rank(next);
+            if (!answer.has_value()) continue;
+            {
+                const std::scoped_lock lock(mutex_);
+                answer_ = MOVE(answer);
+            }
+            done_.signal();
+        }
+    }
+
+    std::optional<ranked> rank(const job& next) {
+        SSM_TRACE_SCOPE("picker.rank");
+        while (levels_.size() > 1 && !is_subsequence(levels_.back().query, next.query)) levels_.pop_back();
+        if (levels_.back().query != next.query) {
+            std::vector<ssm::fuzzy::match> narrowed;
+            if (!ssm::fuzzy::filter(names_, levels_.back().matches, next.query, cancel_, narrowed)) return std::nullopt;
+            levels_.push_back({.query = next.query, .matches = MOVE(narrowed)});
+        }
+
+        const std::vector<ssm::fuzzy::match>& matches = levels_.back().matches;
+        ranked answer = {.query = next.query, .rows = {}, .matches = matches.size()};
+        if (next.query.empty()) {
+            // Nothing to rank by, names are shown in the order `ls` numbers them
+            answer.rows.assign(matches.begin(), matches.begin() + static_cast<std::ptrdiff_t>(
+                                                                      std::min(next.rows, matches.size())));
+        } else {
+            answer.rows = ssm::fuzzy::best(names_, matches, next.rows);
+        }
+        return answer;
+    }
+
+    const ssm::fuzzy::name_set& names_;
+    const wakeup& done_;
+    std::vector<level> levels_; // only touched by the thread once it runs
+
+    std::mutex mutex_;
+    std::condition_variable_any wake_;
+    std::optional<job> pending_;
+    std::optional<ranked> answer_;
+    std::atomic<bool> cancel_ = false;
+    std::jthread thread_; // last, so it is joined before anything it uses goes away
+};
+
+// At most `width` columns of `text`, counting a UTF-8 sequence as one, with control bytes made harmless
+std::string fit(const std::string_view text, const std::size_t width) {
+    std::string out;
+    std::size_t columns = 0;
+    for (const char c : text) {
+        const auto byte = static_cast<u8>(c);
+        if ((byte & 0xC0) != 0x80) {
+            if (columns == width) break;
+            ++columns;
+        }
+        out.push_back(byte < 0x20 || byte == 0x7F ? '?' : c);
+    }
+    return out;
+}
+
+std::size_t columns_of(const std::string_view text) noexcept {
+    return static_cast<std::size_t>(std::ranges::count_if(text, [](const char c) {
+        return (static_cast<u8>(c) & 0xC0) != 0x80;
+    }));
+}
+
+// Remembers what each row shows, so a frame only writes the rows that changed
+class screen {
+public:
+    void invalidate() {
+        rows_.clear();
+        clear_ = true;
+    }
+
+    // What to write to the terminal to show `rows` with the cursor at `cursor` on the first, nothing if it is there
+    std::string update(std::vector<std::string> rows, const std::size_t cursor) {
+        std::string out;
+        if (clear_) out += "\x1b[2J";
+        for (std::size_t i = 0; i < rows.size(); ++i) {
+            if (i < rows_.size() && rows_[i] == rows[i]) continue;
+            std::format_to(std::back_inserter(out), "\x1b[{};1H{}\x1b[K", i + 1, rows[i]);
+        }
+        if (out.empty() && cursor == cursor_) return out;
+
+        clear_ = false;
+        rows_ = MOVE(rows);
+        cursor_ = cursor;
+        // Hidden while rows are rewritten, so it does not flicker across the screen
+        return std::format("\x1b[?25l{}\x1b[1;{}H\x1b[?25h", out, cursor + 1);
+    }
+
+private:
+    std::vector<std::string> rows_;
+    std::size_t cursor_ = 0;
+    bool clear_ = true;
+};
+
+enum class key : u8 {
+    text,
+    erase_char,
+    erase_word,
+    erase_line,
+    up,
+    down,
+    accept,
+    quit,
+    ignored,
+};
+
+// Takes the next key off the front of `input`. Typed text comes one byte at a time, in `byte`
+key next_key(std::string_view& input, char& byte) {
+    const char c = input.front();
+    input.remove_prefix(1);
+    if (c == '\x1b') {
+        // A lone Esc arrives alone, escape sequences arrive whole
+        if (input.empty() || (input.front() != '[' && input.front() != 'O')) return key::quit;
+        std::size_t end = 1;
+        while (end < input.size() && (static_cast<u8>(input[end]) < 0x40 || static_cast<u8>(input[end]) > 0x7E)) ++end;
+        const char final_byte = end < input.size() ? input[end] : '\0';
+        input.remove_prefix(std::min(end + 1, input.size()));
+        if (final_byte == 'A') return key::up;
+        if (final_byte == 'B') return key::down;
+        return key::ignored;
+    }
+
+    switch (c) {
+    case '\r':
+    case '\n':
+        return key::accept;
+    case '\x03': // Ctrl-C
+    case '\x07': // Ctrl-G
+        return key::quit;
+    case '\x7F':
+    case '\x08':
+        return key::erase_char;
+    case '\x17': // Ctrl-W
+        return key::erase_word;
+    case '\x15': // Ctrl-U
+        return key::erase_line;
+    case '\x10': // Ctrl-P
+        return key::up;
+    case '\x0E': // Ctrl-N
+        return key::down;
+    default:
+        byte = c;
+        return static_cast<u8>(c) < 0x20 ? key::ignored : key::text;
+    }
+}
+
+void erase_char(std::string& query) {
+    while (!query.empty() && (static_cast<u8>(query.back()) & 0xC0) == 0x80) query.pop_back();
+    if (!query.empty()) query.pop_back();
+}
+
+void erase_word(std::string& query) {
+    while (!query.empty() && query.back() == ' ') query.pop_back();
+    while (!query.empty() && query.back() != ' ') query.pop_back();
+}
+
+// The prompt with the match count at the right edge when it fits, then one row per match
+std::vector<std::string> frame(const ssm::fuzzy::name_set& names, const std::string_view query, const ranked& shown,
+                               const std::size_t selected, const std::size_t rows, const std::size_t columns) {
+    std::vector<std::string> out;
+    out.reserve(rows);
+
+    std::string prompt = "> " + fit(query, columns > 2 ? columns - 2 : 0);
+    const std::string count = std::format("{}/{}", shown.matches, names.size());
+    const std::size_t used = columns_of(prompt);
+    if (used + 2 + count.size() <= columns) prompt += std::string(columns - used - count.size(), ' ') + count;
+    out.push_back(MOVE(prompt));
+
+    const std::size_t width = columns > 2 ? columns - 2 : 0;
+    for (std::size_t row = 0; row + 1 < rows && row < shown.rows.size(); ++row) {
+        const std::string name = fit(names[shown.rows[row].index], width);
+        out.push_back(row == selected ? std::format("\x1b[7m> {}\x1b[m", name) : std::format("  {}", name));
+    }
+    out.resize(rows);
+    return out;
+}
+
+} // namespace
+
+namespace ssm::picker {
+
+std::optional<std::size_t> pick(const fuzzy::name_set& names, const std::string_view initial) {
+    SSM_TRACE_SCOPE("picker.pick");
+    const wakeup done;
+    if (!done.ok()) {
+        std::println(stderr, "Failed to create a pipe");
+        return std::nullopt;
+    }
+    const terminal term;
+    if (!term.ok()) {
+        std::println(stderr, "ssm pick needs a terminal");
+        return std::nullopt;
+    }
+    resized = 0;
+
+    scorer ranker(names, done);
+    screen view;
+    auto [rows, columns] = term.size();
+    const auto list_rows = [&rows] { return std::max<std::size_t>(rows, 2) - 1; };
+
+    std::string query(initial);
+    ranked shown;
+    std::size_t selected = 0;
+    bool accepting = false; // Enter came before the answer to the query it was typed after
+    ranker.submit(query, list_rows());
+
+    std::array<char, 256> input;
+    while (true) {
+        if (resized != 0) {
+            resized = 0;
+            const std::size_t old_rows = rows;
+            std::tie(rows, columns) = term.size();
+            view.invalidate();
+            if (rows != old_rows) ranker.submit(query, list_rows());
+        }
+        if (!term.write(view.update(frame(names, query, shown, selected, rows, columns), 2 + columns_of(query)))) {
+            return std::nullopt;
+        }
+
+        std::array<pollfd, 2> fds = {{{.fd = term.fd(), .events = POLLIN, .revents = 0},
+                                      {.fd = done.fd(), .events = POLLIN, .revents = 0}}};
+        if (ppoll(fds.data(), fds.size(), nullptr, &term.wait_mask()) < 0) {
+            if (errno == EINTR) continue;
+            return std::nullopt;
+        }
+
+        if ((fds[1].revents & POLLIN) != 0) {
+            done.drain();
+            if (std::optional<ranked> answer = ranker.take(); answer.has_value()) {
+                if (answer->query != shown.query) selected = 0;
+                shown = MOVE(*answer);
+                selected = std::min(selected, shown.rows.empty() ? 0 : shown.rows.size() - 1);
+                if (accepting && shown.query == query) {
+                    accepting = false;
+                    if (!shown.rows.empty()) return std::size_t{shown.rows[selected].index};
+                }
+            }
+        }
+
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+        const ssize_t n = read(term.fd(), input.data(), input.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return std::nullopt;
+
+        const std::string old_query = query;
+        bool accept = false;
+        std::string_view keys(input.data(), static_cast<std::size_t>(n));
+        while (!keys.empty() && !accept) {
+            char byte = 0;
+            switch (next_key(keys, byte)) {
+            case key::text:
+                query.push_back(byte);
+                break;
+            case key::erase_char:
+                erase_char(query);
+                break;
+            case key::erase_word:
+                erase_word(query);
+                break;
+            case key::erase_line:
+                query.clear();
+                break;
+            case key::up:
+                selected = selected == 0 ? 0 : selected - 1;
+                break;
+            case key::down:
+                if (selected + 1 < shown.rows.size()) ++selected;
+                break;
+            case key::accept:
+                accept = true;
+                break;
+            case key::quit:
+                return std::nullopt;
+            case key::ignored:
+            default:
+                break;
+            }
+        }
+        if (query != old_query) ranker.submit(query, list_rows());
+        // The rows on screen may answer an older query, then the pick waits for the answer to this one
+        accepting = accept && (query != old_query || shown.query != query);
+        if (accept && !accepting && !shown.rows.empty()) return std::size_t{shown.rows[selected].index};
+    }
+}
+
+} // namespace ssm::picker
+
+#endif // __linux__
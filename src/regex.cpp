@@ -0,0 +1,815 @@
+#include "regex.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <span>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+using byte_set = std::bitset<256>;
+
+constexpr u32 UNBOUNDED = UINT32_MAX;
+constexpr u32 MAX_REPEAT = 1000;
+constexpr std::size_t MAX_DEPTH = 256;
+constexpr std::size_t MAX_NODES = 100'000;
+
+// Longer required strings only cost time to build, and a prefilter gains nothing from them
+constexpr std::size_t MAX_LITERAL = 256;
+
+struct ast {
+    enum class kind : u8 {
+        empty,
+        bytes,
+        concat,
+        alternate,
+        repeat,
+        line_start,
+        line_end,
+    };
+
+    kind type = kind::empty;
+    byte_set bytes;
+    std::vector<ast> children;
+    u32 min = 0;
+    u32 max = 0;
+};
+
+byte_set range_set(const unsigned lo, const unsigned hi) {
+    byte_set set;
+    for (unsigned b = lo; b <= hi; ++b) set.set(b);
+    return set;
+}
+
+byte_set byte_of(const char c) {
+    byte_set set;
+    set.set(static_cast<u8>(c));
+    return set;
+}
+
+// The byte a set holds if it holds exactly one
+std::optional<u8> single_byte(const byte_set& set) {
+    if (set.count() != 1) return std::nullopt;
+    for (unsigned b = 0; b < 256; ++b) {
+        if (set.test(b)) return static_cast<u8>(b);
+    }
+    return std::nullopt;
+}
+
+class parser {
+public:
+    explicit parser(const std::string_view pattern) : pattern_(pattern) {}
+
+    std::expected<ast, std::string> parse() {
+        ast root = alternate(0);
+        // A top-level alternation only stops early at a ')' without a '('
+        if (error_.empty() && pos_ < pattern_.size()) fail("unmatched ')'");
+        if (!error_.empty()) return std::unexpected(MOVE(error_));
+        return root;
+    }
+
+private:
+    std::string_view pattern_;
+    std::size_t pos_ = 0;
+    std::string error_;
+
+    void fail(const std::string_view what) {
+        if (error_.empty()) error_ = std::format("{} at offset {}", what, pos_);
+    }
+
+    [[nodiscard]] bool more() const noexcept {
+        return error_.empty() && pos_ < pattern_.size();
+    }
+
+    [[nodiscard]] char peek() const noexcept {
+        return pattern_[pos_];
+    }
+
+    ast alternate(const std::size_t depth) {
+        ast first = concat(depth);
+        if (!more() || peek() != '|') return first;
+
+        ast node{.type = ast::kind::alternate};
+        node.children.push_back(MOVE(first));
+        while (more() && peek() == '|') {
+            ++pos_;
+            node.children.push_back(concat(depth));
+        }
+        return node;
+    }
+
+    ast concat(const std::size_t depth) {
+        ast node{.type = ast::kind::concat};
+        while (more() && peek() != '|' && peek() != ')') node.children.push_back(repeat(depth));
+        if (node.children.empty()) return {};
+        if (node.children.size() == 1) return MOVE(node.children.front());
+        return node;
+    }
+
+    ast repeat(const std::size_t depth) {
+        ast node = atom(depth);
+        while (more()) {
+            u32 min = 0;
+            u32 max = UNBOUNDED;
+            if (peek() == '*') {
+                ++pos_;
+            } else if (peek() == '+') {
+                min = 1;
+                ++pos_;
+            } else if (peek() == '?') {
+                max = 1;
+                ++pos_;
+            } else if (peek() != '{' || !counts(min, max)) {
+                break;
+            }
+            if (more() && peek() == '?') ++pos_; // lazy, same lines either way
+
+            ast outer{.type = ast::kind::repeat, .min = min, .max = max};
+            outer.children.push_back(MOVE(node));
+            node = MOVE(outer);
+        }
+        return node;
+    }
+
+    // {n}, {n,} or {n,m}. Anything else leaves `pos_` alone and the '{' is taken literally
+    bool counts(u32& min, u32& max) {
+        const std::size_t start = pos_;
+        const auto number = [&](u32& value) {
+            const std::size_t begin = pos_;
+            value = 0;
+            while (pos_ < pattern_.size() && pattern_[pos_] >= '0' && pattern_[pos_] <= '9') {
+                value = std::min<u32>(value * 10 + static_cast<u32>(pattern_[pos_] - '0'), MAX_REPEAT + 1);
+                ++pos_;
+            }
+            return pos_ > begin;
+        };
+
+        ++pos_;
+        if (!number(min)) {
+            pos_ = start;
+            return false;
+        }
+        max = min;
+        if (pos_ < pattern_.size() && pattern_[pos_] == ',') {
+            ++pos_;
+            if (!number(max)) max = UNBOUNDED;
+        }
+        if (pos_ >= pattern_.size() || pattern_[pos_] != '}') {
+            pos_ = start;
+            return false;
+        }
+        ++pos_;
+
+        if (min > MAX_REPEAT || (max != UNBOUNDED && max > MAX_REPEAT)) {
+            fail(std::format("repetition count above {}", MAX_REPEAT));
+        } else if (min > max) {
+            fail("repetition range out of order");
+        }
+        return true;
+    }
+
+    ast atom(const std::size_t depth) {
+        const char c = pattern_[pos_++];
+        switch (c) {
+        case '(': {
+            if (depth >= MAX_DEPTH) {
+                fail("groups nested too deeply");
+                return {};
+            }
+            if (pattern_.substr(pos_).starts_with("?:")) {
+                pos_ += 2;
+            } else if (pos_ < pattern_.size() && pattern_[pos_] == '?') {
+                fail("unsupported group");
+                return {};
+            }
+            ast inner = alternate(depth + 1);
+            if (!error_.empty()) return {};
+            if (pos_ >= pattern_.size()) {
+                fail("missing ')'");
+                return {};
+            }
+            ++pos_;
+            return inner;
+        }
+        case '[':
+            return bytes(bracket());
+        case '.':
+            return bytes(byte_set().flip());
+        case '^':
+            return {.type = ast::kind::line_start};
+        case '$':
+            return {.type = ast::kind::line_end};
+        case '\\':
+            return bytes(escape());
+        case '*':
+        case '+':
+        case '?':
+            --pos_;
+            fail("nothing to repeat");
+            return {};
+        default:
+            return bytes(byte_of(c));
+        }
+    }
+
+    // Lines never hold a newline, so no set needs to
+    static ast bytes(byte_set set) {
+        set.reset('\n');
+        return {.type = ast::kind::bytes, .bytes = set};
+    }
+
+    // After the backslash
+    byte_set escape() {
+        if (pos_ >= pattern_.size()) {
+            fail("trailing backslash");
+            return {};
+        }
+
+        const byte_set digit = range_set('0', '9');
+        const byte_set word = digit | range_set('a', 'z') | range_set('A', 'Z') | byte_of('_');
+        const byte_set space = byte_of(' ') | byte_of('\t') | byte_of('\r') | byte_of('\f') | byte_of('\v');
+
+        const char c = pattern_[pos_++];
+        switch (c) {
+        case 'd': return digit;
+        case 'D': return ~digit;
+        case 'w': return word;
+        case 'W': return ~word;
+        case 's': return space;
+        case 'S': return ~space;
+        case 't': return byte_of('\t');
+        case 'n': return byte_of('\n');
+        case 'r': return byte_of('\r');
+        case 'f': return byte_of('\f');
+        case 'v': return byte_of('\v');
+        case 'x': {
+            const auto hex = [](const char h) -> int {
+                if (h >= '0' && h <= '9') return h - '0';
+                if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+                if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+                return -1;
+            };
+            if (pos_ + 2 > pattern_.size() || hex(pattern_[pos_]) < 0 || hex(pattern_[pos_ + 1]) < 0) {
+                fail("\\x needs two hex digits");
+                return {};
+            }
+            const auto value = static_cast<unsigned>(hex(pattern_[pos_]) * 16 + hex(pattern_[pos_ + 1]));
+            pos_ += 2;
+            return range_set(value, value);
+        }
+        default:
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+                --pos_;
+                fail(std::format("unsupported escape \\{}", c));
+                return {};
+            }
+            return byte_of(c);
+        }
+    }
+
+    // After the '['. A ']' right after the '[' or '[^' is a member, not the end
+    byte_set bracket() {
+        const bool negated = pos_ < pattern_.size() && pattern_[pos_] == '^';
+        if (negated) ++pos_;
+
+        byte_set set;
+        for (bool first = true;; first = false) {
+            if (!error_.empty()) return {};
+            if (pos_ >= pattern_.size()) {
+                fail("missing ']'");
+                return {};
+            }
+            if (pattern_[pos_] == ']' && !first) {
+                ++pos_;
+                break;
+            }
+
+            byte_set item = member();
+            const std::optional<u8> lo = single_byte(item);
+            if (lo.has_value() && pos_ + 1 < pattern_.size() && pattern_[pos_] == '-' && pattern_[pos_ + 1] != ']') {
+                ++pos_;
+                const std::optional<u8> hi = single_byte(member());
+                if (!hi.has_value() || *hi < *lo) {
+                    fail("invalid range");
+                    return {};
+                }
+                item = range_set(*lo, *hi);
+            }
+            set |= item;
+        }
+        return negated ? ~set : set;
+    }
+
+    byte_set member() {
+        if (pattern_[pos_] == '\\') {
+            ++pos_;
+            return escape();
+        }
+        return byte_of(pattern_[pos_++]);
+    }
+};
+
+// What the pattern says about the literal text of its matches, worked out bottom-up over the syntax tree
+struct literal_info {
+    bool exact = false; // every match is exactly `text`
+    std::string text;
+    std::string prefix;   // every match starts with it
+    std::string suffix;   // every match ends with it
+    std::string required; // every match contains it
+};
+
+const std::string& longest(const std::string& a, const std::string& b) {
+    return b.size() > a.size() ? b : a;
+}
+
+literal_info exact(std::string text) {
+    if (text.size() > MAX_LITERAL) {
+        literal_info info;
+        info.prefix = text.substr(0, MAX_LITERAL);
+        info.suffix = text.substr(text.size() - MAX_LITERAL);
+        info.required = info.prefix;
+        return info;
+    }
+    return {.exact = true, .text = text, .prefix = text, .suffix = text, .required = text};
+}
+
+literal_info join(const literal_info& a, const literal_info& b) {
+    if (a.exact && b.exact) return exact(a.text + b.text);
+
+    literal_info info;
+    info.prefix = a.exact ? a.text + b.prefix : a.prefix;
+    info.suffix = b.exact ? a.suffix + b.text : b.suffix;
+    info.prefix.resize(std::min(info.prefix.size(), MAX_LITERAL));
+    if (info.suffix.size() > MAX_LITERAL) info.suffix.erase(0, info.suffix.size() - MAX_LITERAL);
+
+    // a's match ends with its suffix and b's starts with its prefix, right after it
+    std::string across = a.suffix + b.prefix;
+    across.resize(std::min(across.size(), MAX_LITERAL));
+    info.required = longest(longest(a.required, b.required), longest(across, longest(info.prefix, info.suffix)));
+    return info;
+}
+
+literal_info analyze(const ast& node) {
+    switch (node.type) {
+    case ast::kind::empty:
+    case ast::kind::line_start:
+    case ast::kind::line_end:
+        return exact("");
+    case ast::kind::bytes:
+        if (const std::optional<u8> b = single_byte(node.bytes)) return exact(std::string(1, static_cast<char>(*b)));
+        return {};
+    case ast::kind::concat: {
+        literal_info info = exact("");
+        for (const ast& child : node.children) info = join(info, analyze(child));
+        return info;
+    }
+    case ast::kind::alternate: {
+        std::vector<literal_info> infos;
+        for (const ast& child : node.children) infos.push_back(analyze(child));
+        if (std::ranges::all_of(infos, [&](const literal_info& i) { return i.exact && i.text == infos.front().text; })) {
+            return infos.front();
+        }
+
+        literal_info info;
+        info.prefix = infos.front().prefix;
+        info.suffix = infos.front().suffix;
+        for (const literal_info& i : infos) {
+            const auto prefix_end = std::ranges::mismatch(info.prefix, i.prefix).in1;
+            info.prefix.erase(prefix_end, info.prefix.end());
+            const auto suffix_end = std::ranges::mismatch(info.suffix.rbegin(), info.suffix.rend(), i.suffix.rbegin(),
+                                                          i.suffix.rend()).in1;
+            info.suffix.erase(info.suffix.begin(), suffix_end.base());
+        }
+        info.required = longest(info.prefix, info.suffix);
+        return info;
+    }
+    default:
+        break;
+    }
+
+    // A repetition
+    if (node.max == 0) return exact("");
+    if (node.min == 0) return {};
+    literal_info child = analyze(node.children.front());
+    if (child.exact && node.min == node.max) {
+        std::string text;
+        for (u32 i = 0; i < node.min && text.size() <= MAX_LITERAL; ++i) text += child.text;
+        return exact(MOVE(text));
+    }
+    child.exact = false;
+    return child;
+}
+
+bool has_anchor(const ast& node) {
+    if (node.type == ast::kind::line_start || node.type == ast::kind::line_end) return true;
+    return std::ranges::any_of(node.children, has_anchor);
+}
+
+// Every match starts at the start of a line, so a search never needs to try later starting points
+bool anchored_at_start(const ast& node) {
+    switch (node.type) {
+    case ast::kind::line_start:
+        return true;
+    case ast::kind::concat:
+        return anchored_at_start(node.children.front());
+    case ast::kind::alternate:
+        return std::ranges::all_of(node.children, anchored_at_start);
+    case ast::kind::repeat:
+        return node.min > 0 && anchored_at_start(node.children.front());
+    default:
+        return false;
+    }
+}
+
+// First offset at or after `from` whose byte is in one of `ranges`, data.size() if there is none. A byte is in
+// [lo, hi] when byte - lo, wrapping, is at most hi - lo
+std::size_t find_in_ranges(const std::string_view data, std::size_t from, const std::span<const std::pair<u8, u8>> ranges) {
+    const std::size_t n = data.size();
+    const char* const base = data.data();
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX2__)
+    using vector = __m256i;
+    constexpr std::size_t WIDTH = 32;
+    const auto splat = [](const u8 b) { return _mm256_set1_epi8(static_cast<char>(b)); };
+    const auto in_range = [](const vector bytes, const vector lo, const vector width) {
+        const vector offset = _mm256_sub_epi8(bytes, lo);
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, width), offset);
+    };
+#else
+    using vector = __m128i;
+    constexpr std::size_t WIDTH = 16;
+    const auto splat = [](const u8 b) { return _mm_set1_epi8(static_cast<char>(b)); };
+    const auto in_range = [](const vector bytes, const vector lo, const vector width) {
+        const vector offset = _mm_sub_epi8(bytes, lo);
+        return _mm_cmpeq_epi8(_mm_min_epu8(offset, width), offset);
+    };
+#endif
+    vector los[4];
+    vector widths[4];
+    const std::size_t count = std::min<std::size_t>(ranges.size(), 4);
+    for (std::size_t r = 0; r < count; ++r) {
+        los[r] = splat(ranges[r].first);
+        widths[r] = splat(static_cast<u8>(ranges[r].second - ranges[r].first));
+    }
+    if (count == ranges.size()) {
+        for (; from + WIDTH <= n; from += WIDTH) {
+#if defined(__AVX2__)
+            const vector bytes = _mm256_loadu_si256(reinterpret_cast<const vector*>(base + from));
+            vector hits = _mm256_setzero_si256();
+            for (std::size_t r = 0; r < count; ++r) hits = _mm256_or_si256(hits, in_range(bytes, los[r], widths[r]));
+            const auto mask = static_cast<u32>(_mm256_movemask_epi8(hits));
+#else
+            const vector bytes = _mm_loadu_si128(reinterpret_cast<const vector*>(base + from));
+            vector hits = _mm_setzero_si128();
+            for (std::size_t r = 0; r < count; ++r) hits = _mm_or_si128(hits, in_range(bytes, los[r], widths[r]));
+            const auto mask = static_cast<u32>(_mm_movemask_epi8(hits));
+#endif
+            if (mask != 0) return from + static_cast<std::size_t>(std::countr_zero(mask));
+        }
+    }
+#endif
+
+    for (; from < n; ++from) {
+        const auto b = static_cast<u8>(base[from]);
+        for (const auto& [lo, hi] : ranges) {
+            if (b >= lo && b <= hi) return from;
+        }
+    }
+    return n;
+}
+
+ssm::search::line_span line_around(const std::string_view text, const std::size_t pos) {
+    const std::size_t n = text.size();
+    const std::size_t end = pos < n && text[pos] == '\n' ? pos : std::min(text.find('\n', pos), n);
+    const std::size_t previous_newline = pos == 0 ? std::string_view::npos : text.rfind('\n', pos - 1);
+    return {.begin = previous_newline == std::string_view::npos ? 0 : previous_newline + 1, .end = end};
+}
+
+} // namespace
+
+namespace ssm::regex {
+
+std::expected<program, std::string> program::compile(const std::string_view pattern) {
+    std::expected<ast, std::string> tree = parser(pattern).parse();
+    if (!tree.has_value()) return std::unexpected(MOVE(tree.error()));
+
+    program prog;
+
+    // Builds back to front: each piece is emitted knowing the node that follows it, so no jumps need patching
+    struct emitter {
+        std::vector<node>& nodes;
+
+        u32 add(const node& n) {
+            nodes.push_back(n);
+            return static_cast<u32>(nodes.size() - 1);
+        }
+
+        u32 emit(const ast& a, u32 next) {
+            if (nodes.size() > MAX_NODES) return next;
+            switch (a.type) {
+            case ast::kind::empty:
+                return next;
+            case ast::kind::bytes:
+                return add({.type = node::kind::bytes, .out = next, .bytes = a.bytes});
+            case ast::kind::line_start:
+                return add({.type = node::kind::line_start, .out = next});
+            case ast::kind::line_end:
+                return add({.type = node::kind::line_end, .out = next});
+            case ast::kind::concat:
+                for (auto it = a.children.rbegin(); it != a.children.rend(); ++it) next = emit(*it, next);
+                return next;
+            case ast::kind::alternate: {
+                u32 entry = emit(a.children.back(), next);
+                for (auto it = a.children.rbegin() + 1; it != a.children.rend(); ++it) {
+                    const u32 branch = emit(*it, next);
+                    entry = add({.type = node::kind::split, .out = branch, .out2 = entry});
+                }
+                return entry;
+            }
+            default:
+                break;
+            }
+
+            // A repetition: the optional copies or the loop come last, after `min` required copies
+            const ast& body = a.children.front();
+            if (a.max == UNBOUNDED) {
+                const u32 loop = add({.type = node::kind::split});
+                const u32 entry = emit(body, loop);
+                nodes[loop].out = entry;
+                nodes[loop].out2 = next;
+                next = loop;
+            } else {
+                for (u32 i = a.min; i < a.max; ++i) {
+                    const u32 copy = emit(body, next);
+                    next = add({.type = node::kind::split, .out = copy, .out2 = next});
+                }
+            }
+            for (u32 i = 0; i < a.min; ++i) next = emit(body, next);
+            return next;
+        }
+    };
+
+    emitter em{prog.nodes_};
+    const u32 match = em.add({.type = node::kind::match});
+    const u32 entry = em.emit(*tree, match);
+    if (prog.nodes_.size() > MAX_NODES) return std::unexpected("pattern is too large once repetitions are expanded");
+
+    if (anchored_at_start(*tree)) {
+        prog.start_ = entry;
+    } else {
+        // Unanchored search: any run of bytes may come before the match
+        prog.start_ = em.add({.type = node::kind::split, .out = entry});
+        const u32 skip = em.add({.type = node::kind::bytes, .out = prog.start_, .bytes = byte_set().flip().reset('\n')});
+        prog.nodes_[prog.start_].out2 = skip;
+    }
+
+    // A class starts at every byte where some set starts or stops including bytes. A newline gets a class of its
+    // own, it ends lines
+    std::bitset<257> boundaries;
+    boundaries.set('\n');
+    boundaries.set('\n' + 1);
+    for (const node& n : prog.nodes_) {
+        if (n.type != node::kind::bytes) continue;
+        for (unsigned b = 1; b < 256; ++b) {
+            if (n.bytes.test(b) != n.bytes.test(b - 1)) boundaries.set(b);
+        }
+    }
+    for (unsigned b = 0; b < 256; ++b) {
+        if (b > 0 && boundaries.test(b)) ++prog.class_count_;
+        prog.classes_[b] = static_cast<u8>(prog.class_count_);
+        if (prog.representatives_.size() == prog.class_count_) prog.representatives_.push_back(static_cast<u8>(b));
+    }
+    ++prog.class_count_;
+
+    literal_info info = analyze(*tree);
+    prog.literal_ = info.exact && !info.text.empty() && !has_anchor(*tree);
+    prog.required_ = MOVE(info.required);
+    if (!prog.required_.empty()) prog.prefilter_.emplace(prog.required_);
+    return prog;
+}
+
+matcher::matcher(const program& program) : program_(&program), marks_(program.nodes_.size(), 0) {
+    reset();
+}
+
+void matcher::reset() {
+    states_.clear();
+    next_.clear();
+    index_.clear();
+
+    bool matched = false;
+    set_.clear();
+    at_end_.clear();
+    if (++generation_ == 0) {
+        std::ranges::fill(marks_, 0);
+        generation_ = 1;
+    }
+    closure(program_->start_, true, matched);
+    every_line_ = matched;
+    start_exits_.clear();
+    skip_start_ = false;
+    if (every_line_) return;
+    intern(true); // row 0, where every line starts
+
+    // The start state has few enough successors that building them all now costs next to nothing
+    std::size_t exit_bytes = 0;
+    for (unsigned b = 0; b < 256; ++b) {
+        const u32 byte_class = program_->classes_[b];
+        i32 target = next_[byte_class];
+        if (target == UNKNOWN) target = transition(0, byte_class);
+        if (target == 0) continue;
+
+        ++exit_bytes;
+        if (!start_exits_.empty() && start_exits_.back().second + 1U == b) {
+            start_exits_.back().second = static_cast<u8>(b);
+        } else {
+            start_exits_.emplace_back(static_cast<u8>(b), static_cast<u8>(b));
+        }
+    }
+    // Skipping only pays when most bytes keep the DFA where it is
+    skip_start_ = start_exits_.size() <= MAX_EXIT_RANGES && exit_bytes <= 128;
+}
+
+void matcher::closure(const u32 node, const bool bol, bool& matched) {
+    stack_.push_back(node);
+    while (!stack_.empty()) {
+        const u32 id = stack_.back();
+        stack_.pop_back();
+        if (marks_[id] == generation_) continue;
+        marks_[id] = generation_;
+
+        const program::node& n = program_->nodes_[id];
+        switch (n.type) {
+        case program::node::kind::bytes:
+            set_.push_back(id);
+            break;
+        case program::node::kind::split:
+            stack_.push_back(n.out2);
+            stack_.push_back(n.out);
+            break;
+        case program::node::kind::line_start:
+            if (bol) stack_.push_back(n.out);
+            break;
+        case program::node::kind::line_end:
+            at_end_.push_back(n.out);
+            break;
+        case program::node::kind::match:
+            matched = true;
+            break;
+        default:
+            UNREACHABLE();
+        }
+    }
+}
+
+bool matcher::reaches_match_at_end(const bool bol) {
+    if (++generation_ == 0) {
+        std::ranges::fill(marks_, 0);
+        generation_ = 1;
+    }
+    stack_.assign(at_end_.begin(), at_end_.end());
+    while (!stack_.empty()) {
+        const u32 id = stack_.back();
+        stack_.pop_back();
+        if (marks_[id] == generation_) continue;
+        marks_[id] = generation_;
+
+        const program::node& n = program_->nodes_[id];
+        switch (n.type) {
+        case program::node::kind::bytes:
+            break;
+        case program::node::kind::split:
+            stack_.push_back(n.out2);
+            stack_.push_back(n.out);
+            break;
+        case program::node::kind::line_start:
+            if (bol) stack_.push_back(n.out);
+            break;
+        case program::node::kind::line_end:
+            stack_.push_back(n.out);
+            break;
+        case program::node::kind::match:
+            stack_.clear();
+            return true;
+        default:
+            UNREACHABLE();
+        }
+    }
+    return false;
+}
+
+i32 matcher::intern(const bool bol) {
+    std::ranges::sort(set_);
+    const bool matches_at_end = !at_end_.empty() && reaches_match_at_end(bol);
+    if (set_.empty() && !matches_at_end) return DEAD;
+
+    std::string key(reinterpret_cast<const char*>(set_.data()), set_.size() * sizeof(u32));
+    key.push_back(matches_at_end ? '$' : '-');
+    if (const auto it = index_.find(key); it != index_.end()) return it->second;
+
+    const auto row = static_cast<i32>(next_.size());
+    states_.push_back({.nodes = set_, .matches_at_end = matches_at_end});
+    next_.resize(next_.size() + program_->class_count_, UNKNOWN);
+    // The start row is 0, so this is also right for the start state itself
+    next_[static_cast<std::size_t>(row) + program_->classes_['\n']] = matches_at_end ? MATCHED : 0;
+    index_.emplace(MOVE(key), row);
+    return row;
+}
+
+i32 matcher::transition(const i32 row, const u32 byte_class) {
+    const std::size_t index = static_cast<std::size_t>(row) / program_->class_count_;
+
+    // A pattern with a huge DFA gets its states rebuilt from scratch now and then rather than eating memory
+    const bool flush = states_.size() >= MAX_STATES;
+    std::vector<u32> from;
+    if (flush) {
+        from = MOVE(states_[index].nodes);
+        reset();
+    }
+    const std::vector<u32>& nodes = flush ? from : states_[index].nodes;
+
+    bool matched = false;
+    set_.clear();
+    at_end_.clear();
+    if (++generation_ == 0) {
+        std::ranges::fill(marks_, 0);
+        generation_ = 1;
+    }
+    const u8 byte = program_->representatives_[byte_class];
+    for (const u32 id : nodes) {
+        const program::node& n = program_->nodes_[id];
+        if (n.bytes.test(byte)) closure(n.out, false, matched);
+    }
+
+    const i32 target = matched ? MATCHED : intern(false);
+    if (!flush) next_[static_cast<std::size_t>(row) + byte_class] = target;
+    return target;
+}
+
+std::size_t matcher::run(const std::string_view text, const std::size_t from) {
+    const char* const data = text.data();
+    const std::size_t n = text.size();
+    const u8* const classes = program_->classes_.data();
+
+    i32 row = 0;
+    for (std::size_t i = from; i < n; ++i) {
+        if (row == 0 && skip_start_) {
+            i = find_in_ranges(text, i, start_exits_);
+            if (i == n) break;
+        }
+        const u8 byte_class = classes[static_cast<u8>(data[i])];
+        i32 target = next_[static_cast<std::size_t>(row) + byte_class];
+        if (target < 0) [[unlikely]] {
+            if (target == UNKNOWN) target = transition(row, byte_class);
+            if (target == MATCHED) return i;
+            if (target == DEAD) {
+                const void* newline = std::memchr(data + i, '\n', n - i);
+                if (newline == nullptr) return std::string_view::npos;
+                i = static_cast<std::size_t>(static_cast<const char*>(newline) - data);
+                target = 0;
+            }
+        }
+        row = target;
+    }
+
+    // A text ending in a newline has no last line after it
+    if (n > from && data[n - 1] != '\n' && states_[static_cast<std::size_t>(row) / program_->class_count_].matches_at_end) {
+        return n;
+    }
+    return std::string_view::npos;
+}
+
+std::optional<search::line_span> matcher::next_line(const std::string_view text, std::size_t from) {
+    const std::size_t n = text.size();
+    if (from >= n) return std::nullopt;
+    if (every_line_) return search::line_span{.begin = from, .end = std::min(text.find('\n', from), n)};
+
+    if (!program_->prefilter_.has_value()) {
+        const std::size_t pos = run(text, from);
+        if (pos == std::string_view::npos) return std::nullopt;
+        return line_around(text, pos);
+    }
+
+    // Only lines holding the required string can match, the automaton checks just those
+    while (from < n) {
+        const std::size_t hit = program_->prefilter_->find(text, from);
+        if (hit == std::string_view::npos) return std::nullopt;
+        const search::line_span line = line_around(text, hit);
+        if (program_->literal_ || run(text.substr(line.begin, line.end - line.begin), 0) != std::string_view::npos) {
+            return line;
+        }
+        from = line.end + 1;
+    }
+    return std::nullopt;
+}
+
+} // namespace ssm::regex
@@ -0,0 +1,78 @@
+#include "schema.hpp"
+
+#include "common.hpp"
+#include "fts.hpp"
+#include "minhash.hpp"
+#include "suggest.hpp"
+#include "symbols.hpp"
+#include "tfidf.hpp"
+#include "trace.hpp"
+#include "trigram.hpp"
+
+#include <format>
+#include <iterator>
+#include <optional>
+#include <print>
+
+namespace {
+
+struct migration {
+    i64 version;
+    bool (*apply)(const ssm_sqlite3::database&);
+};
+
+// In version order, never reordered or removed: a database at version N has had every step up to N applied
+constexpr migration MIGRATIONS[] = {
+    {.version = 1, .apply = ssm::suggest::build},
+    {.version = 2, .apply = ssm::trigram::build},
+    {.version = 3, .apply = ssm::fts::build},
+    {.version = 4, .apply = ssm::tfidf::build},
+    {.version = 5, .apply = ssm::minhash::build},
+    {.version = 6, .apply = ssm::symbols::build},
+};
+
+constexpr i64 SUGGEST_VERSION = 1;
+constexpr i64 LATEST_VERSION = MIGRATIONS[std::size(MIGRATIONS) - 1].version;
+
+std::optional<i64> user_version(const ssm_sqlite3::database& sqlite) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("PRAGMA user_version;");
+    if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) return std::nullopt;
+    return sqlite3_column_int64(stmt.get(), 0);
+}
+
+} // namespace
+
+namespace ssm::schema {
+
+bool migrate(const ssm_sqlite3::database& sqlite) {
+    const std::optional<i64> version = user_version(sqlite);
+    if (version.has_value() && *version >= LATEST_VERSION) return true;
+
+    SSM_TRACE_SCOPE("schema.migrate");
+    if (!sqlite.exec("BEGIN IMMEDIATE;")) {
+        std::println(stderr, "Failed to begin transaction: {}", sqlite.errmsg());
+        return false;
+    }
+
+    // Another process may have migrated while this one waited for the lock
+    const std::optional<i64> current = user_version(sqlite);
+    bool ok = current.has_value();
+    for (const migration& m : MIGRATIONS) {
+        if (!ok || m.version <= *current) continue;
+        ok = m.apply(sqlite) && sqlite.exec(std::format("PRAGMA user_version = {};", m.version).c_str());
+    }
+
+    if (!ok || !sqlite.exec("COMMIT;")) {
+        std::println(stderr, "Failed to update the database indexes: {}", sqlite.errmsg());
+        sqlite.exec("ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+bool has_suggest_index(const ssm_sqlite3::database& sqlite) {
+    const std::optional<i64> version = user_version(sqlite);
+    return version.has_value() && *version >= SUGGEST_VERSION;
+}
+
+} // namespace ssm::schema
@@ -0,0 +1,230 @@
+#include "search.hpp"
+
+#include "regex.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// One thread's share of a parallel_for range. [begin, end) is packed into a single word, so the owner taking from
+// the front and a thief taking from the back never both get the same index
+class alignas(64) share {
+public:
+    void assign(const u32 begin, const u32 end) noexcept {
+        range_.store(pack(begin, end), std::memory_order_release);
+    }
+
+    std::optional<u32> pop() noexcept {
+        u64 range = range_.load(std::memory_order_acquire);
+        for (;;) {
+            const auto [begin, end] = unpack(range);
+            if (begin >= end) return std::nullopt;
+            if (range_.compare_exchange_weak(range, pack(begin + 1, end), std::memory_order_acq_rel)) return begin;
+        }
+    }
+
+    // The back half, rounded up so that a last single item can be stolen too
+    std::optional<std::pair<u32, u32>> steal() noexcept {
+        u64 range = range_.load(std::memory_order_acquire);
+        for (;;) {
+            const auto [begin, end] = unpack(range);
+            if (begin >= end) return std::nullopt;
+            const u32 middle = begin + (end - begin) / 2;
+            if (range_.compare_exchange_weak(range, pack(begin, middle), std::memory_order_acq_rel)) {
+                return std::pair{middle, end};
+            }
+        }
+    }
+
+private:
+    std::atomic<u64> range_ = 0;
+
+    static u64 pack(const u32 begin, const u32 end) noexcept {
+        return u64{begin} << 32 | end;
+    }
+
+    static std::pair<u32, u32> unpack(const u64 range) noexcept {
+        return {static_cast<u32>(range >> 32), static_cast<u32>(range)};
+    }
+};
+
+// `next_line(from)` finds the first matching line at or after the line starting at `from`
+template <typename NextLine>
+bool grep_lines(const std::string_view name, const std::string_view text, const bool files_only, std::string& out,
+                NextLine&& next_line) {
+    bool matched = false;
+    std::size_t line = 1;
+    std::size_t counted = 0; // newlines before this offset are already in `line`
+    for (std::optional<ssm::search::line_span> span = next_line(0); span.has_value(); span = next_line(span->end + 1)) {
+        matched = true;
+        if (files_only) {
+            out += name;
+            out.push_back('\n');
+            break;
+        }
+
+        line += static_cast<std::size_t>(std::count(text.begin() + static_cast<std::ptrdiff_t>(counted),
+                                                    text.begin() + static_cast<std::ptrdiff_t>(span->begin), '\n'));
+        counted = span->begin;
+        std::format_to(std::back_inserter(out), "{}:{}:{}\n", name, line, text.substr(span->begin, span->end - span->begin));
+    }
+    return matched;
+}
+
+} // namespace
+
+namespace ssm::search {
+
+finder::finder(const std::string_view needle) : needle_(needle) {}
+
+std::size_t finder::find(const std::string_view haystack, std::size_t from) const noexcept {
+    constexpr std::size_t npos = std::string_view::npos;
+    const std::size_t m = needle_.size();
+    if (from > haystack.size()) return npos;
+    if (m == 0) return from;
+    if (haystack.size() - from < m) return npos;
+
+    const char* const base = haystack.data();
+    if (m == 1) {
+        const void* hit = std::memchr(base + from, needle_[0], haystack.size() - from);
+        return hit == nullptr ? npos : static_cast<std::size_t>(static_cast<const char*>(hit) - base);
+    }
+
+    // Every start position up to here leaves room for the whole needle
+    const std::size_t end = haystack.size() - m + 1;
+    const auto matches_at = [&](const std::size_t pos) {
+        return std::memcmp(base + pos + 1, needle_.data() + 1, m - 2) == 0;
+    };
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(needle_.front());
+    const __m256i last = _mm256_set1_epi8(needle_.back());
+    for (; from + 32 <= end; from += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + from));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + from + m - 1));
+        auto mask = static_cast<u32>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                            _mm256_cmpeq_epi8(b, last))));
+        for (; mask != 0; mask &= mask - 1) {
+            const std::size_t pos = from + static_cast<std::size_t>(std::countr_zero(mask));
+            if (matches_at(pos)) return pos;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle_.front());
+    const __m128i last = _mm_set1_epi8(needle_.back());
+    for (; from + 16 <= end; from += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + from));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + from + m - 1));
+        auto mask = static_cast<u32>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+        for (; mask != 0; mask &= mask - 1) {
+            const std::size_t pos = from + static_cast<std::size_t>(std::countr_zero(mask));
+            if (matches_at(pos)) return pos;
+        }
+    }
+#endif
+
+    for (; from < end; ++from) {
+        if (base[from] == needle_.front() && base[from + m - 1] == needle_.back() && matches_at(from)) return from;
+    }
+    return npos;
+}
+
+mapped_file::mapped_file(const std::filesystem::path& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            ok_ = true;
+        } else if (void* map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                   map != MAP_FAILED) {
+            madvise(map, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+            map_ = map;
+            size_ = static_cast<std::size_t>(st.st_size);
+            ok_ = true;
+        }
+    }
+    close(fd);
+}
+
+mapped_file::~mapped_file() {
+    if (map_ != nullptr) munmap(map_, size_);
+}
+
+bool grep_text(const std::string_view name, const std::string_view text, const finder& finder, const bool files_only,
+               std::string& out) {
+    return grep_lines(name, text, files_only, out, [&](const std::size_t from) -> std::optional<line_span> {
+        const std::size_t pos = finder.find(text, from);
+        if (pos == std::string_view::npos) return std::nullopt;
+        const std::size_t previous_newline = pos == 0 ? std::string_view::npos : text.rfind('\n', pos - 1);
+        return line_span{
+            .begin = previous_newline == std::string_view::npos ? 0 : previous_newline + 1,
+            .end = std::min(text.find('\n', pos + finder.needle().size()), text.size()),
+        };
+    });
+}
+
+bool grep_text(const std::string_view name, const std::string_view text, regex::matcher& matcher, const bool files_only,
+               std::string& out) {
+    return grep_lines(name, text, files_only, out,
+                      [&](const std::size_t from) { return matcher.next_line(text, from); });
+}
+
+void parallel_for(const std::size_t count, unsigned threads, const std::function<void(std::size_t)>& body) {
+    if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; ++i) body(i);
+        return;
+    }
+    ASSERT(count <= UINT32_MAX, "parallel_for range does not fit a share");
+
+    std::vector<share> shares(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        shares[t].assign(static_cast<u32>(count * t / threads), static_cast<u32>(count * (t + 1) / threads));
+    }
+
+    // Items are never added, so a thread that finds every share empty is done for good
+    const auto work = [&](const unsigned self) {
+        for (;;) {
+            while (const std::optional<u32> i = shares[self].pop()) body(*i);
+
+            bool stole = false;
+            for (unsigned k = 1; k < threads && !stole; ++k) {
+                if (const auto range = shares[(self + k) % threads].steal()) {
+                    shares[self].assign(range->first, range->second);
+                    stole = true;
+                }
+            }
+            if (!stole) return;
+        }
+    };
+
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+    work(0);
+}
+
+} // namespace ssm::search
@@ -1,18 +1,49 @@
 #include "ssm.hpp"
 
+#include "common.hpp"
+#include "fts.hpp"
+#include "fuzzy.hpp"
+#include "minhash.hpp"
+#include "picker.hpp"
+#include "regex.hpp"
+#include "schema.hpp"
+#include "search.hpp"
 #include "sqlite3.hpp"
+#include "suggest.hpp"
+#include "symbols.hpp"
+#include "tfidf.hpp"
+#include "trace.hpp"
+#include "trigram.hpp"
 
 #define UTILS_PROCESS_IMPLEMENTATION
 #include "process.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
 #include <cstdlib>
+#include <expected>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <print>
+#include <span>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 namespace fs = std::filesystem;
 
 namespace {
@@ -47,6 +78,7 @@ std::optional<fs::path> get_snippet_dir() {
 }
 
 std::optional<fs::path> ensure_snippet_dir() {
+    SSM_TRACE_SCOPE("ensure_snippet_dir");
     auto dir_opt = get_snippet_dir();
     if (!dir_opt.has_value()) return std::nullopt;
     fs::path& dir = *dir_opt;
@@ -78,6 +110,7 @@ std::vector<std::string> snippet_names() {
         return {};
     }
 
+    SSM_TRACE_SCOPE("sqlite.step");
     for (int ret = sqlite3_step(stmt.get()); ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
         const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
         if (text != nullptr) names.emplace_back(text);
@@ -86,37 +119,662 @@ std::vector<std::string> snippet_names() {
     return names;
 }
 
-bool get_snippet_impl(const fs::path& file) {
-    if (!fs::exists(file)) {
-        std::println(stderr, "Snippet '{}' does not exist", file.filename().string());
+enum class selector_kind : u8 {
+    name,   // exact snippet name
+    number, // 1-based position in `ssm ls`
+    range,  // inclusive positions like 3-10
+    glob    // sqlite GLOB pattern like deploy-*
+};
+
+struct selector {
+    selector_kind kind;
+    std::string_view text; // always a whole argument, possibly a line of a response file
+    i64 first = 0;
+    i64 last = 0;
+};
+
+struct snippet_ref {
+    std::string name;
+    fs::path path;
+};
+
+std::optional<i64> parse_position(const std::string_view str) {
+    i64 value = 0;
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != std::errc{} || ptr != str.data() + str.size()) return std::nullopt;
+    return value;
+}
+
+selector classify_selector(const std::string_view text) {
+    if (const auto number = parse_position(text); number.has_value()) {
+        return {.kind = selector_kind::number, .text = text, .first = *number, .last = *number};
+    }
+
+    if (const std::size_t dash = text.find('-'); dash != std::string_view::npos && dash > 0) {
+        const auto first = parse_position(text.substr(0, dash));
+        const auto last = parse_position(text.substr(dash + 1));
+        if (first.has_value() && last.has_value()) {
+            return {.kind = selector_kind::range, .text = text, .first = *first, .last = *last};
+        }
+    }
+
+    if (text.find_first_of("*?[") != std::string_view::npos) {
+        return {.kind = selector_kind::glob, .text = text};
+    }
+
+    return {.kind = selector_kind::name, .text = text};
+}
+
+void append_json_string(std::string& out, const std::string_view str) {
+    out.push_back('"');
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += std::format("\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+bool load_names(const ssm_sqlite3::database& sqlite, ssm::fuzzy::name_set& names) {
+    constexpr auto select_sql = "SELECT name FROM file ORDER BY id ASC;";
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(select_sql);
+    if (!stmt) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
         return false;
     }
 
-    std::ifstream ifs(file);
-    if (!ifs) {
-        std::println(stderr, "Failed to open snippet '{}'", file.filename().string());
+    SSM_TRACE_SCOPE("sqlite.step");
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
+        const int size = sqlite3_column_bytes(stmt.get(), 0);
+        if (text != nullptr) names.add({text, static_cast<std::size_t>(size)});
+    }
+    if (ret != SQLITE_DONE) {
+        std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
         return false;
     }
+    return true;
+}
+
+// The best match wins if it is the query itself or no other name scores the same, otherwise the leaders are listed
+// and nothing is picked. A name scores the same as every longer name it is a prefix of, so exact names win outright
+std::optional<std::string_view> fuzzy_pick(const ssm::fuzzy::name_set& names, const std::string_view query) {
+    constexpr std::size_t SHOWN_MATCHES = 10;
+
+    const std::vector<ssm::fuzzy::match> matches = [&] {
+        SSM_TRACE_SCOPE("fuzzy.rank");
+        return ssm::fuzzy::rank(names, query, SHOWN_MATCHES);
+    }();
+    if (matches.empty()) {
+        std::println(stderr, "No snippets match '{}'", query);
+        return std::nullopt;
+    }
+    const std::string_view top = names[matches.front().index];
+    if (matches.size() > 1 && matches[0].score == matches[1].score && !ssm::fuzzy::is_exact(top, query)) {
+        std::println(stderr, "'{}' is ambiguous, best matches:", query);
+        for (const ssm::fuzzy::match& m : matches) std::println(stderr, "    {}", names[m.index]);
+        return std::nullopt;
+    }
+    return top;
+}
+
+// Names within a couple of typos of a missing one are offered instead, when the index has already been built
+void report_missing(const ssm_sqlite3::database& sqlite, const std::string_view name) {
+    constexpr std::size_t SUGGESTIONS = 3;
+
+    std::vector<std::string> close;
+    if (ssm::schema::has_suggest_index(sqlite)) close = ssm::suggest::closest(sqlite, name, SUGGESTIONS);
+    if (close.empty()) {
+        std::println(stderr, "Snippet '{}' does not exist", name);
+        return;
+    }
+
+    std::string list;
+    for (const std::string& candidate : close) {
+        if (!list.empty()) list += close.size() > 2 ? ", " : " ";
+        if (&candidate == &close.back() && close.size() > 1) list += "or ";
+        list += std::format("'{}'", candidate);
+    }
+    std::println(stderr, "Snippet '{}' does not exist, did you mean {}?", name, list);
+}
+
+// Resolves every selector against the `file` table with a single query. Exact names go through the unique name
+// index as one json_each() parameter, and globs and ranges get one each too, so the statement stays the same size
+// however many selectors there are. Positions only pay for row_number() when a number or range is present.
+// Selectors that match nothing are reported and clear `complete`; everything that did match is returned in
+// selector order without duplicates. With `fuzzy` every selector is a fuzzy query and is first replaced by the
+// name it picks.
+std::vector<snippet_ref> resolve_snippets(const fs::path& dir, const ssm_sqlite3::database& sqlite,
+                                          const std::span<const std::string_view> args, bool& complete,
+                                          const bool fuzzy = false) {
+    complete = true;
+
+    ssm::fuzzy::name_set candidates; // picked selectors point into it
+    if (fuzzy && !load_names(sqlite, candidates)) {
+        complete = false;
+        return {};
+    }
+
+    std::vector<selector> selectors;
+    selectors.reserve(args.size());
+    bool has_names = false;
+    bool has_globs = false;
+    bool has_positions = false;
+    for (const std::string_view arg : args) {
+        if (arg.empty()) {
+            std::println(stderr, "Snippet name cannot be empty");
+            complete = false;
+            continue;
+        }
+        if (fuzzy) {
+            const auto picked = fuzzy_pick(candidates, arg);
+            if (!picked.has_value()) {
+                complete = false;
+                continue;
+            }
+            selectors.push_back({.kind = selector_kind::name, .text = *picked});
+            has_names = true;
+            continue;
+        }
+        const selector sel = classify_selector(arg);
+        has_names |= sel.kind == selector_kind::name;
+        has_globs |= sel.kind == selector_kind::glob;
+        has_positions |= sel.kind == selector_kind::number || sel.kind == selector_kind::range;
+        selectors.push_back(sel);
+    }
+    if (selectors.empty()) return {};
+
+    std::string sql = has_positions
+                          ? "SELECT n, name FROM (SELECT row_number() OVER (ORDER BY id) AS n, name FROM file) WHERE "
+                          : "SELECT 0, name FROM file WHERE ";
+    std::string_view joiner;
+    if (has_names) {
+        sql += "name IN (SELECT value FROM json_each(?))";
+        joiner = " OR ";
+    }
+    if (has_globs) {
+        sql += joiner;
+        sql += "EXISTS (SELECT 1 FROM json_each(?) WHERE name GLOB value)";
+        joiner = " OR ";
+    }
+    if (has_positions) {
+        sql += joiner;
+        sql += "EXISTS (SELECT 1 FROM json_each(?) WHERE n BETWEEN value->>0 AND value->>1)";
+    }
+    sql += has_positions ? " ORDER BY n;" : " ORDER BY id;";
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(sql.c_str());
+    if (!stmt) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+        complete = false;
+        return {};
+    }
+
+    std::string names = "[";
+    std::string globs = "[";
+    std::string positions = "[";
+    for (const selector& sel : selectors) {
+        switch (sel.kind) {
+        case selector_kind::name:
+            if (names.size() > 1) names.push_back(',');
+            append_json_string(names, sel.text);
+            break;
+        case selector_kind::glob:
+            if (globs.size() > 1) globs.push_back(',');
+            append_json_string(globs, sel.text);
+            break;
+        case selector_kind::number:
+        case selector_kind::range:
+            if (positions.size() > 1) positions.push_back(',');
+            positions += std::format("[{},{}]", sel.first, sel.last);
+            break;
+        default: UNREACHABLE();
+        }
+    }
+    names.push_back(']');
+    globs.push_back(']');
+    positions.push_back(']');
+
+    int param = 1;
+    bool bound = true;
+    if (has_names) bound &= ssm_sqlite3::database::bind_text(stmt.get(), param++, names);
+    if (has_globs) bound &= ssm_sqlite3::database::bind_text(stmt.get(), param++, globs);
+    if (has_positions) bound &= ssm_sqlite3::database::bind_text(stmt.get(), param++, positions);
+    if (!bound) {
+        std::println(stderr, "Failed to bind parameters: {}", sqlite.errmsg());
+        complete = false;
+        return {};
+    }
+
+    struct row {
+        i64 number;
+        std::string name;
+    };
+    std::vector<row> rows;
+    SSM_TRACE_SCOPE("sqlite.step");
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1));
+        if (text != nullptr) rows.push_back({.number = sqlite3_column_int64(stmt.get(), 0), .name = text});
+    }
+    if (ret != SQLITE_DONE) {
+        std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+        complete = false;
+        return {};
+    }
+
+    std::unordered_map<std::string_view, const row*> by_name;
+    std::unordered_map<i64, const row*> by_number;
+    for (const row& r : rows) {
+        by_name.emplace(r.name, &r);
+        if (has_positions) by_number.emplace(r.number, &r);
+    }
+
+    std::vector<snippet_ref> snippets;
+    std::unordered_set<std::string_view> seen;
+    const auto add = [&](const std::string_view name) {
+        if (seen.insert(name).second) snippets.push_back({.name = std::string(name), .path = dir / name});
+    };
+
+    for (const selector& sel : selectors) {
+        switch (sel.kind) {
+        case selector_kind::name:
+            // Files dropped into the directory by hand are not in the table but are still valid snippets
+            if (by_name.contains(sel.text) || fs::exists(dir / sel.text)) {
+                add(sel.text);
+            } else {
+                report_missing(sqlite, sel.text);
+                complete = false;
+            }
+            break;
+        case selector_kind::number:
+        case selector_kind::range:
+            // Positions are contiguous, so the range is fully present iff its last position is
+            if (sel.first < 1 || sel.first > sel.last || !by_number.contains(sel.last)) {
+                if (sel.kind == selector_kind::number) {
+                    std::println(stderr, "Snippet number {} is out of range", sel.first);
+                } else {
+                    std::println(stderr, "Snippet range {} is out of range", sel.text);
+                }
+                complete = false;
+                break;
+            }
+            for (i64 n = sel.first; n <= sel.last; ++n) {
+                add(by_number.at(n)->name);
+            }
+            break;
+        case selector_kind::glob: {
+            // Selectors from response files point into the mapping and are not NUL-terminated
+            const std::string pattern(sel.text);
+            bool matched = false;
+            for (const row& r : rows) {
+                if (sqlite3_strglob(pattern.c_str(), r.name.c_str()) == 0) {
+                    add(r.name);
+                    matched = true;
+                }
+            }
+            if (!matched) {
+                std::println(stderr, "No snippets match '{}'", sel.text);
+                complete = false;
+            }
+            break;
+        }
+        default: UNREACHABLE();
+        }
+    }
+
+    return snippets;
+}
 
-    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-    std::print("{}", content);
+bool write_all(std::span<iovec> iov) {
+    while (!iov.empty()) {
+        const int count = static_cast<int>(std::min<std::size_t>(iov.size(), IOV_MAX));
+        const ssize_t written = writev(STDOUT_FILENO, iov.data(), count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        SSM_TRACE_COUNTER("io.bytes_written", written);
+
+        // Drop fully written buffers and advance into a partially written one
+        auto remaining = static_cast<std::size_t>(written);
+        while (!iov.empty() && remaining >= iov.front().iov_len) {
+            remaining -= iov.front().iov_len;
+            iov = iov.subspan(1);
+        }
+        if (!iov.empty()) {
+            iov.front().iov_base = static_cast<char*>(iov.front().iov_base) + remaining;
+            iov.front().iov_len -= remaining;
+        }
+    }
     return true;
 }
 
-bool edit_snippet_impl(const fs::path& file) {
-    if (!fs::exists(file)) {
-        std::println(stderr, "Snippet '{}' does not exist", file.filename().string());
+bool read_fd(const int fd, std::string& out) {
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) out.resize(static_cast<std::size_t>(st.st_size));
+
+    std::size_t size = 0;
+    for (;;) {
+        if (size == out.size()) out.resize(std::max<std::size_t>(out.size() * 2, 4096));
+        const ssize_t got = read(fd, out.data() + size, out.size() - size);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (got == 0) break;
+        size += static_cast<std::size_t>(got);
+    }
+    out.resize(size);
+    SSM_TRACE_COUNTER("io.bytes_read", static_cast<i64>(size));
+    return true;
+}
+
+bool read_file(const fs::path& path, std::string& out) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const bool ok = read_fd(fd, out);
+    close(fd);
+    return ok;
+}
+
+// Snippets are written in batches: every file of a batch is opened and handed to the kernel for readahead before
+// the first blocking read, so their I/O overlaps, and the whole batch then leaves in as few writev calls as possible.
+bool write_snippets(const std::vector<snippet_ref>& snippets, const ssm::get_options& options) {
+    constexpr std::size_t BATCH_SIZE = 256;
+
+    bool ok = true;
+    bool first = true;
+    std::fflush(stdout);
+
+    for (std::size_t begin = 0; begin < snippets.size(); begin += BATCH_SIZE) {
+        const std::span batch = std::span(snippets).subspan(begin, std::min(BATCH_SIZE, snippets.size() - begin));
+
+        std::vector<int> fds(batch.size(), -1);
+        std::vector<std::string> headers(batch.size());
+        std::vector<std::string> contents(batch.size());
+
+        {
+            SSM_TRACE_SCOPE("io.read");
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                fds[i] = open(batch[i].path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fds[i] < 0) {
+                    std::println(stderr, "Failed to open snippet '{}'", batch[i].name);
+                    ok = false;
+                    continue;
+                }
+                posix_fadvise(fds[i], 0, 0, POSIX_FADV_WILLNEED);
+            }
+
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                if (fds[i] < 0) continue;
+                const bool read_ok = read_fd(fds[i], contents[i]);
+                close(fds[i]);
+                if (!read_ok) {
+                    std::println(stderr, "Failed to read snippet '{}'", batch[i].name);
+                    ok = false;
+                    fds[i] = -1; // skipped below
+                    continue;
+                }
+                if (options.headers) headers[i] = std::format("==> {} <==\n", batch[i].name);
+            }
+        }
+
+        // Buffers are final at this point, so pointing iovecs into them is safe
+        std::vector<iovec> iov;
+        iov.reserve(batch.size() * 3);
+        const auto push = [&iov](const std::string_view buf) {
+            if (!buf.empty()) iov.push_back({.iov_base = const_cast<char*>(buf.data()), .iov_len = buf.size()});
+        };
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            if (fds[i] < 0) continue;
+            if (!first) push(options.separator);
+            first = false;
+            push(headers[i]);
+            push(contents[i]);
+        }
+
+        SSM_TRACE_SCOPE("io.write");
+        if (!write_all(iov)) {
+            std::println(stderr, "Failed to write snippets to stdout: {}", utils::process::posix_error_to_string(errno));
+            return false;
+        }
+    }
+
+    return ok;
+}
+
+#ifdef __linux__
+// Children's CPU time lands in the stats phases next to ours, so a slow `edit` can be told apart from a slow editor
+void record_child_usage(const utils::process::ResourceUsage& usage) {
+    SSM_TRACE_PHASE("child.user_cpu", usage.user_cpu.count());
+    SSM_TRACE_PHASE("child.sys_cpu", usage.system_cpu.count());
+    SSM_TRACE_COUNTER("child.max_rss_kib", usage.max_rss_kib);
+    SSM_TRACE_COUNTER("child.block_reads", usage.block_reads);
+    SSM_TRACE_COUNTER("child.block_writes", usage.block_writes);
+}
+
+// The pipeline's first stage reads the snippet files straight out of the page cache through splice, only headers and
+// separators are written by hand. As with a shell, the result is that of the last stage
+bool pipe_snippets(const std::vector<snippet_ref>& snippets, const ssm::get_options& options) {
+    utils::process::Pipeline pipeline;
+    if (const auto added = pipeline.add(options.pipe); !added) {
+        std::println(stderr, "{}", added.error());
+        return false;
+    }
+
+    {
+        SSM_TRACE_SCOPE("process.spawn");
+        if (const auto started = pipeline.start(); !started) {
+            std::println(stderr, "Failed to start '{}': {}", options.pipe, started.error());
+            return false;
+        }
+    }
+
+    bool ok = true;
+    bool first = true;
+    {
+        SSM_TRACE_SCOPE("io.write");
+        for (const snippet_ref& snippet : snippets) {
+            const int fd = open(snippet.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                std::println(stderr, "Failed to open snippet '{}'", snippet.name);
+                ok = false;
+                continue;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            std::expected<void, std::string> fed;
+            if (!first) fed = pipeline.feed(options.separator);
+            first = false;
+            if (fed && options.headers) fed = pipeline.feed(std::format("==> {} <==\n", snippet.name));
+            if (fed) fed = pipeline.feed(fd);
+            close(fd);
+            if (!fed) {
+                std::println(stderr, "Failed to write snippet '{}' to the pipeline: {}", snippet.name, fed.error());
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    SSM_TRACE_SCOPE("process.wait");
+    const auto statuses = pipeline.wait();
+    if (!statuses) {
+        std::println(stderr, "{}", statuses.error());
         return false;
     }
+    for (const utils::process::ExitStatus& status : *statuses) record_child_usage(status.usage);
+    return ok && statuses->back().exit_code == 0;
+}
+#endif // __linux__
+
+bool edit_snippet_impl(const std::vector<snippet_ref>& snippets) {
+    std::vector<std::string> args;
+    args.reserve(snippets.size() + 1);
+    args.push_back(get_editor());
+
+    for (const snippet_ref& snippet : snippets) {
+        if (!fs::exists(snippet.path)) {
+            std::println(stderr, "Snippet '{}' does not exist", snippet.name);
+            return false;
+        }
+        args.push_back(snippet.path.string());
+    }
+
+#ifdef __linux__
+    auto child = [&args] {
+        SSM_TRACE_SCOPE("process.spawn");
+        return utils::process::spawn(args);
+    }();
+    const auto result = [&child]() -> std::expected<void, std::string> {
+        if (!child.has_value()) return std::unexpected(child.error());
+        SSM_TRACE_SCOPE("process.wait");
+        const auto waited = utils::process::wait_child(*child);
+        if (!waited.has_value()) return std::unexpected(waited.error());
+        const utils::process::ExitStatus& status = **waited;
+        record_child_usage(status.usage);
+        if (status.signal != 0) return std::unexpected(std::format("Editor terminated by signal {}", status.signal));
+        if (status.exit_code != 0) return std::unexpected(std::format("Editor exited with code {}", status.exit_code));
+        return {};
+    }();
+#else
+    const auto proc = [&args] {
+        SSM_TRACE_SCOPE("process.spawn");
+        return utils::process::run_async(args);
+    }();
+    const auto result = [&proc]() -> std::expected<void, std::string> {
+        if (!proc.has_value()) return std::unexpected(proc.error());
+        SSM_TRACE_SCOPE("process.wait");
+        return utils::process::wait_proc(*proc);
+    }();
+#endif // __linux__
 
-    const auto result = utils::process::run_sync({get_editor(), file.string()});
     if (!result.has_value()) {
-        std::println(stderr, "Failed to launch editor for snippet '{}'", file.filename().string());
+        if (snippets.size() == 1) {
+            std::println(stderr, "Failed to launch editor for snippet '{}'", snippets.front().name);
+        } else {
+            std::println(stderr, "Failed to launch editor for {} snippets", snippets.size());
+        }
         return false;
     }
     return true;
 }
 
+// Edited snippets get their content indexed again, all in one transaction. Files dropped into the directory by hand
+// have no row and are left alone
+bool reindex_contents(const ssm_sqlite3::database& sqlite, const std::vector<snippet_ref>& snippets) {
+    if (!ssm::schema::migrate(sqlite)) return false;
+    if (!sqlite.exec("BEGIN IMMEDIATE;")) {
+        std::println(stderr, "Failed to begin transaction: {}", sqlite.errmsg());
+        return false;
+    }
+
+    bool ok = true;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT id FROM file WHERE name = ?;");
+        ok = static_cast<bool>(stmt);
+        std::string content;
+        for (std::size_t i = 0; ok && i < snippets.size(); ++i) {
+            if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, snippets[i].name)) {
+                ok = false;
+                break;
+            }
+            const bool has_row = sqlite3_step(stmt.get()) == SQLITE_ROW;
+            const i64 id = has_row ? sqlite3_column_int64(stmt.get(), 0) : 0;
+            sqlite3_reset(stmt.get());
+            if (!has_row) continue;
+
+            content.clear();
+            ok = read_file(snippets[i].path, content) && ssm::trigram::index_file(sqlite, id, content) &&
+                 ssm::fts::index_file(sqlite, id, content) && ssm::tfidf::index_file(sqlite, id, content) &&
+                 ssm::minhash::index_file(sqlite, id, content) && ssm::symbols::index_file(sqlite, id, content);
+        }
+    }
+
+    if (!ok || !sqlite.exec("COMMIT;")) {
+        std::println(stderr, "Failed to update the content index: {}", sqlite.errmsg());
+        sqlite.exec("ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+// Rows of `file` in `ls` order, only those in `ids` when given
+std::optional<std::vector<snippet_ref>> load_snippets(const fs::path& dir, const ssm_sqlite3::database& sqlite,
+                                                      const std::optional<std::vector<i64>>& ids) {
+    std::string json = "[";
+    if (ids.has_value()) {
+        for (const i64 id : *ids) {
+            if (json.size() > 1) json.push_back(',');
+            json += std::to_string(id);
+        }
+    }
+    json.push_back(']');
+
+    const ssm_sqlite3::stmt_handle stmt =
+        sqlite.prepare(ids.has_value() ? "SELECT name FROM file WHERE id IN (SELECT value FROM json_each(?)) ORDER BY id;"
+                                       : "SELECT name FROM file ORDER BY id;");
+    if (!stmt || (ids.has_value() && !ssm_sqlite3::database::bind_text(stmt.get(), 1, json))) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+        return std::nullopt;
+    }
+
+    std::vector<snippet_ref> snippets;
+    SSM_TRACE_SCOPE("sqlite.step");
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
+        if (text != nullptr) snippets.push_back({.name = text, .path = dir / text});
+    }
+    if (ret != SQLITE_DONE) {
+        std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+        return std::nullopt;
+    }
+    return snippets;
+}
+
+// `matcher` is a search::finder or a regex::matcher
+template <typename Matcher>
+bool grep_file(const snippet_ref& snippet, Matcher& matcher, const bool files_only, std::string& out) {
+    const ssm::search::mapped_file file(snippet.path);
+    if (!file.ok()) return false;
+    SSM_TRACE_COUNTER("io.bytes_read", static_cast<i64>(file.text().size()));
+    return ssm::search::grep_text(snippet.name, file.text(), matcher, files_only, out);
+}
+
+// Regex matchers cache DFA states and are not thread-safe, so a scanning thread borrows one per snippet. There are
+// never more of them than threads scanning at once, and each keeps its states from one snippet to the next
+class matcher_pool {
+public:
+    explicit matcher_pool(const ssm::regex::program& program) : program_(program) {}
+
+    std::unique_ptr<ssm::regex::matcher> acquire() {
+        const std::scoped_lock lock(mutex_);
+        if (idle_.empty()) return std::make_unique<ssm::regex::matcher>(program_);
+        std::unique_ptr<ssm::regex::matcher> matcher = MOVE(idle_.back());
+        idle_.pop_back();
+        return matcher;
+    }
+
+    void release(std::unique_ptr<ssm::regex::matcher> matcher) {
+        const std::scoped_lock lock(mutex_);
+        idle_.push_back(MOVE(matcher));
+    }
+
+private:
+    const ssm::regex::program& program_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ssm::regex::matcher>> idle_;
+};
+
 } // namespace
 
 namespace ssm {
@@ -158,7 +816,7 @@ bool ssm_init() {
         return false;
     }
 
-    return true;
+    return ssm::schema::migrate(sqlite);
 }
 
 bool create_snippet(const std::string& name) {
@@ -181,7 +839,7 @@ bool create_snippet(const std::string& name) {
         return false;
     }
 
-    if (!edit_snippet(name)) {
+    if (!edit_snippet_impl({{.name = name, .path = file}})) {
         fs::remove(file);
         return false;
     }
@@ -192,22 +850,56 @@ bool create_snippet(const std::string& name) {
         return false;
     }
 
-    constexpr auto insert_sql = "INSERT INTO file (name, path) VALUES (?, ?);";
-    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(insert_sql);
-    if (!stmt) {
-        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+    std::string content;
+    if (!read_file(file, content)) {
+        std::println(stderr, "Failed to read snippet '{}'", name);
         fs::remove(file);
         return false;
     }
 
-    if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, name) || !ssm_sqlite3::database::bind_text(stmt.get(), 2, file.string())) {
-        std::println(stderr, "Failed to bind parameters: {}", sqlite.errmsg());
+    if (!ssm::schema::migrate(sqlite)) {
         fs::remove(file);
         return false;
     }
 
-    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
-        std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+    // The row and its index entries land together
+    if (!sqlite.exec("BEGIN IMMEDIATE;")) {
+        std::println(stderr, "Failed to begin transaction: {}", sqlite.errmsg());
+        fs::remove(file);
+        return false;
+    }
+
+    {
+        constexpr auto insert_sql = "INSERT INTO file (name, path) VALUES (?, ?);";
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(insert_sql);
+        if (!stmt) {
+            std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+            sqlite.exec("ROLLBACK;");
+            fs::remove(file);
+            return false;
+        }
+
+        if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, name) || !ssm_sqlite3::database::bind_text(stmt.get(), 2, file.string())) {
+            std::println(stderr, "Failed to bind parameters: {}", sqlite.errmsg());
+            sqlite.exec("ROLLBACK;");
+            fs::remove(file);
+            return false;
+        }
+
+        const i64 id = sqlite3_step(stmt.get()) == SQLITE_DONE ? sqlite.last_insert_rowid() : 0;
+        if (id == 0 || !ssm::suggest::add_name(sqlite, id, name) || !ssm::trigram::index_file(sqlite, id, content) ||
+            !ssm::fts::index_file(sqlite, id, content) || !ssm::tfidf::index_file(sqlite, id, content) ||
+            !ssm::minhash::index_file(sqlite, id, content) || !ssm::symbols::index_file(sqlite, id, content)) {
+            std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+            sqlite.exec("ROLLBACK;");
+            fs::remove(file);
+            return false;
+        }
+    }
+
+    if (!sqlite.exec("COMMIT;")) {
+        std::println(stderr, "Failed to commit transaction: {}", sqlite.errmsg());
+        sqlite.exec("ROLLBACK;");
         fs::remove(file);
         return false;
     }
@@ -231,100 +923,340 @@ void list_snippets() {
     }
 }
 
-bool remove_snippet(const std::string& name) {
-    if (name.empty()) {
-        std::println(stderr, "Snippet name cannot be empty");
+bool remove_snippets(const std::span<const std::string_view> selectors) {
+    const auto dir_opt = ensure_snippet_dir();
+    if (!dir_opt.has_value()) return false;
+
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
         return false;
     }
 
-    const auto dir_opt = ensure_snippet_dir();
-    if (!dir_opt.has_value()) return false;
+    bool complete = false;
+    const std::vector<snippet_ref> snippets = resolve_snippets(*dir_opt, sqlite, selectors, complete);
+    if (!complete || !ssm::schema::migrate(sqlite)) return false;
 
-    const fs::path file_path = *dir_opt / name;
-    if (!fs::exists(file_path)) {
-        std::println(stderr, "Snippet '{}' does not exist", name);
+    // Either every row goes or none does; files are only unlinked once the transaction has committed
+    if (!sqlite.exec("BEGIN IMMEDIATE;")) {
+        std::println(stderr, "Failed to begin transaction: {}", sqlite.errmsg());
+        return false;
+    }
+
+    {
+        constexpr auto delete_sql = "DELETE FROM file WHERE name = ? RETURNING id;";
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(delete_sql);
+        if (!stmt) {
+            std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+            sqlite.exec("ROLLBACK;");
+            return false;
+        }
+
+        for (const snippet_ref& snippet : snippets) {
+            if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, snippet.name)) {
+                std::println(stderr, "Failed to bind parameters: {}", sqlite.errmsg());
+                sqlite.exec("ROLLBACK;");
+                return false;
+            }
+            // Files dropped into the directory by hand have no row and nothing to unindex
+            int ret = sqlite3_step(stmt.get());
+            const bool had_row = ret == SQLITE_ROW;
+            const i64 id = had_row ? sqlite3_column_int64(stmt.get(), 0) : 0;
+            if (had_row) ret = sqlite3_step(stmt.get());
+            if (ret != SQLITE_DONE || (had_row && (!ssm::suggest::remove_name(sqlite, id, snippet.name) ||
+                                                   !ssm::trigram::remove_file(sqlite, id) ||
+                                                   !ssm::fts::remove_file(sqlite, id) ||
+                                                   !ssm::tfidf::remove_file(sqlite, id) ||
+                                                   !ssm::minhash::remove_file(sqlite, id) ||
+                                                   !ssm::symbols::remove_file(sqlite, id)))) {
+                std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+                sqlite.exec("ROLLBACK;");
+                return false;
+            }
+            sqlite3_reset(stmt.get());
+        }
+    }
+
+    if (!sqlite.exec("COMMIT;")) {
+        std::println(stderr, "Failed to commit transaction: {}", sqlite.errmsg());
+        sqlite.exec("ROLLBACK;");
         return false;
     }
 
+    bool removed = true;
+    for (const snippet_ref& snippet : snippets) {
+        std::error_code ec;
+        fs::remove(snippet.path, ec);
+        if (ec) {
+            std::println(stderr, "Failed to remove snippet file '{}': {}", snippet.path.string(), ec.message());
+            removed = false;
+            continue;
+        }
+        std::println("Snippet '{}' removed successfully", snippet.name);
+    }
+    return removed;
+}
+
+bool get_snippets(const std::span<const std::string_view> selectors, const get_options& options) {
+    const auto dir_opt = ensure_snippet_dir();
+    if (!dir_opt.has_value()) return false;
+
     const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
     if (!sqlite.ok()) {
         std::println(stderr, "Failed to open database");
         return false;
     }
 
-    constexpr auto delete_sql = "DELETE FROM file WHERE path = ?;";
-    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(delete_sql);
-    if (!stmt) {
-        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+    bool complete = false;
+    const std::vector<snippet_ref> snippets = resolve_snippets(*dir_opt, sqlite, selectors, complete, options.fuzzy);
+    if (!options.pipe.empty()) {
+#ifdef __linux__
+        return pipe_snippets(snippets, options) && complete;
+#else
+        std::println(stderr, "--pipe is only supported on Linux");
         return false;
+#endif // __linux__
     }
+    return write_snippets(snippets, options) && complete;
+}
 
-    if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, file_path.string())) {
-        std::println(stderr, "Failed to bind parameters: {}", sqlite.errmsg());
+bool edit_snippets(const std::span<const std::string_view> selectors, const bool fuzzy) {
+    const auto dir_opt = ensure_snippet_dir();
+    if (!dir_opt.has_value()) return false;
+
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
         return false;
     }
 
-    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
-        std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+    bool complete = false;
+    const std::vector<snippet_ref> snippets = resolve_snippets(*dir_opt, sqlite, selectors, complete, fuzzy);
+    if (!complete) return false;
+
+    return edit_snippet_impl(snippets) && reindex_contents(sqlite, snippets);
+}
+
+bool grep_snippets(const std::string_view pattern, const grep_options& options) {
+    if (pattern.empty()) {
+        std::println(stderr, "Pattern cannot be empty");
         return false;
     }
 
-    fs::remove(file_path);
+    const auto dir_opt = ensure_snippet_dir();
+    if (!dir_opt.has_value()) return false;
 
-    std::println("Snippet '{}' removed successfully", name);
-    return true;
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
+    if (!ssm::schema::migrate(sqlite)) return false;
+
+    std::optional<ssm::regex::program> program;
+    if (options.regex) {
+        std::expected<ssm::regex::program, std::string> compiled = ssm::regex::program::compile(pattern);
+        if (!compiled.has_value()) {
+            std::println(stderr, "Invalid pattern: {}", compiled.error());
+            return false;
+        }
+        program.emplace(MOVE(*compiled));
+    }
+
+    // A regex narrows through the string all of its matches contain. Patterns too short for a trigram, and regexes
+    // without such a string, scan every snippet
+    const std::string_view literal = program.has_value() ? std::string_view(program->required()) : pattern;
+    const std::optional<std::vector<i64>> ids =
+        options.no_index ? std::nullopt : ssm::trigram::candidates(sqlite, literal);
+    const std::optional<std::vector<snippet_ref>> snippets = load_snippets(*dir_opt, sqlite, ids);
+    if (!snippets.has_value()) return false;
+
+    // Snippets are scanned in parallel and in any order, each into its own buffer. This thread prints the buffers in
+    // id order as soon as each is done, so the output is the same as a sequential scan's
+    SSM_TRACE_SCOPE("grep.scan");
+    const ssm::search::finder finder(pattern);
+    std::optional<matcher_pool> matchers;
+    if (program.has_value()) matchers.emplace(*program);
+    const std::size_t count = snippets->size();
+    std::vector<std::string> outputs(count);
+    std::vector<std::atomic<bool>> done(count);
+    std::atomic<bool> matched = false;
+
+    std::jthread scanner([&] {
+        ssm::search::parallel_for(count, options.threads, [&](const std::size_t i) {
+            bool found = false;
+            if (matchers.has_value()) {
+                std::unique_ptr<ssm::regex::matcher> matcher = matchers->acquire();
+                found = grep_file((*snippets)[i], *matcher, options.files_only, outputs[i]);
+                matchers->release(MOVE(matcher));
+            } else {
+                found = grep_file((*snippets)[i], finder, options.files_only, outputs[i]);
+            }
+            if (found) matched.store(true, std::memory_order_relaxed);
+            done[i].store(true, std::memory_order_release);
+            done[i].notify_one();
+        });
+    });
+
+    for (std::size_t i = 0; i < count; ++i) {
+        done[i].wait(false, std::memory_order_acquire);
+        std::fwrite(outputs[i].data(), 1, outputs[i].size(), stdout);
+        std::string().swap(outputs[i]);
+    }
+    return matched.load(std::memory_order_relaxed);
 }
 
-bool get_snippet(const std::string_view name) {
-    if (name.empty()) {
-        std::println(stderr, "Snippet name cannot be empty");
+bool search_snippets(const std::span<const std::string_view> terms) {
+    if (terms.empty()) {
+        std::println(stderr, "Query cannot be empty");
         return false;
     }
 
     const auto dir_opt = ensure_snippet_dir();
     if (!dir_opt.has_value()) return false;
 
-    return get_snippet_impl(*dir_opt / name);
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
+    if (!ssm::schema::migrate(sqlite)) return false;
+
+    const std::optional<std::vector<std::string>> names = ssm::fts::search(sqlite, terms);
+    if (!names.has_value()) {
+        std::println(stderr, "Failed to search: {}", sqlite.errmsg());
+        return false;
+    }
+    for (const std::string& name : *names) std::println("{}", name);
+    return !names->empty();
 }
 
-bool get_snippet(const int number) {
+bool similar_snippets(const std::string_view name, const std::size_t limit) {
     const auto dir_opt = ensure_snippet_dir();
     if (!dir_opt.has_value()) return false;
 
-    const std::vector<std::string> names = snippet_names();
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
+    if (!ssm::schema::migrate(sqlite)) return false;
 
-    if (number < 1 || static_cast<std::size_t>(number) > names.size()) {
-        std::println(stderr, "Snippet number {} is out of range", number);
+    const ssm_sqlite3::stmt_handle find = sqlite.prepare("SELECT id FROM file WHERE name = ?;");
+    const ssm_sqlite3::stmt_handle name_of = sqlite.prepare("SELECT name FROM file WHERE id = ?;");
+    if (!find || !name_of || !ssm_sqlite3::database::bind_text(find.get(), 1, name)) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+        return false;
+    }
+    if (sqlite3_step(find.get()) != SQLITE_ROW) {
+        report_missing(sqlite, name);
         return false;
     }
 
-    return get_snippet_impl(*dir_opt / names[static_cast<std::size_t>(number - 1)]);
+    const std::optional<std::vector<ssm::tfidf::neighbour>> neighbours =
+        ssm::tfidf::nearest(sqlite, sqlite3_column_int64(find.get(), 0), limit);
+    if (!neighbours.has_value()) {
+        std::println(stderr, "Failed to compare snippets: {}", sqlite.errmsg());
+        return false;
+    }
+    for (const ssm::tfidf::neighbour& n : *neighbours) {
+        if (!ssm_sqlite3::database::bind_int64(name_of.get(), 1, n.file_id) || sqlite3_step(name_of.get()) != SQLITE_ROW) {
+            std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+            return false;
+        }
+        std::println("{:.2f}  {}", n.score, reinterpret_cast<const char*>(sqlite3_column_text(name_of.get(), 0)));
+        sqlite3_reset(name_of.get());
+    }
+    return !neighbours->empty();
 }
 
-bool edit_snippet(const std::string_view name) {
-    if (name.empty()) {
-        std::println(stderr, "Snippet name cannot be empty");
+bool find_duplicates(const double threshold) {
+    if (!(threshold > 0 && threshold <= 1)) {
+        std::println(stderr, "Threshold must be greater than 0 and at most 1");
+        return false;
+    }
+
+    const auto dir_opt = ensure_snippet_dir();
+    if (!dir_opt.has_value()) return false;
+
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
         return false;
     }
+    if (!ssm::schema::migrate(sqlite)) return false;
 
+    const std::optional<std::vector<std::vector<i64>>> clusters = ssm::minhash::clusters(sqlite, threshold);
+    const ssm_sqlite3::stmt_handle name_of = sqlite.prepare("SELECT name FROM file WHERE id = ?;");
+    if (!clusters.has_value() || !name_of) {
+        std::println(stderr, "Failed to find duplicates: {}", sqlite.errmsg());
+        return false;
+    }
+    for (std::size_t c = 0; c < clusters->size(); ++c) {
+        if (c > 0) std::println("");
+        for (const i64 id : (*clusters)[c]) {
+            if (!ssm_sqlite3::database::bind_int64(name_of.get(), 1, id) || sqlite3_step(name_of.get()) != SQLITE_ROW) {
+                std::println(stderr, "Failed to execute statement: {}", sqlite.errmsg());
+                return false;
+            }
+            std::println("{}", reinterpret_cast<const char*>(sqlite3_column_text(name_of.get(), 0)));
+            sqlite3_reset(name_of.get());
+        }
+    }
+    return !clusters->empty();
+}
+
+bool find_symbols(const std::string_view prefix) {
     const auto dir_opt = ensure_snippet_dir();
     if (!dir_opt.has_value()) return false;
 
-    return edit_snippet_impl(*dir_opt / name);
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
+    if (!ssm::schema::migrate(sqlite)) return false;
+
+    const std::optional<std::vector<ssm::symbols::definition>> definitions = ssm::symbols::lookup(sqlite, prefix);
+    if (!definitions.has_value()) {
+        std::println(stderr, "Failed to look up symbols: {}", sqlite.errmsg());
+        return false;
+    }
+    for (const ssm::symbols::definition& d : *definitions) {
+        std::println("{}:{}: {} {}", d.snippet, d.line, d.kind, d.name);
+    }
+    return !definitions->empty();
 }
 
-bool edit_snippet(const int number) {
+bool pick_snippet(const std::string_view query, const bool edit) {
     const auto dir_opt = ensure_snippet_dir();
     if (!dir_opt.has_value()) return false;
 
-    const std::vector<std::string> names = snippet_names();
+    const ssm_sqlite3::database sqlite(*dir_opt / DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
 
-    if (number < 1 || static_cast<std::size_t>(number) > names.size()) {
-        std::println(stderr, "Snippet number {} is out of range", number);
+    ssm::fuzzy::name_set names;
+    if (!load_names(sqlite, names)) return false;
+    if (names.size() == 0) {
+        std::println("No snippets available");
         return false;
     }
 
-    return edit_snippet_impl(*dir_opt / names[static_cast<std::size_t>(number - 1)]);
+#ifdef __linux__
+    const std::optional<std::size_t> picked = ssm::picker::pick(names, query);
+    if (!picked.has_value()) return false;
+
+    // The name came from the table, so it is not taken as a number or a glob the way a typed selector would be
+    const std::string name(names[*picked]);
+    const std::vector<snippet_ref> snippets = {{.name = name, .path = *dir_opt / name}};
+    return edit ? edit_snippet_impl(snippets) && reindex_contents(sqlite, snippets) : write_snippets(snippets, {});
+#else
+    std::println(stderr, "ssm pick is only supported on Linux");
+    return false;
+#endif // __linux__
 }
 
 } // namespace ssm
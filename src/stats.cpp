@@ -0,0 +1,397 @@
+#include "stats.hpp"
+
+#include "sqlite3.hpp"
+#include "ssm.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <optional>
+#include <print>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view SPOOL_FILENAME = ".ssm-stats.spool";
+constexpr off_t FOLD_THRESHOLD = 32 * 1024; // a couple hundred runs per fold
+
+// HDR-style log-linear buckets over microseconds: values below 2^SUB_BUCKET_BITS get a bucket each, above that
+// every power of two is split into 2^(SUB_BUCKET_BITS - 1) linear sub-buckets, so a bucket is never wider than
+// ~3% of the values it holds and a decade of latencies costs about a hundred rows.
+constexpr int SUB_BUCKET_BITS = 6;
+constexpr u64 SUB_BUCKET_HALF = u64{1} << (SUB_BUCKET_BITS - 1);
+
+constexpr auto create_tables = R"(
+    CREATE TABLE IF NOT EXISTS stat_hist (
+        command TEXT NOT NULL,
+        phase TEXT NOT NULL,
+        bucket INTEGER NOT NULL,
+        count INTEGER NOT NULL,
+        PRIMARY KEY (command, phase, bucket)
+    ) WITHOUT ROWID;
+
+    CREATE TABLE IF NOT EXISTS stat_summary (
+        command TEXT NOT NULL,
+        phase TEXT NOT NULL,
+        runs INTEGER NOT NULL,
+        total_us INTEGER NOT NULL,
+        max_us INTEGER NOT NULL,
+        PRIMARY KEY (command, phase)
+    ) WITHOUT ROWID;
+
+    CREATE TABLE IF NOT EXISTS stat_size (
+        day TEXT PRIMARY KEY,
+        snippets INTEGER NOT NULL,
+        db_bytes INTEGER NOT NULL
+    ) WITHOUT ROWID;
+    )";
+
+i64 bucket_of(const u64 value) {
+    if (value < (u64{1} << SUB_BUCKET_BITS)) return static_cast<i64>(value);
+    const int shift = 64 - std::countl_zero(value) - SUB_BUCKET_BITS;
+    return static_cast<i64>(static_cast<u64>(shift) * SUB_BUCKET_HALF + (value >> shift));
+}
+
+// Highest value that lands in `bucket`, which is what percentiles report
+i64 bucket_upper(const i64 bucket) {
+    const auto b = static_cast<u64>(bucket);
+    if (b < (u64{1} << SUB_BUCKET_BITS)) return bucket;
+    const u64 shift = b / SUB_BUCKET_HALF - 1;
+    const u64 top = b - shift * SUB_BUCKET_HALF;
+    return static_cast<i64>(((top + 1) << shift) - 1);
+}
+
+std::optional<fs::path> snippet_dir() {
+    const char* home = std::getenv("HOME");
+    if (home == nullptr || home[0] == '\0') return std::nullopt;
+    return fs::path(home) / ssm::SNIPPETS_DIRNAME;
+}
+
+struct phase_hist {
+    std::map<i64, i64> buckets;
+    i64 runs = 0;
+    i64 total_us = 0;
+    i64 max_us = 0;
+};
+
+using hist_map = std::map<std::pair<std::string, std::string>, phase_hist>;
+
+// Spool lines look like "<unix time> <command> total=<ns> <phase>=<ns>..."
+void parse_spool(const std::string_view content, hist_map& hists) {
+    std::size_t line_start = 0;
+    while (line_start < content.size()) {
+        std::size_t line_end = content.find('\n', line_start);
+        if (line_end == std::string_view::npos) break; // torn write, ignore the partial line
+        const std::string_view line = content.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        std::size_t pos = 0;
+        std::vector<std::string_view> fields;
+        while (pos < line.size()) {
+            const std::size_t next = std::min(line.find(' ', pos), line.size());
+            if (next > pos) fields.push_back(line.substr(pos, next - pos));
+            pos = next + 1;
+        }
+        if (fields.size() < 3) continue;
+
+        const std::string command(fields[1]);
+        for (std::size_t i = 2; i < fields.size(); ++i) {
+            const std::size_t eq = fields[i].find('=');
+            if (eq == std::string_view::npos) continue;
+            const std::string_view value_str = fields[i].substr(eq + 1);
+            i64 ns = 0;
+            const auto [ptr, ec] = std::from_chars(value_str.data(), value_str.data() + value_str.size(), ns);
+            if (ec != std::errc{} || ns < 0) continue;
+
+            const i64 us = ns / 1000;
+            phase_hist& hist = hists[{command, std::string(fields[i].substr(0, eq))}];
+            ++hist.buckets[bucket_of(static_cast<u64>(us))];
+            ++hist.runs;
+            hist.total_us += us;
+            hist.max_us = std::max(hist.max_us, us);
+        }
+    }
+}
+
+bool store_hists(const ssm_sqlite3::database& sqlite, const hist_map& hists) {
+    if (!sqlite.exec(create_tables)) return false;
+
+    constexpr auto hist_sql = R"(
+        INSERT INTO stat_hist (command, phase, bucket, count) VALUES (?, ?, ?, ?)
+        ON CONFLICT (command, phase, bucket) DO UPDATE SET count = count + excluded.count;
+        )";
+    constexpr auto summary_sql = R"(
+        INSERT INTO stat_summary (command, phase, runs, total_us, max_us) VALUES (?, ?, ?, ?, ?)
+        ON CONFLICT (command, phase) DO UPDATE SET
+            runs = runs + excluded.runs,
+            total_us = total_us + excluded.total_us,
+            max_us = max(max_us, excluded.max_us);
+        )";
+    constexpr auto size_sql = R"(
+        INSERT INTO stat_size (day, snippets, db_bytes)
+        SELECT date('now', 'localtime'), (SELECT count(*) FROM file), page_count * page_size
+        FROM pragma_page_count(), pragma_page_size()
+        WHERE true
+        ON CONFLICT (day) DO UPDATE SET snippets = excluded.snippets, db_bytes = excluded.db_bytes;
+        )";
+
+    const ssm_sqlite3::stmt_handle hist_stmt = sqlite.prepare(hist_sql);
+    const ssm_sqlite3::stmt_handle summary_stmt = sqlite.prepare(summary_sql);
+    if (!hist_stmt || !summary_stmt) return false;
+
+    for (const auto& [key, hist] : hists) {
+        const auto& [command, phase] = key;
+        for (const auto& [bucket, count] : hist.buckets) {
+            sqlite3_stmt* stmt = hist_stmt.get();
+            if (!ssm_sqlite3::database::bind_text(stmt, 1, command) || !ssm_sqlite3::database::bind_text(stmt, 2, phase) ||
+                !ssm_sqlite3::database::bind_int64(stmt, 3, bucket) || !ssm_sqlite3::database::bind_int64(stmt, 4, count) ||
+                sqlite3_step(stmt) != SQLITE_DONE) {
+                return false;
+            }
+            sqlite3_reset(stmt);
+        }
+
+        sqlite3_stmt* stmt = summary_stmt.get();
+        if (!ssm_sqlite3::database::bind_text(stmt, 1, command) || !ssm_sqlite3::database::bind_text(stmt, 2, phase) ||
+            !ssm_sqlite3::database::bind_int64(stmt, 3, hist.runs) || !ssm_sqlite3::database::bind_int64(stmt, 4, hist.total_us) ||
+            !ssm_sqlite3::database::bind_int64(stmt, 5, hist.max_us) || sqlite3_step(stmt) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    return sqlite.exec(size_sql);
+}
+
+bool read_all(const int fd, std::string& out) {
+    std::array<char, 16 * 1024> buf;
+    for (;;) {
+        const ssize_t got = read(fd, buf.data(), buf.size());
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (got == 0) return true;
+        out.append(buf.data(), static_cast<std::size_t>(got));
+    }
+}
+
+bool fold_locked(const int fd, const fs::path& db_path) {
+    std::string content;
+    if (!read_all(fd, content)) return false;
+    if (content.empty()) return true;
+
+    hist_map hists;
+    parse_spool(content, hists);
+
+    const ssm_sqlite3::database sqlite(db_path);
+    if (!sqlite.ok()) return false;
+
+    // No busy timeout: if someone else holds the database the fold simply happens on a later run
+    if (!sqlite.exec("BEGIN IMMEDIATE;")) return false;
+    if (!store_hists(sqlite, hists) || !sqlite.exec("COMMIT;")) {
+        sqlite.exec("ROLLBACK;");
+        return false;
+    }
+
+    return ftruncate(fd, 0) == 0;
+}
+
+// Moves the spool into the database. Appenders hold a shared lock while writing, so taking the exclusive lock
+// without waiting guarantees no line is lost between reading and truncating the spool.
+bool fold(const fs::path& spool) {
+    const int fd = open(spool.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT;
+
+    bool ok = false;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        SSM_TRACE_SCOPE("stats.fold");
+        ok = fold_locked(fd, spool.parent_path() / ssm::DB_FILENAME);
+    }
+    close(fd);
+    return ok;
+}
+
+std::string format_us(const i64 us) {
+    if (us < 1000) return std::format("{}us", us);
+    if (us < 1'000'000) return std::format("{:.2f}ms", static_cast<f64>(us) / 1e3);
+    return std::format("{:.2f}s", static_cast<f64>(us) / 1e6);
+}
+
+std::string format_bytes(const i64 bytes) {
+    if (bytes < 1024) return std::format("{} B", bytes);
+    if (bytes < 1024 * 1024) return std::format("{:.1f} KiB", static_cast<f64>(bytes) / 1024.0);
+    if (bytes < 1024 * 1024 * 1024) return std::format("{:.1f} MiB", static_cast<f64>(bytes) / (1024.0 * 1024.0));
+    return std::format("{:.1f} GiB", static_cast<f64>(bytes) / (1024.0 * 1024.0 * 1024.0));
+}
+
+i64 percentile(const std::vector<std::pair<i64, i64>>& buckets, const i64 runs, const f64 p) {
+    const auto target = static_cast<i64>(p * static_cast<f64>(runs) + 0.999999);
+    i64 seen = 0;
+    for (const auto& [bucket, count] : buckets) {
+        seen += count;
+        if (seen >= target) return bucket_upper(bucket);
+    }
+    return buckets.empty() ? 0 : bucket_upper(buckets.back().first);
+}
+
+} // namespace
+
+namespace ssm::stats {
+
+bool sampled() {
+    const char* env = std::getenv("SSM_STATS");
+    if (env == nullptr || env[0] == '\0') return true;
+
+    const std::string_view str(env);
+    u64 every = 0;
+    const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), every);
+    if (ec != std::errc{} || ptr != str.data() + str.size()) return true;
+    if (every <= 1) return every == 1;
+
+    // splitmix64 over clock and pid, plenty for thinning samples
+    u64 x = static_cast<u64>(trace::detail::now_ns()) ^ (static_cast<u64>(getpid()) << 32);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return (x ^ (x >> 31)) % every == 0;
+}
+
+void record(const std::string_view command, const i64 wall_ns) {
+    const auto dir = snippet_dir();
+    if (!dir.has_value()) return;
+    const fs::path spool = *dir / SPOOL_FILENAME;
+
+    std::string line = std::format("{} {} total={}", std::time(nullptr), command, wall_ns);
+    for (const auto& [phase, ns] : trace::phase_totals()) {
+        if (phase == "ssm" || phase.starts_with("cmd.")) continue; // both are the total again
+        line += std::format(" {}={}", phase, ns);
+    }
+    line.push_back('\n');
+
+    // Fails with ENOENT before `ssm init`, which is fine: there is no store to report on yet
+    const int fd = open(spool.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    bool fold_due = false;
+    // A fold in progress holds the exclusive lock; drop this sample instead of waiting for it
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+        if (write(fd, line.data(), line.size()) == static_cast<ssize_t>(line.size())) {
+            struct stat st {};
+            fold_due = fstat(fd, &st) == 0 && st.st_size >= FOLD_THRESHOLD;
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+
+    if (fold_due) fold(spool);
+}
+
+bool report() {
+    const auto dir = snippet_dir();
+    if (!dir.has_value()) {
+        std::println(stderr, "Could not determine home directory");
+        return false;
+    }
+    if (!fs::is_directory(*dir)) {
+        std::println(stderr, "Snippets directory does not exist, did you run `ssm init`?");
+        return false;
+    }
+
+    if (!fold(*dir / SPOOL_FILENAME)) {
+        std::println(stderr, "Could not fold pending samples, the newest runs are not included");
+    }
+
+    const ssm_sqlite3::database sqlite(*dir / ssm::DB_FILENAME);
+    if (!sqlite.ok()) {
+        std::println(stderr, "Failed to open database");
+        return false;
+    }
+    if (!sqlite.exec(create_tables)) {
+        std::println(stderr, "Failed to create stats tables: {}", sqlite.errmsg());
+        return false;
+    }
+
+    constexpr auto summary_sql = R"(
+        SELECT command, phase, runs, max_us FROM stat_summary
+        ORDER BY command, phase != 'total', total_us DESC;
+        )";
+    constexpr auto hist_sql = "SELECT bucket, count FROM stat_hist WHERE command = ? AND phase = ? ORDER BY bucket;";
+
+    const ssm_sqlite3::stmt_handle summary_stmt = sqlite.prepare(summary_sql);
+    const ssm_sqlite3::stmt_handle hist_stmt = sqlite.prepare(hist_sql);
+    if (!summary_stmt || !hist_stmt) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+        return false;
+    }
+
+    std::string current_command;
+    std::vector<std::pair<i64, i64>> buckets;
+    while (sqlite3_step(summary_stmt.get()) == SQLITE_ROW) {
+        const std::string command = reinterpret_cast<const char*>(sqlite3_column_text(summary_stmt.get(), 0));
+        const std::string phase = reinterpret_cast<const char*>(sqlite3_column_text(summary_stmt.get(), 1));
+        const i64 runs = sqlite3_column_int64(summary_stmt.get(), 2);
+        const i64 max_us = sqlite3_column_int64(summary_stmt.get(), 3);
+
+        if (current_command.empty()) std::println("Latency per subcommand\n");
+        if (command != current_command) {
+            if (!current_command.empty()) std::println();
+            std::println("{:<24}{:>8}{:>10}{:>10}{:>10}{:>10}", command, "runs", "p50", "p90", "p99", "max");
+            current_command = command;
+        }
+
+        buckets.clear();
+        ssm_sqlite3::database::bind_text(hist_stmt.get(), 1, command);
+        ssm_sqlite3::database::bind_text(hist_stmt.get(), 2, phase);
+        while (sqlite3_step(hist_stmt.get()) == SQLITE_ROW) {
+            buckets.emplace_back(sqlite3_column_int64(hist_stmt.get(), 0), sqlite3_column_int64(hist_stmt.get(), 1));
+        }
+        sqlite3_reset(hist_stmt.get());
+
+        // Bucket upper bounds can overshoot the true maximum, which is recorded exactly
+        const auto pct = [&](const f64 p) { return format_us(std::min(percentile(buckets, runs, p), max_us)); };
+        std::println("  {:<22}{:>8}{:>10}{:>10}{:>10}{:>10}", phase, runs, pct(0.50), pct(0.90), pct(0.99),
+                     format_us(max_us));
+    }
+
+    if (current_command.empty()) {
+        std::println("No runs recorded yet");
+        return true;
+    }
+
+    constexpr auto size_sql = R"(
+        SELECT day, snippets, db_bytes FROM (SELECT * FROM stat_size ORDER BY day DESC LIMIT 14) ORDER BY day;
+        )";
+    const ssm_sqlite3::stmt_handle size_stmt = sqlite.prepare(size_sql);
+    if (!size_stmt) {
+        std::println(stderr, "Failed to prepare statement: {}", sqlite.errmsg());
+        return false;
+    }
+
+    std::println("\nStore size\n");
+    std::println("{:<24}{:>10}{:>14}", "day", "snippets", "database");
+    while (sqlite3_step(size_stmt.get()) == SQLITE_ROW) {
+        std::println("{:<24}{:>10}{:>14}", reinterpret_cast<const char*>(sqlite3_column_text(size_stmt.get(), 0)),
+                     sqlite3_column_int64(size_stmt.get(), 1), format_bytes(sqlite3_column_int64(size_stmt.get(), 2)));
+    }
+
+    return true;
+}
+
+} // namespace ssm::stats
@@ -0,0 +1,178 @@
+#include "suggest.hpp"
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace {
+
+// Only this much of a name is indexed, which caps a name at 301 entries however long it is. Prefixes within
+// MAX_DISTANCE edits still share a deletion and the full names are compared afterwards anyway, but names that only
+// differ past the prefix all become candidates, so it has to cover typical names whole.
+constexpr std::size_t PREFIX_LENGTH = 24;
+
+constexpr auto create_table = R"(
+    CREATE TABLE IF NOT EXISTS name_delete (
+        hash INTEGER NOT NULL,
+        file_id INTEGER NOT NULL,
+        PRIMARY KEY (hash, file_id)
+    ) WITHOUT ROWID;
+    )";
+
+char fold_case(const char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+std::string folded(const std::string_view text) {
+    std::string out(text);
+    std::ranges::transform(out, out.begin(), fold_case);
+    return out;
+}
+
+// Every string reachable by deleting up to MAX_DISTANCE characters of the folded prefix, the prefix included. The
+// skipped positions are simply left out of the hash, so no string is ever built
+std::vector<i64> deletion_hashes(const std::string_view name) {
+    static_assert(ssm::suggest::MAX_DISTANCE == 2, "hash_without skips at most two positions");
+
+    const std::string prefix = folded(name.substr(0, PREFIX_LENGTH));
+    const std::size_t n = prefix.size();
+    const auto hash_without = [&](const std::size_t first, const std::size_t second) {
+        u64 hash = 14695981039346656037ULL;
+        for (std::size_t k = 0; k < n; ++k) {
+            if (k == first || k == second) continue;
+            hash ^= static_cast<u8>(prefix[k]);
+            hash *= 1099511628211ULL;
+        }
+        return static_cast<i64>(hash >> 1); // JSON integers are signed 64-bit, keep clear of INT64_MIN
+    };
+
+    std::vector<i64> hashes;
+    hashes.reserve(1 + n + n * n / 2);
+    hashes.push_back(hash_without(n, n));
+    for (std::size_t i = 0; i < n; ++i) {
+        hashes.push_back(hash_without(i, n));
+        for (std::size_t j = i + 1; j < n; ++j) hashes.push_back(hash_without(i, j));
+    }
+    std::ranges::sort(hashes);
+    const auto [first, last] = std::ranges::unique(hashes);
+    hashes.erase(first, last);
+    return hashes;
+}
+
+// Optimal string alignment distance between folded strings, anything beyond MAX_DISTANCE reported as MAX_DISTANCE + 1
+std::size_t edit_distance(const std::string_view a, const std::string_view b) {
+    constexpr std::size_t TOO_FAR = ssm::suggest::MAX_DISTANCE + 1;
+    if (std::max(a.size(), b.size()) - std::min(a.size(), b.size()) >= TOO_FAR) return TOO_FAR;
+
+    std::vector<std::size_t> before(b.size() + 1);
+    std::vector<std::size_t> prev(b.size() + 1);
+    std::vector<std::size_t> cur(b.size() + 1);
+    for (std::size_t j = 0; j <= b.size(); ++j) prev[j] = j;
+
+    for (std::size_t i = 1; i <= a.size(); ++i) {
+        cur[0] = i;
+        std::size_t row_min = cur[0];
+        for (std::size_t j = 1; j <= b.size(); ++j) {
+            const std::size_t substitution = fold_case(a[i - 1]) == fold_case(b[j - 1]) ? 0 : 1;
+            cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + substitution});
+            if (i > 1 && j > 1 && fold_case(a[i - 1]) == fold_case(b[j - 2]) &&
+                fold_case(a[i - 2]) == fold_case(b[j - 1])) {
+                cur[j] = std::min(cur[j], before[j - 2] + 1);
+            }
+            row_min = std::min(row_min, cur[j]);
+        }
+        if (row_min >= TOO_FAR) return TOO_FAR;
+        std::swap(before, prev);
+        std::swap(prev, cur);
+    }
+    return std::min(prev[b.size()], TOO_FAR);
+}
+
+// Runs `sql` once for every deletion of `name`
+bool for_each_deletion(const ssm_sqlite3::database& sqlite, const char* sql, const i64 file_id,
+                       const std::string_view name) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(sql);
+    if (!stmt) return false;
+
+    for (const i64 hash : deletion_hashes(name)) {
+        if (!ssm_sqlite3::database::bind_int64(stmt.get(), 1, hash) ||
+            !ssm_sqlite3::database::bind_int64(stmt.get(), 2, file_id) || sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(stmt.get());
+    }
+    return true;
+}
+
+} // namespace
+
+namespace ssm::suggest {
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("suggest.build");
+    if (!sqlite.exec(create_table)) return false;
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT id, name FROM file;");
+    if (!stmt) return false;
+
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1));
+        const int size = sqlite3_column_bytes(stmt.get(), 1);
+        if (text == nullptr) continue;
+        const std::string_view name(text, static_cast<std::size_t>(size));
+        if (!add_name(sqlite, sqlite3_column_int64(stmt.get(), 0), name)) return false;
+    }
+    return ret == SQLITE_DONE;
+}
+
+bool add_name(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view name) {
+    return for_each_deletion(sqlite, "INSERT OR IGNORE INTO name_delete (hash, file_id) VALUES (?, ?);", file_id,
+                             name);
+}
+
+bool remove_name(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view name) {
+    return for_each_deletion(sqlite, "DELETE FROM name_delete WHERE hash = ? AND file_id = ?;", file_id, name);
+}
+
+std::vector<std::string> closest(const ssm_sqlite3::database& sqlite, const std::string_view name,
+                                 const std::size_t limit) {
+    SSM_TRACE_SCOPE("suggest.closest");
+
+    std::string hashes = "[";
+    for (const i64 hash : deletion_hashes(name)) {
+        if (hashes.size() > 1) hashes.push_back(',');
+        hashes += std::to_string(hash);
+    }
+    hashes.push_back(']');
+
+    constexpr auto select_sql = R"(
+        SELECT DISTINCT f.name FROM name_delete AS d JOIN file AS f ON f.id = d.file_id
+        WHERE d.hash IN (SELECT value FROM json_each(?));
+        )";
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(select_sql);
+    if (!stmt || !ssm_sqlite3::database::bind_text(stmt.get(), 1, hashes)) return {};
+
+    std::vector<std::pair<std::size_t, std::string>> found;
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
+        const int size = sqlite3_column_bytes(stmt.get(), 0);
+        if (text == nullptr) continue;
+        const std::string_view candidate(text, static_cast<std::size_t>(size));
+        if (const std::size_t distance = edit_distance(name, candidate); distance <= MAX_DISTANCE) {
+            found.emplace_back(distance, candidate);
+        }
+    }
+
+    std::ranges::sort(found);
+    std::vector<std::string> names;
+    for (auto& [distance, candidate] : found) {
+        if (names.size() == limit) break;
+        names.push_back(MOVE(candidate));
+    }
+    return names;
+}
+
+} // namespace ssm::suggest
@@ -0,0 +1,415 @@
+#include "symbols.hpp"
+
+#include "search.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <utility>
+
+namespace {
+
+// Files read per round of a build: lexed on every core, then written by this one
+constexpr std::size_t BUILD_BATCH = 4096;
+
+// Definitions are recognized by how a line starts, so only this many of its tokens are looked at
+constexpr std::size_t MAX_LINE_TOKENS = 32;
+
+// The primary key is what a prefix lookup scans, the second index what a change deletes by
+constexpr auto create_tables = R"(
+    CREATE TABLE IF NOT EXISTS symbol (
+        name TEXT NOT NULL,
+        file_id INTEGER NOT NULL,
+        line INTEGER NOT NULL,
+        kind TEXT NOT NULL,
+        PRIMARY KEY (name, file_id, line)
+    ) WITHOUT ROWID;
+
+    CREATE INDEX IF NOT EXISTS symbol_file ON symbol (file_id);
+    )";
+
+enum byte_class : u8 {
+    SPACE = 1,
+    WORD = 2,  // letters, digits, '_' and every byte of a UTF-8 sequence
+    INNER = 4, // continues a word but never starts or ends one: deploy-canary, app.users
+    QUOTE = 8,
+};
+
+constexpr std::array<u8, 256> CLASSES = [] {
+    std::array<u8, 256> classes{};
+    for (std::size_t c = 0; c < classes.size(); ++c) {
+        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) classes[c] = WORD;
+    }
+    classes['_'] = WORD;
+    classes['-'] = INNER;
+    classes['.'] = INNER;
+    classes[' '] = SPACE;
+    classes['\t'] = SPACE;
+    classes['\r'] = SPACE;
+    classes['"'] = QUOTE;
+    classes['\''] = QUOTE;
+    classes['`'] = QUOTE;
+    return classes;
+}();
+
+u8 class_of(const char c) noexcept {
+    return CLASSES[static_cast<u8>(c)];
+}
+
+enum class token_kind : u8 {
+    word,
+    string, // without its quotes
+    punct,  // a single byte
+};
+
+struct token {
+    std::string_view text;
+    token_kind kind;
+};
+
+struct line_tokens {
+    std::array<token, MAX_LINE_TOKENS> tokens;
+    std::size_t count = 0;
+    bool complete = true; // the whole line fit
+
+    [[nodiscard]] std::span<const token> view() const noexcept {
+        return std::span(tokens).first(count);
+    }
+};
+
+void lex(const std::string_view line, line_tokens& out) {
+    out.count = 0;
+    out.complete = true;
+    std::size_t i = 0;
+    while (i < line.size()) {
+        const u8 cls = class_of(line[i]);
+        if ((cls & SPACE) != 0) {
+            ++i;
+            continue;
+        }
+        if (out.count == MAX_LINE_TOKENS) {
+            out.complete = false;
+            return;
+        }
+
+        token& t = out.tokens[out.count++];
+        if ((cls & WORD) != 0) {
+            std::size_t end = i + 1;
+            while (end < line.size() && (class_of(line[end]) & (WORD | INNER)) != 0) ++end;
+            while ((class_of(line[end - 1]) & WORD) == 0) --end;
+            t = {.text = line.substr(i, end - i), .kind = token_kind::word};
+            i = end;
+        } else if ((cls & QUOTE) != 0) {
+            const std::size_t close = line.find(line[i], i + 1);
+            const std::size_t end = close == std::string_view::npos ? line.size() : close;
+            t = {.text = line.substr(i + 1, end - i - 1), .kind = token_kind::string};
+            i = std::min(end + 1, line.size());
+        } else {
+            t = {.text = line.substr(i, 1), .kind = token_kind::punct};
+            ++i;
+        }
+    }
+}
+
+bool equals_folded(const std::string_view a, const std::string_view b) noexcept {
+    return std::ranges::equal(a, b, [](const char x, const char y) {
+        const auto lower = [](const char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c; };
+        return lower(x) == lower(y);
+    });
+}
+
+// Words that start statements rather than name or type anything, so `return foo(x)` and `else if (y)` are not
+// definitions
+constexpr std::array<std::string_view, 28> RESERVED = {
+    "and",   "call",   "case",  "delete", "do",    "echo",  "elif",   "else", "for",  "from",
+    "goto",  "if",     "in",    "insert", "into",  "is",    "new",    "not",  "or",   "print",
+    "printf", "return", "select", "sizeof", "switch", "throw", "update", "while",
+};
+
+constexpr std::size_t LONGEST_RESERVED = std::ranges::max(RESERVED, {}, &std::string_view::size).size();
+
+// A quoted one too, for SQL's "user table"
+bool is_name(const token& t) noexcept {
+    if (t.kind == token_kind::string) return !t.text.empty();
+    if (t.kind != token_kind::word || (t.text[0] >= '0' && t.text[0] <= '9')) return false;
+    return t.text.size() > LONGEST_RESERVED ||
+           std::ranges::none_of(RESERVED, [&](const std::string_view r) { return equals_folded(t.text, r); });
+}
+
+bool is_type_part(const token& t) noexcept {
+    if (t.kind == token_kind::punct) return t.text.find_first_of("*&:<>,") != std::string_view::npos;
+    return t.kind == token_kind::word && is_name(t);
+}
+
+// One of the alternatives of a step like "table|view"
+bool matches_any(const token& t, const std::string_view alternatives) noexcept {
+    if (t.kind == token_kind::string) return false;
+    for (std::size_t begin = 0; begin <= alternatives.size();) {
+        const std::size_t end = std::min(alternatives.find('|', begin), alternatives.size());
+        if (equals_folded(t.text, alternatives.substr(begin, end - begin))) return true;
+        begin = end + 1;
+    }
+    return false;
+}
+
+// A definition shape, matched against a line from its first token. Steps are, in order:
+//
+//   $        the name being defined, a word that is not RESERVED or a quoted string
+//   +        one or more type words or * & : < > , (a return type)
+//   *        any tokens but ; and =
+//   ?word    an optional word
+//   =a|b|c   one of the words, which becomes the kind
+//   a|b|c    one of the words or punctuation, case-insensitive like every literal
+//   \n       the end of the line
+struct rule {
+    std::array<std::string_view, 12> steps; // up to the first empty one
+    std::string_view kind;                  // empty when a "=" step gives it
+    char needs = '\0';                      // a byte the line must hold, so most lines never try the loose shapes
+};
+
+// First match wins, so the specific shapes come before the loose ones
+constexpr rule RULES[] = {
+    {.steps = {"def", "$"}, .kind = "function"},
+    {.steps = {"async", "def", "$"}, .kind = "function"},
+    {.steps = {"function", "$"}, .kind = "function"},
+    {.steps = {"alias", "$", "="}, .kind = "alias"},
+    {.steps = {"export", "$", "="}, .kind = "variable"},
+    {.steps = {"#", "define", "$"}, .kind = "macro"},
+    {.steps = {"?typedef", "=class|struct|union|namespace", "$"}, .kind = ""},
+    {.steps = {"enum", "?class", "?struct", "$"}, .kind = "enum"},
+    {.steps = {"create", "?or", "?replace", "?temp", "?temporary", "?unique", "?materialized",
+               "=table|view|function|procedure|index|trigger|type|sequence|schema", "?if", "?not", "?exists", "$"},
+     .kind = ""},
+    {.steps = {"$", "(", ")", "{"}, .kind = "function", .needs = '('},
+    {.steps = {"+", "$", "(", "*", "{|)", "\n"}, .kind = "function", .needs = '('},
+};
+
+struct captures {
+    std::string_view name;
+    std::string_view kind;
+};
+
+bool match(const std::span<const std::string_view> steps, const std::span<const token> tokens, const bool complete,
+           captures& out) {
+    if (steps.empty() || steps[0].empty()) return true;
+    const std::string_view step = steps[0];
+    const auto rest = steps.subspan(1);
+
+    if (step == "\n") return tokens.empty() && complete && match(rest, tokens, complete, out);
+    if (step == "+" || step == "*") {
+        const std::size_t least = step == "+" ? 1 : 0;
+        for (std::size_t k = 0; k <= tokens.size(); ++k) {
+            if (k >= least && match(rest, tokens.subspan(k), complete, out)) return true;
+            if (k == tokens.size()) break;
+            const token& t = tokens[k];
+            const bool skippable = step == "+" ? is_type_part(t) : t.text != ";" && t.text != "=";
+            if (!skippable) break;
+        }
+        return false;
+    }
+    if (step[0] == '?') {
+        if (!tokens.empty() && matches_any(tokens[0], step.substr(1)) &&
+            match(rest, tokens.subspan(1), complete, out)) {
+            return true;
+        }
+        return match(rest, tokens, complete, out);
+    }
+    if (tokens.empty()) return false;
+    if (step == "$") {
+        if (!is_name(tokens[0])) return false;
+        out.name = tokens[0].text;
+        return match(rest, tokens.subspan(1), complete, out);
+    }
+    if (step[0] == '=' && step.size() > 1) {
+        if (!matches_any(tokens[0], step.substr(1))) return false;
+        out.kind = tokens[0].text;
+        return match(rest, tokens.subspan(1), complete, out);
+    }
+    return matches_any(tokens[0], step) && match(rest, tokens.subspan(1), complete, out);
+}
+
+std::string lowercase(const std::string_view text) {
+    std::string out(text);
+    for (char& c : out) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c + ('a' - 'A'));
+    }
+    return out;
+}
+
+// Kubernetes resources, `name:` one level under the document's top-level `metadata:`, of the document's `kind:`. The
+// metadata of a pod template deeper down names no resource
+class yaml_resources {
+public:
+    // Whether the line was the name of a resource, set in `name` and `kind`
+    bool feed(const std::string_view line, const std::span<const token> tokens, std::string_view& name,
+              std::string_view& kind) {
+        if (line.starts_with("---")) {
+            *this = {};
+            return false;
+        }
+        if (tokens.empty()) return false;
+        const std::size_t indent = line.find_first_not_of(' ');
+        const bool key = tokens.size() >= 2 && tokens[1].text == ":" && tokens[0].kind == token_kind::word;
+
+        if (in_metadata_ && indent == 0) in_metadata_ = false;
+        if (in_metadata_) {
+            if (child_indent_ == std::string_view::npos) child_indent_ = indent;
+            if (indent == child_indent_ && key && tokens.size() == 3 && tokens[0].text == "name" &&
+                tokens[2].kind != token_kind::punct && !kind_.empty()) {
+                name = tokens[2].text;
+                kind = kind_;
+                return true;
+            }
+            return false;
+        }
+        if (!key) return false;
+        if (indent == 0 && tokens[0].text == "kind" && tokens.size() == 3) kind_ = tokens[2].text;
+        if (indent == 0 && tokens[0].text == "metadata" && tokens.size() == 2) {
+            in_metadata_ = true;
+            child_indent_ = std::string_view::npos;
+        }
+        return false;
+    }
+
+private:
+    std::string_view kind_;
+    bool in_metadata_ = false;
+    std::size_t child_indent_ = std::string_view::npos;
+};
+
+bool insert(const ssm_sqlite3::stmt_handle& stmt, const i64 file_id, const std::vector<ssm::symbols::symbol>& symbols) {
+    for (const ssm::symbols::symbol& s : symbols) {
+        if (!ssm_sqlite3::database::bind_text(stmt.get(), 1, s.name) ||
+            !ssm_sqlite3::database::bind_int64(stmt.get(), 2, file_id) ||
+            !ssm_sqlite3::database::bind_int64(stmt.get(), 3, s.line) ||
+            !ssm_sqlite3::database::bind_text(stmt.get(), 4, s.kind) || sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(stmt.get());
+    }
+    return true;
+}
+
+constexpr auto insert_sql = "INSERT OR IGNORE INTO symbol (name, file_id, line, kind) VALUES (?, ?, ?, ?);";
+
+// The least string greater than every string starting with `prefix`, none if there is no such string of bytes
+std::optional<std::string> successor(const std::string_view prefix) {
+    std::string next(prefix);
+    while (!next.empty() && static_cast<u8>(next.back()) == 0xFF) next.pop_back();
+    if (next.empty()) return std::nullopt;
+    next.back() = static_cast<char>(static_cast<u8>(next.back()) + 1);
+    return next;
+}
+
+} // namespace
+
+namespace ssm::symbols {
+
+std::vector<symbol> extract(const std::string_view content) {
+    std::vector<symbol> symbols;
+    line_tokens lexed;
+    yaml_resources yaml;
+    u32 number = 0;
+    for (std::size_t begin = 0; begin < content.size();) {
+        const std::size_t newline = content.find('\n', begin);
+        const std::size_t end = newline == std::string_view::npos ? content.size() : newline;
+        const std::string_view line = content.substr(begin, end - begin);
+        begin = end + 1;
+        ++number;
+
+        lex(line, lexed);
+        std::string_view name;
+        std::string_view kind;
+        if (yaml.feed(line, lexed.view(), name, kind)) {
+            symbols.push_back({.name = std::string(name), .kind = std::string(kind), .line = number});
+            continue;
+        }
+        for (const rule& r : RULES) {
+            captures found;
+            if (r.needs != '\0' && line.find(r.needs) == std::string_view::npos) continue;
+            if (!match(r.steps, lexed.view(), lexed.complete, found)) continue;
+            symbols.push_back({.name = std::string(found.name),
+                               .kind = r.kind.empty() ? lowercase(found.kind) : std::string(r.kind),
+                               .line = number});
+            break;
+        }
+    }
+    return symbols;
+}
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("symbols.build");
+    if (!sqlite.exec(create_tables)) return false;
+
+    std::vector<std::pair<i64, std::string>> files;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT id, path FROM file ORDER BY id;");
+        if (!stmt) return false;
+        int ret = sqlite3_step(stmt.get());
+        for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+            const char* path = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1));
+            if (path != nullptr) files.emplace_back(sqlite3_column_int64(stmt.get(), 0), path);
+        }
+        if (ret != SQLITE_DONE) return false;
+    }
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(insert_sql);
+    if (!stmt) return false;
+    std::vector<std::vector<symbol>> extracted;
+    for (std::size_t begin = 0; begin < files.size(); begin += BUILD_BATCH) {
+        const std::size_t count = std::min(BUILD_BATCH, files.size() - begin);
+        extracted.assign(count, {});
+        search::parallel_for(count, 0, [&](const std::size_t i) {
+            const search::mapped_file file(files[begin + i].second);
+            if (file.ok()) extracted[i] = extract(file.text()); // one removed by hand defines nothing
+        });
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!insert(stmt, files[begin + i].first, extracted[i])) return false;
+        }
+    }
+    return true;
+}
+
+bool index_file(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view content) {
+    SSM_TRACE_SCOPE("symbols.index");
+    if (!remove_file(sqlite, file_id)) return false;
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(insert_sql);
+    return stmt && insert(stmt, file_id, extract(content));
+}
+
+bool remove_file(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("DELETE FROM symbol WHERE file_id = ?;");
+    return stmt && ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) && sqlite3_step(stmt.get()) == SQLITE_DONE;
+}
+
+std::optional<std::vector<definition>> lookup(const ssm_sqlite3::database& sqlite, const std::string_view prefix) {
+    SSM_TRACE_SCOPE("symbols.lookup");
+    // Both ends of the range are bound, SQLite only narrows an index scan by the terms it can see are plain ranges
+    const std::optional<std::string> bound = successor(prefix);
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(
+        bound.has_value()
+            ? "SELECT symbol.name, symbol.kind, file.name, symbol.line FROM symbol JOIN file ON file.id = symbol.file_id "
+              "WHERE symbol.name >= ? AND symbol.name < ? ORDER BY symbol.name, file.name, symbol.line;"
+            : "SELECT symbol.name, symbol.kind, file.name, symbol.line FROM symbol JOIN file ON file.id = symbol.file_id "
+              "WHERE symbol.name >= ? ORDER BY symbol.name, file.name, symbol.line;");
+    if (!stmt || !ssm_sqlite3::database::bind_text(stmt.get(), 1, prefix)) return std::nullopt;
+    if (bound.has_value() && !ssm_sqlite3::database::bind_text(stmt.get(), 2, *bound)) return std::nullopt;
+
+    const auto text = [&](const int column) {
+        const unsigned char* value = sqlite3_column_text(stmt.get(), column);
+        return value == nullptr ? std::string{} : std::string(reinterpret_cast<const char*>(value));
+    };
+    std::vector<definition> definitions;
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        definitions.push_back({.name = text(0),
+                               .kind = text(1),
+                               .snippet = text(2),
+                               .line = static_cast<u32>(sqlite3_column_int64(stmt.get(), 3))});
+    }
+    if (ret != SQLITE_DONE) return std::nullopt;
+    return definitions;
+}
+
+} // namespace ssm::symbols
@@ -0,0 +1,508 @@
+#include "tfidf.hpp"
+
+#include "fts.hpp"
+#include "search.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using ssm::tfidf::MAX_TERMS;
+
+// Counts and frequencies are what the vectors are computed from and kept exact. Vectors are a table of their own so
+// a similarity scan reads nothing else: MAX_TERMS terms and then as many weights, 4 bytes each. `weighted_docs` is
+// the number of documents the vectors were last all computed for
+constexpr auto create_tables = R"(
+    CREATE TABLE IF NOT EXISTS tfidf_term (
+        term INTEGER PRIMARY KEY,
+        df INTEGER NOT NULL
+    );
+
+    CREATE TABLE IF NOT EXISTS tfidf_doc (
+        file_id INTEGER PRIMARY KEY,
+        counts BLOB NOT NULL
+    );
+
+    CREATE TABLE IF NOT EXISTS tfidf_vector (
+        file_id INTEGER PRIMARY KEY,
+        vector BLOB NOT NULL
+    );
+
+    CREATE TABLE IF NOT EXISTS tfidf_state (
+        id INTEGER PRIMARY KEY CHECK (id = 1),
+        docs INTEGER NOT NULL,
+        weighted_docs INTEGER NOT NULL
+    );
+
+    INSERT OR IGNORE INTO tfidf_state (id, docs, weighted_docs) VALUES (1, 0, 0);
+    )";
+
+struct term_count {
+    u32 term;
+    u32 count;
+};
+
+u32 hash_term(const std::string_view text) noexcept {
+    u32 hash = 2166136261U;
+    for (const char c : text) {
+        hash ^= static_cast<u8>(c);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// How often each term occurs in `content`, terms ascending
+std::vector<term_count> count_terms(const std::string_view content) {
+    std::vector<u32> hashes;
+    ssm::fts::tokenize(content, ssm::fts::mode::document, [&hashes](const ssm::fts::token& token) {
+        hashes.push_back(hash_term(token.text));
+        return true;
+    });
+    std::ranges::sort(hashes);
+
+    std::vector<term_count> counts;
+    for (std::size_t i = 0; i < hashes.size();) {
+        std::size_t j = i + 1;
+        while (j < hashes.size() && hashes[j] == hashes[i]) ++j;
+        counts.push_back({.term = hashes[i], .count = static_cast<u32>(j - i)});
+        i = j;
+    }
+    return counts;
+}
+
+void put_varint(std::string& out, u64 value) {
+    for (; value >= 0x80; value >>= 7) out.push_back(static_cast<char>(static_cast<u8>(value | 0x80)));
+    out.push_back(static_cast<char>(static_cast<u8>(value)));
+}
+
+// Each term as a delta from the one before, then its count
+std::string encode_counts(const std::vector<term_count>& counts) {
+    std::string bytes;
+    u32 last = 0;
+    for (const term_count& c : counts) {
+        put_varint(bytes, c.term - last);
+        put_varint(bytes, c.count);
+        last = c.term;
+    }
+    return bytes;
+}
+
+void decode_counts(const std::string_view bytes, std::vector<term_count>& counts) {
+    counts.clear();
+    std::array<u64, 2> pair{};
+    std::size_t field = 0;
+    u64 value = 0;
+    int shift = 0;
+    u32 term = 0;
+    for (const char c : bytes) {
+        const auto byte = static_cast<u8>(c);
+        value |= u64{byte & 0x7FU} << shift;
+        if ((byte & 0x80) != 0) {
+            shift += 7;
+            continue;
+        }
+        pair[field++] = value;
+        value = 0;
+        shift = 0;
+        if (field < pair.size()) continue;
+        term += static_cast<u32>(pair[0]);
+        counts.push_back({.term = term, .count = static_cast<u32>(pair[1])});
+        field = 0;
+    }
+}
+
+std::string_view column_blob(sqlite3_stmt* stmt, const int column) {
+    const void* data = sqlite3_column_blob(stmt, column);
+    const int size = sqlite3_column_bytes(stmt, column);
+    return data == nullptr ? std::string_view{} : std::string_view(static_cast<const char*>(data), static_cast<std::size_t>(size));
+}
+
+// The vector of a document with `counts`, as stored: its MAX_TERMS heaviest terms ascending, then their weights
+// scaled to unit length. `df(term)` is how many of the `docs` documents hold the term
+template <class Df>
+std::string weigh(const std::vector<term_count>& counts, const i64 docs, Df&& df) {
+    struct weighted {
+        u32 term;
+        f64 weight;
+    };
+    std::vector<weighted> terms;
+    terms.reserve(counts.size());
+    const auto n = static_cast<f64>(docs);
+    for (const term_count& c : counts) {
+        const auto frequency = static_cast<f64>(df(c.term));
+        const f64 idf = std::log((1 + n) / (1 + frequency)) + 1;
+        terms.push_back({.term = c.term, .weight = (1 + std::log(static_cast<f64>(c.count))) * idf});
+    }
+
+    const std::size_t kept = std::min(terms.size(), MAX_TERMS);
+    std::ranges::partial_sort(terms, terms.begin() + static_cast<std::ptrdiff_t>(kept),
+                              [](const weighted& a, const weighted& b) {
+                                  if (a.weight > b.weight || b.weight > a.weight) return a.weight > b.weight;
+                                  return a.term < b.term;
+                              });
+    terms.resize(kept);
+    std::ranges::sort(terms, {}, &weighted::term);
+
+    f64 norm = 0;
+    for (const weighted& t : terms) norm += t.weight * t.weight;
+    norm = std::sqrt(norm);
+
+    std::string blob(kept * (sizeof(u32) + sizeof(f32)), '\0');
+    for (std::size_t i = 0; i < kept; ++i) {
+        const auto weight = static_cast<f32>(terms[i].weight / norm);
+        std::memcpy(blob.data() + i * sizeof(u32), &terms[i].term, sizeof(u32));
+        std::memcpy(blob.data() + kept * sizeof(u32) + i * sizeof(f32), &weight, sizeof(f32));
+    }
+    return blob;
+}
+
+// A stored vector copied out of its blob, which SQLite gives no alignment for
+struct unpacked {
+    std::array<u32, MAX_TERMS> terms{};
+    std::array<f32, MAX_TERMS> weights{};
+    std::size_t size = 0;
+
+    bool assign(const std::string_view blob) noexcept {
+        constexpr std::size_t entry = sizeof(u32) + sizeof(f32);
+        if (blob.size() % entry != 0 || blob.size() / entry > MAX_TERMS) return false;
+        size = blob.size() / entry;
+        std::memcpy(terms.data(), blob.data(), size * sizeof(u32));
+        std::memcpy(weights.data(), blob.data() + size * sizeof(u32), size * sizeof(f32));
+        return true;
+    }
+};
+
+// The vector every other one is compared with, its terms split into lanes of 8. Terms are sorted, so only the lane
+// whose range holds a term of the other vector can hold the term itself, and that lane is compared with it all at
+// once. Past its size the weights are zero, so whatever the padding terms happen to match adds nothing
+class query {
+public:
+    query(const std::span<const u32> terms, const std::span<const f32> weights) noexcept {
+        alignas(32) std::array<u32, MAX_TERMS> t{};
+        alignas(32) std::array<f32, MAX_TERMS> w{};
+        size_ = std::min({terms.size(), weights.size(), MAX_TERMS});
+        std::copy_n(terms.begin(), size_, t.begin());
+        std::copy_n(weights.begin(), size_, w.begin());
+#if defined(__AVX2__)
+        // Lanes past the last term copy the last one holding any, so a term beyond its range finds the same terms
+        // whichever of them it picks
+        const std::size_t filled = std::max<std::size_t>((size_ + 7) / 8, 1);
+        for (std::size_t l = 0; l < LANES; ++l) {
+            const std::size_t source = std::min(l, filled - 1);
+            terms_[l] = _mm256_load_si256(reinterpret_cast<const __m256i*>(t.data() + source * 8));
+            weights_[l] = _mm256_load_ps(w.data() + source * 8);
+            firsts_[l] = t[source * 8];
+        }
+#else
+        terms_ = t;
+        weights_ = w;
+#endif
+    }
+
+    [[nodiscard]] f32 dot(const std::span<const u32> terms, const std::span<const f32> weights) const noexcept {
+        const std::size_t size = std::min({terms.size(), weights.size(), MAX_TERMS});
+#if defined(__AVX2__)
+        // Terms within a vector are distinct, so each of the other's matches at most one of ours. The lane is picked
+        // by comparisons rather than branches, which would mispredict on every other term
+        __m256 sum = _mm256_setzero_ps();
+        for (std::size_t i = 0; i < size; ++i) {
+            const u32 term = terms[i];
+            const std::size_t l = std::size_t{term >= firsts_[1]} + std::size_t{term >= firsts_[2]} +
+                                  std::size_t{term >= firsts_[3]};
+            const __m256 equal =
+                _mm256_castsi256_ps(_mm256_cmpeq_epi32(terms_[l], _mm256_set1_epi32(static_cast<int>(term))));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_and_ps(equal, weights_[l]), _mm256_set1_ps(weights[i])));
+        }
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        const __m128 quarter = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(quarter, _mm_shuffle_ps(quarter, quarter, 1)));
+#else
+        f32 sum = 0;
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < size_ && j < size) {
+            if (terms_[i] < terms[j]) {
+                ++i;
+            } else if (terms[j] < terms_[i]) {
+                ++j;
+            } else {
+                sum += weights_[i++] * weights[j++];
+            }
+        }
+        return sum;
+#endif
+    }
+
+private:
+    std::size_t size_ = 0;
+#if defined(__AVX2__)
+    static constexpr std::size_t LANES = MAX_TERMS / 8;
+    static_assert(LANES == 4, "a lane is picked by comparing against the first term of the other three");
+    __m256i terms_[LANES];
+    __m256 weights_[LANES];
+    u32 firsts_[LANES];
+#else
+    std::array<u32, MAX_TERMS> terms_{};
+    std::array<f32, MAX_TERMS> weights_{};
+#endif
+};
+
+// Whether `file_id` has stored counts, and if so what they are
+std::optional<bool> stored_counts(const ssm_sqlite3::database& sqlite, const i64 file_id, std::vector<term_count>& counts) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT counts FROM tfidf_doc WHERE file_id = ?;");
+    if (!stmt || !ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id)) return std::nullopt;
+    const int ret = sqlite3_step(stmt.get());
+    if (ret == SQLITE_DONE) return false;
+    if (ret != SQLITE_ROW) return std::nullopt;
+    decode_counts(column_blob(stmt.get(), 0), counts);
+    return true;
+}
+
+// Counts a document's terms in or out of the document frequencies. A term no document holds any more loses its row
+bool add_frequencies(const ssm_sqlite3::database& sqlite, const std::vector<term_count>& counts, const bool add) {
+    const ssm_sqlite3::stmt_handle update = sqlite.prepare(
+        add ? "INSERT INTO tfidf_term (term, df) VALUES (?, 1) ON CONFLICT (term) DO UPDATE SET df = df + 1;"
+            : "UPDATE tfidf_term SET df = df - 1 WHERE term = ?;");
+    const ssm_sqlite3::stmt_handle erase = sqlite.prepare("DELETE FROM tfidf_term WHERE term = ? AND df <= 0;");
+    if (!update || !erase) return false;
+    for (const term_count& c : counts) {
+        if (!ssm_sqlite3::database::bind_int64(update.get(), 1, c.term) || sqlite3_step(update.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(update.get());
+        if (add) continue;
+        if (!ssm_sqlite3::database::bind_int64(erase.get(), 1, c.term) || sqlite3_step(erase.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(erase.get());
+    }
+    return true;
+}
+
+// Adds `delta` to the document count. The new count and the one the vectors were computed for
+std::optional<std::pair<i64, i64>> add_docs(const ssm_sqlite3::database& sqlite, const i64 delta) {
+    const ssm_sqlite3::stmt_handle update = sqlite.prepare("UPDATE tfidf_state SET docs = docs + ? WHERE id = 1;");
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT docs, weighted_docs FROM tfidf_state WHERE id = 1;");
+    if (!update || !select || !ssm_sqlite3::database::bind_int64(update.get(), 1, delta) ||
+        sqlite3_step(update.get()) != SQLITE_DONE || sqlite3_step(select.get()) != SQLITE_ROW) {
+        return std::nullopt;
+    }
+    return std::pair{sqlite3_column_int64(select.get(), 0), sqlite3_column_int64(select.get(), 1)};
+}
+
+bool store_vector(const ssm_sqlite3::stmt_handle& stmt, const i64 file_id, const std::string_view blob) {
+    const bool ok = ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) &&
+                    ssm_sqlite3::database::bind_blob(stmt.get(), 2, blob) && sqlite3_step(stmt.get()) == SQLITE_DONE;
+    sqlite3_reset(stmt.get());
+    return ok;
+}
+
+// Recomputes every vector from the stored counts and the current frequencies, for `docs` documents
+bool reweight(const ssm_sqlite3::database& sqlite, const i64 docs) {
+    SSM_TRACE_SCOPE("tfidf.reweight");
+    std::vector<term_count> frequencies; // term ascending, the table's own order
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT term, df FROM tfidf_term ORDER BY term;");
+        if (!stmt) return false;
+        int ret = sqlite3_step(stmt.get());
+        for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+            frequencies.push_back({.term = static_cast<u32>(sqlite3_column_int64(stmt.get(), 0)),
+                                   .count = static_cast<u32>(sqlite3_column_int64(stmt.get(), 1))});
+        }
+        if (ret != SQLITE_DONE) return false;
+    }
+    const auto df = [&frequencies](const u32 term) {
+        const auto it = std::ranges::lower_bound(frequencies, term, {}, &term_count::term);
+        return it != frequencies.end() && it->term == term ? it->count : 0;
+    };
+
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT file_id, counts FROM tfidf_doc;");
+    const ssm_sqlite3::stmt_handle upsert = sqlite.prepare("INSERT OR REPLACE INTO tfidf_vector (file_id, vector) VALUES (?, ?);");
+    const ssm_sqlite3::stmt_handle state = sqlite.prepare("UPDATE tfidf_state SET weighted_docs = ? WHERE id = 1;");
+    if (!select || !upsert || !state) return false;
+    std::vector<term_count> counts;
+    int ret = sqlite3_step(select.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(select.get())) {
+        decode_counts(column_blob(select.get(), 1), counts);
+        if (!store_vector(upsert, sqlite3_column_int64(select.get(), 0), weigh(counts, docs, df))) return false;
+    }
+    return ret == SQLITE_DONE && ssm_sqlite3::database::bind_int64(state.get(), 1, docs) &&
+           sqlite3_step(state.get()) == SQLITE_DONE;
+}
+
+// Every weight depends on N. Recomputing them all whenever N has doubled or halved since the last time keeps them
+// within a factor of two of current, at a cost that, spread over the changes in between, is constant per change
+bool reweight_if_stale(const ssm_sqlite3::database& sqlite, const i64 docs, const i64 weighted_docs, bool& reweighted) {
+    reweighted = docs > 2 * weighted_docs || 2 * docs < weighted_docs;
+    return !reweighted || reweight(sqlite, docs);
+}
+
+} // namespace
+
+namespace ssm::tfidf {
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("tfidf.build");
+    if (!sqlite.exec(create_tables)) return false;
+
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT id, path FROM file ORDER BY id;");
+    const ssm_sqlite3::stmt_handle insert = sqlite.prepare("INSERT OR REPLACE INTO tfidf_doc (file_id, counts) VALUES (?, ?);");
+    if (!select || !insert) return false;
+
+    std::unordered_map<u32, u32> frequencies;
+    i64 docs = 0;
+    int ret = sqlite3_step(select.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(select.get())) {
+        const char* path = reinterpret_cast<const char*>(sqlite3_column_text(select.get(), 1));
+        if (path == nullptr) continue;
+        const search::mapped_file file(path);
+        if (!file.ok()) continue; // removed by hand, there is nothing to compare it by
+
+        const std::vector<term_count> counts = count_terms(file.text());
+        for (const term_count& c : counts) ++frequencies[c.term];
+        ++docs;
+        if (!ssm_sqlite3::database::bind_int64(insert.get(), 1, sqlite3_column_int64(select.get(), 0)) ||
+            !ssm_sqlite3::database::bind_blob(insert.get(), 2, encode_counts(counts)) ||
+            sqlite3_step(insert.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(insert.get());
+    }
+    if (ret != SQLITE_DONE) return false;
+
+    std::vector<term_count> sorted;
+    sorted.reserve(frequencies.size());
+    for (const auto& [term, df] : frequencies) sorted.push_back({.term = term, .count = df});
+    std::ranges::sort(sorted, {}, &term_count::term);
+    const ssm_sqlite3::stmt_handle term = sqlite.prepare("INSERT OR REPLACE INTO tfidf_term (term, df) VALUES (?, ?);");
+    const ssm_sqlite3::stmt_handle state = sqlite.prepare("UPDATE tfidf_state SET docs = ? WHERE id = 1;");
+    if (!term || !state) return false;
+    for (const term_count& t : sorted) {
+        if (!ssm_sqlite3::database::bind_int64(term.get(), 1, t.term) ||
+            !ssm_sqlite3::database::bind_int64(term.get(), 2, t.count) || sqlite3_step(term.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(term.get());
+    }
+    return ssm_sqlite3::database::bind_int64(state.get(), 1, docs) && sqlite3_step(state.get()) == SQLITE_DONE &&
+           reweight(sqlite, docs);
+}
+
+bool index_file(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view content) {
+    SSM_TRACE_SCOPE("tfidf.index");
+    std::vector<term_count> old_counts;
+    const std::optional<bool> existed = stored_counts(sqlite, file_id, old_counts);
+    if (!existed || (*existed && !add_frequencies(sqlite, old_counts, false))) return false;
+
+    const std::vector<term_count> counts = count_terms(content);
+    const ssm_sqlite3::stmt_handle insert = sqlite.prepare("INSERT OR REPLACE INTO tfidf_doc (file_id, counts) VALUES (?, ?);");
+    if (!add_frequencies(sqlite, counts, true) || !insert ||
+        !ssm_sqlite3::database::bind_int64(insert.get(), 1, file_id) ||
+        !ssm_sqlite3::database::bind_blob(insert.get(), 2, encode_counts(counts)) ||
+        sqlite3_step(insert.get()) != SQLITE_DONE) {
+        return false;
+    }
+
+    const std::optional<std::pair<i64, i64>> docs = add_docs(sqlite, *existed ? 0 : 1);
+    bool reweighted = false;
+    if (!docs || !reweight_if_stale(sqlite, docs->first, docs->second, reweighted)) return false;
+    if (reweighted) return true;
+
+    const ssm_sqlite3::stmt_handle df = sqlite.prepare("SELECT df FROM tfidf_term WHERE term = ?;");
+    const ssm_sqlite3::stmt_handle upsert = sqlite.prepare("INSERT OR REPLACE INTO tfidf_vector (file_id, vector) VALUES (?, ?);");
+    if (!df || !upsert) return false;
+    bool ok = true;
+    const std::string blob = weigh(counts, docs->first, [&](const u32 term) {
+        u32 frequency = 0;
+        if (ssm_sqlite3::database::bind_int64(df.get(), 1, term) && sqlite3_step(df.get()) == SQLITE_ROW) {
+            frequency = static_cast<u32>(sqlite3_column_int64(df.get(), 0));
+        } else {
+            ok = false;
+        }
+        sqlite3_reset(df.get());
+        return frequency;
+    });
+    return ok && store_vector(upsert, file_id, blob);
+}
+
+bool remove_file(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    std::vector<term_count> counts;
+    const std::optional<bool> existed = stored_counts(sqlite, file_id, counts);
+    if (!existed) return false;
+    if (!*existed) return true;
+
+    const ssm_sqlite3::stmt_handle doc = sqlite.prepare("DELETE FROM tfidf_doc WHERE file_id = ?;");
+    const ssm_sqlite3::stmt_handle vector = sqlite.prepare("DELETE FROM tfidf_vector WHERE file_id = ?;");
+    if (!add_frequencies(sqlite, counts, false) || !doc || !vector ||
+        !ssm_sqlite3::database::bind_int64(doc.get(), 1, file_id) || sqlite3_step(doc.get()) != SQLITE_DONE ||
+        !ssm_sqlite3::database::bind_int64(vector.get(), 1, file_id) || sqlite3_step(vector.get()) != SQLITE_DONE) {
+        return false;
+    }
+
+    const std::optional<std::pair<i64, i64>> docs = add_docs(sqlite, -1);
+    bool reweighted = false;
+    return docs && reweight_if_stale(sqlite, docs->first, docs->second, reweighted);
+}
+
+std::optional<std::vector<neighbour>> nearest(const ssm_sqlite3::database& sqlite, const i64 file_id,
+                                              const std::size_t count) {
+    SSM_TRACE_SCOPE("tfidf.nearest");
+    if (count == 0) return std::vector<neighbour>{};
+    unpacked v;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT vector FROM tfidf_vector WHERE file_id = ?;");
+        if (!stmt || !ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id)) return std::nullopt;
+        const int ret = sqlite3_step(stmt.get());
+        if (ret == SQLITE_DONE) return std::vector<neighbour>{};
+        if (ret != SQLITE_ROW) return std::nullopt;
+        if (!v.assign(column_blob(stmt.get(), 0))) return std::vector<neighbour>{};
+    }
+    const query q(std::span(v.terms).first(v.size), std::span(v.weights).first(v.size));
+
+    // The best `count` so far, kept as a heap with the worst of them on top, ready to be displaced
+    const auto better = [](const neighbour& a, const neighbour& b) {
+        if (a.score > b.score || b.score > a.score) return a.score > b.score;
+        return a.file_id < b.file_id;
+    };
+    std::vector<neighbour> best;
+    best.reserve(count);
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT file_id, vector FROM tfidf_vector;");
+    if (!stmt) return std::nullopt;
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const i64 id = sqlite3_column_int64(stmt.get(), 0);
+        if (id == file_id || !v.assign(column_blob(stmt.get(), 1))) continue;
+        const neighbour scored{.file_id = id,
+                               .score = q.dot(std::span(v.terms).first(v.size), std::span(v.weights).first(v.size))};
+        if (scored.score <= 0) continue;
+        if (best.size() < count) {
+            best.push_back(scored);
+            std::ranges::push_heap(best, better);
+        } else if (better(scored, best.front())) {
+            std::ranges::pop_heap(best, better);
+            best.back() = scored;
+            std::ranges::push_heap(best, better);
+        }
+    }
+    if (ret != SQLITE_DONE) return std::nullopt;
+    std::ranges::sort_heap(best, better);
+    return best;
+}
+
+f32 dot(const std::span<const u32> a_terms, const std::span<const f32> a_weights, const std::span<const u32> b_terms,
+        const std::span<const f32> b_weights) noexcept {
+    return query(a_terms, a_weights).dot(b_terms, b_weights);
+}
+
+} // namespace ssm::tfidf
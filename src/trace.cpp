@@ -0,0 +1,180 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <mutex>
+#include <print>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+struct span_event {
+    const char* name;
+    i64 start_ns;
+    i64 end_ns;
+    i64 tid;
+};
+
+struct counter_event {
+    const char* name;
+    i64 ts_ns;
+    i64 value;
+};
+
+struct trace_state {
+    std::mutex mutex;
+    std::string path;
+    bool write_events = false;
+    std::vector<span_event> spans;
+    std::vector<counter_event> counters;
+    std::unordered_map<std::string_view, i64> totals;
+    std::vector<std::pair<std::string_view, i64>> phases;
+};
+
+trace_state& state() {
+    static trace_state s;
+    return s;
+}
+
+std::string expand_path(const std::string_view pattern) {
+    std::string path;
+    path.reserve(pattern.size() + 8);
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] == '%' && i + 1 < pattern.size() && pattern[i + 1] == 'p') {
+            path += std::to_string(getpid());
+            ++i;
+        } else {
+            path.push_back(pattern[i]);
+        }
+    }
+    return path;
+}
+
+void append_json_string(std::string& out, const std::string_view str) {
+    out.push_back('"');
+    for (const char c : str) {
+        if (c == '"' || c == '\\') out.push_back('\\');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+// Caller holds the mutex. Returns the phase's new total
+i64 add_to_phase(trace_state& s, const std::string_view name, const i64 ns) {
+    const auto it = std::ranges::find(s.phases, name, &std::pair<std::string_view, i64>::first);
+    if (it != s.phases.end()) return it->second += ns;
+    s.phases.emplace_back(name, ns);
+    return ns;
+}
+
+// Chrome trace timestamps are microseconds, keep the nanosecond precision in the fraction
+std::string format_us(const i64 ns) {
+    return std::format("{}.{:03}", ns / 1000, ns % 1000);
+}
+
+bool write_trace(const trace_state& s) {
+    const i64 pid = getpid();
+
+    std::string out;
+    out.reserve(128 + (s.spans.size() + s.counters.size()) * 112);
+    out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out += std::format(R"({{"name":"process_name","ph":"M","pid":{},"tid":{},"args":{{"name":"ssm"}}}})", pid, pid);
+
+    for (const span_event& e : s.spans) {
+        out += ",\n{\"name\":";
+        append_json_string(out, e.name);
+        out += std::format(R"(,"cat":"ssm","ph":"X","ts":{},"dur":{},"pid":{},"tid":{}}})", format_us(e.start_ns),
+                           format_us(e.end_ns - e.start_ns), pid, e.tid);
+    }
+    for (const counter_event& e : s.counters) {
+        out += ",\n{\"name\":";
+        append_json_string(out, e.name);
+        out += std::format(R"(,"ph":"C","ts":{},"pid":{},"args":{{"value":{}}}}})", format_us(e.ts_ns), pid, e.value);
+    }
+    out += "\n]}\n";
+
+    std::FILE* file = std::fopen(s.path.c_str(), "w");
+    if (file == nullptr) return false;
+    const bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+} // namespace
+
+namespace ssm::trace {
+
+namespace detail {
+
+i64 now_ns() noexcept {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return i64{ts.tv_sec} * 1'000'000'000 + ts.tv_nsec;
+}
+
+void record_span(const char* name, const i64 start_ns, const i64 end_ns) {
+    trace_state& s = state();
+    const std::scoped_lock lock(s.mutex);
+    if (s.write_events) {
+        s.spans.push_back({.name = name, .start_ns = start_ns, .end_ns = end_ns, .tid = gettid()});
+    }
+    add_to_phase(s, name, end_ns - start_ns);
+}
+
+void record_counter(const char* name, const i64 delta) {
+    const i64 ts = now_ns();
+    trace_state& s = state();
+    const std::scoped_lock lock(s.mutex);
+    i64& total = s.totals[name];
+    total += delta;
+    if (s.write_events) s.counters.push_back({.name = name, .ts_ns = ts, .value = total});
+}
+
+void record_phase(const char* name, const i64 ns) {
+    const i64 ts = now_ns();
+    trace_state& s = state();
+    const std::scoped_lock lock(s.mutex);
+    const i64 total = add_to_phase(s, name, ns);
+    if (s.write_events) s.counters.push_back({.name = name, .ts_ns = ts, .value = total});
+}
+
+} // namespace detail
+
+session::session(const bool collect_phases) : start_ns_(detail::now_ns()) {
+    trace_state& s = state();
+    s.phases.reserve(16);
+
+    if (const char* path = std::getenv("SSM_TRACE"); path != nullptr && path[0] != '\0') {
+        s.path = expand_path(path);
+        s.write_events = true;
+        s.spans.reserve(256);
+        s.counters.reserve(64);
+    }
+
+    detail::enabled = s.write_events || collect_phases;
+}
+
+session::~session() {
+    if (!detail::enabled) return;
+    detail::enabled = false;
+
+    const trace_state& s = state();
+    if (s.write_events && !write_trace(s)) {
+        std::println(stderr, "Failed to write trace to '{}'", s.path);
+    }
+}
+
+std::vector<std::pair<std::string_view, i64>> phase_totals() {
+    trace_state& s = state();
+    const std::scoped_lock lock(s.mutex);
+    return s.phases;
+}
+
+} // namespace ssm::trace
@@ -0,0 +1,356 @@
+#include "trigram.hpp"
+
+#include "search.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+constexpr std::size_t GRAM_COUNT = std::size_t{1} << 24;
+
+// A build flushes its lists to the database whenever they grow past this, so a large store is indexed in bounded
+// memory
+constexpr std::size_t FLUSH_BYTES = 64 * 1024 * 1024;
+
+// Below this many dead ids, rewriting every list costs more than skipping them does
+constexpr i64 MIN_DEAD_DOCS = 256;
+
+constexpr auto create_tables = R"(
+    CREATE TABLE IF NOT EXISTS trigram_doc (
+        doc INTEGER PRIMARY KEY AUTOINCREMENT,
+        file_id INTEGER NOT NULL UNIQUE
+    );
+
+    CREATE TABLE IF NOT EXISTS trigram (
+        gram INTEGER PRIMARY KEY,
+        last_doc INTEGER NOT NULL,
+        postings BLOB NOT NULL
+    );
+    )";
+
+u32 gram_at(const char* p) noexcept {
+    return u32{static_cast<u8>(p[0])} << 16 | u32{static_cast<u8>(p[1])} << 8 | u32{static_cast<u8>(p[2])};
+}
+
+// Distinct trigrams of `text` in order of first occurrence. `seen` has a bit per trigram and is all clear again on
+// return, so one allocation serves every file of a build
+std::vector<u32> grams_of(const std::string_view text, std::vector<u64>& seen) {
+    std::vector<u32> grams;
+    for (std::size_t i = 0; i + 2 < text.size(); ++i) {
+        const u32 gram = gram_at(text.data() + i);
+        u64& word = seen[gram / 64];
+        const u64 bit = u64{1} << (gram % 64);
+        if ((word & bit) != 0) continue;
+        word |= bit;
+        grams.push_back(gram);
+    }
+    for (const u32 gram : grams) seen[gram / 64] = 0;
+    return grams;
+}
+
+// Distinct trigrams of `text` in ascending order. Used for single files, where zeroing a bitmap over every possible
+// trigram costs more than the extraction itself
+std::vector<u32> grams_of(const std::string_view text) {
+    std::vector<u32> grams;
+    grams.reserve(text.size() < 2 ? 0 : text.size() - 2);
+    for (std::size_t i = 0; i + 2 < text.size(); ++i) grams.push_back(gram_at(text.data() + i));
+    std::ranges::sort(grams);
+    grams.erase(std::ranges::unique(grams).begin(), grams.end());
+    return grams;
+}
+
+void put_varint(std::string& out, u64 value) {
+    for (; value >= 0x80; value >>= 7) out.push_back(static_cast<char>(static_cast<u8>(value | 0x80)));
+    out.push_back(static_cast<char>(static_cast<u8>(value)));
+}
+
+// Appends the ids of an encoded list to `docs`
+void decode(const std::string_view bytes, std::vector<i64>& docs) {
+    u64 doc = 0;
+    u64 delta = 0;
+    int shift = 0;
+    for (const char c : bytes) {
+        const auto byte = static_cast<u8>(c);
+        delta |= u64{byte & 0x7FU} << shift;
+        if ((byte & 0x80) != 0) {
+            shift += 7;
+            continue;
+        }
+        doc += delta;
+        docs.push_back(static_cast<i64>(doc));
+        delta = 0;
+        shift = 0;
+    }
+}
+
+std::string_view column_blob(sqlite3_stmt* stmt, const int column) {
+    const void* data = sqlite3_column_blob(stmt, column);
+    const int size = sqlite3_column_bytes(stmt, column);
+    return data == nullptr ? std::string_view{} : std::string_view(static_cast<const char*>(data), static_cast<std::size_t>(size));
+}
+
+// Ids appended to lists in memory before they reach the database. The first id is kept apart because its delta is
+// against whatever the stored list ends with
+struct pending_list {
+    i64 first = 0;
+    i64 last = 0;
+    std::string tail; // deltas after the first id
+};
+
+class list_writer {
+public:
+    void add(const i64 doc, const std::vector<u32>& grams) {
+        for (const u32 gram : grams) {
+            pending_list& list = lists_[gram];
+            if (list.first == 0) {
+                list.first = doc;
+                bytes_ += sizeof(pending_list);
+            } else {
+                const std::size_t before = list.tail.size();
+                put_varint(list.tail, static_cast<u64>(doc - list.last));
+                bytes_ += list.tail.size() - before;
+            }
+            list.last = doc;
+        }
+    }
+
+    [[nodiscard]] std::size_t bytes() const noexcept {
+        return bytes_;
+    }
+
+    // Appends every pending list to its stored one, in trigram order so the table is walked front to back
+    bool flush(const ssm_sqlite3::database& sqlite) {
+        const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT last_doc, postings FROM trigram WHERE gram = ?;");
+        const ssm_sqlite3::stmt_handle upsert =
+            sqlite.prepare("INSERT OR REPLACE INTO trigram (gram, last_doc, postings) VALUES (?, ?, ?);");
+        if (!select || !upsert) return false;
+
+        std::vector<u32> grams;
+        grams.reserve(lists_.size());
+        for (const auto& [gram, list] : lists_) grams.push_back(gram);
+        std::ranges::sort(grams);
+
+        std::string postings;
+        for (const u32 gram : grams) {
+            const pending_list& list = lists_.at(gram);
+            i64 stored_last = 0;
+            postings.clear();
+            if (!ssm_sqlite3::database::bind_int64(select.get(), 1, gram)) return false;
+            if (sqlite3_step(select.get()) == SQLITE_ROW) {
+                stored_last = sqlite3_column_int64(select.get(), 0);
+                postings = column_blob(select.get(), 1);
+            }
+            sqlite3_reset(select.get());
+
+            put_varint(postings, static_cast<u64>(list.first - stored_last));
+            postings += list.tail;
+            if (!ssm_sqlite3::database::bind_int64(upsert.get(), 1, gram) ||
+                !ssm_sqlite3::database::bind_int64(upsert.get(), 2, list.last) ||
+                !ssm_sqlite3::database::bind_blob(upsert.get(), 3, postings) || sqlite3_step(upsert.get()) != SQLITE_DONE) {
+                return false;
+            }
+            sqlite3_reset(upsert.get());
+        }
+
+        lists_.clear();
+        bytes_ = 0;
+        return true;
+    }
+
+private:
+    std::unordered_map<u32, pending_list> lists_;
+    std::size_t bytes_ = 0;
+};
+
+// A fresh document id for `file_id`, whose previous one (if any) becomes dead
+std::optional<i64> new_doc(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("INSERT OR REPLACE INTO trigram_doc (file_id) VALUES (?);");
+    if (!stmt || !ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) || sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        return std::nullopt;
+    }
+    return sqlite.last_insert_rowid();
+}
+
+// Dead ids cost every lookup whose lists hold them. Once they outnumber the live ones, every list is rewritten
+// without them in one pass, which never has to read a snippet again. The live ids are renumbered 1..N on the way,
+// keeping their order, so the id sequence afterwards counts exactly the live documents
+bool compact_if_needed(const ssm_sqlite3::database& sqlite) {
+    i64 issued = 0;
+    i64 live = 0;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare(
+            "SELECT (SELECT seq FROM sqlite_sequence WHERE name = 'trigram_doc'), (SELECT count(*) FROM trigram_doc);");
+        if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) return false;
+        issued = sqlite3_column_int64(stmt.get(), 0);
+        live = sqlite3_column_int64(stmt.get(), 1);
+    }
+    const i64 dead = issued - live;
+    if (dead < MIN_DEAD_DOCS || dead <= live) return true;
+
+    SSM_TRACE_SCOPE("trigram.compact");
+    std::vector<i64> renumbered(static_cast<std::size_t>(issued) + 1); // 0 for dead ids
+    {
+        const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT doc FROM trigram_doc ORDER BY doc;");
+        if (!select) return false;
+        i64 next = 0;
+        while (sqlite3_step(select.get()) == SQLITE_ROW) {
+            renumbered[static_cast<std::size_t>(sqlite3_column_int64(select.get(), 0))] = ++next;
+        }
+    }
+
+    // Rows are only rewritten once the scan is done, SQLite does not promise a scan sees a table it is changing
+    struct rewrite {
+        i64 gram;
+        i64 last;
+        std::string postings;
+    };
+    std::vector<rewrite> rewrites;
+    {
+        const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT gram, postings FROM trigram;");
+        if (!stmt) return false;
+        std::vector<i64> docs;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            docs.clear();
+            decode(column_blob(stmt.get(), 1), docs);
+            rewrite r{.gram = sqlite3_column_int64(stmt.get(), 0), .last = 0, .postings = {}};
+            for (const i64 doc : docs) {
+                const i64 id = renumbered[static_cast<std::size_t>(doc)];
+                if (id == 0) continue;
+                put_varint(r.postings, static_cast<u64>(id - r.last));
+                r.last = id;
+            }
+            rewrites.push_back(MOVE(r));
+        }
+    }
+
+    const ssm_sqlite3::stmt_handle update = sqlite.prepare("UPDATE trigram SET last_doc = ?, postings = ? WHERE gram = ?;");
+    const ssm_sqlite3::stmt_handle erase = sqlite.prepare("DELETE FROM trigram WHERE gram = ?;");
+    if (!update || !erase) return false;
+    for (const rewrite& r : rewrites) {
+        sqlite3_stmt* stmt = erase.get();
+        bool bound = true;
+        if (r.postings.empty()) {
+            bound = ssm_sqlite3::database::bind_int64(stmt, 1, r.gram);
+        } else {
+            stmt = update.get();
+            bound = ssm_sqlite3::database::bind_int64(stmt, 1, r.last) &&
+                    ssm_sqlite3::database::bind_blob(stmt, 2, r.postings) &&
+                    ssm_sqlite3::database::bind_int64(stmt, 3, r.gram);
+        }
+        if (!bound || sqlite3_step(stmt) != SQLITE_DONE) return false;
+        sqlite3_reset(stmt);
+    }
+
+    // Ascending, a row only ever moves down to an id that the rows before it have already vacated
+    const ssm_sqlite3::stmt_handle move = sqlite.prepare("UPDATE trigram_doc SET doc = ? WHERE doc = ?;");
+    if (!move) return false;
+    for (std::size_t doc = 1; doc < renumbered.size(); ++doc) {
+        if (renumbered[doc] == 0 || renumbered[doc] == static_cast<i64>(doc)) continue;
+        if (!ssm_sqlite3::database::bind_int64(move.get(), 1, renumbered[doc]) ||
+            !ssm_sqlite3::database::bind_int64(move.get(), 2, static_cast<i64>(doc)) ||
+            sqlite3_step(move.get()) != SQLITE_DONE) {
+            return false;
+        }
+        sqlite3_reset(move.get());
+    }
+
+    return sqlite.exec("UPDATE sqlite_sequence SET seq = (SELECT count(*) FROM trigram_doc) WHERE name = 'trigram_doc';");
+}
+
+} // namespace
+
+namespace ssm::trigram {
+
+bool build(const ssm_sqlite3::database& sqlite) {
+    SSM_TRACE_SCOPE("trigram.build");
+    if (!sqlite.exec(create_tables)) return false;
+
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("SELECT id, path FROM file ORDER BY id;");
+    if (!stmt) return false;
+
+    std::vector<u64> seen(GRAM_COUNT / 64);
+    list_writer writer;
+    int ret = sqlite3_step(stmt.get());
+    for (; ret == SQLITE_ROW; ret = sqlite3_step(stmt.get())) {
+        const char* path = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1));
+        if (path == nullptr) continue;
+        const search::mapped_file file(path);
+        if (!file.ok()) continue; // removed by hand, there is nothing to find in it
+
+        const std::optional<i64> doc = new_doc(sqlite, sqlite3_column_int64(stmt.get(), 0));
+        if (!doc.has_value()) return false;
+        writer.add(*doc, grams_of(file.text(), seen));
+        if (writer.bytes() >= FLUSH_BYTES && !writer.flush(sqlite)) return false;
+    }
+    return ret == SQLITE_DONE && writer.flush(sqlite);
+}
+
+bool index_file(const ssm_sqlite3::database& sqlite, const i64 file_id, const std::string_view content) {
+    SSM_TRACE_SCOPE("trigram.index");
+    const std::optional<i64> doc = new_doc(sqlite, file_id);
+    if (!doc.has_value()) return false;
+
+    list_writer writer;
+    writer.add(*doc, grams_of(content));
+    return writer.flush(sqlite) && compact_if_needed(sqlite);
+}
+
+bool remove_file(const ssm_sqlite3::database& sqlite, const i64 file_id) {
+    const ssm_sqlite3::stmt_handle stmt = sqlite.prepare("DELETE FROM trigram_doc WHERE file_id = ?;");
+    if (!stmt || !ssm_sqlite3::database::bind_int64(stmt.get(), 1, file_id) || sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        return false;
+    }
+    return compact_if_needed(sqlite);
+}
+
+std::optional<std::vector<i64>> candidates(const ssm_sqlite3::database& sqlite, const std::string_view literal) {
+    if (literal.size() < 3) return std::nullopt;
+    SSM_TRACE_SCOPE("trigram.candidates");
+
+    const ssm_sqlite3::stmt_handle select = sqlite.prepare("SELECT postings FROM trigram WHERE gram = ?;");
+    if (!select) return std::nullopt;
+
+    std::vector<std::vector<i64>> lists;
+    for (std::size_t i = 0; i + 2 < literal.size(); ++i) {
+        const u32 gram = gram_at(literal.data() + i);
+        if (!ssm_sqlite3::database::bind_int64(select.get(), 1, gram)) return std::nullopt;
+        if (sqlite3_step(select.get()) != SQLITE_ROW) return std::vector<i64>{}; // nothing has this trigram at all
+        decode(column_blob(select.get(), 0), lists.emplace_back());
+        sqlite3_reset(select.get());
+    }
+
+    // Smallest first, so every intersection is bounded by the shortest list
+    std::ranges::sort(lists, {}, &std::vector<i64>::size);
+    std::vector<i64> docs = MOVE(lists.front());
+    std::vector<i64> narrowed;
+    for (std::size_t i = 1; i < lists.size() && !docs.empty(); ++i) {
+        narrowed.clear();
+        std::ranges::set_intersection(docs, lists[i], std::back_inserter(narrowed));
+        std::swap(docs, narrowed);
+    }
+    if (docs.empty()) return docs;
+
+    // Dead ids have no trigram_doc row and drop out here
+    std::string json = "[";
+    for (const i64 doc : docs) {
+        if (json.size() > 1) json.push_back(',');
+        json += std::to_string(doc);
+    }
+    json.push_back(']');
+
+    const ssm_sqlite3::stmt_handle map =
+        sqlite.prepare("SELECT file_id FROM trigram_doc WHERE doc IN (SELECT value FROM json_each(?));");
+    if (!map || !ssm_sqlite3::database::bind_text(map.get(), 1, json)) return std::nullopt;
+    std::vector<i64> files;
+    while (sqlite3_step(map.get()) == SQLITE_ROW) files.push_back(sqlite3_column_int64(map.get(), 0));
+    std::ranges::sort(files);
+    return files;
+}
+
+} // namespace ssm::trigram